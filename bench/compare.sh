@@ -0,0 +1,58 @@
+#!/bin/sh
+# SYNOPSIS
+#     compare.sh [-t PERCENT] BASELINE CURRENT
+#
+# DESCRIPTION
+#     Compares two CSV files written by bench/scaling.sh, matching lines on
+#     their workload, procs, msg_size and part_size columns. For each
+#     configuration in both files, writes the baseline and current
+#     ops_per_sec and their ratio (current / baseline) as CSV:
+#
+#         workload,procs,msg_size,part_size,baseline,current,ratio,status
+#
+#     where status is "regression" if throughput dropped by more than
+#     PERCENT percent (default 20), and "ok" otherwise. Configurations in
+#     only one of the files are ignored.
+#
+# EXIT STATUS
+#     0 if there are no regressions, 1 if there are, 2 on usage errors.
+
+set -o errexit
+set -o nounset
+
+threshold=20
+
+while getopts t: option
+do
+  case $option in
+  t) threshold=$OPTARG ;;
+  ?) echo "usage: ${0##*/} [-t PERCENT] BASELINE CURRENT" 1>&2
+     exit 2 ;;
+  esac
+done
+shift $(($OPTIND - 1))
+
+if [ $# -ne 2 ]
+then
+  echo "usage: ${0##*/} [-t PERCENT] BASELINE CURRENT" 1>&2
+  exit 2
+fi
+
+exec awk -F, -v threshold=$threshold '
+  BEGIN {
+    print "workload,procs,msg_size,part_size,baseline,current,ratio,status"
+  }
+  FNR == 1 { next }
+  NR == FNR { baseline[$1 "," $2 "," $3 "," $4] = $7; next }
+  ($1 "," $2 "," $3 "," $4) in baseline {
+    config = $1 "," $2 "," $3 "," $4
+    ratio = (baseline[config] > 0 ? $7 / baseline[config] : 1)
+    status = "ok"
+    if (ratio < 1 - threshold / 100) {
+      status = "regression"
+      regressions++
+    }
+    printf "%s,%s,%s,%.3f,%s\n", config, baseline[config], $7, ratio, status
+  }
+  END { exit (regressions > 0) }
+' "$1" "$2"
@@ -0,0 +1,310 @@
+#!/bin/sh
+# SYNOPSIS
+#     scaling.sh [-w WORKLOADS] [-p PROCS] [-s MSG_SIZES] [-S PART_SIZES]
+#                [-n SCALE]
+#
+# DESCRIPTION
+#     Measures how ipcmd-based coordination scales, using parameterized
+#     versions of the examples as workloads (default: all of them):
+#
+#       barrier      PROCS processes pass 10*SCALE barriers (barrier.sh);
+#                    an operation is one process passing one barrier
+#       prodcons     PROCS producers and PROCS consumers pass 200*SCALE
+#                    messages of each size in MSG_SIZES through one queue
+#                    (producer-consumer.sh); an operation is one message
+#       pipe         examples/parallelpipe.sh runs PROCS filters (cat) over
+#                    4*SCALE MiB of input split into partitions of each size
+#                    in PART_SIZES; an operation is one partition
+#       philosophers PROCS (at least 2) philosophers eat 10*SCALE meals each,
+#                    without pausing (dining-philosophers.ksh); an operation
+#                    is one meal
+#       smokers      the agent serves 50*SCALE times (cigarette-smokers.ksh;
+#                    always 4 processes); an operation is one serve
+#
+#     for each process count in PROCS (default: 1 2 4 8 16 32 64), message
+#     size in MSG_SIZES (default: 16 1024 4096), and partition size in
+#     PART_SIZES (default: 64k 256k 1m), all space-separated lists.
+#
+#     Output is CSV, one line per configuration:
+#         workload,procs,msg_size,part_size,ops,wall_sec,ops_per_sec,cpu_sec
+#     where cpu_sec is the user + system time of all processes involved
+#     (including ipcmd), and msg_size and part_size are 0 where they don't
+#     apply. Compare two such files with bench/compare.sh.
+#
+# NOTES
+#     ipcmd is run from PATH ("make bench" puts bin/ first). Wall-clock time
+#     is read with "date +%s%N" where supported; otherwise, only whole
+#     seconds are available, so use a large SCALE.
+
+set -o errexit
+set -o nounset
+
+workloads='barrier prodcons pipe philosophers smokers'
+procs_list='1 2 4 8 16 32 64'
+msg_sizes='16 1024 4096'
+part_sizes='64k 256k 1m'
+scale=1
+
+while getopts n:p:s:S:w: option
+do
+  case $option in
+  n) scale=$OPTARG ;;
+  p) procs_list=$OPTARG ;;
+  s) msg_sizes=$OPTARG ;;
+  S) part_sizes=$OPTARG ;;
+  w) workloads=$OPTARG ;;
+  ?) echo "usage: ${0##*/} [-w WORKLOADS] [-p PROCS] [-s MSG_SIZES]" \
+          "[-S PART_SIZES] [-n SCALE]" 1>&2
+     exit 2 ;;
+  esac
+done
+shift $(($OPTIND - 1))
+
+readonly EXAMPLES=$(cd "$(dirname "$0")/../examples" && pwd)
+readonly TMP=${TMPDIR:-/tmp}/scaling.sh.$$
+mkdir $TMP
+trap 'rm -rf $TMP' EXIT
+
+# microseconds since the epoch (or whole seconds, in microseconds)
+now() {
+  t=$(date +%s%N)
+  case $t in
+    *N) echo $(( $(date +%s) * 1000000 )) ;;
+     *) echo $((t / 1000)) ;;
+  esac
+}
+
+# user + system time of this shell's (waited-for) children so far, in
+# milliseconds, from the second line of "times" ("0m1.250s 0m0.500s"); times
+# must run in this shell, not a subshell, as a fork resets children's times
+cpu_msec() {
+  times > $TMP/times
+  awk 'NR == 2 {
+    t = 0
+    for (i = 1; i <= 2; i++) {
+      split($i, ms, "m")
+      t += ms[1] * 60000 + ms[2] * 1000
+    }
+    printf "%d\n", t
+  }' $TMP/times
+}
+
+# run a workload function ("$@"), which sets $ops, and write its CSV line
+measure() {
+  workload=$1 procs=$2 msg_size=$3 part_size=$4
+  shift 4
+  cpu_msec > $TMP/cpu_start
+  start=$(now)
+  "$@"
+  usec=$(( $(now) - start ))
+  cpu_msec > $TMP/cpu_end
+  cpu=$(( $(cat $TMP/cpu_end) - $(cat $TMP/cpu_start) ))
+  awk -v w=$workload -v p=$procs -v m=$msg_size -v s=$part_size -v n=$ops \
+      -v usec=$usec -v cpu=$cpu 'BEGIN {
+    printf "%s,%d,%d,%s,%d,%.3f,%.1f,%.3f\n", w, p, m, s, n, usec / 1e6,
+           (usec > 0 ? n * 1e6 / usec : 0), cpu / 1e3
+  }'
+}
+
+########################################
+# workloads
+########################################
+
+barrier() {
+  procs=$1
+  nbarriers=$((10 * scale))
+  export IPCMD_SEMID=$(ipcmd semget -N $procs)
+  ipcmd semctl setall $procs
+  rank=0
+  while [ $rank -lt $procs ]
+  do
+    (
+      b=0
+      while [ $b -lt $nbarriers ]
+      do
+        ipcmd semop -1
+        ipcmd semop $rank=0 $rank=+$procs
+        b=$((b+1))
+      done
+    ) &
+    rank=$((rank+1))
+  done
+  wait
+  ipcrm -s $IPCMD_SEMID
+  ops=$((procs * nbarriers))
+}
+
+prodcons() {
+  procs=$1 msg_size=$2
+  items=$((200 * scale / procs * procs))
+  export IPCMD_MSQID=$(ipcmd msgget)
+  message=$(awk -v n=$msg_size 'BEGIN {while (n-- > 0) printf "x"}')
+  p=0
+  while [ $p -lt $procs ]
+  do
+    (
+      while [ "$(ipcmd msgrcv)" != 'poison pill' ]
+      do
+        :
+      done
+    ) &
+    p=$((p+1))
+  done
+  p=0
+  pids=''
+  while [ $p -lt $procs ]
+  do
+    (
+      i=0
+      while [ $i -lt $((items / procs)) ]
+      do
+        ipcmd msgsnd "$message"
+        i=$((i+1))
+      done
+    ) &
+    pids="$pids $!"
+    p=$((p+1))
+  done
+  wait $pids
+  p=0
+  while [ $p -lt $procs ]
+  do
+    ipcmd msgsnd 'poison pill'
+    p=$((p+1))
+  done
+  wait
+  ipcrm -q $IPCMD_MSQID
+  ops=$items
+}
+
+pipe() {
+  procs=$1 part_size=$2
+  if [ ! -f $TMP/input ]
+  then
+    awk -v n=$((4194304 * scale / 64)) \
+        'BEGIN {for (i = 1; i <= n; i++) printf "%063d\n", i}' > $TMP/input
+  fi
+  sh $EXAMPLES/parallelpipe.sh -p $procs ipcmd split -s $part_size : cat \
+    < $TMP/input > $TMP/output
+  if ! cmp -s $TMP/input $TMP/output
+  then
+    echo "${0##*/}: parallelpipe.sh output differs from its input" 1>&2
+    exit 1
+  fi
+  # lines are 64 bytes, so partitions hold exactly part_size bytes
+  ops=$(awk -v size=$(wc -c < $TMP/input) -v part=$part_size 'BEGIN {
+    n = part + 0
+    if (part ~ /[kK]$/) n *= 1024
+    if (part ~ /[mM]$/) n *= 1048576
+    printf "%d\n", (size + n - 1) / n
+  }')
+}
+
+philosophers() {
+  procs=$1
+  nmeals=$((10 * scale))
+  export IPCMD_SEMID=$(ipcmd semget -N $procs)
+  ipcmd semctl setall 1
+  rank=0
+  while [ $rank -lt $procs ]
+  do
+    (
+      # acquire the lower-numbered chopstick first
+      left=$(( rank == 0 ? procs - 1 : rank - 1 ))
+      right=$rank
+      meal=0
+      while [ $meal -lt $nmeals ]
+      do
+        if [ $left -lt $right ]
+        then
+          ipcmd semop $left=-1
+          ipcmd semop $right=-1
+        else
+          ipcmd semop $right=-1
+          ipcmd semop $left=-1
+        fi
+        ipcmd semop $left=+1 $right=+1
+        meal=$((meal+1))
+      done
+    ) &
+    rank=$((rank+1))
+  done
+  wait
+  ipcrm -s $IPCMD_SEMID
+  ops=$((procs * nmeals))
+}
+
+smokers() {
+  nserves=$((50 * scale))
+  # supplies, a smoker is done, closing time
+  export IPCMD_SEMID=$(ipcmd semget -N 5)
+  ipcmd semctl setall 0
+  for needs in '1=-1 2=-1' '0=-1 2=-1' '0=-1 1=-1'
+  do
+    (
+      while true
+      do
+        ipcmd semop $needs
+        if [ $(ipcmd semctl getval 4) -eq 1 ]
+        then
+          exit
+        fi
+        ipcmd semop 3=+1
+      done
+    ) &
+  done
+  serve=0
+  while [ $serve -lt $nserves ]
+  do
+    case $((serve % 3)) in
+      0) ipcmd semop 1=+1 2=+1 ;;
+      1) ipcmd semop 0=+1 2=+1 ;;
+      2) ipcmd semop 0=+1 1=+1 ;;
+    esac
+    ipcmd semop 3=-1
+    serve=$((serve+1))
+  done
+  ipcmd semop 0=+2 1=+2 2=+2 4=+1
+  wait
+  ipcrm -s $IPCMD_SEMID
+  ops=$nserves
+}
+
+########################################
+# sweep
+########################################
+
+echo "workload,procs,msg_size,part_size,ops,wall_sec,ops_per_sec,cpu_sec"
+for workload in $workloads
+do
+  case $workload in
+    smokers)
+      measure smokers 4 0 0 smokers
+      continue ;;
+    barrier|prodcons|pipe|philosophers) ;;
+    *) echo "${0##*/}: unknown workload: $workload" 1>&2
+       exit 2 ;;
+  esac
+  for procs in $procs_list
+  do
+    case $workload in
+      barrier)
+        measure barrier $procs 0 0 barrier $procs ;;
+      prodcons)
+        for msg_size in $msg_sizes
+        do
+          measure prodcons $procs $msg_size 0 prodcons $procs $msg_size
+        done ;;
+      pipe)
+        for part_size in $part_sizes
+        do
+          measure pipe $procs 0 $part_size pipe $procs $part_size
+        done ;;
+      philosophers)
+        if [ $procs -ge 2 ]
+        then
+          measure philosophers $procs 0 0 philosophers $procs
+        fi ;;
+    esac
+  done
+done
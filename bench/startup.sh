@@ -0,0 +1,88 @@
+#!/bin/sh
+# SYNOPSIS
+#     startup.sh [-n ITERATIONS] [IPCMD...]
+#
+# DESCRIPTION
+#     Measures the exec-to-exit latency of the most frequently run ipcmd
+#     subcommands by running each one ITERATIONS times (default 2000) from a
+#     shell loop, for each IPCMD executable given (default: bin/ipcmd, and
+#     bin/ipcmd-static if it has been built with "make static"). For
+#     reference, the cost of running the (dynamically linked) true(1) utility
+#     the same way is reported as the "baseline".
+#
+#     Output is CSV: ipcmd,subcommand,iterations,usec_per_call
+#
+# NOTES
+#     Wall-clock time is read with "date +%s%N" where supported; otherwise,
+#     only whole seconds are available, so use a large ITERATIONS.
+
+set -o errexit
+set -o nounset
+
+iterations=2000
+
+while getopts n: option
+do
+  case $option in
+  n) iterations=$OPTARG ;;
+  ?) echo "usage: ${0##*/} [-n ITERATIONS] [IPCMD...]" 1>&2
+     exit 2 ;;
+  esac
+done
+shift $(($OPTIND - 1))
+
+if [ $# -eq 0 ]
+then
+  set -- bin/ipcmd
+  if [ -x bin/ipcmd-static ]
+  then
+    set -- "$@" bin/ipcmd-static
+  fi
+fi
+
+# microseconds since the epoch (or whole seconds, in microseconds)
+now() {
+  t=$(date +%s%N)
+  case $t in
+    *N) echo $(( $(date +%s) * 1000000 )) ;;
+     *) echo $((t / 1000)) ;;
+  esac
+}
+
+# run "$@" $iterations times; print the average wall time in microseconds
+per_call() {
+  start=$(now)
+  i=0
+  while [ $i -lt $iterations ]
+  do
+    "$@" > /dev/null
+    i=$((i+1))
+  done
+  echo $(( ($(now) - start) / iterations ))
+}
+
+true_path=$(command -v true)
+case $true_path in
+  /*) ;;
+   *) true_path=/bin/true ;; # builtin; use the external utility
+esac
+baseline=$(per_call $true_path)
+echo "ipcmd,subcommand,iterations,usec_per_call"
+echo "$true_path,baseline,$iterations,$baseline"
+
+for ipcmd in "$@"
+do
+  export IPCMD_SEMID=$($ipcmd semget)
+  export IPCMD_MSQID=$($ipcmd msgget)
+  trap 'ipcrm -s $IPCMD_SEMID; ipcrm -q $IPCMD_MSQID' EXIT
+
+  $ipcmd semctl setval 0 0
+  echo "$ipcmd,semop,$iterations,$(per_call $ipcmd semop 0=+1)"
+  echo "$ipcmd,semctl getval,$iterations,$(per_call $ipcmd semctl getval 0)"
+  echo "$ipcmd,msgsnd,$iterations,$(per_call $ipcmd msgsnd -n m)"
+  echo "$ipcmd,msgrcv,$iterations,$(per_call $ipcmd msgrcv -n)"
+
+  ipcrm -s $IPCMD_SEMID
+  ipcrm -q $IPCMD_MSQID
+  trap - EXIT
+done
@@ -66,23 +66,22 @@ export PARTITION_PATH=$PARTITION_DIR/partition
 #              assumes values in {0,1,...,$num_partitions}
 # semaphore 1: write (binary semaphore)
 # semaphore 2: read (binary semaphore)
+# plus the filter's and output message queues, all created in one process
 readonly partition_slot_sem=0 write_sem=1 read_sem=2
-export IPCMD_SEMID=$(ipcmd semget -N 3)
-
-# filter's message queue
-readonly filter_msqid=$(ipcmd msgget)
-
-# output message queue
-readonly output_msqid=$(ipcmd msgget)
-
-trap 'ipcrm -s $IPCMD_SEMID; ipcrm -q $filter_msqid; ipcrm -q $output_msqid; rm -rf $PARTITION_DIR' EXIT
+objects=$(ipcmd setup <<EOF
+IPCMD_SEMID  sem 3 $partition_slot_sem=${num_partitions:-$nprocs} \
+                   $write_sem=1 $read_sem=0
+filter_msqid msg
+output_msqid msg
+EOF
+)
+eval "$objects"
+readonly filter_msqid output_msqid
+
+trap 'ipcmd teardown; rm -rf $PARTITION_DIR' EXIT
 
 # if terminated by a CTRL-C
-trap 'ipcrm -s $IPCMD_SEMID; ipcrm -q $filter_msqid; ipcrm -q $output_msqid; rm -rf $PARTITION_DIR; kill 0' INT
-
-ipcmd semctl setall $partition_slot_sem=${num_partitions:-$nprocs} \
-                    $write_sem=1 \
-                    $read_sem=0
+trap 'ipcmd teardown; rm -rf $PARTITION_DIR; kill 0' INT
 
 # executes the user-specified partitioner
 partitioner() {
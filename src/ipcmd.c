@@ -26,15 +26,68 @@
  */
 
 #define _XOPEN_SOURCE 600
+// Linux-specific extensions (MSG_COPY, MSG_EXCEPT, semtimedop(), futex(),
+// sendfile(), st_ctim, IPC_INFO) are used when available unless
+// IPCMD_XSI_ONLY is defined (see Makefile).
+// HAVE_SEMTIMEDOP may also be defined on other platforms that provide
+// semtimedop().
+// IPCMD_NO_TCP leaves out bridge tcp: addresses, whose host name lookup
+// (getaddrinfo()) a static glibc binary can do only with the shared name
+// service modules at run time; "make static" defines it.
+#if defined(__linux__) && !defined(IPCMD_XSI_ONLY)
+#define _GNU_SOURCE
+#ifndef HAVE_SEMTIMEDOP
+#define HAVE_SEMTIMEDOP 1
+#endif
+#define HAVE_FUTEX 1
+#define HAVE_SENDFILE 1
+#define HAVE_ST_CTIM 1
+#define HAVE_IPC_INFO 1
+#endif
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__APPLE__)
+#define HAVE_SYSCTLBYNAME 1
+#endif
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/msg.h>
+#include <sys/resource.h>
 #include <sys/sem.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef HAVE_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_SYSCTLBYNAME
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#endif
+#if defined(_POSIX_MESSAGE_PASSING) && _POSIX_MESSAGE_PASSING >= 0
+#define HAVE_MQUEUE 1
+#include <mqueue.h>
+#endif
 
 //**************************************
 // utility functions
@@ -170,6 +223,509 @@ static long get_long_arg(
     return arg;
 }
 
+// RETURN VALUE
+//     A 'msglen_t' representation of the string referenced by optarg, which
+//     must be a positive value that msglen_t can hold.
+static msglen_t get_qbytes_arg(
+    const char *qbytes_arg,
+    const char *ipcmd_command // whence this function was called
+) {
+    long arg = get_long_arg(qbytes_arg, ipcmd_command);
+    if (arg <= 0 || (unsigned long)arg > (unsigned long)(msglen_t)-1) {
+        fprintf(stderr, "ipcmd %s: qbytes (%li) out of valid range [1,%lu]\n",
+                ipcmd_command, arg, (unsigned long)(msglen_t)-1);
+        exit(EXIT_FAILURE);
+    }
+    return (msglen_t)arg;
+}
+
+// RETURN VALUE
+//     A timespec from a (possibly fractional) number of seconds.
+static struct timespec get_timeout_arg(
+    const char *timeout_arg,
+    const char *ipcmd_command // whence this function was called
+) {
+    char *endptr;
+    struct timespec timeout;
+    errno = 0;
+    double seconds = strtod(timeout_arg, &endptr);
+    if (errno != 0 || endptr == timeout_arg || *endptr != '\0' ||
+        seconds < 0 || seconds > (double)INT_MAX) {
+        fprintf(stderr, "ipcmd %s: invalid timeout (%s)\n", ipcmd_command,
+                timeout_arg);
+        exit(EXIT_FAILURE);
+    }
+    timeout.tv_sec = (time_t)seconds;
+    timeout.tv_nsec = (long)((seconds - (double)timeout.tv_sec) * 1e9);
+    return timeout;
+}
+
+// RETURN VALUE
+//     A byte count from an argument of the form N[k|m|g] (binary multiples).
+//     The program will exit if the argument is not of this form, or is 0.
+static off_t get_size_arg(
+    const char *size_arg,
+    const char *ipcmd_command // whence this function was called
+) {
+    char *endptr;
+    errno = 0;
+    intmax_t size = strtoimax(size_arg, &endptr, 10);
+    if (errno != 0) {
+        perror("ipcmd: invalid size argument");
+        exit(EXIT_FAILURE);
+    }
+    switch (*endptr) {
+        case 'g': case 'G': size *= 1024; // fall through
+        case 'm': case 'M': size *= 1024; // fall through
+        case 'k': case 'K': size *= 1024;
+                            endptr++;
+                            break;
+    }
+    if (endptr == size_arg || *endptr != '\0' || size <= 0) {
+        fprintf(stderr, "ipcmd %s: invalid size argument (%s)\n",
+                ipcmd_command, size_arg);
+        exit(EXIT_FAILURE);
+    }
+    return (off_t)size;
+}
+
+// Like write(), but retries after partial writes and EINTR.
+//
+// RETURN VALUE
+//     0 on success, -1 (with errno set) on error.
+static int write_all(int fd, const void *buf, size_t nbyte) {
+    const char *p = buf;
+    while (nbyte > 0) {
+        ssize_t n = write(fd, p, nbyte);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        nbyte -= (size_t)n;
+    }
+    return 0;
+}
+
+// Like read(), but retries after partial reads and EINTR until nbyte bytes
+// have been read or end-of-file is reached.
+//
+// RETURN VALUE
+//     The number of bytes read, or -1 (with errno set) on error.
+static ssize_t read_all(int fd, void *buf, size_t nbyte) {
+    char *p = buf;
+    while (nbyte > 0) {
+        ssize_t n = read(fd, p, nbyte);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        } else if (n == 0)
+            break;
+        p += n;
+        nbyte -= (size_t)n;
+    }
+    return p - (char *)buf;
+}
+
+// RETURN VALUE
+//     Microseconds since an arbitrary point in the past (CLOCK_MONOTONIC)
+static uint64_t now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void timeout_alarm(int sig) {
+    (void)sig; // only needs to interrupt a blocking system call
+}
+
+// Arrange for a blocking system call (semop(), msgrcv(), ...) to fail with
+// EINTR once timeout (which must be nonzero) has elapsed, saving the previous
+// SIGALRM action in *oact for timeout_stop().
+static void timeout_start(
+    const struct timespec *timeout,
+    struct sigaction *oact
+) {
+    struct sigaction act;
+    struct itimerval timer;
+
+    act.sa_handler = timeout_alarm;
+    act.sa_flags = 0; // no SA_RESTART: the call must fail with EINTR
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGALRM, &act, oact);
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 0;
+    timer.it_value.tv_sec = timeout->tv_sec;
+    timer.it_value.tv_usec = timeout->tv_nsec / 1000;
+    if (timer.it_value.tv_sec == 0 && timer.it_value.tv_usec == 0)
+        timer.it_value.tv_usec = 1;
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+static void timeout_stop(const struct sigaction *oact) {
+    struct itimerval timer = {{0, 0}, {0, 0}};
+    setitimer(ITIMER_REAL, &timer, NULL);
+    sigaction(SIGALRM, oact, NULL);
+}
+
+//**************************************
+// semaphore set identifiers
+//**************************************
+
+// A semid is that of an XSI semaphore set if it is nonnegative (-1 meaning
+// "unset"). Otherwise it is a handle, meaningful only within this process,
+// to an entry of semsets, which tags a set of another backend with that
+// backend and its own identifier; an shm backend set's shmid (see "ipcmd
+// semget -b shm") may be any nonnegative int, as an XSI semid may.
+enum { SEMSET_SHM = 1, SEMSET_BRIDGE };
+
+static struct semset {
+    int backend; // SEMSET_*
+    int id;      // shmid, or -1 for a set served by a bridge
+} *semsets;
+static int nsemsets;
+
+#define SEMSET(semid) (&semsets[-2 - (semid)])
+#define SEMSET_BACKEND(semid) ((semid) < -1 ? SEMSET(semid)->backend : 0)
+#define SEMSET_ID(semid) ((semid) < -1 ? SEMSET(semid)->id : (semid))
+
+// RETURN VALUE
+//     The semid of the set of the given backend with the given identifier.
+static int semset_handle(int backend, int id) {
+    struct semset *grown;
+    for (int i = 0; i < nsemsets; i++)
+        if (semsets[i].backend == backend && semsets[i].id == id)
+            return -2 - i;
+    if ((grown = realloc(semsets, (size_t)(nsemsets + 1) *
+                                  sizeof(*semsets))) == NULL) {
+        perror("ipcmd: realloc");
+        exit(EXIT_FAILURE);
+    }
+    semsets = grown;
+    semsets[nsemsets].backend = backend;
+    semsets[nsemsets].id = id;
+    return -2 - nsemsets++;
+}
+
+//**************************************
+// tracing (IPCMD_TRACE; see "ipcmd trace-export")
+//**************************************
+
+// Each traced invocation appends two lines to the trace file: when it starts,
+//     B <time> <pid> <command>
+// and when it exits (or execs a command),
+//     E <time> <pid> <command> <id> <bytes> <wait_begin> <wait_usec> <detail>
+// where times are microseconds since the Epoch, id is the IPC object operated
+// on (-1 if none, or a set served by a bridge; the shmid of an shm backend
+// set), bytes is the number of message bytes sent or received, the wait is
+// the interval spent in the call that may have blocked (if any), and detail
+// describes the operation (semaphore operations or message type).
+// Each line is a single write() to a file opened with O_APPEND, so lines from
+// concurrent processes don't interleave.
+#define TRACE_LINE_MAX 512
+
+static struct {
+    int fd; // -1 if not tracing
+    pid_t pid;
+    const char *command;
+    int id;
+    uint64_t bytes;
+    uint64_t wait_begin;
+    uint64_t wait_usec;
+    char detail[TRACE_LINE_MAX/2];
+} trace = {-1, 0, NULL, -1, 0, 0, 0, ""};
+
+// RETURN VALUE
+//     Microseconds since the Epoch if tracing, otherwise 0 (without a system
+//     call, so that untraced invocations pay nothing).
+static uint64_t trace_clock(void) {
+    struct timespec ts;
+    if (trace.fd == -1)
+        return 0;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// Record that the call begun at wait_begin (as returned by trace_clock()) has
+// just returned.
+static void trace_wait(uint64_t wait_begin) {
+    if (trace.fd == -1)
+        return;
+    trace.wait_begin = wait_begin;
+    trace.wait_usec += trace_clock() - wait_begin;
+}
+
+// Record the IPC object operated on, the number of message bytes transferred
+// so far, and a printf()-style description of the operation.
+static void trace_object(int id, uint64_t bytes, const char *format, ...) {
+    va_list ap;
+    if (trace.fd == -1)
+        return;
+    trace.id = SEMSET_ID(id); // not a handle (see semsets)
+    trace.bytes = bytes;
+    va_start(ap, format);
+    vsnprintf(trace.detail, sizeof(trace.detail), format, ap);
+    va_end(ap);
+}
+
+// Write the end-of-invocation line. Called at exit, and before exec.
+static void trace_close(void) {
+    char line[TRACE_LINE_MAX];
+    int len;
+    if (trace.fd == -1 || trace.pid != getpid()) // not in forked children
+        return;
+    len = snprintf(line, sizeof(line), "E %" PRIu64 " %li %.64s %i %" PRIu64
+                   " %" PRIu64 " %" PRIu64 " %s\n", trace_clock(),
+                   (long)trace.pid, trace.command, trace.id, trace.bytes,
+                   trace.wait_begin, trace.wait_usec, trace.detail);
+    if (len >= (int)sizeof(line)) { // detail truncated; keep the newline
+        len = sizeof(line) - 1;
+        line[len-1] = '\n';
+    }
+    write_all(trace.fd, line, (size_t)len);
+    close(trace.fd);
+    trace.fd = -1;
+}
+
+// If the IPCMD_TRACE environment variable names a file, write the
+// start-of-invocation line for command to it.
+static void trace_open(const char *command) {
+    const char *path = getenv("IPCMD_TRACE");
+    char line[TRACE_LINE_MAX];
+    int len;
+
+    if (!path || !*path)
+        return;
+    if ((trace.fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666)) == -1) {
+        fprintf(stderr, "ipcmd %s: %s: %s\n", command, path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    trace.pid = getpid();
+    trace.command = command;
+    len = snprintf(line, sizeof(line), "B %" PRIu64 " %li %.64s\n",
+                   trace_clock(), (long)trace.pid, command);
+    write_all(trace.fd, line, (size_t)len);
+    atexit(trace_close);
+}
+
+//**************************************
+// shared memory segments that ipcmd associates with semaphore sets and
+// message queues to keep state that doesn't fit in the IPC object itself
+//**************************************
+
+// atomic operations on such segments (GCC-style builtins, also supported by
+// clang, icc, pathcc, and Oracle Solaris Studio >= 12.4)
+#define atomic_add(ptr, val) __sync_add_and_fetch((ptr), (val))
+#define atomic_cas(ptr, oldval, newval) \
+    __sync_val_compare_and_swap((ptr), (oldval), (newval))
+
+// raise *ptr to at least val
+static void atomic_max(volatile uint64_t *ptr, uint64_t val) {
+    uint64_t old = *ptr;
+    while (old < val) {
+        uint64_t seen = atomic_cas(ptr, old, val);
+        if (seen == old)
+            break;
+        old = seen;
+    }
+}
+
+#define SEGMENT_MAGIC 0x69706364 // "ipcd"
+
+// what a segment is used for (part of its IPC key)
+enum {
+    SEGMENT_SEMSTAT = 1, SEGMENT_MSGSTAT, SEGMENT_RATELIMIT, SEGMENT_MUTEX,
+    SEGMENT_CONFLATE
+};
+
+// Every segment begins with this header, so that a segment that happens to
+// have the same key, but wasn't created by ipcmd for the same purpose and
+// IPC object, can be detected (and another key tried). The rest of the
+// segment is initially zero, which must be a valid state; its creator fills
+// in the header.
+struct segment_header {
+    uint32_t magic;
+    int32_t kind;
+    int32_t id;   // semid (or shmid of an shm backend set) or msqid
+    uint32_t backend; // SEMSET_SHM for an shm backend set, otherwise 0
+};
+
+#define SEGMENT_PROBES 4 // keys tried for a segment, should others collide
+#define SEGMENT_WAIT_SPINS 1000 // yields to wait for a new header
+
+// RETURN VALUE
+//     The probe'th candidate key for the segment of the given kind for IPC
+//     object id. Keys have only 24 bits to spare, so the (full) id is hashed,
+//     and segments whose keys collide are told apart by their headers.
+static key_t segment_key(int kind, int id, int probe) {
+    uint32_t h = (uint32_t)SEMSET_ID(id) * 0x9e3779b1u ^ (uint32_t)kind ^
+                 (uint32_t)SEMSET_BACKEND(id) << 16;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    // "i" in the high-order byte, as if generated by ftok(path, 'i')
+    return (key_t)(((uint32_t)'i' << 24) | ((h + (uint32_t)probe) & 0xffffff));
+}
+
+// Look for the segment of the given kind for IPC object id among its
+// candidate keys (all of them, as an earlier one may have been removed).
+//
+// RETURN VALUE
+//     The address of the segment header (with its shmid in *shmidp), or NULL
+//     if there is none, with the first unused probe (or -1) in *free_probe.
+//     The program exits on errors.
+static struct segment_header *find_segment(
+    int kind,
+    int id,
+    int *shmidp,
+    int *free_probe,
+    const char *ipcmd_command // whence this function was called
+) {
+    *free_probe = -1;
+    for (int probe = 0; probe < SEGMENT_PROBES; probe++) {
+        volatile struct segment_header *header;
+        int shmid = shmget(segment_key(kind, id, probe), 0, 0);
+        if (shmid == -1) {
+            if (errno != ENOENT) {
+                fprintf(stderr, "ipcmd %s (shmget()): %s\n", ipcmd_command,
+                        strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            if (*free_probe == -1)
+                *free_probe = probe;
+            continue;
+        }
+        if ((header = shmat(shmid, NULL, 0)) == (void *)-1) {
+            fprintf(stderr, "ipcmd %s (shmat()): %s\n", ipcmd_command,
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        // header->kind is written last, so wait for it if need be (a
+        // segment that stays zero wasn't created by ipcmd)
+        for (int spins = 0; header->kind == 0 && spins < SEGMENT_WAIT_SPINS;
+             spins++)
+            sched_yield();
+        if (header->magic == SEGMENT_MAGIC && header->kind == kind &&
+            header->id == SEMSET_ID(id) &&
+            header->backend == (uint32_t)SEMSET_BACKEND(id)) {
+            *shmidp = shmid;
+            return (struct segment_header *)header;
+        }
+        shmdt((void *)header);
+    }
+    return NULL;
+}
+
+// Attach the segment (of size bytes, including the header) that holds state
+// of the given kind for IPC object id, creating it with the given mode if it
+// doesn't exist and create is nonzero.
+//
+// RETURN VALUE
+//     The address of the segment header, or NULL if the segment doesn't exist
+//     and create is zero. The program exits on any other error.
+static struct segment_header *attach_segment(
+    int kind,
+    int id,
+    size_t size,
+    int mode,
+    int create,
+    const char *ipcmd_command // whence this function was called
+) {
+    struct segment_header *header;
+    int shmid, free_probe;
+
+    while ((header = find_segment(kind, id, &shmid, &free_probe,
+                                  ipcmd_command)) == NULL) {
+        if (!create)
+            return NULL;
+        if (free_probe == -1) {
+            fprintf(stderr, "ipcmd %s: shared memory segments with keys "
+                            "0x%lx to 0x%lx are in use by other applications "
+                            "or IPC objects\n", ipcmd_command,
+                    (unsigned long)segment_key(kind, id, 0),
+                    (unsigned long)segment_key(kind, id, SEGMENT_PROBES-1));
+            exit(EXIT_FAILURE);
+        }
+        shmid = shmget(segment_key(kind, id, free_probe), size,
+                       IPC_CREAT | IPC_EXCL | mode);
+        if (shmid == -1 && errno == EEXIST) // created concurrently; look again
+            continue;
+        if (shmid == -1 || (header = shmat(shmid, NULL, 0)) == (void *)-1) {
+            fprintf(stderr, "ipcmd %s (%s()): %s\n", ipcmd_command,
+                    shmid == -1 ? "shmget" : "shmat", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        // the rest of the segment is zero; whoever looks for it meanwhile
+        // waits for header->kind
+        header->magic = SEGMENT_MAGIC;
+        header->id = SEMSET_ID(id);
+        header->backend = (uint32_t)SEMSET_BACKEND(id);
+        __sync_synchronize();
+        header->kind = kind;
+        break;
+    }
+
+    return header;
+}
+
+#define HISTOGRAM_BUCKETS 40
+
+// Log2-scale histogram of durations: bucket 0 counts durations < 1 us, and
+// bucket b > 0 counts durations in [2^(b-1), 2^b) us.
+struct histogram {
+    uint64_t count;
+    uint64_t blocked; // number of operations that had to wait at all
+    uint64_t max_usec;
+    uint64_t total_usec;
+    uint64_t bucket[HISTOGRAM_BUCKETS];
+};
+
+static void histogram_record(struct histogram *h, uint64_t usec, int blocked) {
+    int b = 0;
+    while (b < HISTOGRAM_BUCKETS-1 && usec >= ((uint64_t)1 << b))
+        b++;
+    atomic_add(&h->bucket[b], 1);
+    atomic_add(&h->count, 1);
+    if (blocked)
+        atomic_add(&h->blocked, 1);
+    atomic_add(&h->total_usec, usec);
+    atomic_max(&h->max_usec, usec);
+}
+
+// RETURN VALUE
+//     An upper bound on the p-th percentile (0 < p <= 100), in microseconds.
+static uint64_t histogram_percentile(const struct histogram *h, double p) {
+    uint64_t rank = (uint64_t)((double)h->count * p / 100.0 + 0.5);
+    uint64_t seen = 0;
+    if (rank == 0)
+        rank = 1;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += h->bucket[b];
+        if (seen >= rank) {
+            uint64_t bound = b == 0 ? 0 : ((uint64_t)1 << b) - 1;
+            return bound < h->max_usec ? bound : h->max_usec;
+        }
+    }
+    return h->max_usec;
+}
+
+// Remove the segment of the given kind for IPC object id, if it exists.
+static void remove_segment(int kind, int id, const char *ipcmd_command) {
+    int shmid, free_probe;
+    struct segment_header *header = find_segment(kind, id, &shmid,
+                                                 &free_probe, ipcmd_command);
+    if (header == NULL)
+        return;
+    shmdt(header);
+    if (shmctl(shmid, IPC_RMID, NULL) == -1) {
+        fprintf(stderr, "ipcmd %s (shmctl()): %s\n", ipcmd_command,
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
 static void ipcmd_ftok(int argc, char *argv[]) {
     const char *usage = "ipcmd ftok [path [id]]";
     key_t key;
@@ -209,19 +765,297 @@ static void ipcmd_ftok(int argc, char *argv[]) {
 #endif
 }
 
-// NOTE: may not implement msgctl, as most of its functionality overlaps with
-// that of ipcs. The only extra functionality that msgctl provides is to
-// adjust certain queue attributes.
+//**************************************
+// kernel IPC limits ("ipcmd limits")
+//**************************************
+
+// semctl()'s optional fourth argument, which the application must define
+union semun {
+    int val;
+    struct semid_ds *buf;
+    unsigned short  *array;
+};
+
+enum {
+    LIMIT_SEMMNI, LIMIT_SEMMSL, LIMIT_SEMMNS, LIMIT_SEMOPM, LIMIT_SEMVMX,
+    LIMIT_MSGMNI, LIMIT_MSGMAX, LIMIT_MSGMNB,
+    LIMIT_SHMMNI, LIMIT_SHMMAX, LIMIT_SHMALL,
+    LIMIT_NPROC,
+    LIMIT_COUNT
+};
+
+static const char *const limit_names[LIMIT_COUNT] = {
+    "semmni", "semmsl", "semmns", "semopm", "semvmx",
+    "msgmni", "msgmax", "msgmnb",
+    "shmmni", "shmmax", "shmall",
+    "nproc"
+};
+
+// Fill in the limits (and, where known, how much of each is in use) that
+// apply to this process; each is -1 where it can't be determined.
+// semctl()/msgctl()/shmctl() IPC_INFO (and the *_INFO usage counts) are used
+// on Linux, and sysctlbyname() on FreeBSD and macOS.
+static void ipc_limits_probe(long limit[], long used[]) {
+    for (int i = 0; i < LIMIT_COUNT; i++)
+        limit[i] = used[i] = -1;
+#ifdef HAVE_IPC_INFO
+    struct seminfo seminfo;
+    struct msginfo msginfo;
+    struct shminfo shminfo;
+    struct shm_info shm_info;
+    union semun arg;
+
+    arg.buf = (struct semid_ds *)(void *)&seminfo; // as struct seminfo *
+    if (semctl(0, 0, IPC_INFO, arg) != -1) {
+        limit[LIMIT_SEMMNI] = seminfo.semmni;
+        limit[LIMIT_SEMMSL] = seminfo.semmsl;
+        limit[LIMIT_SEMMNS] = seminfo.semmns;
+        limit[LIMIT_SEMOPM] = seminfo.semopm;
+        limit[LIMIT_SEMVMX] = seminfo.semvmx;
+    }
+    if (semctl(0, 0, SEM_INFO, arg) != -1) {
+        used[LIMIT_SEMMNI] = seminfo.semusz; // sets
+        used[LIMIT_SEMMNS] = seminfo.semaem; // semaphores
+    }
+    if (msgctl(0, IPC_INFO, (struct msqid_ds *)&msginfo) != -1) {
+        limit[LIMIT_MSGMNI] = msginfo.msgmni;
+        limit[LIMIT_MSGMAX] = msginfo.msgmax;
+        limit[LIMIT_MSGMNB] = msginfo.msgmnb;
+    }
+    if (msgctl(0, MSG_INFO, (struct msqid_ds *)&msginfo) != -1)
+        used[LIMIT_MSGMNI] = msginfo.msgpool; // queues
+    if (shmctl(0, IPC_INFO, (struct shmid_ds *)&shminfo) != -1) {
+        limit[LIMIT_SHMMNI] = (long)shminfo.shmmni;
+        limit[LIMIT_SHMMAX] = shminfo.shmmax > LONG_MAX ? LONG_MAX :
+                              (long)shminfo.shmmax;
+        limit[LIMIT_SHMALL] = shminfo.shmall > LONG_MAX ? LONG_MAX :
+                              (long)shminfo.shmall; // pages
+    }
+    if (shmctl(0, SHM_INFO, (struct shmid_ds *)&shm_info) != -1) {
+        used[LIMIT_SHMMNI] = shm_info.used_ids;
+        used[LIMIT_SHMALL] = (long)shm_info.shm_tot;
+    }
+#elif defined(HAVE_SYSCTLBYNAME)
+    for (int i = 0; i < LIMIT_NPROC; i++) {
+        char name[32];
+        union {int i; long l;} value;
+        size_t size = sizeof(value);
+#ifdef __APPLE__
+        snprintf(name, sizeof(name), "kern.sysv.%s", limit_names[i]);
+#else
+        snprintf(name, sizeof(name), "kern.ipc.%s", limit_names[i]);
+#endif
+        if (sysctlbyname(name, &value, &size, NULL, 0) == 0)
+            limit[i] = size == sizeof(int) ? value.i : value.l;
+    }
+#endif
+#ifdef RLIMIT_NPROC
+    struct rlimit rlim;
+    if (getrlimit(RLIMIT_NPROC, &rlim) == 0)
+        limit[LIMIT_NPROC] = rlim.rlim_cur == RLIM_INFINITY ||
+                             rlim.rlim_cur > LONG_MAX ? LONG_MAX :
+                             (long)rlim.rlim_cur;
+#endif
+}
+
+#define MSGMAX_DEFAULT 8192 // Linux's, and no smaller than other systems'
+
+// RETURN VALUE
+//     The largest message that can be sent to (and so received from) a queue
+//     whose msg_qbytes is qbytes: qbytes, or the system's MSGMAX if smaller.
+//     Only MSGMAX is probed, and only for queues larger than MSGMAX_DEFAULT,
+//     as this is on the path of every msgrcv.
+static size_t msgsz_limit(size_t qbytes) {
+    long msgmax = -1;
+    if (qbytes <= MSGMAX_DEFAULT)
+        return qbytes;
+#ifdef HAVE_IPC_INFO
+    struct msginfo msginfo;
+    if (msgctl(0, IPC_INFO, (struct msqid_ds *)&msginfo) != -1)
+        msgmax = msginfo.msgmax;
+#elif defined(HAVE_SYSCTLBYNAME) && !defined(__APPLE__)
+    int value;
+    size_t size = sizeof(value);
+    if (sysctlbyname("kern.ipc.msgmax", &value, &size, NULL, 0) == 0 &&
+        size == sizeof(value))
+        msgmax = value;
+#endif
+    return msgmax > 0 && (size_t)msgmax < qbytes ? (size_t)msgmax : qbytes;
+}
+
+// RETURN VALUE
+//     The number of semaphore operations semop() will perform atomically
+//     (SEMOPM), or max if that is smaller or SEMOPM is unknown.
+static int semopm_limit(int max) {
+    long limit[LIMIT_COUNT], used[LIMIT_COUNT];
+    ipc_limits_probe(limit, used);
+    return limit[LIMIT_SEMOPM] > 0 && limit[LIMIT_SEMOPM] < max ?
+           (int)limit[LIMIT_SEMOPM] : max;
+}
+
+static void ipcmd_limits(int argc, char *argv[]) {
+    const char *usage =
+        "ipcmd limits [-p procs] [-s msgsize] [-r rate]\n"
+        "  -p procs   : processes coordinating through one set or queue\n"
+        "  -s msgsize : bytes per message\n"
+        "  -r rate    : messages per second\n"
+        "  (any of these reports which limit the workload reaches first)";
+    long limit[LIMIT_COUNT], used[LIMIT_COUNT];
+    long procs = 0, msgsize = 0, rate = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "p:r:s:")) != -1)
+    {
+        switch (c)
+        {
+            case 'p':
+                procs = get_long_arg(optarg, "limits");
+                break;
+            case 'r':
+                rate = get_long_arg(optarg, "limits");
+                break;
+            case 's':
+                msgsize = (long)get_size_arg(optarg, "limits");
+                break;
+            default: // unknown option
+                print_usage_and_exit(usage);
+        }
+    }
+    if (optind != argc || procs < 0 || rate < 0)
+        print_usage_and_exit(usage);
+
+    ipc_limits_probe(limit, used);
+    if (procs == 0 && msgsize == 0 && rate == 0) {
+        for (int i = 0; i < LIMIT_COUNT; i++) {
+            printf("%s ", limit_names[i]);
+            printf(limit[i] == -1 ? "-" : "%li", limit[i]);
+            printf(used[i] == -1 ? " -\n" : " %li\n", used[i]);
+        }
+        return;
+    }
+
+    // What the workload needs of each limit: procs processes each with a
+    // message of msgsize bytes in the queue, or each with a semaphore of its
+    // own (e.g., a rank or a mutex slot), operated on in one semop() (e.g., a
+    // barrier's release); and one more set and queue than are in use.
+    long need[LIMIT_COUNT];
+    double worst = -1;
+    int first = -1;
+    if (procs == 0)
+        procs = 1;
+    if (msgsize == 0)
+        msgsize = 1;
+    for (int i = 0; i < LIMIT_COUNT; i++)
+        need[i] = -1;
+    need[LIMIT_SEMMSL] = need[LIMIT_SEMOPM] = need[LIMIT_SEMVMX] = procs;
+    need[LIMIT_MSGMAX] = msgsize;
+    need[LIMIT_MSGMNB] = msgsize * procs;
+    need[LIMIT_NPROC] = procs;
+    if (used[LIMIT_SEMMNI] != -1)
+        need[LIMIT_SEMMNI] = used[LIMIT_SEMMNI] + 1;
+    if (used[LIMIT_SEMMNS] != -1)
+        need[LIMIT_SEMMNS] = used[LIMIT_SEMMNS] + procs;
+    if (used[LIMIT_MSGMNI] != -1)
+        need[LIMIT_MSGMNI] = used[LIMIT_MSGMNI] + 1;
+
+    for (int i = 0; i < LIMIT_COUNT; i++) {
+        double fraction;
+        if (need[i] == -1 || limit[i] <= 0)
+            continue;
+        fraction = (double)need[i] / (double)limit[i];
+        printf("%s %li %li %.0f%%\n", limit_names[i], need[i], limit[i],
+               fraction * 100);
+        if (fraction > worst) {
+            worst = fraction;
+            first = i;
+        }
+    }
+    // with a message rate, how long a full queue holds them at that rate
+    if (rate > 0 && limit[LIMIT_MSGMNB] > 0)
+        printf("backlog %.3f seconds\n",
+               (double)limit[LIMIT_MSGMNB] / msgsize / rate);
+    if (first != -1)
+        printf("first %s%s\n", limit_names[first],
+               worst > 1 ? " (exceeded)" : "");
+}
+
+//**************************************
+// POSIX message queue backend ("ipcmd msgget -P /name")
+//**************************************
+
+// A msqid argument beginning with "/" names a POSIX message queue. It is
+// represented internally by MSQID_POSIX, with the name in posix_mq_name.
+#define MSQID_POSIX (-1)
+static const char *posix_mq_name;
+#ifdef HAVE_MQUEUE
+static mqd_t posix_mq; // opened by posix_mq_open()
+#endif
+
+// Convert a msqid argument (an integer, or the name of a POSIX message queue)
+// to a msqid.
+static int get_msqid_arg(const char *msqid_arg, const char *ipcmd_command) {
+    if (msqid_arg[0] == '/') {
+#ifdef HAVE_MQUEUE
+        posix_mq_name = msqid_arg;
+        return MSQID_POSIX;
+#else
+        fprintf(stderr, "ipcmd %s: POSIX message queues are not supported on "
+                        "this platform\n", ipcmd_command);
+        exit(EXIT_FAILURE);
+#endif
+    }
+    return get_int_arg(msqid_arg, ipcmd_command);
+}
+
+// Exit with an error message if msqid is MSQID_POSIX (for features that
+// are only implemented for XSI message queues).
+static void require_xsi_msqid(
+    int msqid,
+    const char *feature,
+    const char *ipcmd_command
+) {
+    if (msqid == MSQID_POSIX) {
+        fprintf(stderr, "ipcmd %s: %s is not supported for POSIX message "
+                        "queues\n", ipcmd_command, feature);
+        exit(EXIT_FAILURE);
+    }
+}
+
+#ifdef HAVE_MQUEUE
+// Open the POSIX message queue posix_mq_name with the given oflag, and get
+// its attributes (if attr is not NULL).
+static void posix_mq_open(
+    int oflag,
+    struct mq_attr *attr,
+    const char *ipcmd_command // whence this function was called
+) {
+    if ((posix_mq = mq_open(posix_mq_name, oflag)) == (mqd_t)-1) {
+        fprintf(stderr, "ipcmd %s (mq_open()): %s: %s\n", ipcmd_command,
+                posix_mq_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (attr && mq_getattr(posix_mq, attr) == -1) {
+        fprintf(stderr, "ipcmd %s (mq_getattr()): %s\n", ipcmd_command,
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+#endif
+
 static void ipcmd_msgget(int argc, char *argv[]) {
-    const char *usage = "ipcmd msgget [-Q msgkey [-e]] [-m mode]";
+    const char *usage =
+        "ipcmd msgget [-Q msgkey [-e]] [-m mode]\n"
+        "       ipcmd msgget -P name [-e] [-m mode] [-M maxmsg] [-S msgsize]";
     const int default_mode = 0600; // read & write permission for owner
     // default: create message queue, error if already exists, mode 600
     int msgflg = IPC_CREAT | IPC_EXCL | default_mode;
     key_t key = IPC_PRIVATE; // default if "-Q msgkey" is not specified
+    const char *name = NULL; // "-P name" (POSIX message queue)
+    long maxmsg = 0, msgsize = 0; // "-M maxmsg" and "-S msgsize"
     int msqid;
     int c;
 
-    while ((c = getopt(argc, argv, "ehm:Q:")) != -1)
+    while ((c = getopt(argc, argv, "ehm:M:P:Q:S:")) != -1)
     {
         switch (c)
         {
@@ -232,14 +1066,51 @@ static void ipcmd_msgget(int argc, char *argv[]) {
                 msgflg ^= default_mode; // clear default_mode bits
                 msgflg |= get_mode_arg(optarg, "msgget"); // user-supplied mode
                 break;
+            case 'M':
+                maxmsg = get_long_arg(optarg, "msgget");
+                break;
+            case 'P':
+                name = optarg;
+                break;
             case 'Q':
                 key = get_key_t_arg(optarg, "msgget");
                 break;
+            case 'S':
+                msgsize = get_size_arg(optarg, "msgget");
+                break;
             default: // unknown or missing argument
                 print_usage_and_exit(usage);
         }
     }
 
+    if (name) { // -P name: POSIX message queue
+        if (key != IPC_PRIVATE || name[0] != '/')
+            print_usage_and_exit(usage);
+#ifdef HAVE_MQUEUE
+        struct mq_attr attr = {0};
+        // if only one of maxmsg/msgsize is given, the other has its Linux
+        // default (mq_open() requires both or neither)
+        attr.mq_maxmsg = maxmsg > 0 ? maxmsg : 10;
+        attr.mq_msgsize = msgsize > 0 ? msgsize : 8192;
+        if ((posix_mq = mq_open(name, O_RDONLY | O_CREAT |
+                                      (msgflg & IPC_EXCL ? O_EXCL : 0),
+                                (mode_t)(msgflg & 0777),
+                                maxmsg > 0 || msgsize > 0 ? &attr : NULL))
+            == (mqd_t)-1) {
+            fprintf(stderr, "ipcmd msgget (mq_open()): %s: %s\n", name,
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        trace_object(MSQID_POSIX, 0, "%s", name);
+        printf("%s\n", name);
+        return;
+#else
+        get_msqid_arg(name, "msgget"); // exits with an error message
+#endif
+    }
+    if (maxmsg || msgsize) // only for POSIX message queues
+        print_usage_and_exit(usage);
+
     // detect invalid option combinations (-e and not -Q)
     if ((!(msgflg & IPC_EXCL) && key == IPC_PRIVATE))
         print_usage_and_exit(usage);
@@ -273,6 +1144,7 @@ static void ipcmd_msgget(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    trace_object(msqid, 0, "");
     printf("%i\n", msqid);
 }
 
@@ -303,267 +1175,706 @@ const char *ipcmd_msgctl_strerror(int errnum) {
         case EINVAL:
             return "The value of msqid is not a valid message queue "
                    "identifier; or the value of cmd is not a valid command.";
-        // case EPERM: not applicable, since ipcmd does not call msgctl() with
-        //       either IPC_SET or IPC_RMID. Update this function if this ever
-        //       changes.
+        case EPERM:
+            return "The argument cmd is IPC_SET and the effective user ID of "
+                   "the calling process is not equal to that of a process with "
+                   "appropriate privileges and it is not equal to the value of "
+                   "msg_perm.cuid or msg_perm.uid in the data structure "
+                   "associated with msqid, or an attempt is being made to "
+                   "increase msg_qbytes beyond the system limit without "
+                   "appropriate privileges.";
         default:
             return strerror(errno);
     }
 }
 
-// FIXME: It probably doesn't make sense to allow both "-n" and more than one 
-// message argument, as it would be impossible to know which messages were sent.
-static void ipcmd_msgsnd(int argc, char *argv[]) {
-    const char *usage = "msgsnd [-q msqid] [-t mtype] [-n] [message...]";
-    struct msg {long mtype; char mtext[];}; 
-    struct msg *msgp;
-    long mtype = 1;
+// RETURN VALUE
+//     msqid if it was specified with "-q msqid" (i.e., it is nonzero);
+//     otherwise, the value of the IPCMD_MSQID environment variable. The
+//     program will exit if neither was specified.
+static int get_msqid(
+    int msqid,
+    const char *ipcmd_command // whence this function was called
+) {
+    if (msqid) // -q option used
+        return msqid;
+    if (!getenv("IPCMD_MSQID")) { // IPCMD_MSQID environment variable not set
+        fprintf(stderr, "ipcmd %s: must either specify [-q msqid] or set "
+                        "IPCMD_MSQID environment variable\n", ipcmd_command);
+        exit(EXIT_FAILURE);
+    }
+    return get_msqid_arg(getenv("IPCMD_MSQID"), ipcmd_command);
+}
+
+static void ipcmd_msgctl(int argc, char *argv[]) {
+    const char *usage =
+    "ipcmd msgctl [-q msqid] <subcommand> <args>\n"
+    "Where <subcommand> <args> is one of the following:\n"
+    "  stat\n"
+    "  set  [qbytes=QBYTES] [mode=MODE] [uid=UID] [gid=GID]...\n"
+    "  rmid";
     int msqid = 0;
-    int msgflg = 0;
-    int c;
     struct msqid_ds buf;
-    size_t msgsz;
+    int c;
 
-    while ((c = getopt(argc, argv, "nq:t:")) != -1)
+    while ((c = getopt(argc, argv, "q:")) != -1)
     {
         switch (c)
         {
-            case 'n':
-                msgflg |= IPC_NOWAIT;
-                break;
             case 'q':
-                msqid = get_int_arg(optarg, "msgsnd");
-                break;
-            case 't':
-                mtype = get_long_arg(optarg, "msgsnd");
+                msqid = get_msqid_arg(optarg, "msgctl");
                 break;
-            default:  // unknown option
+            default: // unknown or missing argument
                 print_usage_and_exit(usage);
         }
     }
 
-    if (!msqid) { // -q option not used
-        if (!getenv("IPCMD_MSQID")) { //IPCMD_MSQID environment variable not set
-            fprintf(stderr, "ipcmd msgsnd: must either specify [-q msqid] or "
-                            "set IPCMD_MSQID environment variable\n");
-            exit(1);
-        } else
-            msqid = get_int_arg(getenv("IPCMD_MSQID"), "msgget");
+    if (optind == argc) // no subcommand specified
+        print_usage_and_exit(usage);
+
+    msqid = get_msqid(msqid, "msgctl");
+    trace_object(msqid, 0, "%s", argv[optind]);
+
+#ifdef HAVE_MQUEUE
+    if (msqid == MSQID_POSIX) {
+        struct mq_attr attr;
+        if (optind+1 != argc) // no arguments to stat or rmid
+            print_usage_and_exit(usage);
+        if (strcmp(argv[optind], "stat") == 0) {
+            posix_mq_open(O_RDONLY, &attr, "msgctl");
+            printf("mq_flags %li\n", (long)attr.mq_flags);
+            printf("mq_maxmsg %li\n", (long)attr.mq_maxmsg);
+            printf("mq_msgsize %li\n", (long)attr.mq_msgsize);
+            printf("mq_curmsgs %li\n", (long)attr.mq_curmsgs);
+        } else if (strcmp(argv[optind], "rmid") == 0) {
+            if (mq_unlink(posix_mq_name) == -1) {
+                fprintf(stderr, "ipcmd msgctl rmid (mq_unlink()): %s: %s\n",
+                        posix_mq_name, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[optind], "set") == 0)
+            require_xsi_msqid(msqid, "set", "msgctl");
+        else
+            print_usage_and_exit(usage);
+        return;
+    }
+#endif
+
+    if (strcmp(argv[optind], "rmid") == 0) {
+        if (optind+1 != argc) // if extra arguments after "rmid"
+            print_usage_and_exit(usage);
+        if (msgctl(msqid, IPC_RMID, NULL) == -1) {
+            fprintf(stderr, "ipcmd msgctl rmid (msgctl()): %s\n",
+                    ipcmd_msgctl_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        // statistics (if any) would otherwise outlive the queue
+        remove_segment(SEGMENT_MSGSTAT, msqid, "msgctl rmid");
+        remove_segment(SEGMENT_CONFLATE, msqid, "msgctl rmid");
+        return;
     }
 
-    // BUG (maybe): it's possible the user has write permission, but not read
-    // permission, on the message queue.
+    // both subcommands need the current msqid_ds; "set" modifies it in place
     if (msgctl(msqid, IPC_STAT, &buf) == -1) {
-        fprintf(stderr, "ipcmd msgsnd (msgctl()): %s\n",
+        fprintf(stderr, "ipcmd msgctl (msgctl()): %s\n",
                 ipcmd_msgctl_strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    // FIXME: maximum number of bytes allowed on a queue is not necessarily
-    // equal to the max number of bytes allowed in a message (they are equal in
-    // Solaris, though).
-    if ((msgp = (struct msg *)malloc(sizeof(struct msg) + buf.msg_qbytes+1)) ==
-        NULL) {
-        perror("ipcmd msgsnd: malloc");
-        exit(EXIT_FAILURE);
+    if (strcmp(argv[optind], "stat") == 0) {
+        if (optind+1 != argc) // if extra arguments after "stat"
+            print_usage_and_exit(usage);
+        printf("msg_perm.uid %lu\n", (unsigned long)buf.msg_perm.uid);
+        printf("msg_perm.gid %lu\n", (unsigned long)buf.msg_perm.gid);
+        printf("msg_perm.cuid %lu\n", (unsigned long)buf.msg_perm.cuid);
+        printf("msg_perm.cgid %lu\n", (unsigned long)buf.msg_perm.cgid);
+        printf("msg_perm.mode %04o\n", (unsigned)buf.msg_perm.mode & 0777);
+        printf("msg_qnum %lu\n", (unsigned long)buf.msg_qnum);
+        printf("msg_qbytes %lu\n", (unsigned long)buf.msg_qbytes);
+#ifdef __linux__
+        // not in SUSv4, but too useful to leave out where available
+        printf("msg_cbytes %lu\n", (unsigned long)buf.__msg_cbytes);
+#endif
+        printf("msg_lspid %li\n", (long)buf.msg_lspid);
+        printf("msg_lrpid %li\n", (long)buf.msg_lrpid);
+        printf("msg_stime %lld\n", (long long)buf.msg_stime);
+        printf("msg_rtime %lld\n", (long long)buf.msg_rtime);
+        printf("msg_ctime %lld\n", (long long)buf.msg_ctime);
+    } else if (strcmp(argv[optind], "set") == 0) {
+        if (optind+1 == argc) // nothing to set
+            print_usage_and_exit(usage);
+        for (int i = optind+1; i < argc; i++) {
+            char *value = strchr(argv[i], '=');
+            if (value == NULL)
+                print_usage_and_exit(usage);
+            value++;
+            if (strncmp(argv[i], "qbytes=", strlen("qbytes=")) == 0)
+                buf.msg_qbytes = get_qbytes_arg(value, "msgctl set");
+            else if (strncmp(argv[i], "mode=", strlen("mode=")) == 0)
+                buf.msg_perm.mode = (mode_t)get_mode_arg(value, "msgctl set");
+            else if (strncmp(argv[i], "uid=", strlen("uid=")) == 0)
+                buf.msg_perm.uid = (uid_t)get_long_arg(value, "msgctl set");
+            else if (strncmp(argv[i], "gid=", strlen("gid=")) == 0)
+                buf.msg_perm.gid = (gid_t)get_long_arg(value, "msgctl set");
+            else
+                print_usage_and_exit(usage);
+        }
+        if (msgctl(msqid, IPC_SET, &buf) == -1) {
+            fprintf(stderr, "ipcmd msgctl set (msgctl()): %s\n",
+                    ipcmd_msgctl_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    } else
+        print_usage_and_exit(usage);
+}
+
+// Send a message, raising msg_qbytes (up to qbytes_max) whenever the message
+// cannot be placed on the queue immediately. If msg_qbytes is already at
+// qbytes_max, or the caller lacks permission to raise it, fall back to an
+// ordinary msgsnd() with the caller's msgflg.
+//
+// RETURN VALUE
+//     As for msgsnd().
+static int msgsnd_autogrow(
+    int msqid,
+    const void *msgp,
+    size_t msgsz,
+    int msgflg,
+    msglen_t qbytes_max
+) {
+    struct msqid_ds buf;
+
+    for (;;) {
+        if (msgsnd(msqid, msgp, msgsz, msgflg | IPC_NOWAIT) == 0)
+            return 0;
+        if (errno != EAGAIN)
+            return -1;
+        if (msgctl(msqid, IPC_STAT, &buf) == -1)
+            return -1;
+        if (buf.msg_qbytes >= qbytes_max)
+            break; // can't grow any further; wait (or not) like msgsnd()
+        // double msg_qbytes, but make sure the message fits on an empty queue
+        msglen_t qbytes = buf.msg_qbytes * 2;
+        if (qbytes < buf.msg_qbytes + msgsz)
+            qbytes = buf.msg_qbytes + (msglen_t)msgsz;
+        buf.msg_qbytes = qbytes < qbytes_max ? qbytes : qbytes_max;
+        if (msgctl(msqid, IPC_SET, &buf) == -1) {
+            if (errno == EPERM)
+                break; // not the owner, or qbytes_max exceeds MSGMNB
+            return -1;
+        }
     }
 
-    msgp->mtype = mtype; // any user-specified applies to all messages
+    return msgsnd(msqid, msgp, msgsz, msgflg);
+}
 
-    if (optind < argc) {   // message arguments specified
-        do {
-            if ((msgsz = strlen(argv[optind])) > (size_t)(buf.msg_qbytes)) {
-                fprintf(stderr,"ipcmd msgsnd: message argument length > "
-                               "msg_qbytes\n");
-                exit(EXIT_FAILURE);
-            }
+// Optional header that "ipcmd msgsnd -E" prepends to each message, and
+// "ipcmd msgrcv -E" removes, to measure how long messages wait in the queue.
+// It is stored in host byte order, as messages never leave the host.
+#define ENVELOPE_MAGIC 0x49504345 // "IPCE"
+#define ENVELOPE_VERSION 1
+struct envelope {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;     // sizeof(struct envelope), for future extension
+    int64_t tv_sec;    // send time (CLOCK_REALTIME)
+    int32_t tv_nsec;
+    int32_t pid;       // sender
+    uint64_t seq;      // message number within the sending ipcmd process
+};
 
-            strcpy(msgp->mtext, argv[optind]);
+// Write an envelope for the seq-th message sent by this process to dst.
+static void envelope_seal(char *dst, uint64_t seq) {
+    struct envelope e;
+    struct timespec now;
 
-            if (msgsnd(msqid, (void *)msgp, msgsz, msgflg) == -1) {
-                if (errno == EAGAIN) // message could not be sent and "-n" used
-                    exit(2); 
-                else {
-                    fprintf(stderr, "ipcmd msgsnd (msgsnd()): %s\n", 
-                        ipcmd_msgsnd_strerror(errno));
-                    exit(EXIT_FAILURE);
-                }
-            }
-            optind++;
-        } while (optind < argc);
-    } else { // read message from stdin
-        msgsz = fread(msgp->mtext, (size_t)1, buf.msg_qbytes+1, stdin);
+    clock_gettime(CLOCK_REALTIME, &now);
+    memset(&e, 0, sizeof(e));
+    e.magic = ENVELOPE_MAGIC;
+    e.version = ENVELOPE_VERSION;
+    e.size = sizeof(e);
+    e.tv_sec = (int64_t)now.tv_sec;
+    e.tv_nsec = (int32_t)now.tv_nsec;
+    e.pid = (int32_t)getpid();
+    e.seq = seq;
+    memcpy(dst, &e, sizeof(e)); // dst needn't be aligned
+}
 
-        if (ferror(stdin)) {
-            perror("ipcmd msgsnd: fread");
-            exit(EXIT_FAILURE);
+// If the message of msgsz bytes at mtext begins with an envelope, copy it to
+// *e and set *residence_usec to how long ago it was sealed.
+//
+// RETURN VALUE
+//     The size of the envelope, or 0 if there is none.
+static size_t envelope_open(
+    const char *mtext,
+    size_t msgsz,
+    struct envelope *e,
+    uint64_t *residence_usec
+) {
+    struct timespec now;
+    int64_t usec;
+
+    if (msgsz < sizeof(*e))
+        return 0;
+    memcpy(e, mtext, sizeof(*e));
+    if (e->magic != ENVELOPE_MAGIC || e->version != ENVELOPE_VERSION ||
+        e->size < sizeof(*e) || e->size > msgsz)
+        return 0;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    usec = ((int64_t)now.tv_sec - e->tv_sec) * 1000000 +
+           ((int64_t)now.tv_nsec - e->tv_nsec) / 1000;
+    *residence_usec = usec > 0 ? (uint64_t)usec : 0; // clock may have stepped
+    return e->size;
+}
+
+// Optional compression of message payloads by "ipcmd msgsnd -z", undone by
+// "ipcmd msgrcv -z". A compressed payload is a frame: ZFRAME_MAGIC, a method
+// byte, the payload's length as a 4-byte big-endian integer, then the
+// payload, either stored or compressed with a byte-oriented LZ77 codec:
+//     a token byte: the number of literals (high nibble) and the match
+//         length - LZ_MIN_MATCH (low nibble), 15 meaning that further
+//         bytes (255 each, up to the first that isn't) are to be added;
+//     any further literal length bytes, then the literals;
+//     unless this is the last sequence: the match offset (2 bytes, little
+//         endian), then any further match length bytes.
+// Payloads shorter than ZFRAME_THRESHOLD, or that don't get smaller, are
+// sent as they are, unless they begin with ZFRAME_MAGIC.
+#define ZFRAME_MAGIC "\0ipz"
+#define ZFRAME_MAGIC_SIZE 4
+#define ZFRAME_HEADER_SIZE 9
+#define ZFRAME_STORED 's'
+#define ZFRAME_LZ 'l'
+#define ZFRAME_THRESHOLD 256
+#define ZFRAME_RATIO_MAX 64 // largest payload, in multiples of msg_qbytes
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 13
+
+// Append len as a 15+255+... length extension.
+static unsigned char *lz_put_length(
+    unsigned char *out,
+    const unsigned char *end,
+    size_t len
+) {
+    for (; len >= 255; len -= 255)
+        if (out < end)
+            *out++ = 255;
+    if (out < end)
+        *out++ = (unsigned char)len;
+    return out;
+}
+
+static unsigned char *lz_put_sequence(
+    unsigned char *out,
+    const unsigned char *end, // of the output buffer
+    const unsigned char *literals,
+    size_t nliterals,
+    size_t offset,            // 0 for the last sequence
+    size_t match
+) {
+    size_t extra = match - LZ_MIN_MATCH;
+    if (out >= end)
+        return out;
+    *out++ = (unsigned char)((nliterals < 15 ? nliterals : 15) << 4 |
+                             (offset == 0 ? 0 : extra < 15 ? extra : 15));
+    if (nliterals >= 15)
+        out = lz_put_length(out, end, nliterals - 15);
+    if ((size_t)(end - out) < nliterals)
+        return (unsigned char *)end;
+    memcpy(out, literals, nliterals);
+    out += nliterals;
+    if (offset == 0 || end - out < 2)
+        return offset == 0 ? out : (unsigned char *)end;
+    *out++ = (unsigned char)(offset & 0xff);
+    *out++ = (unsigned char)(offset >> 8);
+    if (extra >= 15)
+        out = lz_put_length(out, end, extra - 15);
+    return out;
+}
+
+// RETURN VALUE
+//     The compressed size, or 0 if it would be len or more.
+static size_t lz_compress(const unsigned char *in, size_t len,
+                          unsigned char *out) {
+    static uint32_t table[1 << LZ_HASH_BITS]; // position + 1 of a 4-gram
+    const unsigned char *end = out + len - 1; // must end up shorter
+    unsigned char *p = out;
+    size_t anchor = 0, i = 0;
+
+    if (len < 2)
+        return 0;
+    memset(table, 0, sizeof(table));
+    while (i + LZ_MIN_MATCH <= len && p < end) {
+        uint32_t gram;
+        memcpy(&gram, in + i, sizeof(gram));
+        uint32_t h = (gram * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)(i + 1);
+        if (candidate == 0 || i - --candidate > 65535 ||
+            memcmp(in + candidate, in + i, LZ_MIN_MATCH) != 0) {
+            i++;
+            continue;
         }
-        
-        // if 1 more byte was read than the queue can hold
-        if (msgsz == (size_t)buf.msg_qbytes+1) {
-            fprintf(stderr,"ipcmd msgsnd: message length > msg_qbytes\n");
-            exit(EXIT_FAILURE);
+        size_t match = LZ_MIN_MATCH;
+        while (i + match < len && in[candidate + match] == in[i + match])
+            match++;
+        p = lz_put_sequence(p, end, in + anchor, i - anchor, i - candidate,
+                            match);
+        i += match;
+        anchor = i;
+    }
+    p = lz_put_sequence(p, end, in + anchor, len - anchor, 0, LZ_MIN_MATCH);
+    return p < end ? (size_t)(p - out) : 0;
+}
+
+// Read a length extension; *len is set to SIZE_MAX if the input is short.
+static const unsigned char *lz_get_length(
+    const unsigned char *in,
+    const unsigned char *end,
+    size_t *len
+) {
+    unsigned char b;
+    do {
+        if (in == end) {
+            *len = SIZE_MAX;
+            return in;
         }
+        b = *in++;
+        *len += b;
+    } while (b == 255);
+    return in;
+}
 
-        if (msgsnd(msqid, (void *)msgp, msgsz, msgflg) == -1) {
-            if (errno == EAGAIN)
-                exit(2); // message could not be sent and "-n" specified
-            else {
-                fprintf(stderr, "ipcmd msgsnd (msgsnd()): %s\n", 
-                    ipcmd_msgsnd_strerror(errno));
+// RETURN VALUE
+//     0 if in decompresses to exactly outlen bytes at out, otherwise -1.
+static int lz_decompress(const unsigned char *in, size_t len,
+                         unsigned char *out, size_t outlen) {
+    const unsigned char *end = in + len;
+    size_t o = 0;
+
+    while (in < end) {
+        unsigned token = *in++;
+        size_t n = token >> 4, match = token & 15, offset;
+        if (n == 15 && (in = lz_get_length(in, end, &n), n == SIZE_MAX))
+            return -1;
+        if (n > (size_t)(end - in) || n > outlen - o)
+            return -1;
+        memcpy(out + o, in, n);
+        in += n;
+        o += n;
+        if (in == end) // the last sequence has no match
+            break;
+        if (end - in < 2)
+            return -1;
+        offset = (size_t)in[0] | (size_t)in[1] << 8;
+        in += 2;
+        if (match == 15 &&
+            (in = lz_get_length(in, end, &match), match == SIZE_MAX))
+            return -1;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || match > outlen - o)
+            return -1;
+        for (size_t k = 0; k < match; k++, o++) // may overlap
+            out[o] = out[o - offset];
+    }
+    return o == outlen ? 0 : -1;
+}
+
+// Write the payload of len bytes at data to out (which has room for cap
+// bytes), compressed if worthwhile.
+//
+// RETURN VALUE
+//     The number of bytes written to out, or (size_t)-1 if they wouldn't fit.
+static size_t zframe_pack(
+    const char *data,
+    size_t len,
+    char *out,
+    size_t cap
+) {
+    static unsigned char *compressed;
+    static size_t compressed_size;
+    size_t n = 0;
+    int magic = len >= ZFRAME_MAGIC_SIZE &&
+                memcmp(data, ZFRAME_MAGIC, ZFRAME_MAGIC_SIZE) == 0;
+
+    if (len >= ZFRAME_THRESHOLD && len <= UINT32_MAX) {
+        if (compressed_size < len) {
+            free(compressed);
+            if ((compressed = malloc(len)) == NULL) {
+                perror("ipcmd msgsnd: malloc");
                 exit(EXIT_FAILURE);
             }
+            compressed_size = len;
         }
+        n = lz_compress((const unsigned char *)data, len, compressed);
+        if (n + ZFRAME_HEADER_SIZE >= len)
+            n = 0;
     }
+    if (n == 0 && !magic) { // sent as it is
+        if (len > cap)
+            return (size_t)-1;
+        memcpy(out, data, len);
+        return len;
+    }
+    if ((n ? n : len) + ZFRAME_HEADER_SIZE > cap)
+        return (size_t)-1;
+    memcpy(out, ZFRAME_MAGIC, ZFRAME_MAGIC_SIZE);
+    out[4] = n ? ZFRAME_LZ : ZFRAME_STORED;
+    for (int i = 0; i < 4; i++)
+        out[5+i] = (char)(((uint32_t)len >> (24 - 8*i)) & 0xff);
+    memcpy(out + ZFRAME_HEADER_SIZE, n ? (const char *)compressed : data,
+           n ? n : len);
+    return ZFRAME_HEADER_SIZE + (n ? n : len);
 }
 
-static void ipcmd_msgrcv(int argc, char *argv[]) {
-    const char *usage = "ipcmd msgrcv [q msqid] [-t msgtyp] [-n] [-v]";
-    struct msg {long mtype; char mtext[];}; 
-    struct msg *msgp;
-    long msgtyp = 0; // 0: default is to receive a message of any type
-    int msqid = 0;
-    int msgflg = 0;
-    int c;
-    struct msqid_ds buf;
-    size_t msgsz;
-    ssize_t bytes_received;
-    int verbose = 0; // if 1, print type of received message to stderr
+// If the message payload of len bytes at data is a frame, set *data and
+// *len to its decompressed contents (in a buffer reused by the next call).
+// The program exits if the frame is corrupt, or would decompress to more
+// than max bytes.
+static void zframe_unpack(const char **data, size_t *len, size_t max) {
+    static char *out;
+    static size_t out_size;
+    const unsigned char *p = (const unsigned char *)*data;
+    size_t n = 0;
 
-    while ((c = getopt(argc, argv, "nq:t:v")) != -1)
-    {
-        switch (c)
-        {
-            case 'n':
-                msgflg |= IPC_NOWAIT;
-                break;
-            case 'q':
-                msqid = get_int_arg(optarg, "msgrcv");
-                break;
-            case 't':
-                msgtyp = get_long_arg(optarg, "msgrcv");
-                break;
-            case 'v':
-                verbose = 1;
-                break;
-            default:  // unknown option
-                print_usage_and_exit(usage);
+    if (*len < ZFRAME_HEADER_SIZE ||
+        memcmp(p, ZFRAME_MAGIC, ZFRAME_MAGIC_SIZE) != 0)
+        return;
+    for (int i = 0; i < 4; i++)
+        n = n << 8 | p[5+i];
+    if (p[4] == ZFRAME_STORED && n == *len - ZFRAME_HEADER_SIZE) {
+        *data += ZFRAME_HEADER_SIZE;
+        *len = n;
+        return;
+    }
+    if (p[4] != ZFRAME_LZ || n > max) {
+        fprintf(stderr, "ipcmd msgrcv: corrupt compressed message\n");
+        exit(EXIT_FAILURE);
+    }
+    if (out_size < n) {
+        free(out);
+        if ((out = malloc(n)) == NULL) {
+            perror("ipcmd msgrcv: malloc");
+            exit(EXIT_FAILURE);
         }
+        out_size = n;
     }
+    if (lz_decompress(p + ZFRAME_HEADER_SIZE, *len - ZFRAME_HEADER_SIZE,
+                      (unsigned char *)out, n) == -1) {
+        fprintf(stderr, "ipcmd msgrcv: corrupt compressed message\n");
+        exit(EXIT_FAILURE);
+    }
+    *data = out;
+    *len = n;
+}
 
-    if (!msqid) { // -q option not used
-        if (!getenv("IPCMD_MSQID")) { //IPCMD_MSQID environment variable not set
-            fprintf(stderr, "ipcmd msgrcv: must either specify [-q msqid] or "
-                            "set IPCMD_MSQID environment variable\n");
-            exit(1);
-        } else
-            msqid = get_int_arg(getenv("IPCMD_MSQID"), "msgget");
+// Reference messages, sent by "ipcmd msgsnd -R" and resolved by "ipcmd
+// msgrcv -D", carry a description of a range of a file rather than its
+// bytes: REF_MAGIC, then the text "dev ino ctime size offset length\n"
+// followed by the file's absolute path. The device, inode, status change time
+// (in nanoseconds where available), and size identify the version of the file
+// referred to (its generation); the range is not read if the file has since
+// been replaced or modified.
+#define REF_MAGIC "\0ipr"
+#define REF_MAGIC_SIZE 4
+
+// RETURN VALUE
+//     The status change time of the file described by st, in nanoseconds
+//     where supported (otherwise, whole seconds' worth).
+static intmax_t ref_ctime(const struct stat *st) {
+#ifdef HAVE_ST_CTIM
+    return (intmax_t)st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+#else
+    return (intmax_t)st->st_ctime * 1000000000;
+#endif
+}
+
+// RETURN VALUE
+//     The value of a decimal byte count (0 included) from end - len to end of
+//     s, or -1 if those characters aren't all digits.
+static intmax_t ref_get_count(const char *s, size_t len) {
+    intmax_t count = 0;
+    if (len == 0 || len > 18)
+        return -1;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9')
+            return -1;
+        count = count * 10 + (s[i] - '0');
     }
-        
-    if (msgctl(msqid, IPC_STAT, &buf) == -1) {
-        fprintf(stderr, "ipcmd msgrcv (msgctl()): %s\n",
-                ipcmd_msgctl_strerror(errno));
+    return count;
+}
+
+// Write a reference to the range of a file given by arg, FILE[:OFFSET:LEN]
+// (LEN 0, or no OFFSET:LEN, meaning through the end of the file), to out,
+// which has room for cap bytes. The program exits if the file can't be
+// found, or the range isn't within it.
+//
+// RETURN VALUE
+//     The number of bytes written to out, or (size_t)-1 if they wouldn't fit.
+static size_t ref_pack(const char *arg, char *out, size_t cap) {
+    char path[PATH_MAX];
+    char resolved[PATH_MAX];
+    size_t path_len = strlen(arg);
+    intmax_t offset = 0, length = 0;
+    struct stat st;
+    int n;
+
+    // the path may itself contain ':', so OFFSET:LEN must be all digits
+    const char *len_colon = strrchr(arg, ':');
+    if (len_colon && len_colon > arg) {
+        const char *off_colon = len_colon - 1;
+        while (off_colon > arg && *off_colon != ':')
+            off_colon--;
+        if (*off_colon == ':' &&
+            (offset = ref_get_count(off_colon + 1, (size_t)(len_colon -
+                                                   off_colon - 1))) >= 0 &&
+            (length = ref_get_count(len_colon + 1, strlen(len_colon + 1))) >= 0)
+            path_len = (size_t)(off_colon - arg);
+        else
+            offset = length = 0;
+    }
+    if (path_len >= sizeof(path)) {
+        fprintf(stderr, "ipcmd msgsnd: %s: %s\n", arg, strerror(ENAMETOOLONG));
         exit(EXIT_FAILURE);
     }
+    memcpy(path, arg, path_len);
+    path[path_len] = '\0';
 
-    if ((msgp = (struct msg *)malloc(sizeof(struct msg) + buf.msg_qbytes)) ==
-        NULL) {
-        perror("ipcmd msgrcv: malloc");
+    // the receiver may have another working directory
+    if (realpath(path, resolved) == NULL || stat(resolved, &st) == -1) {
+        fprintf(stderr, "ipcmd msgsnd: %s: %s\n", path, strerror(errno));
         exit(EXIT_FAILURE);
     }
+    if (!S_ISREG(st.st_mode) || offset > (intmax_t)st.st_size ||
+        length > (intmax_t)st.st_size - offset) {
+        fprintf(stderr, "ipcmd msgsnd: %s: range is not within a regular "
+                        "file\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    if (length == 0)
+        length = (intmax_t)st.st_size - offset;
 
-    msgsz = buf.msg_qbytes;
+    if (cap < REF_MAGIC_SIZE)
+        return (size_t)-1;
+    memcpy(out, REF_MAGIC, REF_MAGIC_SIZE);
+    n = snprintf(out + REF_MAGIC_SIZE, cap - REF_MAGIC_SIZE,
+                 "%ju %ju %jd %jd %jd %jd\n%s", (uintmax_t)st.st_dev,
+                 (uintmax_t)st.st_ino, ref_ctime(&st), (intmax_t)st.st_size,
+                 offset, length, resolved);
+    if (n < 0 || (size_t)n >= cap - REF_MAGIC_SIZE)
+        return (size_t)-1;
+    return REF_MAGIC_SIZE + (size_t)n;
+}
 
-    if ((bytes_received = msgrcv(msqid, (void *)msgp, msgsz, msgtyp, msgflg))
-         == (ssize_t)-1) {
-        if (errno == ENOMSG) // "-n" option specified and no message of desired
-            exit(2);         // type in queue
-        else {
-            fprintf(stderr, "ipcmd msgrcv (msgrcv()): ");
-            switch(errno) {
-                case E2BIG:
-                    fprintf(stderr, "The value of mtext is greater than msgsz "
-                        "and (msgflg & MSG_NOERROR) is 0.\n");
-                    break;
-                case EACCES:
-                    fprintf(stderr, "Operation permission is denied to the "
-                        "calling process\n");
+// If the message payload of len bytes at data is a reference, write the range
+// of the file it refers to to standard output (and then, if unlink_file is
+// 1, remove the file); otherwise, write the payload itself. The program
+// exits if the reference is corrupt or stale.
+static void ref_write(const char *data, size_t len, int unlink_file) {
+    char text[64 + PATH_MAX];
+    const char *path;
+    uintmax_t dev, ino;
+    intmax_t ctime, size, offset, length;
+    struct stat st;
+    int fd;
 
-                    break;
-                case EIDRM:
-                    fprintf(stderr, "The message queue identifier msqid is "
-                        "removed from the system.\n");
-                    break;
-                case EINTR:
-                    fprintf(stderr, "The msgrcv() function was interrupted by "
-                        "a signal.\n");
-                    break;
-                case EINVAL:
-                    fprintf(stderr, "msqid is not a valid message queue "
-                        "identifier.\n");
-                    break;
-                case ENOMSG:
-                    fprintf(stderr, "The queue does not contain a message of "
-                        "the desired type and (msgflg & IPC_NOWAIT) is "
-                        "non-zero.\n");
-                    break;
-                default:
-                    fprintf(stderr, "%s\n", strerror(errno)); 
-            }
+    if (len < REF_MAGIC_SIZE || memcmp(data, REF_MAGIC, REF_MAGIC_SIZE) != 0) {
+        if (write_all(STDOUT_FILENO, data, len) == -1) {
+            perror("ipcmd msgrcv: write");
             exit(EXIT_FAILURE);
         }
+        return;
+    }
+    len -= REF_MAGIC_SIZE;
+    if (len >= sizeof(text)) {
+        fprintf(stderr, "ipcmd msgrcv: corrupt reference message\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(text, data + REF_MAGIC_SIZE, len);
+    text[len] = '\0';
+    if (sscanf(text, "%ju %ju %jd %jd %jd %jd", &dev, &ino, &ctime, &size,
+               &offset, &length) != 6 || (path = strchr(text, '\n')) == NULL ||
+        *++path != '/' || offset < 0 || length < 0) {
+        fprintf(stderr, "ipcmd msgrcv: corrupt reference message\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "ipcmd msgrcv: %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if ((uintmax_t)st.st_dev != dev || (uintmax_t)st.st_ino != ino ||
+        ref_ctime(&st) != ctime || (intmax_t)st.st_size != size ||
+        offset + length > size) {
+        fprintf(stderr, "ipcmd msgrcv: %s: file changed since the reference "
+                        "was sent\n", path);
+        exit(EXIT_FAILURE);
     }
 
-    if (verbose)
-        fprintf(stderr, "%li\n", msgp->mtype);
+#ifdef HAVE_SENDFILE
+    // copied within the kernel; stdout may be any kind of file on Linux 2.6.33
+    // or later, so fall back to mmap() only if it isn't supported
+    off_t pos = (off_t)offset;
+    while (length > 0) {
+        ssize_t sent = sendfile(STDOUT_FILENO, fd, &pos, (size_t)length);
+        if (sent == -1 && errno == EINTR)
+            continue;
+        if (sent == -1 && (errno == EINVAL || errno == ENOSYS) &&
+            pos == (off_t)offset)
+            break;
+        if (sent <= 0) {
+            fprintf(stderr, "ipcmd msgrcv: %s: %s\n", path,
+                    sent == 0 ? "file truncated" : strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        length -= sent;
+    }
+#endif
+    if (length > 0) {
+        // mmap() offsets must be page-aligned
+        long page_size = sysconf(_SC_PAGESIZE);
+        off_t skip = (off_t)offset % page_size;
+        char *p = mmap(NULL, (size_t)(skip + length), PROT_READ, MAP_SHARED,
+                       fd, (off_t)offset - skip);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "ipcmd msgrcv: %s: %s\n", path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (write_all(STDOUT_FILENO, p + skip, (size_t)length) == -1) {
+            perror("ipcmd msgrcv: write");
+            exit(EXIT_FAILURE);
+        }
+        munmap(p, (size_t)(skip + length));
+    }
+    close(fd);
 
-    if (fwrite(msgp->mtext, (size_t)1, (size_t)bytes_received, stdout) 
-        < (size_t)bytes_received) {
-        perror("ipcmd msgsnd: fwrite");
+    if (unlink_file && unlink(path) == -1) {
+        fprintf(stderr, "ipcmd msgrcv: %s: %s\n", path, strerror(errno));
         exit(EXIT_FAILURE);
     }
 }
 
-// TODO: restrict mode argument to bits 666 (i.e., no "execute" bit)
-// * NOTE: semget() allows specifying nsems without IPC_CREAT, (i.e., we could 
-//   use '-N nsems' without '-c', so ipcmd semget could verifies that the
-//   semaphore set contains at least nsems semaphores, but would specifying
-//   the two together likely be a mistake? Revisit this and decide.
-// * Does it make sense to accept "-s semid", or could we just use
-// IPCMD_SEMID=SEMID ipcmd...
-static void ipcmd_semget(int argc, char *argv[]) {
-    const char *usage = 
-    "ipcmd semget [-S semkey [-e]] [-m mode] [-N nsems]\n"
-    "  -S       : create semaphore set associated with semkey\n"
-    "  -e       : no error if the semaphore set already exists\n"
-    "  -m mode  : read/alter permissions (octal value; default: 600)\n"
-    "  -N nsems : create a semaphores set with nsems semaphores (default 1)";
-
-    const int default_mode = 0600; // read & alter permission for owner
-    // default: create semaphore set, error if already exists, mode 600
-    int semflg = IPC_CREAT | IPC_EXCL | default_mode;
-    key_t key = IPC_PRIVATE; // default if "-S semkey" is not specified
-    int nsems = 1;  // create 1 semaphore by default if "-c" (IPC_CREAT) is 
-                    // specified; this parameter is ignored otherwise
-    int semid;
+static void ipcmd_msgstat(int argc, char *argv[]) {
+    const char *usage =
+    "ipcmd msgstat [-q msqid] [-r]\n"
+    "  -q msqid : message queue identifier\n"
+    "  -r       : remove the statistics (they are otherwise kept until the\n"
+    "             shared memory segment is removed)";
+    int msqid = 0;
+    int reset = 0;
+    struct segment_header *header;
+    struct histogram *h;
     int c;
 
-    while ((c = getopt(argc, argv, "em:N:S:")) != -1)
+    while ((c = getopt(argc, argv, "q:r")) != -1)
     {
         switch (c)
         {
-            case 'e':
-                semflg ^= IPC_EXCL; // remove IPC_EXCL from semflg
-                break;
-            case 'm':
-                semflg ^= default_mode; // clear default_mode bits
-                semflg |= get_mode_arg(optarg, "semget"); // user-supplied mode
-                break;
-            case 'N':
-                nsems = get_int_arg(optarg, "semget");
+            case 'q':
+                msqid = get_msqid_arg(optarg, "msgstat");
                 break;
-            case 'S':
-                key = get_key_t_arg(optarg, "semget");
+            case 'r':
+                reset = 1;
                 break;
             default: // unknown or missing argument
                 print_usage_and_exit(usage);
@@ -573,728 +1884,7183 @@ static void ipcmd_semget(int argc, char *argv[]) {
     if (optind != argc) // arguments specified
         print_usage_and_exit(usage);
 
-    // detect invalid option combinations (-e and not -S)
-    if ((!(semflg & IPC_EXCL) && key == IPC_PRIVATE))
-        print_usage_and_exit(usage);
-        
-    if ((semid = semget(key, nsems, semflg)) == -1) {
-        fprintf(stderr, "ipcmd semget (semget()): ");
-        switch (errno) {
-            case EACCES:
-                fprintf(stderr, "A semaphore identifier exists for key, but "
-                    "operation permission as specified by the low-order 9 bits "
-                    "of semflg would not be granted.\n");
-                break;
-            case EEXIST:
-                fprintf(stderr, "A semaphore identifier exists for the "
-                    "argument key but ((semflg &IPC_CREAT) && "
-                    "(semflg &IPC_EXCL)) is non-zero.\n");
-                exit(2);
-                break;
-            case EINVAL:
-                fprintf(stderr, "The value of nsems is either less than or "
-                    "equal to 0 or greater than the system-imposed limit, or a "
-                    "semaphore identifier exists for the argument key, but the "
-                    "number of semaphores in the set associated with it is "
-                    "less than nsems and nsems is not equal to 0.\n");
-                break;
-            case ENOENT:
-                fprintf(stderr, "A semaphore identifier does not exist for the "
-                                "argument key and (semflg &IPC_CREAT) is equal "
-                                "to 0.\n");
-                break;
-            case ENOSPC:
-                fprintf(stderr, "A semaphore identifier is to be created but "
-                    "the system-imposed limit on the maximum number of allowed "
-                    "semaphores system-wide would be exceeded.\n");
-                break;
-            default:
-                fprintf(stderr, "%s\n", strerror(errno));
-        }
+    msqid = get_msqid(msqid, "msgstat");
+    require_xsi_msqid(msqid, "msgstat", "msgstat");
+
+    if (reset) {
+        remove_segment(SEGMENT_MSGSTAT, msqid, "msgstat");
+        return;
+    }
+
+    if ((header = attach_segment(SEGMENT_MSGSTAT, msqid,
+                                 sizeof(struct segment_header) +
+                                 sizeof(struct histogram), 0, 0, "msgstat"))
+        == NULL) {
+        fprintf(stderr, "ipcmd msgstat: no statistics have been recorded for "
+                        "msqid %i (set IPCMD_MSGSTAT=1 for ipcmd msgrcv -E)\n",
+                msqid);
         exit(EXIT_FAILURE);
     }
+    h = (struct histogram *)(header + 1);
 
-    printf("%i\n", semid);
+    printf("%12s %12s %12s %12s %12s\n", "count", "mean_usec", "p50_usec",
+           "p99_usec", "max_usec");
+    printf("%12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64
+           "\n", h->count, h->count ? h->total_usec / h->count : 0,
+           histogram_percentile(h, 50), histogram_percentile(h, 99),
+           h->max_usec);
 }
 
-// unsigned short interval due to SEMMSL <= USHRT_MAX in all known
-// implementations (Mac OS X 10.5/10.6 claims 87381 as the default SEMMSL, but
-// it doesn't appear to support this in practice)
-static void get_interval(
-    const char *interval_arg,    // lower_bound[:upper_bound]=...
-    const char delimiter,        // character after interval; "=" or ":"
-    unsigned short *lower_bound, 
-    unsigned short *upper_bound  // == lower_bound if no upper_bound specified
+// Send one message, exiting with status 2 if it could not be sent and
+// IPC_NOWAIT was specified, or with EXIT_FAILURE on any other error.
+// qbytes_max > 0 enables msgsnd_autogrow().
+static void send_message(
+    int msqid,
+    const void *msgp,
+    size_t msgsz,
+    int msgflg,
+    msglen_t qbytes_max
 ) {
-    char *beginptr, *endptr;
-    errno = 0;
-    long val = strtol(interval_arg, &endptr, 10);
+    static uint64_t bytes_sent; // for tracing
+    uint64_t wait_begin;
+    int status;
 
-    // if error converting to long, or argument not a digit, or argument not
-    // entirely a digit
-    if (errno != 0) {
-        perror("ipcmd: strtol");
-        exit(EXIT_FAILURE);
-    } else if (endptr == interval_arg) {
-        // no integer at beginning of string
-        fprintf(stderr, "ipcmd: invalid argument: %s\n", interval_arg);
+    trace_object(msqid, bytes_sent, "mtype=%li", *(const long *)msgp);
+    wait_begin = trace_clock();
+#ifdef HAVE_MQUEUE
+    if (msqid == MSQID_POSIX) // mtype is the priority
+        status = mq_send(posix_mq, (const char *)msgp + sizeof(long), msgsz,
+                         (unsigned)*(const long *)msgp);
+    else
+#endif
+    status = qbytes_max > 0 ?
+                 msgsnd_autogrow(msqid, msgp, msgsz, msgflg, qbytes_max) :
+                 msgsnd(msqid, msgp, msgsz, msgflg);
+    trace_wait(wait_begin);
+    if (status == -1) {
+        if (errno == EAGAIN) // message could not be sent and "-n" used
+            exit(2);
+        fprintf(stderr, "ipcmd msgsnd (msgsnd()): %s\n",
+            ipcmd_msgsnd_strerror(errno));
         exit(EXIT_FAILURE);
-    } else if (val < 0 || val > USHRT_MAX) {
-        fprintf(stderr, "ipcmd: argument (%li) out of valid range\n", val);
+    }
+    bytes_sent += msgsz;
+    trace_object(msqid, bytes_sent, "mtype=%li", *(const long *)msgp);
+}
+
+// Conflated messages, sent by "ipcmd msgsnd -K key" and received by "ipcmd
+// msgrcv -K", keep only the latest value per key. The values are kept in a
+// CONFLATE segment associated with the queue, and the queue holds at most
+// one message per key, whose text is the key: it is sent when a key's value
+// becomes pending, and a new value for a key that is still pending replaces
+// the old one instead. The message is sent with the table locked, and the
+// key's slot is deleted once the value has been received, so only the keys
+// pending at once need a slot. A receiver takes the value only after it has
+// received the message, though, and one that dies in between (or a plain
+// "ipcmd msgrcv" that takes the message) leaves the key pending with no
+// message on the queue; so a sender finding a key pending on an empty queue
+// sends its message again. A receiver that then finds its key no longer
+// pending discards the message as a duplicate. The table is protected by a
+// spin lock, which holds the owner's process ID.
+#define CONFLATE_SLOTS 128
+#define CONFLATE_KEY_MAX 64 // including the terminating null byte
+#define CONFLATE_VALUE_MAX 4096
+#define CONFLATE_SPINS 100 // spin this many times before yielding the CPU
+
+enum {CONFLATE_FREE, CONFLATE_USED, CONFLATE_DELETED}; // a slot's state
+
+struct conflate_slot {
+    uint32_t used; // CONFLATE_FREE, CONFLATE_USED or CONFLATE_DELETED
+    uint32_t pending; // a message for the key is on the queue
+    uint32_t len;
+    uint32_t version; // of the value, from conflate.versions (0 if none)
+    char key[CONFLATE_KEY_MAX];
+    char value[CONFLATE_VALUE_MAX];
+};
+
+struct conflate {
+    uint32_t lock;
+    uint32_t versions; // values stored
+    struct conflate_slot slot[CONFLATE_SLOTS];
+};
+
+static struct conflate *attach_conflate(
+    int msqid,
+    const struct msqid_ds *buf,
+    int create,
+    const char *ipcmd_command // whence this function was called
+) {
+    struct segment_header *header;
+
+    header = attach_segment(SEGMENT_CONFLATE, msqid,
+                            sizeof(struct segment_header) +
+                            sizeof(struct conflate),
+                            buf->msg_perm.mode & 0666, create, ipcmd_command);
+    if (header == NULL) {
+        fprintf(stderr, "ipcmd %s: no conflated messages have been sent to "
+                        "msqid %i\n", ipcmd_command, msqid);
         exit(EXIT_FAILURE);
     }
+    return (struct conflate *)(header + 1);
+}
 
-    *lower_bound = (unsigned short) val;
+static void conflate_lock(struct conflate *t) {
+    uint32_t self = (uint32_t)getpid();
+    int saved_errno = errno;
+    for (int spins = 0; ; spins++) {
+        uint32_t owner = atomic_cas(&t->lock, 0, self);
+        if (owner == 0)
+            break;
+        if (spins < CONFLATE_SPINS)
+            continue;
+        // take over the lock from an owner that was killed holding it
+        if (spins % CONFLATE_SPINS == 0 && kill((pid_t)owner, 0) == -1 &&
+            errno == ESRCH && atomic_cas(&t->lock, owner, self) == owner)
+            break;
+        sched_yield();
+    }
+    errno = saved_errno;
+}
 
-    if (*endptr == ':') {
-        beginptr = endptr+1; // next character
-        errno = 0;
-        val = strtol(beginptr, &endptr, 10);
-        if (errno != 0) {
-            perror("strtol");
-            exit(EXIT_FAILURE);
-        } else if (endptr == beginptr) {
-            // no integer after comma
-            fprintf(stderr, "ipcmd: invalid argument: %s\n", interval_arg);
-            exit(EXIT_FAILURE);
-        } else if (val < 0 || val > USHRT_MAX) {
-            fprintf(stderr, "ipcmd: argument (%li) out of valid range\n", val);
-            exit(EXIT_FAILURE);
-        }
+static void conflate_unlock(struct conflate *t) {
+    __sync_lock_release(&t->lock);
+}
 
-        *upper_bound = (unsigned short) val;
+// RETURN VALUE
+//     The slot holding key (claiming a free or deleted one if create is
+//     nonzero), or NULL if there is none. Called with the table locked.
+static struct conflate_slot *conflate_find(
+    struct conflate *t,
+    const char *key,
+    int create
+) {
+    struct conflate_slot *claim = NULL; // the first free or deleted slot
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (const char *p = key; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    for (int i = 0; i < CONFLATE_SLOTS; i++) {
+        struct conflate_slot *s = &t->slot[(hash + (uint32_t)i) %
+                                           CONFLATE_SLOTS];
+        if (s->used != CONFLATE_USED && claim == NULL)
+            claim = s;
+        if (s->used == CONFLATE_FREE) // key would have been found by now
+            break;
+        if (s->used == CONFLATE_USED && strcmp(s->key, key) == 0)
+            return s;
+    }
+    if (!create || claim == NULL)
+        return NULL;
+    claim->used = CONFLATE_USED;
+    claim->pending = 0;
+    claim->version = 0;
+    strcpy(claim->key, key);
+    return claim;
+}
 
-        if (*upper_bound < *lower_bound) {
-            fprintf(stderr, "ipcmd: invalid argument (%s); upper bound of "
-                  "interval must be >= lower bound\n", interval_arg);
+// Make value (len bytes) the pending value of key, and send a message of
+// type mtype, whose text is the key, unless one is already on the queue.
+static void conflate_send(
+    int msqid,
+    const struct msqid_ds *buf,
+    long mtype,
+    const char *key,
+    const char *value,
+    size_t len
+) {
+    struct conflate *t = attach_conflate(msqid, buf, 1, "msgsnd");
+    struct conflate_slot *s;
+    struct {long mtype; char mtext[CONFLATE_KEY_MAX];} msg;
+    long interval_nsec = 1000000; // while the queue is full
+    uint32_t version = 0; // of this value, once stored
+
+    msg.mtype = mtype;
+    memcpy(msg.mtext, key, strlen(key));
+    conflate_lock(t);
+    for (;;) {
+        if ((s = conflate_find(t, key, 1)) == NULL) {
+            conflate_unlock(t);
+            fprintf(stderr, "ipcmd msgsnd: more than %i keys are pending on "
+                            "msqid %i\n", CONFLATE_SLOTS, msqid);
             exit(EXIT_FAILURE);
         }
-    } else
-        *upper_bound = *lower_bound; // no upper_bound specified
-
-    // kludge: the function that gets the value will pick up at the delimiter;
-    // ensure it exists immediately after the interval to verify the entire
-    // argument is of the right form
-    if (*endptr != delimiter) {
-        fprintf(stderr, "ipcmd: invalid argument (%s)\n", interval_arg);
-        exit(EXIT_FAILURE);
+        // store the value, unless a later one has been stored while this
+        // process was waiting for room
+        if (version == 0 || s->version == 0 ||
+            (int32_t)(s->version - version) < 0) {
+            if ((version = ++t->versions) == 0)
+                version = ++t->versions;
+            memcpy(s->value, value, len);
+            s->len = (uint32_t)len;
+            s->version = version;
+        }
+        if (s->pending) {
+            struct msqid_ds stat;
+            if (msgctl(msqid, IPC_STAT, &stat) == -1 || stat.msg_qnum > 0)
+                break;
+            // the message was lost
+        }
+        if (msgsnd(msqid, &msg, strlen(key), IPC_NOWAIT) == 0) {
+            s->pending = 1;
+            break;
+        }
+        if (errno != EAGAIN) {
+            conflate_unlock(t);
+            fprintf(stderr, "ipcmd msgsnd (msgsnd()): %s\n",
+                    ipcmd_msgsnd_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        // wait for room without the lock, polling with the interval doubling
+        // from 1 ms to 16 ms
+        conflate_unlock(t);
+        struct timespec interval = {0, interval_nsec};
+        nanosleep(&interval, NULL);
+        if (interval_nsec < 16000000)
+            interval_nsec *= 2;
+        conflate_lock(t);
     }
+    conflate_unlock(t);
 }
 
-static unsigned short get_interval_semval(
-    const char *arg // sem_num_lbound[,sem_num_ubound]=semval
-)
-{
-    long val;
-    char *beginptr, *endptr;
+// Take the pending value of the key named by a received message (key_len
+// bytes at key), and point *value at the text "key\tvalue" (in a static
+// buffer), of *len bytes.
+//
+// RETURN VALUE
+//     1, or 0 if the key isn't pending (the message was a duplicate).
+static int conflate_receive(
+    int msqid,
+    const struct msqid_ds *buf,
+    const char *key,
+    size_t key_len,
+    const char **value,
+    size_t *len
+) {
+    static char out[CONFLATE_KEY_MAX + CONFLATE_VALUE_MAX];
+    struct conflate *t = attach_conflate(msqid, buf, 0, "msgrcv");
+    struct conflate_slot *s;
+    char name[CONFLATE_KEY_MAX];
 
-    // this check shouldn't be needed, as it was done in get_interval()
-    if ((beginptr = strchr(arg, '=')) == NULL) {
-        fprintf(stderr, "ipcmd: invalid argument (%s)\n", arg);
+    if (key_len >= CONFLATE_KEY_MAX || memchr(key, '\0', key_len)) {
+        fprintf(stderr, "ipcmd msgrcv: received a message that isn't a "
+                        "conflated key (from ipcmd msgsnd -K)\n");
         exit(EXIT_FAILURE);
     }
+    memcpy(name, key, key_len);
+    name[key_len] = '\0';
+    conflate_lock(t);
+    s = conflate_find(t, name, 0);
+    if (s == NULL || !s->pending) { // taken by an earlier message
+        conflate_unlock(t);
+        return 0;
+    }
+    memcpy(out, name, key_len);
+    out[key_len] = '\t';
+    memcpy(out + key_len + 1, s->value, s->len);
+    *len = key_len + 1 + s->len;
+    s->pending = 0; // the next value sends a message again
+    s->used = CONFLATE_DELETED; // and claims a slot again
+    conflate_unlock(t);
+    *value = out;
+    return 1;
+}
 
-    beginptr++; // next character
+#define MSGSND_PREFETCH 16 // files opened, and read ahead, before being sent
 
-    errno = 0;
-    val = strtol(beginptr, &endptr, 10);
-    // if error converting to long, or argument not a digit, or argument not
-    // entirely a digit
-    if (errno != 0) {
-        perror("strtol");
-        exit(EXIT_FAILURE);
-    } else if (endptr == beginptr) {
-        // no integer at beginning of field
-        fprintf(stderr, "ipcmd semctl setall: invalid argument: %s\n", arg);
-        exit(EXIT_FAILURE);
-    } else if (val < 0 || val > USHRT_MAX) {
-        fprintf(stderr, 
-                "ipcmd semctl setall: semval (%li) out of valid range\n", val);
-        exit(EXIT_FAILURE);
-    } else if (*endptr != '\0') {
-        // extra characters after semval
-        fprintf(stderr, "ipcmd semop: invalid argument: %s\n", arg);
+// files whose contents "ipcmd msgsnd -f" or "-F" has yet to send
+struct msgsnd_file {
+    char *name;
+    int fd;
+};
+
+// RETURN VALUE
+//     The name of the next file to send (to be freed by the caller): the next
+//     of argv[*next...] (up to argc), or if from_stdin is 1, the next
+//     non-empty line of standard input. NULL if there are no more.
+static char *msgsnd_next_file(
+    int argc,
+    char *argv[],
+    int *next,
+    int from_stdin
+) {
+    char line[PATH_MAX+2];
+    char *name;
+
+    if (!from_stdin)
+        name = *next < argc ? argv[(*next)++] : NULL;
+    else {
+        do {
+            if (fgets(line, sizeof(line), stdin) == NULL) {
+                if (ferror(stdin)) {
+                    perror("ipcmd msgsnd: read");
+                    exit(EXIT_FAILURE);
+                }
+                return NULL;
+            }
+            line[strcspn(line, "\n")] = '\0';
+        } while (line[0] == '\0');
+        name = line;
+    }
+    if (name && (name = strdup(name)) == NULL) {
+        perror("ipcmd msgsnd: strdup");
         exit(EXIT_FAILURE);
     }
+    return name;
+}
 
-    return (unsigned short) val;
+// Open the files to be sent next (up to MSGSND_PREFETCH), and advise the
+// system that they will be read, so that their contents are read in the
+// meantime.
+static void msgsnd_prefetch(
+    struct msgsnd_file *ahead,
+    size_t head,
+    size_t *count,
+    int argc,
+    char *argv[],
+    int *next,
+    int from_stdin
+) {
+    char *name;
+    while (*count < MSGSND_PREFETCH &&
+           (name = msgsnd_next_file(argc, argv, next, from_stdin)) != NULL) {
+        struct msgsnd_file *f = &ahead[(head + *count) % MSGSND_PREFETCH];
+        f->name = name;
+        if ((f->fd = open(name, O_RDONLY)) == -1) {
+            fprintf(stderr, "ipcmd msgsnd: %s: %s\n", name, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(f->fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+        (*count)++;
+    }
 }
 
-const char *ipcmd_semctl_strerror(int errnum) {
-    switch(errnum) {
-        case EACCES:
-            return "Operation permission is denied to the calling process.";
-        case EINVAL:
-            return "The value of semid is not a valid semaphore identifier, "
-                   "or the value of semnum is less than 0 or greater than or "
-                   "equal to sem_nsems, or the value of cmd is not a valid "
-                   "command.";
-        case EPERM:
-            return "The argument cmd is equal to IPC_RMID or IPC_SET and the "
-                   "effective user ID of the calling process is not equal to "
-                   "that of a process with appropriate privileges and it is "
-                   "not equal to the value of sem_perm.cuid or sem_perm.uid in "
-                   "the data structure associated with semid.";
-        case ERANGE:
-            return "The argument cmd is equal to SETVAL or SETALL and the "
-                   "value to which semval is to be set is greater than the "
-                   "system-imposed maximum.";
-        default:
-            return strerror(errnum);
+// RETURN VALUE
+//     The message type given by the leading digits of the base name of a file
+//     ("ipcmd msgsnd -T name"). The program exits if there are none.
+static long msgsnd_name_mtype(const char *name) {
+    const char *base = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+    char *endptr;
+    long mtype;
+    errno = 0;
+    mtype = strtol(base, &endptr, 10);
+    if (errno != 0 || endptr == base || *base == '-' || *base == '+' ||
+        mtype <= 0) {
+        fprintf(stderr, "ipcmd msgsnd: %s: file name doesn't begin with a "
+                        "message type\n", name);
+        exit(EXIT_FAILURE);
     }
+    return mtype;
 }
-// TODO: This would be more elegant if we used long options as follows:
-//     [--chown owner] [--chgrp group] [--chmod mode]
-//     --getval semnum
-//     --setval semnum value
-//     --getpid semnum
-//     --getncnt semnum
-//     --getzcnt semnum
-//     --getall
-//     --setall arg [arg...]
-static void ipcmd_semctl(int argc, char *argv[]) {
-    const char *usage = 
-    "ipcmd semctl [-s semid] <subcommand> <args>\n"
-    "Where <subcommand> <args> is one of the following:\n"
-    "  getval  SEMNUM\n"
-    "  setval  SEMNUM SEMVAL\n"
-    "  getpid  SEMNUM\n"
-    "  getncnt SEMNUM\n"
-    "  getzcnt SEMNUM\n"
-    "  getall\n"
-    "  setall  [SEMNUM_LBOUND[,SEMNUM_UBOUND]=]SEMVAL...";
-    int semid = -1;
-    int semnum = -1; // semnum argument for some commands
-    int cmd = IPC_STAT; // command that won't be supported, so it's safe to use
-                        // as an "unset" value
-    unsigned short sem_nsems;
-    union semun {
-        int val;
-        struct semid_ds *buf;
-        unsigned short  *array;
-    } arg;
-    struct semid_ds seminfo;
+
+// FIXME: It probably doesn't make sense to allow both "-n" and more than one 
+// message argument, as it would be impossible to know which messages were sent.
+static void ipcmd_msgsnd(int argc, char *argv[]) {
+    const char *usage =
+        "msgsnd [-q msqid] [-t mtype] [-n] [-g max_qbytes] [-E] [-z]\n"
+        "             [message...] | -f [-T seq|name] file... |\n"
+        "             -F [-T seq|name] | -R file[:offset:length] |\n"
+        "             -K key [value]";
+    struct msg {long mtype; char mtext[];}; 
+    struct msg *msgp;
+    char *input = NULL; // uncompressed message read from a file, if -z
+    long mtype = 1;
+    int msqid = 0;
+    int msgflg = 0;
+    msglen_t qbytes_max = 0; // > 0 if "-g max_qbytes" specified
     int c;
+    struct msqid_ds buf;
+    size_t msgsz;
+    size_t msgsz_max; // largest message this process will attempt to send
+    size_t header_size = 0; // bytes preceding the message text in mtext
+    char *payload; // message text (after any envelope)
+    uint64_t seq = 0; // number of messages sent
+    int mtype_set = 0; // if 1, "-t mtype" was specified
+    int compress = 0; // if 1, "-z" was specified
+    const char *ref = NULL; // "-R file[:offset:length]"
+    int files = 0; // 'f' or 'F', if "-f" or "-F" was specified
+    int mtype_from = 0; // 's' or 'n', if "-T seq|name" was specified
+    const char *key = NULL; // "-K key"
 
-    while ((c = getopt(argc, argv, "s:")) != -1)
+    while ((c = getopt(argc, argv, "Efg:FK:nq:R:t:T:z")) != -1)
     {
         switch (c)
         {
-            case 's':
-                semid = get_int_arg(optarg, "semctl");
+            case 'E':
+                header_size = sizeof(struct envelope);
                 break;
-            default: // unknown or missing argument
+            case 'f':
+            case 'F':
+                files = c;
+                break;
+            case 'K':
+                key = optarg;
+                break;
+            case 'g':
+                qbytes_max = get_qbytes_arg(optarg, "msgsnd");
+                break;
+            case 'n':
+                msgflg |= IPC_NOWAIT;
+                break;
+            case 'q':
+                msqid = get_msqid_arg(optarg, "msgsnd");
+                break;
+            case 'R':
+                ref = optarg;
+                break;
+            case 't':
+                mtype = get_long_arg(optarg, "msgsnd");
+                mtype_set = 1;
+                break;
+            case 'T':
+                if (strcmp(optarg, "seq") == 0 || strcmp(optarg, "name") == 0)
+                    mtype_from = optarg[0];
+                else
+                    print_usage_and_exit(usage);
+                break;
+            case 'z':
+                compress = 1;
+                break;
+            default:  // unknown option
                 print_usage_and_exit(usage);
         }
     }
 
-    if (optind == argc) // no subcommand specified
+    if ((ref && (compress || files || optind < argc)) || // ref is the message
+        (files == 'f' && optind == argc) || (files == 'F' && optind < argc) ||
+        (mtype_from && !files) ||
+        // a value may not be left pending without a message for its key
+        (key && (ref || files || compress || header_size || msgflg ||
+                 qbytes_max || optind + 1 < argc)))
         print_usage_and_exit(usage);
-
-    if (semid == -1) { // -s option not used
-        if (!getenv("IPCMD_SEMID")) { //IPCMD_SEMID environment variable not set
-            fprintf(stderr, "ipcmd semctl: must either specify [-s semid] or "
-                            "set IPCMD_SEMID environment variable\n");
-            exit(1);
-        } else
-            semid = get_int_arg(getenv("IPCMD_SEMID"), "semctl");
+    if (key && (*key == '\0' || strlen(key) >= CONFLATE_KEY_MAX ||
+                strpbrk(key, "\t\n") != NULL)) {
+        fprintf(stderr, "ipcmd msgsnd: key must be 1 to %i bytes, without "
+                        "tabs or newlines\n", CONFLATE_KEY_MAX - 1);
+        exit(EXIT_FAILURE);
     }
 
-    if (strncmp(argv[optind], "getval", (size_t)_POSIX_ARG_MAX) == 0)
-        cmd = GETVAL;
-    else if (strncmp(argv[optind], "setval", (size_t)_POSIX_ARG_MAX) == 0)
-        cmd = SETVAL;
-    else if (strncmp(argv[optind], "getpid", (size_t)_POSIX_ARG_MAX) == 0)
-        cmd = GETPID;
-    else if (strncmp(argv[optind], "getncnt", (size_t)_POSIX_ARG_MAX) == 0)
-        cmd = GETNCNT;
-    else if (strncmp(argv[optind], "getzcnt", (size_t)_POSIX_ARG_MAX) == 0)
-        cmd = GETZCNT;
-    else if (strncmp(argv[optind], "getall", (size_t)_POSIX_ARG_MAX) == 0)
-        cmd = GETALL;
-    else if (strncmp(argv[optind], "setall", (size_t)_POSIX_ARG_MAX) == 0)
-        cmd = SETALL;
-    else
-        print_usage_and_exit(usage);
+    msqid = get_msqid(msqid, "msgsnd");
+    if (key)
+        require_xsi_msqid(msqid, "-K", "msgsnd");
 
-    optind++;
+#ifdef HAVE_MQUEUE
+    if (msqid == MSQID_POSIX) {
+        struct mq_attr attr;
+        if (qbytes_max)
+            require_xsi_msqid(msqid, "-g", "msgsnd");
+        posix_mq_open(O_WRONLY | (msgflg & IPC_NOWAIT ? O_NONBLOCK : 0),
+                      &attr, "msgsnd");
+        msgsz_max = (size_t)attr.mq_msgsize;
+        if (!mtype_set) // the lowest priority, rather than the default mtype
+            mtype = 0;
+    } else
+#endif
+    {
+        // BUG (maybe): it's possible the user has write permission, but not
+        // read permission, on the message queue.
+        if (msgctl(msqid, IPC_STAT, &buf) == -1) {
+            fprintf(stderr, "ipcmd msgsnd (msgctl()): %s\n",
+                    ipcmd_msgctl_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
 
-    switch(cmd) {
-        case GETVAL:
-        case GETPID:
-        case GETNCNT:
-        case GETZCNT:
-            if (optind+1 != argc) // if not exactly one more argument (SEMNUM)
-                print_usage_and_exit(usage);
-            semnum = get_int_arg(argv[optind++], "semctl");
-            int result;
-            if ((result = semctl(semid, semnum, cmd, arg)) == -1) {
-                fprintf(stderr, "ipcmd semctl getzcnt (semctl()): %s\n",
-                        ipcmd_semctl_strerror(errno));
+        // no message larger than the queue may grow to, or than MSGMAX, can
+        // be sent
+        msgsz_max = msgsz_limit((size_t)(qbytes_max > buf.msg_qbytes ?
+                                         qbytes_max : buf.msg_qbytes));
+    }
+    if (key) {
+        char value[CONFLATE_VALUE_MAX + 1];
+        ssize_t len;
+        if (optind < argc) {
+            len = (ssize_t)strlen(argv[optind]);
+            if (len <= CONFLATE_VALUE_MAX)
+                memcpy(value, argv[optind], (size_t)len);
+        } else if ((len = read_all(STDIN_FILENO, value, sizeof(value)))
+                   == -1) {
+            perror("ipcmd msgsnd: read");
+            exit(EXIT_FAILURE);
+        }
+        if (len > CONFLATE_VALUE_MAX) {
+            fprintf(stderr, "ipcmd msgsnd: value length > %i\n",
+                    CONFLATE_VALUE_MAX);
+            exit(EXIT_FAILURE);
+        }
+        conflate_send(msqid, &buf, mtype, key, value, (size_t)len);
+        return;
+    }
+    if ((msgp = (struct msg *)malloc(sizeof(struct msg) + msgsz_max+1)) ==
+        NULL) {
+        perror("ipcmd msgsnd: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    msgp->mtype = mtype; // any user-specified applies to all messages
+    payload = msgp->mtext + header_size;
+    msgsz_max = msgsz_max > header_size ? msgsz_max - header_size : 0;
+
+    if (ref) {
+        if ((msgsz = ref_pack(ref, payload, msgsz_max)) == (size_t)-1) {
+            fprintf(stderr,"ipcmd msgsnd: reference length > msg_qbytes\n");
+            exit(EXIT_FAILURE);
+        }
+        if (header_size)
+            envelope_seal(msgp->mtext, ++seq);
+        send_message(msqid, msgp, header_size + msgsz, msgflg, qbytes_max);
+    } else if (optind < argc && !files) {   // message arguments specified
+        do {
+            msgsz = strlen(argv[optind]);
+            if (compress)
+                msgsz = zframe_pack(argv[optind], msgsz, payload, msgsz_max);
+            if (msgsz > msgsz_max) {
+                fprintf(stderr,"ipcmd msgsnd: message argument length > "
+                               "msg_qbytes\n");
                 exit(EXIT_FAILURE);
             }
-            printf("%i\n", result);
+
+            if (!compress)
+                strcpy(payload, argv[optind]);
+
+            if (header_size)
+                envelope_seal(msgp->mtext, ++seq);
+            send_message(msqid, msgp, header_size + msgsz, msgflg,
+                         qbytes_max);
+            optind++;
+        } while (optind < argc);
+    } else { // read a message from each file, or one from stdin
+        // -z: the message may be larger than the queue can hold, as long as
+        // it compresses to fit
+        size_t input_max = compress ? ZFRAME_RATIO_MAX * msgsz_max :
+                                      msgsz_max;
+        struct msgsnd_file ahead[MSGSND_PREFETCH];
+        size_t head = 0, count = 0;
+        const char *name = NULL; // of the file being sent, if any
+        int fd = STDIN_FILENO;
+
+        if (compress && (input = malloc(input_max+1)) == NULL) {
+            perror("ipcmd msgsnd: malloc");
+            exit(EXIT_FAILURE);
+        }
+        for (;;) {
+            if (files) {
+                // one process sends them all, so the queue is looked up and
+                // the buffer allocated only once
+                msgsnd_prefetch(ahead, head, &count, argc, argv, &optind,
+                                files == 'F');
+                if (count == 0)
+                    break;
+                name = ahead[head].name;
+                fd = ahead[head].fd;
+                head = (head + 1) % MSGSND_PREFETCH;
+                count--;
+                if (mtype_from == 'n')
+                    msgp->mtype = msgsnd_name_mtype(name);
+                else if (mtype_from == 's')
+                    msgp->mtype = mtype + (long)seq;
+            }
+            // read() rather than fread(): msgsnd is typically run once per
+            // message, so avoid stdio's buffering (an extra copy) entirely
+            ssize_t bytes_read = read_all(fd, compress ? input : payload,
+                                          input_max+1);
+
+            if (bytes_read == -1) {
+                if (name)
+                    fprintf(stderr, "ipcmd msgsnd: %s: %s\n", name,
+                            strerror(errno));
+                else
+                    perror("ipcmd msgsnd: read");
+                exit(EXIT_FAILURE);
+            }
+            msgsz = (size_t)bytes_read;
+            if (compress && msgsz <= input_max)
+                msgsz = zframe_pack(input, msgsz, payload, msgsz_max);
+
+            // if 1 more byte was read than the queue can hold
+            if (msgsz > msgsz_max) {
+                if (name)
+                    fprintf(stderr, "ipcmd msgsnd: %s: file length > "
+                                    "msg_qbytes\n", name);
+                else
+                    fprintf(stderr,"ipcmd msgsnd: message length > "
+                                   "msg_qbytes\n");
+                exit(EXIT_FAILURE);
+            }
+
+            if (header_size)
+                envelope_seal(msgp->mtext, seq+1);
+            seq++;
+            send_message(msqid, msgp, header_size + msgsz, msgflg, qbytes_max);
+            if (!files)
+                break;
+            close(fd);
+            free((char *)name);
+        }
+    }
+}
+
+// Record how long a message spent in the queue: append a line to logfile
+// (if not NULL), and if the IPCMD_MSGSTAT environment variable is set to a
+// non-empty string, add it to the queue's msgstat histogram.
+static void record_residence(
+    int msqid,
+    const struct msqid_ds *buf,
+    long mtype,
+    const struct envelope *e,
+    uint64_t usec,
+    const char *logfile
+) {
+    if (logfile) {
+        char line[128];
+        int fd, len;
+        // one write() per line, so lines from concurrent receivers don't mix
+        len = snprintf(line, sizeof(line), "%li %li %" PRIu64 " %" PRIu64 "\n",
+                       mtype, (long)e->pid, e->seq, usec);
+        if ((fd = open(logfile, O_WRONLY | O_APPEND | O_CREAT, 0666)) == -1 ||
+            write_all(fd, line, (size_t)len) == -1) {
+            fprintf(stderr, "ipcmd msgrcv: %s: %s\n", logfile,
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    }
+
+    if (msqid != MSQID_POSIX && // msgstat segments are keyed by msqid
+        getenv("IPCMD_MSGSTAT") && *getenv("IPCMD_MSGSTAT")) {
+        struct segment_header *header =
+            attach_segment(SEGMENT_MSGSTAT, msqid,
+                           sizeof(struct segment_header) +
+                           sizeof(struct histogram),
+                           buf->msg_perm.mode & 0666, 1, "msgrcv");
+        histogram_record((struct histogram *)(header + 1), usec, usec > 0);
+    }
+}
+
+// Receive a message as msgrcv() does, from either backend, but give up
+// after timeout (if not NULL) has elapsed, failing with ENOMSG as msgrcv()
+// does when IPC_NOWAIT is specified. For a POSIX message queue, msgtyp is
+// ignored, and the message's priority is stored as its type.
+static ssize_t receive_message(
+    int msqid,
+    void *msgp,
+    size_t msgsz,
+    long msgtyp,
+    int msgflg,
+    const struct timespec *timeout
+) {
+    struct sigaction oact;
+    ssize_t received;
+    int saved_errno;
+
+#ifdef HAVE_MQUEUE
+    if (msqid == MSQID_POSIX) {
+        char *mtext = (char *)msgp + sizeof(long);
+        unsigned prio;
+        if (timeout) { // mq_timedreceive() takes an absolute time
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += timeout->tv_sec;
+            deadline.tv_nsec += timeout->tv_nsec;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            received = mq_timedreceive(posix_mq, mtext, msgsz, &prio,
+                                       &deadline);
+        } else
+            received = mq_receive(posix_mq, mtext, msgsz, &prio);
+        if (received >= 0)
+            *(long *)msgp = (long)prio;
+        else if (errno == EAGAIN || errno == ETIMEDOUT)
+            errno = ENOMSG;
+        return received;
+    }
+#endif
+
+    if (timeout == NULL)
+        return msgrcv(msqid, msgp, msgsz, msgtyp, msgflg);
+    // a zero timeout would disarm the timer; poll instead
+    if (timeout->tv_sec == 0 && timeout->tv_nsec == 0)
+        return msgrcv(msqid, msgp, msgsz, msgtyp, msgflg | IPC_NOWAIT);
+
+    timeout_start(timeout, &oact);
+    received = msgrcv(msqid, msgp, msgsz, msgtyp, msgflg);
+    saved_errno = errno;
+    timeout_stop(&oact);
+
+    errno = (received == -1 && saved_errno == EINTR) ? ENOMSG : saved_errno;
+    return received;
+}
+
+static void ipcmd_msgrcv(int argc, char *argv[]) {
+    const char *usage =
+        "ipcmd msgrcv [-q msqid] [-t msgtyp | -x msgtyp | -p index] [-n]\n"
+        "             [-w timeout] [-v] [-E [-L logfile]] [-z] [-D [-u]] [-K]";
+    struct msg {long mtype; char mtext[];}; 
+    struct msg *msgp;
+    long msgtyp = 0; // 0: default is to receive a message of any type
+    int msqid = 0;
+    int msgflg = 0;
+    int c;
+    struct msqid_ds buf;
+    size_t msgsz;
+    size_t payload_max; // largest decompressed payload (-z)
+    ssize_t bytes_received;
+    int verbose = 0; // if 1, print type of received message to stderr
+    int msgtyp_opts = 0; // number of -t, -x, and -p options
+    int envelope = 0; // if 1, remove any envelope from the message
+    const char *logfile = NULL; // "-L logfile"
+    size_t header_size = 0; // size of the envelope, if any
+    uint64_t wait_begin;
+    struct timespec timeout;
+    struct timespec *timeoutp = NULL; // non-NULL if "-w timeout" specified
+    int decompress = 0; // if 1, "-z" was specified
+    int deref = 0; // if 1, "-D" was specified
+    int unlink_file = 0; // if 1, "-u" was specified
+    int peek = 0; // if 1, "-p" was specified
+    int conflated = 0; // if 1, "-K" was specified
+    const char *data; // the message payload written
+    size_t len;
+
+    while ((c = getopt(argc, argv, "DEKL:np:q:t:uvw:x:z")) != -1)
+    {
+        switch (c)
+        {
+            case 'D':
+                deref = 1;
+                break;
+            case 'E':
+                envelope = 1;
+                break;
+            case 'K':
+                conflated = 1;
+                break;
+            case 'L':
+                logfile = optarg;
+                break;
+            case 'n':
+                msgflg |= IPC_NOWAIT;
+                break;
+            case 'p':
+#ifdef MSG_COPY
+                // MSG_COPY interprets msgtyp as an index into the queue, and
+                // requires IPC_NOWAIT
+                msgtyp = get_long_arg(optarg, "msgrcv");
+                msgflg |= MSG_COPY | IPC_NOWAIT;
+                msgtyp_opts++;
+                peek = 1;
+                break;
+#else
+                fprintf(stderr, "ipcmd msgrcv: -p is not supported on this "
+                                "platform\n");
+                exit(EXIT_FAILURE);
+#endif
+            case 'q':
+                msqid = get_msqid_arg(optarg, "msgrcv");
+                break;
+            case 't':
+                msgtyp = get_long_arg(optarg, "msgrcv");
+                msgtyp_opts++;
+                break;
+            case 'u':
+                unlink_file = 1;
+                break;
+            case 'x':
+#ifdef MSG_EXCEPT
+                msgtyp = get_long_arg(optarg, "msgrcv");
+                msgflg |= MSG_EXCEPT;
+                msgtyp_opts++;
+                break;
+#else
+                fprintf(stderr, "ipcmd msgrcv: -x is not supported on this "
+                                "platform\n");
+                exit(EXIT_FAILURE);
+#endif
+            case 'v':
+                verbose = 1;
+                break;
+            case 'w':
+                timeout = get_timeout_arg(optarg, "msgrcv");
+                timeoutp = &timeout;
+                break;
+            case 'z':
+                decompress = 1;
+                break;
+            default:  // unknown option
+                print_usage_and_exit(usage);
+        }
+    }
+
+    if (msgtyp_opts > 1 || // -t, -x, and -p are mutually exclusive
+        (logfile && !envelope) ||
+        // a message left in the queue by -p must still refer to its file
+        (unlink_file && (!deref || peek)) ||
+        // the message only names a key, whose value must then be taken
+        (conflated && (peek || envelope || decompress || deref)))
+        print_usage_and_exit(usage);
+
+    msqid = get_msqid(msqid, "msgrcv");
+    if (conflated)
+        require_xsi_msqid(msqid, "-K", "msgrcv");
+
+#ifdef HAVE_MQUEUE
+    if (msqid == MSQID_POSIX) {
+        struct mq_attr attr;
+        if (msgtyp_opts) // messages are received in priority order
+            require_xsi_msqid(msqid, "-t, -x, or -p", "msgrcv");
+        posix_mq_open(O_RDONLY | (msgflg & IPC_NOWAIT ? O_NONBLOCK : 0),
+                      &attr, "msgrcv");
+        msgsz = payload_max = (size_t)attr.mq_msgsize;
+    } else
+#endif
+    {
+        if (msgctl(msqid, IPC_STAT, &buf) == -1) {
+            fprintf(stderr, "ipcmd msgrcv (msgctl()): %s\n",
+                    ipcmd_msgctl_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        payload_max = buf.msg_qbytes;
+        msgsz = msgsz_limit(buf.msg_qbytes); // no larger message exists
+    }
+
+    if ((msgp = (struct msg *)malloc(sizeof(struct msg) + msgsz)) == NULL) {
+        perror("ipcmd msgrcv: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+receive: // again, if -K received a duplicate
+    trace_object(msqid, 0, "msgtyp=%li", msgtyp); // in case none arrives
+    wait_begin = trace_clock();
+    bytes_received = receive_message(msqid, msgp, msgsz, msgtyp, msgflg,
+                                     timeoutp);
+    trace_wait(wait_begin);
+    if (bytes_received == (ssize_t)-1) {
+        if (errno == ENOMSG) // "-n" option specified and no message of desired
+            exit(2);         // type in queue, or -w timed out
+        else {
+            fprintf(stderr, "ipcmd msgrcv (msgrcv()): ");
+            switch(errno) {
+                case E2BIG:
+                    fprintf(stderr, "The value of mtext is greater than msgsz "
+                        "and (msgflg & MSG_NOERROR) is 0.\n");
+                    break;
+                case EACCES:
+                    fprintf(stderr, "Operation permission is denied to the "
+                        "calling process\n");
+
+                    break;
+                case EIDRM:
+                    fprintf(stderr, "The message queue identifier msqid is "
+                        "removed from the system.\n");
+                    break;
+                case EINTR:
+                    fprintf(stderr, "The msgrcv() function was interrupted by "
+                        "a signal.\n");
+                    break;
+                case EINVAL:
+                    fprintf(stderr, "msqid is not a valid message queue "
+                        "identifier.\n");
+                    break;
+                case ENOSYS:
+                    fprintf(stderr, "MSG_COPY (-p) is not supported by this "
+                        "kernel.\n");
+                    break;
+                case ENOMSG:
+                    fprintf(stderr, "The queue does not contain a message of "
+                        "the desired type and (msgflg & IPC_NOWAIT) is "
+                        "non-zero.\n");
+                    break;
+                default:
+                    fprintf(stderr, "%s\n", strerror(errno)); 
+            }
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    trace_object(msqid, (uint64_t)bytes_received, "mtype=%li", msgp->mtype);
+
+    if (envelope) {
+        struct envelope e;
+        uint64_t usec;
+        if ((header_size = envelope_open(msgp->mtext, (size_t)bytes_received,
+                                         &e, &usec)) > 0)
+            record_residence(msqid, &buf, msgp->mtype, &e, usec, logfile);
+    }
+
+    data = msgp->mtext + header_size;
+    len = (size_t)bytes_received - header_size;
+    if (conflated && !conflate_receive(msqid, &buf, data, len, &data, &len))
+        goto receive;
+
+    // write() rather than stdio, to keep the per-message cost of msgrcv down
+    if (verbose) {
+        char mtype[32];
+        int len = snprintf(mtype, sizeof(mtype), "%li\n", msgp->mtype);
+        write_all(STDERR_FILENO, mtype, (size_t)len);
+    }
+
+    if (decompress)
+        zframe_unpack(&data, &len, ZFRAME_RATIO_MAX * payload_max);
+    if (deref)
+        ref_write(data, len, unlink_file);
+    else if (write_all(STDOUT_FILENO, data, len) == -1) {
+        perror("ipcmd msgrcv: write");
+        exit(EXIT_FAILURE);
+    }
+}
+
+//**************************************
+// message queue checkpoint/restore ("ipcmd msgdump" and "ipcmd msgload")
+//**************************************
+
+// A dump is MSGDUMP_MAGIC followed by one record per message: its type as an
+// 8-byte and its length as a 4-byte big-endian integer, then its bytes.
+#define MSGDUMP_MAGIC "ipcmdq1\n"
+#define MSGDUMP_MAGIC_SIZE 8
+#define MSGDUMP_RECORD_HEADER_SIZE 12
+
+static void msgdump_put_header(unsigned char *p, long mtype, size_t len) {
+    uint64_t type = (uint64_t)(int64_t)mtype;
+    for (int i = 0; i < 8; i++)
+        p[i] = (unsigned char)(type >> (56 - 8*i));
+    for (int i = 0; i < 4; i++)
+        p[8+i] = (unsigned char)((uint32_t)len >> (24 - 8*i));
+}
+
+static void msgdump_get_header(
+    const unsigned char *p,
+    long *mtype,
+    size_t *len
+) {
+    uint64_t type = 0;
+    uint32_t length = 0;
+    for (int i = 0; i < 8; i++)
+        type = type << 8 | p[i];
+    for (int i = 0; i < 4; i++)
+        length = length << 8 | p[8+i];
+    *mtype = (long)(int64_t)type;
+    *len = length;
+}
+
+// RETURN VALUE
+//     The size of the largest message that can be sent to or received from
+//     msqid, after opening it (if a POSIX message queue) with oflag.
+static size_t msgdump_open(int msqid, int oflag, const char *ipcmd_command) {
+    struct msqid_ds buf;
+#ifdef HAVE_MQUEUE
+    if (msqid == MSQID_POSIX) {
+        struct mq_attr attr;
+        posix_mq_open(oflag, &attr, ipcmd_command);
+        return (size_t)attr.mq_msgsize;
+    }
+#else
+    (void)oflag;
+#endif
+    if (msgctl(msqid, IPC_STAT, &buf) == -1) {
+        fprintf(stderr, "ipcmd %s (msgctl()): %s\n", ipcmd_command,
+                ipcmd_msgctl_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return (size_t)buf.msg_qbytes;
+}
+
+// Report that the message just received (msgsz bytes at msgp) could not be
+// written, return it to (the end of) the queue if possible, and exit.
+static void msgdump_write_failed(int msqid, const void *msgp, size_t msgsz) {
+    int saved_errno = errno;
+    int returned = 0;
+#ifdef HAVE_MQUEUE
+    if (msqid != MSQID_POSIX) // opened for reading only
+#endif
+    returned = msgsnd(msqid, msgp, msgsz, IPC_NOWAIT) == 0;
+    fprintf(stderr, "ipcmd msgdump: write: %s (the message of type %li being "
+                    "written was %s)\n", strerror(saved_errno),
+            *(const long *)msgp, returned ? "returned to the queue" : "lost");
+    exit(EXIT_FAILURE);
+}
+
+static void ipcmd_msgdump(int argc, char *argv[]) {
+    const char *usage =
+        "ipcmd msgdump [-q msqid] [-p]\n"
+        "  -p : copy the messages, leaving them in the queue (Linux only)";
+    struct msg {long mtype; char mtext[];};
+    struct msg *msgp;
+    unsigned char header[MSGDUMP_RECORD_HEADER_SIZE];
+    unsigned char *record = NULL; // header and message, unless -p
+    int msqid = 0;
+    int msgflg = IPC_NOWAIT; // stop when the queue is empty
+    int peek = 0; // if 1, "-p" was specified
+    uint64_t bytes = 0;
+    size_t msgsz;
+    ssize_t received;
+    int c;
+
+    while ((c = getopt(argc, argv, "pq:")) != -1)
+    {
+        switch (c)
+        {
+            case 'p':
+#ifdef MSG_COPY
+                peek = 1;
+                msgflg |= MSG_COPY;
+                break;
+#else
+                fprintf(stderr, "ipcmd msgdump: -p is not supported on this "
+                                "platform\n");
+                exit(EXIT_FAILURE);
+#endif
+            case 'q':
+                msqid = get_msqid_arg(optarg, "msgdump");
+                break;
+            default:  // unknown option
+                print_usage_and_exit(usage);
+        }
+    }
+
+    if (optind != argc) // arguments specified
+        print_usage_and_exit(usage);
+
+    msqid = get_msqid(msqid, "msgdump");
+    if (peek)
+        require_xsi_msqid(msqid, "-p", "msgdump");
+#ifdef HAVE_MQUEUE
+    msgsz = msgdump_open(msqid, O_RDONLY | O_NONBLOCK, "msgdump");
+#else
+    msgsz = msgdump_open(msqid, 0, "msgdump");
+#endif
+    if ((msgp = (struct msg *)malloc(sizeof(struct msg) + msgsz)) == NULL ||
+        (!peek && (record = malloc(sizeof(header) + msgsz)) == NULL)) {
+        perror("ipcmd msgdump: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    // With -p, stdout is fully buffered unless it's a terminal, so the
+    // messages go out in large writes. Otherwise, each message is written
+    // before the next is received, so that a write error loses none.
+    if (!peek)
+        signal(SIGPIPE, SIG_IGN); // a closed pipe is a write error, too
+    if (peek)
+        fwrite(MSGDUMP_MAGIC, 1, MSGDUMP_MAGIC_SIZE, stdout);
+    else if (write_all(STDOUT_FILENO, MSGDUMP_MAGIC, MSGDUMP_MAGIC_SIZE)
+             == -1) {
+        perror("ipcmd msgdump: write");
+        exit(EXIT_FAILURE);
+    }
+    // with MSG_COPY, msgtyp is the index of the message to copy
+    for (long index = 0; ; index++) {
+        received = receive_message(msqid, msgp, msgsz, peek ? index : 0,
+                                   msgflg, NULL);
+        if (received == -1) {
+            if (errno == ENOMSG)
+                break;
+            fprintf(stderr, "ipcmd msgdump (msgrcv()): %s\n",
+                    errno == ENOSYS ? "MSG_COPY (-p) is not supported by "
+                                      "this kernel" : strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (!peek) {
+            msgdump_put_header(record, msgp->mtype, (size_t)received);
+            memcpy(record + sizeof(header), msgp->mtext, (size_t)received);
+            if (write_all(STDOUT_FILENO, record,
+                          sizeof(header) + (size_t)received) == -1)
+                msgdump_write_failed(msqid, msgp, (size_t)received);
+        } else {
+            msgdump_put_header(header, msgp->mtype, (size_t)received);
+            fwrite(header, 1, sizeof(header), stdout);
+            fwrite(msgp->mtext, 1, (size_t)received, stdout);
+        }
+        bytes += (uint64_t)received;
+        trace_object(msqid, bytes, "messages=%li", index + 1);
+    }
+    if (fflush(stdout) == EOF || ferror(stdout)) {
+        perror("ipcmd msgdump: write");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void ipcmd_msgload(int argc, char *argv[]) {
+    const char *usage = "ipcmd msgload [-q msqid]";
+    struct msg {long mtype; char mtext[];};
+    struct msg *msgp;
+    unsigned char header[MSGDUMP_RECORD_HEADER_SIZE];
+    char magic[MSGDUMP_MAGIC_SIZE];
+    int msqid = 0;
+    size_t msgsz_max, msgsz;
+    size_t n;
+    int c;
+
+    while ((c = getopt(argc, argv, "q:")) != -1)
+    {
+        switch (c)
+        {
+            case 'q':
+                msqid = get_msqid_arg(optarg, "msgload");
+                break;
+            default:  // unknown option
+                print_usage_and_exit(usage);
+        }
+    }
+
+    if (optind != argc) // arguments specified
+        print_usage_and_exit(usage);
+
+    msqid = get_msqid(msqid, "msgload");
+    msgsz_max = msgdump_open(msqid, O_WRONLY, "msgload");
+    if ((msgp = (struct msg *)malloc(sizeof(struct msg) + msgsz_max)) ==
+        NULL) {
+        perror("ipcmd msgload: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    if (fread(magic, 1, sizeof(magic), stdin) != sizeof(magic) ||
+        memcmp(magic, MSGDUMP_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "ipcmd msgload: input is not an ipcmd msgdump\n");
+        exit(EXIT_FAILURE);
+    }
+    while ((n = fread(header, 1, sizeof(header), stdin)) == sizeof(header)) {
+        msgdump_get_header(header, &msgp->mtype, &msgsz);
+        if (msgsz > msgsz_max) {
+            fprintf(stderr, "ipcmd msgload: message length (%zu) > "
+                            "msg_qbytes\n", msgsz);
+            exit(EXIT_FAILURE);
+        }
+        if (fread(msgp->mtext, 1, msgsz, stdin) != msgsz)
+            break;
+        send_message(msqid, msgp, msgsz, 0, 0);
+    }
+    if (ferror(stdin)) {
+        perror("ipcmd msgload: read");
+        exit(EXIT_FAILURE);
+    }
+    if (!feof(stdin) || n != 0 || fgetc(stdin) != EOF) {
+        fprintf(stderr, "ipcmd msgload: truncated input\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+//**************************************
+// type-routing demultiplexer ("ipcmd route")
+//**************************************
+
+// A route passes the messages of a range of types either to a stream (a
+// pipe to a command, a FIFO, or standard output), each message followed by
+// the delimiter, or to another XSI message queue. Each route buffers what its
+// destination isn't ready for, so a slow destination holds up only its own
+// messages. Once a route's buffer is full, messages are received by type for
+// the other routes (those of few enough types) until it drains; messages
+// for the full route meanwhile stay in the queue.
+//
+// What a destination won't take without waiting is handed to a writer: a
+// child process that waits for the destination instead, so that this process
+// can block in msgrcv() (a queue and a stream can't be waited for at once).
+// Once done, the writer says so on a pipe, and interrupts msgrcv() with
+// SIGUSR1 (repeatedly, in case the signal arrives just before msgrcv() is
+// called) until it is killed; the route's later output waits until then.
+enum {ROUTE_STREAM, ROUTE_QUEUE};
+
+#define ROUTE_TYPED_MAX 64 // most types per route received by type
+#define ROUTE_WAKE_NSEC 1000000 // interval between a writer's signals
+
+struct route {
+    long lo, hi; // message types routed
+    int kind;
+    int fd;      // ROUTE_STREAM
+    int msqid;   // ROUTE_QUEUE
+    pid_t pid;   // command, if any
+    pid_t writer; // writer of earlier output, if any
+    int done;     // read end of the pipe the writer reports on
+    size_t handed; // bytes handed to the writer
+    const char *dest;
+    // buffered output: for streams, bytes; for queues, records of a size_t
+    // (the message length) followed by the message, padded to a long
+    char *buf;
+    size_t start, end, capacity;
+};
+
+struct route_msg {long mtype; char mtext[];};
+
+#define ROUTE_RECORD_SIZE(len) \
+    ((sizeof(size_t) + sizeof(long) + (len) + sizeof(long) - 1) / \
+     sizeof(long) * sizeof(long))
+
+// Parse "type[:type]=destination", and open the destination.
+static void route_open(struct route *r, char *arg, const char *usage) {
+    char *endptr, *dest;
+    int fds[2];
+
+    errno = 0;
+    r->lo = r->hi = strtol(arg, &endptr, 10);
+    if (errno == 0 && *endptr == ':' && endptr[1] != '=')
+        r->hi = strtol(endptr + 1, &endptr, 10);
+    if (errno != 0 || endptr == arg || *endptr != '=' || r->lo <= 0 ||
+        r->hi < r->lo || strlen(endptr + 1) < 3 || endptr[2] != ':')
+        print_usage_and_exit(usage);
+    r->dest = endptr + 1;
+    dest = endptr + 3;
+    r->kind = ROUTE_STREAM;
+
+    switch (endptr[1]) {
+        case 'c':
+            if (pipe(fds) == -1 || (r->pid = fork()) == -1) {
+                perror("ipcmd route: fork");
+                exit(EXIT_FAILURE);
+            }
+            if (r->pid == 0) {
+                dup2(fds[0], STDIN_FILENO);
+                close(fds[0]);
+                close(fds[1]);
+                execl("/bin/sh", "sh", "-c", dest, (char *)NULL);
+                perror("ipcmd route: execl");
+                _exit(127);
+            }
+            close(fds[0]);
+            r->fd = fds[1];
+            break;
+        case 'f': // waits for a reader, if a FIFO
+            if ((r->fd = open(dest, O_WRONLY | O_APPEND | O_CREAT, 0666)) ==
+                -1) {
+                fprintf(stderr, "ipcmd route: %s: %s\n", dest,
+                        strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'q':
+            r->kind = ROUTE_QUEUE;
+            r->msqid = get_int_arg(dest, "route");
+            return;
+        default:
+            print_usage_and_exit(usage);
+    }
+    // later commands mustn't inherit the pipe, or this command would never
+    // see end-of-file
+    fcntl(r->fd, F_SETFD, FD_CLOEXEC);
+    fcntl(r->fd, F_SETFL, fcntl(r->fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void route_append(
+    struct route *r,
+    const struct route_msg *msgp,
+    size_t len,
+    char delim
+) {
+    size_t size = r->kind == ROUTE_QUEUE ? ROUTE_RECORD_SIZE(len) : len + 1;
+
+    if (r->end + size > r->capacity) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+        while (r->end + size > r->capacity)
+            r->capacity = r->capacity ? 2 * r->capacity : 65536;
+        if ((r->buf = realloc(r->buf, r->capacity)) == NULL) {
+            perror("ipcmd route: realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (r->kind == ROUTE_QUEUE) {
+        memcpy(r->buf + r->end, &len, sizeof(size_t));
+        memcpy(r->buf + r->end + sizeof(size_t), msgp, sizeof(long) + len);
+    } else {
+        memcpy(r->buf + r->end, msgp->mtext, len);
+        r->buf[r->end + len] = delim;
+    }
+    r->end += size;
+}
+
+// Write or send as much of the route's buffer as its destination will take
+// without waiting (nothing while a writer has earlier output).
+static void route_flush(struct route *r) {
+    while (r->start < r->end && !r->writer) {
+        if (r->kind == ROUTE_STREAM) {
+            ssize_t n = write(r->fd, r->buf + r->start, r->end - r->start);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return;
+                if (errno == EINTR)
+                    continue;
+                fprintf(stderr, "ipcmd route: %s: %s\n", r->dest,
+                        strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            r->start += (size_t)n;
+        } else {
+            size_t len;
+            memcpy(&len, r->buf + r->start, sizeof(size_t));
+            if (msgsnd(r->msqid, r->buf + r->start + sizeof(size_t), len,
+                       IPC_NOWAIT) == -1) {
+                if (errno == EAGAIN)
+                    return;
+                if (errno == EINTR)
+                    continue;
+                fprintf(stderr, "ipcmd route (msgsnd()): %s: %s\n", r->dest,
+                        ipcmd_msgsnd_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            r->start += ROUTE_RECORD_SIZE(len);
+        }
+    }
+    if (r->start == r->end)
+        r->start = r->end = 0;
+}
+
+static void route_wake(int sig) {
+    (void)sig; // only interrupts msgrcv()
+}
+
+// Hand the route's buffered output to a writer (see above).
+static void route_hand_off(struct route *r) {
+    const struct timespec wake = {0, ROUTE_WAKE_NSEC};
+    pid_t parent = getpid();
+    int fds[2];
+
+    if (pipe(fds) == -1 || (r->writer = fork()) == -1) {
+        perror("ipcmd route: fork");
+        exit(EXIT_FAILURE);
+    }
+    if (r->writer != 0) {
+        close(fds[1]);
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        r->done = fds[0];
+        r->handed = r->end - r->start;
+        r->start = r->end = 0;
+        return;
+    }
+
+    close(fds[0]);
+    while (r->start < r->end) {
+        if (r->kind == ROUTE_STREAM) {
+            struct pollfd pfd = {r->fd, POLLOUT, 0};
+            ssize_t n;
+            poll(&pfd, 1, -1); // the descriptor is nonblocking
+            n = write(r->fd, r->buf + r->start, r->end - r->start);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINTR)
+                    continue;
+                fprintf(stderr, "ipcmd route: %s: %s\n", r->dest,
+                        strerror(errno));
+                _exit(EXIT_FAILURE);
+            }
+            r->start += (size_t)n;
+        } else {
+            size_t len;
+            memcpy(&len, r->buf + r->start, sizeof(size_t));
+            if (msgsnd(r->msqid, r->buf + r->start + sizeof(size_t), len,
+                       0) == -1) {
+                if (errno == EINTR)
+                    continue;
+                fprintf(stderr, "ipcmd route (msgsnd()): %s: %s\n", r->dest,
+                        ipcmd_msgsnd_strerror(errno));
+                _exit(EXIT_FAILURE);
+            }
+            r->start += ROUTE_RECORD_SIZE(len);
+        }
+    }
+    write_all(fds[1], "", 1);
+    while (kill(parent, SIGUSR1) == 0)
+        nanosleep(&wake, NULL);
+    _exit(EXIT_SUCCESS);
+}
+
+// If the route's writer is done, reap it. The program exits if it failed.
+static void route_reap(struct route *r) {
+    struct pollfd pfd = {r->done, POLLIN, 0};
+    char c;
+
+    if (!r->writer || poll(&pfd, 1, 0) != 1)
+        return;
+    if (read(r->done, &c, 1) != 1) // exited without finishing: it says why
+        exit(EXIT_FAILURE);
+    kill(r->writer, SIGKILL);
+    waitpid(r->writer, NULL, 0);
+    close(r->done);
+    r->writer = 0;
+    r->handed = 0;
+}
+
+static void ipcmd_route(int argc, char *argv[]) {
+    const char *usage =
+    "ipcmd route [-q msqid] [-n] [-b size] [-d delim] type[:type]=dest...\n"
+    "  where dest is one of:\n"
+    "    c:command : a pipe to command (run once, by sh)\n"
+    "    f:path    : a FIFO or file (opened for appending)\n"
+    "    q:msqid   : another XSI message queue\n"
+    "  -n       : exit once the queue is empty (rather than once removed)\n"
+    "  -b size  : buffer up to size bytes per route (default: 1m)\n"
+    "  -d delim : byte written after each message to a stream (default: \\n)\n"
+    "Messages of other types are written to standard output.";
+    struct route_msg *msgp;
+    struct route *routes;
+    struct pollfd *fds;
+    struct msqid_ds buf;
+    struct sigaction sa;
+    size_t nroutes;
+    size_t limit = 1024 * 1024;
+    char delim = '\n';
+    int msqid = 0;
+    int exit_when_empty = 0;
+    int removed = 0; // if 1, the queue has been removed
+    uint64_t messages = 0, bytes = 0;
+    int c;
+
+#ifdef __GNU_LIBRARY__
+    // disable GNU getopt() permutation of argv so commands aren't mangled
+    while ((c = getopt(argc, argv, "+b:d:nq:")) != -1)
+#else
+    while ((c = getopt(argc, argv, "b:d:nq:")) != -1)
+#endif
+    {
+        switch (c)
+        {
+            case 'b':
+                limit = (size_t)get_size_arg(optarg, "route");
+                break;
+            case 'd':
+                if (strcmp(optarg, "\\n") == 0)
+                    delim = '\n';
+                else if (strcmp(optarg, "\\t") == 0)
+                    delim = '\t';
+                else if (strcmp(optarg, "\\0") == 0)
+                    delim = '\0';
+                else if (strlen(optarg) == 1)
+                    delim = optarg[0];
+                else
+                    print_usage_and_exit(usage);
+                break;
+            case 'n':
+                exit_when_empty = 1;
+                break;
+            case 'q':
+                msqid = get_msqid_arg(optarg, "route");
+                break;
+            default:  // unknown option
+                print_usage_and_exit(usage);
+        }
+    }
+
+    msqid = get_msqid(msqid, "route");
+    require_xsi_msqid(msqid, "route", "route"); // routes by message type
+    if (msgctl(msqid, IPC_STAT, &buf) == -1) {
+        fprintf(stderr, "ipcmd route (msgctl()): %s\n",
+                ipcmd_msgctl_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // the last route, standard output, takes the messages of any other type
+    nroutes = (size_t)(argc - optind) + 1;
+    if ((routes = calloc(nroutes, sizeof(struct route))) == NULL ||
+        (fds = malloc(nroutes * sizeof(struct pollfd))) == NULL ||
+        (msgp = malloc(sizeof(struct route_msg) + buf.msg_qbytes)) == NULL) {
+        perror("ipcmd route: malloc");
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN); // report commands that exit early as errors
+    sa.sa_handler = route_wake;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0; // interrupt msgrcv()
+    sigaction(SIGUSR1, &sa, NULL);
+    for (size_t i = 0; i + 1 < nroutes; i++)
+        route_open(&routes[i], argv[optind + (int)i], usage);
+    routes[nroutes-1].lo = 1;
+    routes[nroutes-1].hi = LONG_MAX;
+    routes[nroutes-1].fd = STDOUT_FILENO; // left blocking: it may be shared
+    routes[nroutes-1].dest = "standard output";
+
+    for (;;) {
+        int pending = 0; // number of routes with buffered output
+        int full = 0;    // number of routes whose buffer is full
+        ssize_t received = -1;
+        size_t i;
+
+        for (i = 0; i < nroutes; i++) {
+            struct route *r = &routes[i];
+            route_reap(r);
+            route_flush(r);
+            if (r->start < r->end && !r->writer)
+                route_hand_off(r);
+            pending += r->start < r->end || r->writer;
+            full += r->end - r->start + r->handed >= limit;
+        }
+
+        errno = ENOMSG;
+        if (!removed && !full)
+            received = msgrcv(msqid, msgp, buf.msg_qbytes, 0,
+                              exit_when_empty ? IPC_NOWAIT : 0);
+        else if (!removed)
+            for (i = 0; i < nroutes && received == -1; i++) {
+                struct route *r = &routes[i];
+                if (r->end - r->start >= limit ||
+                    r->hi - r->lo >= ROUTE_TYPED_MAX)
+                    continue;
+                for (long type = r->lo; type <= r->hi && received == -1;
+                     type++)
+                    received = msgrcv(msqid, msgp, buf.msg_qbytes, type,
+                                      IPC_NOWAIT);
+            }
+
+        if (received >= 0) {
+            for (i = 0; msgp->mtype < routes[i].lo ||
+                        msgp->mtype > routes[i].hi; i++)
+                ;
+            route_append(&routes[i], msgp, (size_t)received, delim);
+            messages++;
+            bytes += (uint64_t)received;
+            trace_object(msqid, bytes, "messages=%" PRIu64, messages);
+            continue;
+        }
+        if (errno == EIDRM || errno == EINVAL) // removed (it existed above)
+            removed = 1;
+        else if (errno != ENOMSG && errno != EINTR) {
+            fprintf(stderr, "ipcmd route (msgrcv()): %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (!pending && (removed || exit_when_empty))
+            break;
+
+        if (errno == EINTR && !removed && !full && !exit_when_empty)
+            continue; // a writer is done
+
+        // wait for a writer to be done
+        nfds_t nfds = 0;
+        for (i = 0; i < nroutes; i++)
+            if (routes[i].writer) {
+                fds[nfds].fd = routes[i].done;
+                fds[nfds].events = POLLIN;
+                nfds++;
+            }
+        poll(fds, nfds, -1);
+    }
+
+    for (size_t i = 0; i + 1 < nroutes; i++)
+        if (routes[i].kind == ROUTE_STREAM)
+            close(routes[i].fd);
+    for (size_t i = 0; i + 1 < nroutes; i++)
+        if (routes[i].pid > 0)
+            waitpid(routes[i].pid, NULL, 0);
+}
+
+//**************************************
+// queue bridge over a socket ("ipcmd bridge")
+//**************************************
+
+// The sending bridge receives messages from its queue and writes them to the
+// socket in the msgdump format (see "ipcmd msgdump"), in batches. The
+// receiving bridge sends them to its queue, and after each batch it has
+// read, writes back the number of messages it has sent (4 bytes, big
+// endian). The sender stops receiving from its queue while window messages
+// are unacknowledged, so a full remote queue backs up into the local one.
+#define BRIDGE_WINDOW 256 // default unacknowledged messages
+#define BRIDGE_BATCH 64   // most messages per write
+#define BRIDGE_BUFFER_SIZE 65536
+#define BRIDGE_LISTENER 2 // "listening": don't wait for a connection
+
+// Connect a stream socket to sa, or if listening, wait for a connection
+// to sa (or if listening is BRIDGE_LISTENER, just listen for them).
+//
+// RETURN VALUE
+//     The connected (or listening) socket, or -1 (with errno set) on error.
+static int bridge_socket(
+    int family,
+    const struct sockaddr *sa,
+    socklen_t salen,
+    int listening
+) {
+    int fd, listener, saved_errno, one = 1;
+
+    if ((fd = socket(family, SOCK_STREAM, 0)) == -1)
+        return -1;
+    if (!listening && connect(fd, sa, salen) == 0)
+        return fd;
+    if (listening) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, sa, salen) == 0 &&
+            listen(fd, listening == BRIDGE_LISTENER ? SOMAXCONN : 1) == 0) {
+            if (listening == BRIDGE_LISTENER)
+                return fd;
+            listener = fd;
+            while ((fd = accept(listener, NULL, NULL)) == -1 && errno == EINTR)
+                ;
+            saved_errno = errno;
+            close(listener);
+            errno = saved_errno;
+            return fd;
+        }
+    }
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+}
+
+// Open a stream socket for address ("unix:PATH" or "tcp:[HOST]:PORT", HOST
+// defaulting to the loopback address):
+// if listening, wait for a connection (then remove PATH, which is no longer
+// needed), or if listening is BRIDGE_LISTENER, listen for connections;
+// otherwise connect, retrying for up to timeout (if not NULL).
+//
+// RETURN VALUE
+//     The connected (or listening) socket.
+static int bridge_connect(
+    const char *address,
+    int listening,
+    const struct timespec *timeout
+) {
+    uint64_t deadline = timeout ? now_usec() +
+                        (uint64_t)timeout->tv_sec * 1000000 +
+                        (uint64_t)timeout->tv_nsec / 1000 : 0;
+    const struct timespec retry = {0, 50000000};
+    struct addrinfo hints, *ai, *res = NULL;
+    struct sockaddr_un sun;
+    int fd = -1, one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    memset(&sun, 0, sizeof(sun));
+    if (strncmp(address, "unix:", strlen("unix:")) == 0) {
+        const char *path = address + strlen("unix:");
+        if (strlen(path) >= sizeof(sun.sun_path)) {
+            fprintf(stderr, "ipcmd bridge: socket path too long: %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, path);
+#ifdef IPCMD_NO_TCP
+    } else if (strncmp(address, "tcp:", strlen("tcp:")) == 0) {
+        fprintf(stderr, "ipcmd bridge: %s: tcp: addresses are not supported "
+                        "by this build (IPCMD_NO_TCP)\n", address);
+        exit(EXIT_FAILURE);
+#else
+    } else if (strncmp(address, "tcp:", strlen("tcp:")) == 0 &&
+               strrchr(address, ':') > address + strlen("tcp:") - 1) {
+        char host[256];
+        int error;
+        const char *port = strrchr(address, ':') + 1;
+        size_t len = (size_t)(port - 1 - (address + strlen("tcp:")));
+        if (len >= sizeof(host)) {
+            fprintf(stderr, "ipcmd bridge: host name too long: %s\n", address);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(host, address + strlen("tcp:"), len);
+        host[len] = '\0';
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        // without AI_PASSIVE, no HOST is the loopback address, even when
+        // listening: a bridge listens on other interfaces only if told to
+        if ((error = getaddrinfo(len ? host : NULL, port, &hints, &res)) !=
+            0) {
+            fprintf(stderr, "ipcmd bridge (getaddrinfo()): %s: %s\n", address,
+                    gai_strerror(error));
+            exit(EXIT_FAILURE);
+        }
+#endif
+    } else {
+        fprintf(stderr, "ipcmd bridge: invalid address (%s); expected "
+                        "unix:PATH or tcp:[HOST]:PORT\n", address);
+        exit(EXIT_FAILURE);
+    }
+
+    for (;;) {
+        if (res == NULL)
+            fd = bridge_socket(AF_UNIX, (struct sockaddr *)&sun, sizeof(sun),
+                               listening);
+        for (ai = res; ai != NULL && fd == -1; ai = ai->ai_next)
+            fd = bridge_socket(ai->ai_family, ai->ai_addr, ai->ai_addrlen,
+                               listening);
+        if (fd != -1 || listening || !timeout || now_usec() >= deadline)
+            break;
+        nanosleep(&retry, NULL); // the receiving bridge may not be up yet
+    }
+    if (fd == -1) {
+        fprintf(stderr, "ipcmd bridge: %s: %s\n", address, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (res == NULL && listening && listening != BRIDGE_LISTENER)
+        unlink(sun.sun_path);
+    if (res != NULL) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        freeaddrinfo(res);
+    }
+    return fd;
+}
+
+// Add the acknowledgements that have arrived (waiting for some if wait is
+// nonzero) to *acked.
+static void bridge_read_acks(int fd, uint64_t *acked, int wait) {
+    static unsigned char buf[4 * BRIDGE_WINDOW];
+    static size_t len; // bytes of an incomplete acknowledgement
+    struct pollfd pfd = {fd, POLLIN, 0};
+    ssize_t n;
+    size_t i;
+
+    if (!wait && poll(&pfd, 1, 0) != 1)
+        return;
+    while ((n = read(fd, buf + len, sizeof(buf) - len)) == -1 &&
+           errno == EINTR)
+        ;
+    if (n <= 0) {
+        fprintf(stderr, "ipcmd bridge: %s\n", n == 0 ?
+                "connection closed by the receiving bridge" : strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    len += (size_t)n;
+    for (i = 0; i + 4 <= len; i += 4)
+        *acked += (uint32_t)buf[i] << 24 | (uint32_t)buf[i+1] << 16 |
+                  (uint32_t)buf[i+2] << 8 | buf[i+3];
+    memmove(buf, buf + i, len - i);
+    len -= i;
+}
+
+// Forward messages from msqid to the receiving bridge on fd, until msqid is
+// removed (or is empty, if exit_when_empty is nonzero) and every message
+// has been acknowledged.
+static void bridge_send(
+    int fd,
+    int msqid,
+    long msgtyp,
+    uint64_t window,
+    size_t batch,
+    int exit_when_empty
+) {
+    struct msg {long mtype; char mtext[];};
+    struct msg *msgp;
+    struct msqid_ds buf;
+    char *out;
+    size_t len;
+    uint64_t sent = 0, acked = 0;
+    int done = 0;
+
+    if (msgctl(msqid, IPC_STAT, &buf) == -1) {
+        fprintf(stderr, "ipcmd bridge (msgctl()): %s\n",
+                ipcmd_msgctl_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if ((msgp = malloc(sizeof(struct msg) + buf.msg_qbytes)) == NULL ||
+        (out = malloc(batch * (MSGDUMP_RECORD_HEADER_SIZE +
+                               buf.msg_qbytes))) == NULL) {
+        perror("ipcmd bridge: malloc");
+        exit(EXIT_FAILURE);
+    }
+    if (write_all(fd, MSGDUMP_MAGIC, MSGDUMP_MAGIC_SIZE) == -1) {
+        perror("ipcmd bridge: write");
+        exit(EXIT_FAILURE);
+    }
+
+    while (!done) {
+        size_t n = 0;
+        bridge_read_acks(fd, &acked, sent - acked >= window);
+        len = 0;
+        while (n < batch && sent + n - acked < window) {
+            // wait only for the first message of a batch
+            ssize_t received = msgrcv(msqid, msgp, buf.msg_qbytes, msgtyp,
+                                      n > 0 || exit_when_empty ?
+                                      IPC_NOWAIT : 0);
+            if (received == -1) {
+                if (errno == EINTR && n == 0)
+                    continue;
+                done = errno == EIDRM || errno == EINVAL || // removed
+                       (errno == ENOMSG && n == 0 && exit_when_empty);
+                if (!done && errno != ENOMSG) {
+                    fprintf(stderr, "ipcmd bridge (msgrcv()): %s\n",
+                            strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            msgdump_put_header((unsigned char *)out + len, msgp->mtype,
+                               (size_t)received);
+            memcpy(out + len + MSGDUMP_RECORD_HEADER_SIZE, msgp->mtext,
+                   (size_t)received);
+            len += MSGDUMP_RECORD_HEADER_SIZE + (size_t)received;
+            n++;
+        }
+        if (n > 0 && write_all(fd, out, len) == -1) {
+            perror("ipcmd bridge: write");
+            exit(EXIT_FAILURE);
+        }
+        sent += n;
+        trace_object(msqid, sent, "sent=%" PRIu64, sent);
+    }
+
+    shutdown(fd, SHUT_WR); // no more messages
+    while (acked < sent)
+        bridge_read_acks(fd, &acked, 1);
+}
+
+// Send the messages from the sending bridge on fd to msqid, until it closes
+// the connection.
+static void bridge_receive(int fd, int msqid) {
+    struct msg {long mtype; char mtext[];};
+    struct msg *msgp;
+    struct msqid_ds buf;
+    char magic[MSGDUMP_MAGIC_SIZE];
+    unsigned char *in;
+    size_t capacity, len = 0, msgsz;
+    uint64_t received = 0;
+    ssize_t n;
+
+    if (msgctl(msqid, IPC_STAT, &buf) == -1) {
+        fprintf(stderr, "ipcmd bridge (msgctl()): %s\n",
+                ipcmd_msgctl_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    capacity = BRIDGE_BUFFER_SIZE + MSGDUMP_RECORD_HEADER_SIZE +
+               buf.msg_qbytes;
+    if ((msgp = malloc(sizeof(struct msg) + buf.msg_qbytes)) == NULL ||
+        (in = malloc(capacity)) == NULL) {
+        perror("ipcmd bridge: malloc");
+        exit(EXIT_FAILURE);
+    }
+    if (read_all(fd, magic, sizeof(magic)) != (ssize_t)sizeof(magic) ||
+        memcmp(magic, MSGDUMP_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "ipcmd bridge: the peer is not a sending bridge\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // send the messages in each read(), then acknowledge them all at once
+    while ((n = read(fd, in + len, capacity - len)) != 0) {
+        unsigned char ack[4];
+        uint32_t count = 0;
+        size_t i = 0;
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("ipcmd bridge: read");
+            exit(EXIT_FAILURE);
+        }
+        len += (size_t)n;
+        while (len - i >= MSGDUMP_RECORD_HEADER_SIZE) {
+            msgdump_get_header(in + i, &msgp->mtype, &msgsz);
+            if (msgsz > buf.msg_qbytes) {
+                fprintf(stderr, "ipcmd bridge: message length (%zu) > "
+                                "msg_qbytes\n", msgsz);
+                exit(EXIT_FAILURE);
+            }
+            if (len - i - MSGDUMP_RECORD_HEADER_SIZE < msgsz)
+                break;
+            memcpy(msgp->mtext, in + i + MSGDUMP_RECORD_HEADER_SIZE, msgsz);
+            send_message(msqid, msgp, msgsz, 0, 0); // waits for room
+            i += MSGDUMP_RECORD_HEADER_SIZE + msgsz;
+            count++;
+        }
+        memmove(in, in + i, len - i);
+        len -= i;
+        if (count == 0)
+            continue;
+        received += count;
+        for (int b = 0; b < 4; b++)
+            ack[b] = (unsigned char)(count >> (24 - 8*b));
+        if (write_all(fd, ack, sizeof(ack)) == -1) {
+            perror("ipcmd bridge: write");
+            exit(EXIT_FAILURE);
+        }
+        trace_object(msqid, received, "received=%" PRIu64, received);
+    }
+    if (len != 0) {
+        fprintf(stderr, "ipcmd bridge: connection closed within a message\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Semaphore sets can also be used across a bridge: "ipcmd bridge -S -l
+// address" serves a local set, and a semid given as the address
+// ("unix:PATH" or "tcp:[HOST]:PORT") identifies it to other commands, which
+// send their semop() and semctl() calls to it over a connection of their
+// own, one request and reply at a time. The connection lasts as long as
+// the process (and any command it execs, if SEM_UNDO was used), and the
+// bridge performs the calls in a process of its own for each connection,
+// so SEM_UNDO adjustments are applied when the connection closes.
+//
+// A request or reply is its length (4 bytes), then its fields, each a big
+// endian integer:
+//     semop() request:  'o' (1 byte), timeout in ms (4; all ones for none),
+//                       nsops (4), and for each operation: sem_num (2),
+//                       sem_op (2), and BRIDGE_NOWAIT|BRIDGE_UNDO (2)
+//     semctl() request: 'c' (1 byte), BRIDGE_* command (4), semnum (4),
+//                       value (4), count (4), and count values (2 each)
+//     reply:            error (4; an index into bridge_errnos), result (4),
+//                       count (4), and count values (2 each)
+// The internal semid of such a set is tagged SEMSET_BRIDGE (see semsets).
+#define IS_BRIDGESEM(semid) (SEMSET_BACKEND(semid) == SEMSET_BRIDGE)
+#define BRIDGE_NOWAIT 1
+#define BRIDGE_UNDO 2
+#define BRIDGE_NO_TIMEOUT UINT32_MAX
+static const char *bridge_sem_address; // of the set tagged SEMSET_BRIDGE
+
+// portable codes for the semctl() commands a bridge performs
+enum {
+    BRIDGE_IPC_STAT = 1, BRIDGE_GETVAL, BRIDGE_SETVAL, BRIDGE_GETPID,
+    BRIDGE_GETNCNT, BRIDGE_GETZCNT, BRIDGE_GETALL, BRIDGE_SETALL
+};
+
+// errno values, by their portable codes (others are sent as EIO)
+static const int bridge_errnos[] = {
+    0, EIO, EAGAIN, EIDRM, EINVAL, ERANGE, EFBIG, EACCES, E2BIG, ENOSPC,
+    EPERM, ENOTSUP, ENOMEM
+};
+
+static void bridge_put16(unsigned char *p, uint16_t val) {
+    p[0] = (unsigned char)(val >> 8);
+    p[1] = (unsigned char)val;
+}
+
+static void bridge_put32(unsigned char *p, uint32_t val) {
+    for (int i = 0; i < 4; i++)
+        p[i] = (unsigned char)(val >> (24 - 8*i));
+}
+
+static uint16_t bridge_get16(const unsigned char *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t bridge_get32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+           (uint32_t)p[2] << 8 | p[3];
+}
+
+#define BRIDGE_FRAME_MAX (1 << 20) // longest request or reply
+
+// Read a request or reply from fd into *buf (of *capacity bytes, which is
+// grown as needed).
+//
+// RETURN VALUE
+//     Its length, or -1 if the connection was closed (or failed).
+static ssize_t bridge_read_frame(
+    int fd,
+    unsigned char **buf,
+    size_t *capacity
+) {
+    unsigned char header[4];
+    size_t len;
+
+    if (read_all(fd, header, sizeof(header)) != (ssize_t)sizeof(header))
+        return -1;
+    if ((len = bridge_get32(header)) > BRIDGE_FRAME_MAX)
+        return -1;
+    if (len > *capacity) {
+        free(*buf);
+        if ((*buf = malloc(len)) == NULL) {
+            perror("ipcmd bridge: malloc");
+            exit(EXIT_FAILURE);
+        }
+        *capacity = len;
+    }
+    if (len > 0 && read_all(fd, *buf, len) != (ssize_t)len)
+        return -1;
+    return (ssize_t)len;
+}
+
+// Send a request (len bytes at req + 4, the first 4 bytes being left for
+// its length) to the bridge at bridge_sem_address, connecting to it first
+// if need be, and read the reply.
+//
+// RETURN VALUE
+//     The result, or -1 with errno set; the count values of the reply are
+//     copied to values (if not NULL), which must have room for them.
+static int bridge_sem_call(
+    unsigned char *req,
+    size_t len,
+    int undo, // nonzero if the request uses SEM_UNDO
+    unsigned short *values
+) {
+    static int fd = -1;
+    static unsigned char *reply;
+    static size_t capacity;
+    ssize_t reply_len;
+    uint32_t error, count;
+
+    if (fd == -1) {
+        fd = bridge_connect(bridge_sem_address, 0, NULL);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    if (undo) // keep the connection, and so the adjustments, through exec
+        fcntl(fd, F_SETFD, 0);
+    bridge_put32(req, (uint32_t)len);
+    if (write_all(fd, req, 4 + len) == -1 ||
+        (reply_len = bridge_read_frame(fd, &reply, &capacity)) < 12 ||
+        (size_t)reply_len != 12 + 2 * (size_t)bridge_get32(reply + 8)) {
+        fprintf(stderr, "ipcmd bridge: %s: connection to the bridge "
+                        "failed\n", bridge_sem_address);
+        exit(EXIT_FAILURE);
+    }
+    error = bridge_get32(reply);
+    count = bridge_get32(reply + 8);
+    if (error != 0) {
+        errno = error < sizeof(bridge_errnos) / sizeof(bridge_errnos[0]) ?
+                bridge_errnos[error] : EIO;
+        return -1;
+    }
+    for (uint32_t i = 0; values && i < count; i++)
+        values[i] = bridge_get16(reply + 12 + 2*i);
+    return (int32_t)bridge_get32(reply + 4);
+}
+
+// semop_timed() on the set served by the bridge at bridge_sem_address
+static int bridge_semop(
+    struct sembuf *sops,
+    size_t nsops,
+    const struct timespec *timeout
+) {
+    unsigned char *req;
+    uint32_t timeout_msec = BRIDGE_NO_TIMEOUT;
+    int undo = 0;
+    int result;
+
+    if ((req = malloc(4 + 9 + 6 * nsops)) == NULL) {
+        perror("ipcmd bridge: malloc");
+        exit(EXIT_FAILURE);
+    }
+    if (timeout) {
+        uint64_t msec = (uint64_t)timeout->tv_sec * 1000 +
+                        ((uint64_t)timeout->tv_nsec + 999999) / 1000000;
+        timeout_msec = msec < BRIDGE_NO_TIMEOUT ? (uint32_t)msec :
+                                                  BRIDGE_NO_TIMEOUT - 1;
+    }
+    req[4] = 'o';
+    bridge_put32(req + 5, timeout_msec);
+    bridge_put32(req + 9, (uint32_t)nsops);
+    for (size_t i = 0; i < nsops; i++) {
+        unsigned char *op = req + 13 + 6*i;
+        bridge_put16(op, sops[i].sem_num);
+        bridge_put16(op + 2, (uint16_t)sops[i].sem_op);
+        bridge_put16(op + 4,
+                     (sops[i].sem_flg & IPC_NOWAIT ? BRIDGE_NOWAIT : 0) |
+                     (sops[i].sem_flg & SEM_UNDO ? BRIDGE_UNDO : 0));
+        undo |= sops[i].sem_flg & SEM_UNDO;
+    }
+    result = bridge_sem_call(req, 9 + 6 * nsops, undo, NULL);
+    free(req);
+    return result;
+}
+
+// semctl_any() on the set served by the bridge at bridge_sem_address, for
+// the commands in the BRIDGE_* enum. IPC_STAT fills in only sem_nsems.
+static int bridge_semctl(int semnum, int cmd, union semun arg) {
+    unsigned char *req;
+    uint32_t count = 0;
+    uint32_t code;
+    int result;
+
+    switch (cmd) {
+        case IPC_STAT: code = BRIDGE_IPC_STAT; break;
+        case GETVAL: code = BRIDGE_GETVAL; break;
+        case SETVAL: code = BRIDGE_SETVAL; break;
+        case GETPID: code = BRIDGE_GETPID; break;
+        case GETNCNT: code = BRIDGE_GETNCNT; break;
+        case GETZCNT: code = BRIDGE_GETZCNT; break;
+        case GETALL: code = BRIDGE_GETALL; break;
+        case SETALL: code = BRIDGE_SETALL; break;
+        default:
+            errno = ENOTSUP;
+            return -1;
+    }
+    if (cmd == SETALL) { // the number of values is that of the set
+        union semun stat;
+        struct semid_ds seminfo;
+        stat.buf = &seminfo;
+        if (bridge_semctl(0, IPC_STAT, stat) == -1)
+            return -1;
+        count = (uint32_t)seminfo.sem_nsems;
+    }
+    if ((req = malloc(4 + 17 + 2 * (size_t)count)) == NULL) {
+        perror("ipcmd bridge: malloc");
+        exit(EXIT_FAILURE);
+    }
+    req[4] = 'c';
+    bridge_put32(req + 5, code);
+    bridge_put32(req + 9, (uint32_t)semnum);
+    bridge_put32(req + 13, cmd == SETVAL ? (uint32_t)arg.val : 0);
+    bridge_put32(req + 17, count);
+    for (uint32_t i = 0; i < count; i++)
+        bridge_put16(req + 21 + 2*i, arg.array[i]);
+    result = bridge_sem_call(req, 17 + 2 * (size_t)count, 0,
+                             cmd == GETALL ? arg.array : NULL);
+    free(req);
+    if (cmd == IPC_STAT && result != -1) {
+        memset(arg.buf, 0, sizeof(*arg.buf));
+        arg.buf->sem_nsems = result;
+        result = 0;
+    }
+    return result;
+}
+
+//**************************************
+// request/response ("ipcmd call" and "ipcmd serve")
+//**************************************
+
+// A request is the type to reply with, a nonce, and a deadline (a
+// now_usec() time, or 0 if none), each an 8-byte big-endian
+// integer, followed by the payload; the reply is the request's nonce, the
+// handler's exit status (1 byte), then its output. The reply type is
+// CALL_REPLY_BASE plus the caller's process ID; the nonce lets a caller
+// discard a reply meant for an earlier process with the same ID that gave up
+// waiting for it. A request whose caller has given up is dropped, and so is
+// its reply, so that neither is left in the queue.
+#define CALL_REQUEST_HEADER_SIZE 24
+#define CALL_REPLY_HEADER_SIZE 9
+#define CALL_REPLY_BASE (1L << 30) // request types must be less
+#define CALL_FAILED 255 // reply status if the handler couldn't be run
+
+static void call_put64(unsigned char *p, uint64_t value) {
+    for (int i = 0; i < 8; i++)
+        p[i] = (unsigned char)(value >> (56 - 8*i));
+}
+
+static uint64_t call_get64(const unsigned char *p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value = value << 8 | p[i];
+    return value;
+}
+
+// RETURN VALUE
+//     The largest message an XSI message queue will take: msg_qbytes, or
+//     MSGMAX if smaller.
+static size_t call_msgsz_max(int msqid, const char *ipcmd_command) {
+    struct msqid_ds buf;
+    if (msgctl(msqid, IPC_STAT, &buf) == -1) {
+        fprintf(stderr, "ipcmd %s (msgctl()): %s\n", ipcmd_command,
+                ipcmd_msgctl_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return msgsz_limit((size_t)buf.msg_qbytes);
+}
+
+static void ipcmd_call(int argc, char *argv[]) {
+    const char *usage =
+        "ipcmd call [-q msqid] [-t mtype] [-w timeout] [payload]\n"
+        "  -t mtype   : request type, served by ipcmd serve -t (default: 1)\n"
+        "  -w timeout : exit with status 2 if there is no reply within timeout "
+        "seconds";
+    struct msg {long mtype; unsigned char mtext[];};
+    struct msg *msgp;
+    long mtype = 1;
+    int msqid = 0;
+    struct timespec timeout;
+    struct timespec *timeoutp = NULL; // non-NULL if "-w timeout" specified
+    uint64_t deadline = 0;
+    size_t msgsz_max, len;
+    ssize_t received;
+    uint64_t nonce = now_usec();
+    uint64_t wait_begin;
+    int c;
+
+    while ((c = getopt(argc, argv, "q:t:w:")) != -1)
+    {
+        switch (c)
+        {
+            case 'q':
+                msqid = get_msqid_arg(optarg, "call");
+                break;
+            case 't':
+                mtype = get_long_arg(optarg, "call");
+                if (mtype <= 0 || mtype >= CALL_REPLY_BASE) {
+                    fprintf(stderr, "ipcmd call: mtype must be between 1 and "
+                                    "%li\n", CALL_REPLY_BASE - 1);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                timeout = get_timeout_arg(optarg, "call");
+                timeoutp = &timeout;
+                deadline = now_usec() + (uint64_t)timeout.tv_sec * 1000000 +
+                           (uint64_t)timeout.tv_nsec / 1000;
+                break;
+            default: // unknown option
+                print_usage_and_exit(usage);
+        }
+    }
+    if (optind+1 < argc)
+        print_usage_and_exit(usage);
+
+    msqid = get_msqid(msqid, "call");
+    require_xsi_msqid(msqid, "call", "call");
+    msgsz_max = call_msgsz_max(msqid, "call");
+    if ((msgp = malloc(sizeof(struct msg) + msgsz_max+1)) == NULL) {
+        perror("ipcmd call: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    msgp->mtype = mtype;
+    call_put64(msgp->mtext, (uint64_t)(CALL_REPLY_BASE + getpid()));
+    call_put64(msgp->mtext + 8, nonce);
+    call_put64(msgp->mtext + 16, deadline);
+    if (msgsz_max < CALL_REQUEST_HEADER_SIZE)
+        len = 1; // too long, below
+    else if (optind < argc) {
+        len = strlen(argv[optind]);
+        if (len <= msgsz_max - CALL_REQUEST_HEADER_SIZE)
+            memcpy(msgp->mtext + CALL_REQUEST_HEADER_SIZE, argv[optind], len);
+    } else {
+        ssize_t bytes_read = read_all(STDIN_FILENO,
+                                      msgp->mtext + CALL_REQUEST_HEADER_SIZE,
+                                      msgsz_max - CALL_REQUEST_HEADER_SIZE+1);
+        if (bytes_read == -1) {
+            perror("ipcmd call: read");
+            exit(EXIT_FAILURE);
+        }
+        len = (size_t)bytes_read;
+    }
+    if (msgsz_max < CALL_REQUEST_HEADER_SIZE ||
+        len > msgsz_max - CALL_REQUEST_HEADER_SIZE) {
+        fprintf(stderr, "ipcmd call: request length > msg_qbytes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    trace_object(msqid, 0, "mtype=%li", mtype);
+    wait_begin = trace_clock();
+    while (msgsnd(msqid, msgp, CALL_REQUEST_HEADER_SIZE + len, 0) == -1)
+        if (errno != EINTR) {
+            fprintf(stderr, "ipcmd call (msgsnd()): %s\n",
+                    ipcmd_msgsnd_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+    // wait for the reply with this process's type and nonce
+    do {
+        struct timespec remaining;
+        if (timeoutp) {
+            uint64_t now = now_usec();
+            uint64_t usec = deadline > now ? deadline - now : 0;
+            remaining.tv_sec = (time_t)(usec / 1000000);
+            remaining.tv_nsec = (long)(usec % 1000000) * 1000;
+        }
+        received = receive_message(msqid, msgp, msgsz_max,
+                                   CALL_REPLY_BASE + getpid(), 0,
+                                   timeoutp ? &remaining : NULL);
+        if (received == -1) {
+            if (errno == ENOMSG) { // timed out
+                trace_wait(wait_begin);
+                exit(2);
+            }
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "ipcmd call (msgrcv()): %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    } while (received < CALL_REPLY_HEADER_SIZE ||
+             call_get64(msgp->mtext) != nonce);
+    trace_wait(wait_begin);
+
+    if (write_all(STDOUT_FILENO, msgp->mtext + CALL_REPLY_HEADER_SIZE,
+                  (size_t)received - CALL_REPLY_HEADER_SIZE) == -1) {
+        perror("ipcmd call: write");
+        exit(EXIT_FAILURE);
+    }
+    if (msgp->mtext[8] != 0) {
+        fprintf(stderr, "ipcmd call: handler failed (exit status %i)\n",
+                msgp->mtext[8]);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// a handler process and the pipes to and from it
+struct serve_handler {
+    pid_t pid; // 0 if not running
+    int to;
+    int from;
+};
+
+static void serve_start(struct serve_handler *h, char *handler[]) {
+    int to[2], from[2];
+    if (pipe(to) == -1 || pipe(from) == -1) {
+        perror("ipcmd serve: pipe");
+        exit(EXIT_FAILURE);
+    }
+    if ((h->pid = fork()) == -1) {
+        perror("ipcmd serve: fork");
+        exit(EXIT_FAILURE);
+    }
+    if (h->pid == 0) {
+        dup2(to[0], STDIN_FILENO);
+        dup2(from[1], STDOUT_FILENO);
+        close(to[0]); close(to[1]);
+        close(from[0]); close(from[1]);
+        execvp(handler[0], handler);
+        fprintf(stderr, "ipcmd serve: %s: %s\n", handler[0], strerror(errno));
+        _exit(CALL_FAILED);
+    }
+    close(to[0]);
+    close(from[1]);
+    h->to = to[1];
+    h->from = from[0];
+}
+
+// RETURN VALUE
+//     The exit status of a handler that has exited, as a reply status.
+static int serve_reap(struct serve_handler *h) {
+    int status;
+    if (h->to != -1)
+        close(h->to);
+    close(h->from);
+    while (waitpid(h->pid, &status, 0) == -1)
+        if (errno != EINTR) {
+            perror("ipcmd serve: waitpid");
+            exit(EXIT_FAILURE);
+        }
+    h->pid = 0;
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    return 128 + WTERMSIG(status) > CALL_FAILED ? CALL_FAILED :
+           128 + WTERMSIG(status);
+}
+
+// Run the handler with the request payload (len bytes at in) as its
+// standard input, and collect its standard output (up to max bytes) at out,
+// writing one while reading the other so that neither pipe fills up.
+//
+// RETURN VALUE
+//     The reply status: the handler's exit status, or CALL_FAILED if its
+//     output was too long.
+static int serve_exec(
+    char *handler[],
+    const unsigned char *in,
+    size_t len,
+    unsigned char *out,
+    size_t max,
+    size_t *out_len
+) {
+    struct serve_handler h;
+    size_t written = 0;
+    int overflow = 0;
+    int status;
+
+    serve_start(&h, handler);
+    fcntl(h.to, F_SETFL, O_NONBLOCK);
+    *out_len = 0;
+    if (len == 0) {
+        close(h.to);
+        h.to = -1;
+    }
+    for (;;) {
+        struct pollfd fds[2];
+        fds[0].fd = h.from;
+        fds[0].events = POLLIN;
+        fds[1].fd = h.to; // ignored once closed (-1)
+        fds[1].events = POLLOUT;
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("ipcmd serve: poll");
+            exit(EXIT_FAILURE);
+        }
+        if (fds[1].revents) {
+            ssize_t n = write(h.to, in + written, len - written);
+            if (n > 0)
+                written += (size_t)n;
+            if ((n == -1 && errno != EAGAIN && errno != EINTR) ||
+                written == len) { // done, or the handler closed its stdin
+                close(h.to);
+                h.to = -1;
+            }
+        }
+        if (fds[0].revents) {
+            unsigned char discard[BUFSIZ];
+            ssize_t n = *out_len < max ?
+                        read(h.from, out + *out_len, max - *out_len) :
+                        read(h.from, discard, sizeof(discard));
+            if (n == 0)
+                break;
+            if (n > 0 && *out_len < max)
+                *out_len += (size_t)n;
+            else if (n > 0)
+                overflow = 1;
+            else if (errno != EINTR) {
+                perror("ipcmd serve: read");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    status = serve_reap(&h);
+    if (overflow) {
+        fprintf(stderr, "ipcmd serve: %s: output length > msg_qbytes\n",
+                handler[0]);
+        return CALL_FAILED;
+    }
+    return status;
+}
+
+// Pass the request payload to a resident handler as a line of input, and
+// read a line of output from it, starting the handler if it isn't running.
+//
+// RETURN VALUE
+//     The reply status: 0, or if the handler exited (or its output was too
+//     long), its exit status or CALL_FAILED.
+static int serve_line(
+    struct serve_handler *h,
+    char *handler[],
+    const unsigned char *in,
+    size_t len,
+    unsigned char *out,
+    size_t max,
+    size_t *out_len
+) {
+    static unsigned char buffer[BUFSIZ]; // output read beyond the line
+    static size_t buffered;
+
+    *out_len = 0;
+    if (h->pid == 0) {
+        serve_start(h, handler);
+        buffered = 0;
+    }
+    if (write_all(h->to, in, len) == -1 ||
+        ((len == 0 || in[len-1] != '\n') && write_all(h->to, "\n", 1) == -1)) {
+        int status = serve_reap(h); // the handler exited without replying
+        return status ? status : CALL_FAILED;
+    }
+
+    for (;;) {
+        unsigned char *newline = memchr(buffer, '\n', buffered);
+        size_t n = newline ? (size_t)(newline - buffer) + 1 : buffered;
+        if (*out_len + n > max) {
+            fprintf(stderr, "ipcmd serve: %s: output length > msg_qbytes\n",
+                    handler[0]);
+            kill(h->pid, SIGTERM);
+            serve_reap(h);
+            return CALL_FAILED;
+        }
+        memcpy(out + *out_len, buffer, n);
+        *out_len += n;
+        memmove(buffer, buffer + n, buffered - n);
+        buffered -= n;
+        if (newline)
+            return 0;
+
+        ssize_t got = read(h->from, buffer, sizeof(buffer));
+        if (got == 0) { // the handler exited
+            int status = serve_reap(h);
+            return status ? status : CALL_FAILED;
+        }
+        if (got == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("ipcmd serve: read");
+            exit(EXIT_FAILURE);
+        }
+        buffered = (size_t)got;
+    }
+}
+
+// Receive requests and reply to them until the queue is removed.
+static void serve_worker(
+    int msqid,
+    long msgtyp,
+    char *handler[],
+    int line_mode,
+    size_t msgsz_max
+) {
+    struct msg {long mtype; unsigned char mtext[];};
+    struct msg *request, *reply;
+    struct serve_handler h;
+
+    h.pid = 0;
+    if ((request = malloc(sizeof(struct msg) + msgsz_max)) == NULL ||
+        (reply = malloc(sizeof(struct msg) + msgsz_max)) == NULL) {
+        perror("ipcmd serve: malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (;;) {
+        ssize_t received = msgrcv(msqid, request, msgsz_max, msgtyp, 0);
+        size_t out_len;
+        uint64_t deadline;
+        int status;
+
+        if (received == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EIDRM || errno == EINVAL)
+                break; // the queue was removed
+            fprintf(stderr, "ipcmd serve (msgrcv()): %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (received < CALL_REQUEST_HEADER_SIZE ||
+            msgsz_max < CALL_REPLY_HEADER_SIZE) {
+            fprintf(stderr, "ipcmd serve: ignoring a message that isn't a "
+                            "request (from ipcmd call)\n");
+            continue;
+        }
+        deadline = call_get64(request->mtext + 16);
+        if (deadline && now_usec() >= deadline)
+            continue; // the caller has given up
+        if (line_mode)
+            status = serve_line(&h, handler,
+                                request->mtext + CALL_REQUEST_HEADER_SIZE,
+                                (size_t)received - CALL_REQUEST_HEADER_SIZE,
+                                reply->mtext + CALL_REPLY_HEADER_SIZE,
+                                msgsz_max - CALL_REPLY_HEADER_SIZE, &out_len);
+        else
+            status = serve_exec(handler,
+                                request->mtext + CALL_REQUEST_HEADER_SIZE,
+                                (size_t)received - CALL_REQUEST_HEADER_SIZE,
+                                reply->mtext + CALL_REPLY_HEADER_SIZE,
+                                msgsz_max - CALL_REPLY_HEADER_SIZE, &out_len);
+        if (status != 0 && out_len > 0 && line_mode)
+            out_len = 0; // a partial line
+        if (deadline && now_usec() >= deadline)
+            continue; // nobody would receive the reply
+        reply->mtype = (long)call_get64(request->mtext);
+        memcpy(reply->mtext, request->mtext + 8, 8); // the nonce
+        reply->mtext[8] = (unsigned char)status;
+        while (msgsnd(msqid, reply, CALL_REPLY_HEADER_SIZE + out_len, 0) == -1)
+            if (errno != EINTR) {
+                if (errno == EINVAL && out_len > 0) {
+                    // beyond the system's message size limit (or removed)
+                    fprintf(stderr, "ipcmd serve: %s: output length > "
+                                    "message size limit\n", handler[0]);
+                    reply->mtext[8] = CALL_FAILED;
+                    out_len = 0;
+                    continue;
+                }
+                if (errno == EIDRM || errno == EINVAL)
+                    goto removed;
+                fprintf(stderr, "ipcmd serve (msgsnd()): %s\n",
+                        ipcmd_msgsnd_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+    }
+removed:
+    if (h.pid != 0)
+        serve_reap(&h); // closing its input lets it exit
+}
+
+static void ipcmd_serve(int argc, char *argv[]) {
+    const char *usage =
+        "ipcmd serve [-q msqid] [-t msgtyp] [-N workers] [-l] "
+        ": handler [argument...]\n"
+        "  -t msgtyp  : receive requests as msgrcv -t msgtyp would "
+        "(default: 1)\n"
+        "  -N workers : serve up to workers requests at once (default: 1)\n"
+        "  -l         : keep one handler running per worker, passing it a "
+        "line per request\n"
+        "               and replying with a line of its output";
+    long msgtyp = 1;
+    int msqid = 0;
+    int workers = 1;
+    int line_mode = 0;
+    size_t msgsz_max;
+    pid_t pid;
+    int c;
+
+#ifdef __GNU_LIBRARY__
+    // disable GNU getopt() permutation of argv so the handler's arguments
+    // aren't mangled
+    while ((c = getopt(argc, argv, "+lN:q:t:")) != -1)
+#else
+    while ((c = getopt(argc, argv, "lN:q:t:")) != -1)
+#endif
+    {
+        switch (c)
+        {
+            case 'l':
+                line_mode = 1;
+                break;
+            case 'N':
+                workers = get_int_arg(optarg, "serve");
+                if (workers <= 0)
+                    print_usage_and_exit(usage);
+                break;
+            case 'q':
+                msqid = get_msqid_arg(optarg, "serve");
+                break;
+            case 't':
+                msgtyp = get_long_arg(optarg, "serve");
+                if (msgtyp >= CALL_REPLY_BASE || msgtyp <= -CALL_REPLY_BASE) {
+                    fprintf(stderr, "ipcmd serve: msgtyp must be less than "
+                                    "%li in magnitude\n", CALL_REPLY_BASE);
+                    exit(EXIT_FAILURE);
+                }
+                if (msgtyp == 0) // any request, but not the replies
+                    msgtyp = -(CALL_REPLY_BASE - 1);
+                break;
+            default: // unknown option
+                print_usage_and_exit(usage);
+        }
+    }
+    // "--" has been consumed by getopt(), if used rather than ":"
+    if (optind < argc && strcmp(argv[optind], ":") == 0)
+        optind++;
+    if (optind == argc)
+        print_usage_and_exit(usage);
+
+    msqid = get_msqid(msqid, "serve");
+    require_xsi_msqid(msqid, "serve", "serve");
+    msgsz_max = call_msgsz_max(msqid, "serve");
+    signal(SIGPIPE, SIG_IGN); // a handler that exits early is reported
+
+    fflush(stdout);
+    for (int w = 0; w < workers; w++) {
+        if ((pid = fork()) == -1) {
+            perror("ipcmd serve: fork");
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            serve_worker(msqid, msgtyp, &argv[optind], line_mode, msgsz_max);
+            exit(EXIT_SUCCESS);
+        }
+    }
+    while (wait(NULL) != -1 || errno == EINTR)
+        ;
+}
+
+//**************************************
+// collective operations ("ipcmd coll")
+//**************************************
+
+// The ranks of a collective operation exchange messages over one XSI message
+// queue along a binomial tree rooted at the root rank, so each operation
+// takes O(log size) steps. A message from rank src to rank dest has type
+// 1 + dest*size + src, and its first byte is one of:
+#define COLL_READY '?' // dest is ready to receive from src
+#define COLL_MORE  '+' // part of a payload, which continues in the next one
+#define COLL_LAST  '.' // the end of a payload
+// A payload is sent only after the receiver has said it is ready, so every
+// payload on the queue is being read; the queue therefore can't fill up with
+// messages that nobody will read before the operation completes, whatever
+// the size of the payloads. Successive operations by the same ranks on the
+// same queue are kept apart by the FIFO order of each message type.
+#define COLL_CHUNK_MAX 8192 // bytes per message (the Linux default MSGMAX)
+
+struct coll {
+    int msqid;
+    int rank;
+    int size;
+    int root;
+    size_t chunk; // maximum message text size
+    struct {long mtype; char mtext[COLL_CHUNK_MAX];} msg;
+};
+
+enum {COLL_SUM, COLL_MIN, COLL_MAX, COLL_CONCAT};
+
+// a growable byte buffer
+struct coll_buffer {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+static void coll_append(struct coll_buffer *b, const void *data, size_t len) {
+    if (b->len + len + 1 > b->capacity) {
+        while (b->len + len + 1 > b->capacity)
+            b->capacity = b->capacity ? 2 * b->capacity : 4096;
+        if ((b->data = realloc(b->data, b->capacity)) == NULL) {
+            perror("ipcmd coll: realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0'; // for parsing
+}
+
+// the tree is over virtual ranks, with the root at 0
+static int coll_rank(const struct coll *c, int vrank) {
+    return (vrank + c->root) % c->size;
+}
+
+static int coll_vrank(const struct coll *c) {
+    return (c->rank - c->root + c->size) % c->size;
+}
+
+static void coll_msgsnd(struct coll *c, int dest, size_t msgsz) {
+    c->msg.mtype = 1 + (long)dest * c->size + c->rank;
+    if (msgsnd(c->msqid, &c->msg, msgsz, 0) == -1) {
+        fprintf(stderr, "ipcmd coll (msgsnd()): %s\n",
+                ipcmd_msgsnd_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static size_t coll_msgrcv(struct coll *c, int src, int expected) {
+    ssize_t received;
+    received = msgrcv(c->msqid, &c->msg, c->chunk,
+                      1 + (long)c->rank * c->size + src, 0);
+    if (received == -1) {
+        fprintf(stderr, "ipcmd coll (msgrcv()): %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (received == 0 || (expected == COLL_READY) !=
+                         (c->msg.mtext[0] == COLL_READY)) {
+        fprintf(stderr, "ipcmd coll: unexpected message from rank %i (are "
+                        "all ranks performing the same operations?)\n", src);
+        exit(EXIT_FAILURE);
+    }
+    return (size_t)received;
+}
+
+// Send a payload to rank dest, once it is ready for it.
+static void coll_send(struct coll *c, int dest, const char *data, size_t len) {
+    size_t part = c->chunk - 1;
+    coll_msgrcv(c, dest, COLL_READY);
+    do {
+        size_t n = len < part ? len : part;
+        c->msg.mtext[0] = len > part ? COLL_MORE : COLL_LAST;
+        memcpy(c->msg.mtext + 1, data, n);
+        coll_msgsnd(c, dest, n + 1);
+        data += n;
+        len -= n;
+    } while (len > 0);
+}
+
+// Receive a payload from rank src, appending it to b.
+static void coll_recv(struct coll *c, int src, struct coll_buffer *b) {
+    size_t received;
+    c->msg.mtext[0] = COLL_READY;
+    coll_msgsnd(c, src, 1);
+    do {
+        received = coll_msgrcv(c, src, COLL_LAST);
+        coll_append(b, c->msg.mtext + 1, received - 1);
+    } while (c->msg.mtext[0] == COLL_MORE);
+}
+
+// Broadcast the payload in b (significant only at the root) to all ranks.
+static void coll_bcast(struct coll *c, struct coll_buffer *b) {
+    int vrank = coll_vrank(c);
+    int mask = 1;
+
+    // receive from the parent (vrank with its lowest set bit cleared)...
+    while (mask < c->size && !(vrank & mask))
+        mask <<= 1;
+    if (vrank != 0)
+        coll_recv(c, coll_rank(c, vrank & ~mask), b);
+    // ...and send to the children (vrank + each lower power of 2), largest
+    // subtree first
+    for (mask >>= 1; mask > 0; mask >>= 1)
+        if (vrank + mask < c->size)
+            coll_send(c, coll_rank(c, vrank + mask), b->data, b->len);
+}
+
+// Fan in to the root: combine() the payloads of this rank's children into b,
+// then send b to its parent (unless this is the root).
+static void coll_fan_in(
+    struct coll *c,
+    struct coll_buffer *b,
+    void (*combine)(struct coll_buffer *b, const struct coll_buffer *child,
+                    int op),
+    int op
+) {
+    int vrank = coll_vrank(c);
+    struct coll_buffer child = {NULL, 0, 0};
+    int mask;
+
+    for (mask = 1; mask < c->size && !(vrank & mask); mask <<= 1)
+        if (vrank + mask < c->size) {
+            child.len = 0;
+            coll_recv(c, coll_rank(c, vrank + mask), &child);
+            combine(b, &child, op);
+        }
+    if (vrank != 0)
+        coll_send(c, coll_rank(c, vrank & ~mask), b->data, b->len);
+    free(child.data);
+}
+
+// Gathered payloads are sequences of records: "RANK LENGTH\n" followed by
+// LENGTH bytes of payload.
+static void coll_gather_combine(
+    struct coll_buffer *b,
+    const struct coll_buffer *child,
+    int op
+) {
+    (void)op;
+    coll_append(b, child->data, child->len);
+}
+
+// Replace the records in b by their payloads, in rank order.
+static void coll_gather_output(const struct coll *c, struct coll_buffer *b) {
+    struct {const char *data; size_t len;} *payloads;
+    struct coll_buffer out = {NULL, 0, 0};
+    const char *p = b->data, *end = b->data + b->len;
+
+    if ((payloads = calloc((size_t)c->size, sizeof(*payloads))) == NULL) {
+        perror("ipcmd coll: malloc");
+        exit(EXIT_FAILURE);
+    }
+    while (p < end) {
+        int rank, n = 0;
+        size_t len;
+        if (sscanf(p, "%i %zu\n%n", &rank, &len, &n) != 2 || n == 0 ||
+            rank < 0 || rank >= c->size || len > (size_t)(end - p - n)) {
+            fprintf(stderr, "ipcmd coll: malformed gather message\n");
+            exit(EXIT_FAILURE);
+        }
+        payloads[rank].data = p + n;
+        payloads[rank].len = len;
+        p += n + len;
+    }
+    coll_append(&out, "", 0);
+    for (int rank = 0; rank < c->size; rank++)
+        coll_append(&out, payloads[rank].data, payloads[rank].len);
+    free(payloads);
+    free(b->data);
+    *b = out;
+}
+
+// A value in a numeric reduction: an integer, until combined with a value
+// that isn't one.
+struct coll_value {
+    int is_double;
+    intmax_t i;
+    double d;
+};
+
+// Parse the whitespace-separated numbers in s into values (at most max).
+//
+// RETURN VALUE
+//     The number of values.
+static size_t coll_parse_values(
+    const char *s,
+    struct coll_value *values,
+    size_t max
+) {
+    size_t n = 0;
+    char *endptr;
+
+    for (;;) {
+        while (*s == ' ' || *s == '\t' || *s == '\n')
+            s++;
+        if (*s == '\0')
+            return n;
+        if (n == max) {
+            fprintf(stderr, "ipcmd coll: payloads have different numbers "
+                            "of values\n");
+            exit(EXIT_FAILURE);
+        }
+        errno = 0;
+        values[n].is_double = 0;
+        values[n].i = strtoimax(s, &endptr, 10);
+        if (errno != 0 || endptr == s ||
+            (*endptr != '\0' && *endptr != ' ' && *endptr != '\t' &&
+             *endptr != '\n')) {
+            values[n].is_double = 1;
+            values[n].d = strtod(s, &endptr);
+            if (endptr == s || (*endptr != '\0' && *endptr != ' ' &&
+                                *endptr != '\t' && *endptr != '\n')) {
+                fprintf(stderr, "ipcmd coll: not a number: %.*s\n",
+                        (int)strcspn(s, " \t\n"), s);
+                exit(EXIT_FAILURE);
+            }
+        }
+        s = endptr;
+        n++;
+    }
+}
+
+static double coll_double(const struct coll_value *v) {
+    return v->is_double ? v->d : (double)v->i;
+}
+
+static void coll_combine_value(
+    struct coll_value *a,
+    const struct coll_value *b,
+    int op
+) {
+    if (a->is_double || b->is_double) {
+        double x = coll_double(a), y = coll_double(b);
+        a->is_double = 1;
+        a->d = op == COLL_SUM ? x + y : op == COLL_MIN ? (y < x ? y : x) :
+                                                         (y > x ? y : x);
+    } else
+        a->i = op == COLL_SUM ? a->i + b->i :
+               op == COLL_MIN ? (b->i < a->i ? b->i : a->i) :
+                                (b->i > a->i ? b->i : a->i);
+}
+
+static void coll_format_values(
+    struct coll_buffer *b,
+    const struct coll_value *values,
+    size_t n,
+    const char *double_format
+) {
+    char number[64];
+    b->len = 0;
+    coll_append(b, "", 0);
+    for (size_t i = 0; i < n; i++) {
+        int len = values[i].is_double ?
+            snprintf(number, sizeof(number), double_format, values[i].d) :
+            snprintf(number, sizeof(number), "%jd", values[i].i);
+        if (i > 0)
+            coll_append(b, " ", 1);
+        coll_append(b, number, (size_t)len);
+    }
+}
+
+// Combine the values in child into those in b, element by element.
+static void coll_reduce_combine(
+    struct coll_buffer *b,
+    const struct coll_buffer *child,
+    int op
+) {
+    size_t max = b->len / 2 + 1; // a bound on the number of values in b
+    struct coll_value *x, *y;
+    size_t n;
+
+    if ((x = malloc(max * sizeof(*x))) == NULL ||
+        (y = malloc(max * sizeof(*y))) == NULL) {
+        perror("ipcmd coll: malloc");
+        exit(EXIT_FAILURE);
+    }
+    n = coll_parse_values(b->data, x, max);
+    if (coll_parse_values(child->data, y, n) != n) {
+        fprintf(stderr, "ipcmd coll: payloads have different numbers of "
+                        "values\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++)
+        coll_combine_value(&x[i], &y[i], op);
+    coll_format_values(b, x, n, "%.17g"); // exact, for the next combine
+    free(x);
+    free(y);
+}
+
+static void ipcmd_coll(int argc, char *argv[]) {
+    const char *usage =
+    "ipcmd coll bcast|gather|allgather|reduce -r rank -N size [-R root]\n"
+    "           [-o sum|min|max|concat] [-q msqid] [payload]\n"
+    "  -r rank  : this process's rank (0 <= rank < size)\n"
+    "  -N size  : number of ranks taking part\n"
+    "  -R root  : rank that broadcasts, or receives the result (default 0)\n"
+    "  -o op    : reduction operation (default: sum)\n"
+    "The payload is read from standard input if not given as an argument\n"
+    "(for bcast, only the root's payload is read).";
+    static struct coll c; // large
+    struct coll_buffer b = {NULL, 0, 0};
+    struct msqid_ds buf;
+    const char *operation;
+    int op = COLL_SUM;
+    int msqid = 0;
+    int c_opt;
+
+    if (argc < 2)
+        print_usage_and_exit(usage);
+    operation = argv[1];
+    argc--; argv++; // consume "coll", leaving <operation> [options]...
+
+    c.rank = c.size = -1;
+    while ((c_opt = getopt(argc, argv, "N:o:q:r:R:")) != -1)
+    {
+        switch (c_opt)
+        {
+            case 'N':
+                c.size = get_int_arg(optarg, "coll");
+                break;
+            case 'o':
+                if (strcmp(optarg, "sum") == 0)
+                    op = COLL_SUM;
+                else if (strcmp(optarg, "min") == 0)
+                    op = COLL_MIN;
+                else if (strcmp(optarg, "max") == 0)
+                    op = COLL_MAX;
+                else if (strcmp(optarg, "concat") == 0)
+                    op = COLL_CONCAT;
+                else
+                    print_usage_and_exit(usage);
+                break;
+            case 'q':
+                msqid = get_msqid_arg(optarg, "coll");
+                break;
+            case 'r':
+                c.rank = get_int_arg(optarg, "coll");
+                break;
+            case 'R':
+                c.root = get_int_arg(optarg, "coll");
+                break;
+            default: // unknown or missing argument
+                print_usage_and_exit(usage);
+        }
+    }
+
+    if (c.size <= 0 || c.rank < 0 || c.rank >= c.size || c.root < 0 ||
+        c.root >= c.size || optind+1 < argc ||
+        (c.size > 1 && (long)c.size > (LONG_MAX - 1) / c.size))
+        print_usage_and_exit(usage);
+    if (strcmp(operation, "bcast") != 0 && strcmp(operation, "gather") != 0 &&
+        strcmp(operation, "allgather") != 0 &&
+        strcmp(operation, "reduce") != 0)
+        print_usage_and_exit(usage);
+
+    c.msqid = get_msqid(msqid, "coll");
+    require_xsi_msqid(c.msqid, "coll", "coll"); // needs message types
+    if (msgctl(c.msqid, IPC_STAT, &buf) == -1) {
+        fprintf(stderr, "ipcmd coll (msgctl()): %s\n",
+                ipcmd_msgctl_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    c.chunk = buf.msg_qbytes < COLL_CHUNK_MAX ? (size_t)buf.msg_qbytes :
+                                                COLL_CHUNK_MAX;
+    trace_object(c.msqid, 0, "%s rank=%i size=%i", operation, c.rank,
+                 c.size);
+
+    // this rank's payload
+    if (strcmp(operation, "bcast") == 0 && c.rank != c.root)
+        coll_append(&b, "", 0);
+    else if (optind < argc)
+        coll_append(&b, argv[optind], strlen(argv[optind]));
+    else {
+        char input[4096];
+        ssize_t n;
+        coll_append(&b, "", 0);
+        while ((n = read(STDIN_FILENO, input, sizeof(input))) > 0)
+            coll_append(&b, input, (size_t)n);
+        if (n == -1) {
+            perror("ipcmd coll: read");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (strcmp(operation, "bcast") == 0)
+        coll_bcast(&c, &b);
+    else if (strcmp(operation, "reduce") == 0 && op != COLL_CONCAT) {
+        struct coll_value *values;
+        size_t max = b.len / 2 + 1, n;
+        if ((values = malloc(max * sizeof(*values))) == NULL) {
+            perror("ipcmd coll: malloc");
+            exit(EXIT_FAILURE);
+        }
+        // normalize, so that malformed payloads are detected at their rank
+        n = coll_parse_values(b.data, values, max);
+        coll_format_values(&b, values, n, "%.17g");
+        coll_fan_in(&c, &b, coll_reduce_combine, op);
+        if (c.rank == c.root) {
+            coll_parse_values(b.data, values, n);
+            coll_format_values(&b, values, n, "%.15g");
+            coll_append(&b, "\n", 1);
+        }
+        free(values);
+    } else { // gather, allgather, or concatenating reduce
+        char header[64];
+        int len = snprintf(header, sizeof(header), "%i %zu\n", c.rank, b.len);
+        struct coll_buffer record = {NULL, 0, 0};
+        coll_append(&record, header, (size_t)len);
+        coll_append(&record, b.data, b.len);
+        free(b.data);
+        b = record;
+        c.root = strcmp(operation, "allgather") == 0 ? 0 : c.root;
+        coll_fan_in(&c, &b, coll_gather_combine, op);
+        if (c.rank == c.root)
+            coll_gather_output(&c, &b);
+        if (strcmp(operation, "allgather") == 0)
+            coll_bcast(&c, &b);
+    }
+
+    // only the root has the result of gather and reduce
+    if ((strcmp(operation, "gather") == 0 ||
+         strcmp(operation, "reduce") == 0) && c.rank != c.root)
+        return;
+    if (write_all(STDOUT_FILENO, b.data, b.len) == -1) {
+        perror("ipcmd coll: write");
+        exit(EXIT_FAILURE);
+    }
+}
+
+//**************************************
+// shm semaphore backend ("ipcmd semget -b shm")
+//**************************************
+
+// A semaphore set of the shm backend is a shared memory segment holding the
+// semaphore values, so that semaphore operations that don't have to wait
+// need no system call. The values are protected by a spinlock (held only
+// long enough to apply or check the operations); processes that have to wait
+// sleep on seq, which is changed whenever semaphore values change while
+// anyone is waiting (C API: futex() on Linux; elsewhere, by polling).
+//
+// The lock holds the pid of its owner, and sleepers are listed by pid, so
+// that a process killed while holding the lock or sleeping doesn't leave the
+// set locked, or itself counted by semncnt or semzcnt, for good.
+//
+// Its identifier is written SHMSEM_PREFIX followed by the shmid, and is
+// represented internally by a semid tagged SEMSET_SHM (see semsets).
+#define SHMSEM_PREFIX "shm:"
+#define SHMSEM_MAGIC 0x69706373 // "ipcs"
+#define SHMSEM_REMOVED 0x69706378 // "ipcx": see "ipcmd semctl rmid"
+#define SHMSEM_SEMVMX 32767 // SEMVMX as on Linux (and most other systems)
+#define IS_SHMSEM(semid) (SEMSET_BACKEND(semid) == SEMSET_SHM)
+#define SHMSEM_SHMID(semid) (SEMSET(semid)->id)
+#define SHMSEM_SEMID(shmid) semset_handle(SEMSET_SHM, (shmid))
+
+#define SHMSEM_SLEEPERS 128 // sleepers whose counts can be undone if they die
+
+struct shmsem_set {
+    uint32_t magic; // 0 before initialization
+    uint32_t nsems;
+    uint32_t lock; // pid of the owner, or 0
+    uint32_t seq;
+    uint32_t waiters; // processes waiting (on seq)
+    uint32_t pad;
+    struct {
+        int32_t pid; // 0 if the entry is free
+        uint16_t semnum; // the semaphore waited for
+        uint16_t zero; // 1 if counted by semzcnt, 0 if by semncnt
+    } sleeper[SHMSEM_SLEEPERS];
+    struct {
+        int32_t semval;
+        int32_t sempid;  // process that last operated on the semaphore
+        uint32_t semncnt; // processes waiting for semval to increase
+        uint32_t semzcnt; // processes waiting for semval to become 0
+    } sem[];
+};
+
+#define SHMSEM_SPINS 100 // spin this many times before yielding the CPU
+
+static void shmsem_lock(struct shmsem_set *set) {
+    uint32_t self = (uint32_t)getpid();
+    int saved_errno = errno;
+    for (int spins = 0; ; spins++) {
+        uint32_t owner = atomic_cas(&set->lock, 0, self);
+        if (owner == 0)
+            break;
+        if (spins < SHMSEM_SPINS)
+            continue;
+        // take over the lock from an owner that was killed holding it (the
+        // operation it was applying may have been left half done)
+        if (spins % SHMSEM_SPINS == 0 && kill((pid_t)owner, 0) == -1 &&
+            errno == ESRCH && atomic_cas(&set->lock, owner, self) == owner)
+            break;
+        sched_yield();
+    }
+    errno = saved_errno;
+}
+
+static void shmsem_unlock(struct shmsem_set *set) {
+    __sync_lock_release(&set->lock);
+}
+
+// Sleep until seq may no longer equal val, or timeout (if not NULL) expires.
+//
+// RETURN VALUE
+//     -1 (with errno EINTR) if interrupted by a signal handler, otherwise 0.
+static int shmsem_sleep(
+    uint32_t *seq,
+    uint32_t val,
+    const struct timespec *timeout
+) {
+#ifdef HAVE_FUTEX
+    if (syscall(SYS_futex, seq, FUTEX_WAIT, val, timeout, NULL, 0) == -1 &&
+        errno == EINTR)
+        return -1;
+    return 0;
+#else
+    // poll, with the interval doubling from 1 ms to 16 ms while seq is
+    // unchanged (which it probably is, unless polling very slowly)
+    static long interval_nsec = 1000000;
+    struct timespec interval = {0, interval_nsec};
+    (void)val;
+    if (timeout && (timeout->tv_sec < interval.tv_sec ||
+                    (timeout->tv_sec == interval.tv_sec &&
+                     timeout->tv_nsec < interval.tv_nsec)))
+        interval = *timeout;
+    if (nanosleep(&interval, NULL) == -1)
+        return -1;
+    if (interval_nsec < 16000000)
+        interval_nsec *= 2;
+    (void)seq;
+    return 0;
+#endif
+}
+
+static void shmsem_wake(uint32_t *seq) {
+#ifdef HAVE_FUTEX
+    syscall(SYS_futex, seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)seq; // sleepers poll
+#endif
+}
+
+// Undo the counts of sleepers that have died. Called with the set locked.
+static void shmsem_reap(struct shmsem_set *set) {
+    int saved_errno = errno;
+    for (int i = 0; i < SHMSEM_SLEEPERS; i++) {
+        if (set->sleeper[i].pid == 0 ||
+            kill((pid_t)set->sleeper[i].pid, 0) == 0 || errno != ESRCH)
+            continue;
+        if (set->sleeper[i].zero)
+            set->sem[set->sleeper[i].semnum].semzcnt--;
+        else
+            set->sem[set->sleeper[i].semnum].semncnt--;
+        set->waiters--;
+        set->sleeper[i].pid = 0;
+    }
+    errno = saved_errno;
+}
+
+#define SHMSEM_ATTACHED 8 // sets a process keeps attached
+
+// Attach the shm backend semaphore set identified by semid, unless this
+// process already has (the set stays attached until it exits, so that
+// loops of operations don't each map it again).
+//
+// RETURN VALUE
+//     The semaphore set, or NULL with errno set to EINVAL if semid doesn't
+//     identify one, or as for shmat() on other errors.
+static struct shmsem_set *shmsem_attach(int semid) {
+    static struct {
+        int semid;
+        struct shmsem_set *set;
+    } attached[SHMSEM_ATTACHED];
+    static size_t next; // the entry to replace
+    struct shmsem_set *set;
+
+    for (size_t i = 0; i < SHMSEM_ATTACHED; i++)
+        if (attached[i].set != NULL && attached[i].semid == semid)
+            return attached[i].set;
+    set = shmat(SHMSEM_SHMID(semid), NULL, 0);
+    if (set == (void *)-1)
+        return NULL;
+    // wait for a concurrent "ipcmd semget -b shm -S semkey -e" to initialize
+    // a set it has just created
+    for (int spins = 0;
+         ((volatile struct shmsem_set *)set)->magic == 0 && spins < 1000;
+         spins++)
+        sched_yield();
+    if (set->magic != SHMSEM_MAGIC) {
+        shmdt(set);
+        errno = EINVAL;
+        return NULL;
+    }
+    // callers don't keep the set across calls, so one can be replaced
+    if (attached[next].set != NULL)
+        shmdt(attached[next].set);
+    attached[next].semid = semid;
+    attached[next].set = set;
+    next = (next + 1) % SHMSEM_ATTACHED;
+    return set;
+}
+
+// Create (or, if semflg lacks IPC_EXCL, open) an shm backend semaphore set,
+// as semget() would a semaphore set.
+//
+// RETURN VALUE
+//     The semid (see SHMSEM_SEMID()), or -1 with errno set.
+static int shmsem_get(key_t key, int nsems, int semflg) {
+    struct shmsem_set *set;
+    int shmid;
+
+    if (nsems <= 0 || nsems > USHRT_MAX + 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    shmid = shmget(key, sizeof(struct shmsem_set) +
+                        (size_t)nsems * sizeof(set->sem[0]),
+                   semflg | IPC_CREAT | IPC_EXCL);
+    if (shmid == -1 && errno == EEXIST && !(semflg & IPC_EXCL)) {
+        // already exists: check that it's a large enough semaphore set
+        if ((shmid = shmget(key, 0, semflg & 0777)) == -1)
+            return -1;
+        if ((set = shmsem_attach(SHMSEM_SEMID(shmid))) == NULL)
+            return -1;
+        if (set->nsems < (uint32_t)nsems) {
+            errno = EINVAL;
+            return -1;
+        }
+        return SHMSEM_SEMID(shmid);
+    }
+    if (shmid == -1)
+        return -1;
+
+    // the segment is initially zero: all semaphore values are 0
+    if ((set = shmat(shmid, NULL, 0)) == (void *)-1)
+        return -1;
+    set->nsems = (uint32_t)nsems;
+    __sync_synchronize();
+    set->magic = SHMSEM_MAGIC;
+    shmdt(set);
+    return SHMSEM_SEMID(shmid);
+}
+
+// Perform the semaphore operations atomically, as semop_timed() does.
+static int shmsem_op(
+    int semid,
+    struct sembuf *sops,
+    size_t nsops,
+    const struct timespec *timeout
+) {
+    struct shmsem_set *set;
+    uint64_t deadline = 0;
+    pid_t pid = getpid();
+
+    if ((set = shmsem_attach(semid)) == NULL)
+        return -1;
+    for (size_t i = 0; i < nsops; i++) {
+        if (sops[i].sem_num >= set->nsems) {
+            errno = EFBIG;
+            return -1;
+        }
+        if (sops[i].sem_flg & SEM_UNDO) {
+            errno = ENOTSUP;
+            return -1;
+        }
+    }
+    if (timeout)
+        deadline = now_usec() + (uint64_t)timeout->tv_sec * 1000000 +
+                   (uint64_t)timeout->tv_nsec / 1000;
+
+    int slot = -1; // this process's entry in set->sleeper, while it sleeps
+    int interrupted = 0; // 1 if the last sleep was interrupted by a signal
+    for (size_t waited = nsops; ; ) { // index of the operation waited for
+        struct timespec remaining, *remainingp = NULL;
+        size_t i;
+        int error = 0;
+        uint32_t seq;
+
+        shmsem_lock(set);
+        // a waiter is counted until it has tried again, as XSI semaphores
+        // complete a woken operation before semncnt or semzcnt drop (see
+        // "ipcmd event pulse")
+        if (waited < nsops) {
+            if (sops[waited].sem_op == 0)
+                set->sem[sops[waited].sem_num].semzcnt--;
+            else
+                set->sem[sops[waited].sem_num].semncnt--;
+            set->waiters--;
+            if (slot != -1)
+                set->sleeper[slot].pid = 0;
+            slot = -1;
+            waited = nsops;
+        }
+        if (set->magic == SHMSEM_REMOVED) {
+            shmsem_unlock(set);
+            errno = EIDRM;
+            return -1;
+        }
+        // apply the operations in order, undoing them if one can't proceed
+        for (i = 0; i < nsops; i++) {
+            int32_t *semval = &set->sem[sops[i].sem_num].semval;
+            if (sops[i].sem_op == 0 ? *semval != 0 :
+                                      *semval + sops[i].sem_op < 0)
+                break;
+            if (*semval + sops[i].sem_op > SHMSEM_SEMVMX) {
+                error = ERANGE;
+                break;
+            }
+            *semval += sops[i].sem_op;
+        }
+        if (i == nsops) { // success
+            int changed = 0;
+            for (i = 0; i < nsops; i++) {
+                set->sem[sops[i].sem_num].sempid = (int32_t)pid;
+                changed |= sops[i].sem_op != 0;
+            }
+            // only contended operations need a system call
+            changed = changed && set->waiters > 0;
+            if (changed)
+                set->seq++;
+            shmsem_unlock(set);
+            if (changed)
+                shmsem_wake(&set->seq);
+            return 0;
+        }
+        for (size_t j = i; j-- > 0;)
+            set->sem[sops[j].sem_num].semval -= sops[j].sem_op;
+        if (error || sops[i].sem_flg & IPC_NOWAIT || interrupted) {
+            shmsem_unlock(set);
+            errno = error ? error : interrupted ? EINTR : EAGAIN;
+            return -1;
+        }
+
+        // wait until semaphore values change
+        if (timeout) {
+            uint64_t now = now_usec();
+            if (now >= deadline) {
+                shmsem_unlock(set);
+                errno = EAGAIN;
+                return -1;
+            }
+            remaining.tv_sec = (time_t)((deadline - now) / 1000000);
+            remaining.tv_nsec = (long)((deadline - now) % 1000000) * 1000;
+            remainingp = &remaining;
+        }
+        if (sops[i].sem_op == 0)
+            set->sem[sops[i].sem_num].semzcnt++;
+        else
+            set->sem[sops[i].sem_num].semncnt++;
+        set->waiters++;
+        // if every entry is taken, this sleeper's count can't be undone
+        for (int j = 0; j < SHMSEM_SLEEPERS && slot == -1; j++)
+            if (set->sleeper[j].pid == 0) {
+                set->sleeper[j].pid = (int32_t)pid;
+                set->sleeper[j].semnum = sops[i].sem_num;
+                set->sleeper[j].zero = sops[i].sem_op == 0;
+                slot = j;
+            }
+        waited = i;
+        seq = set->seq;
+        shmsem_unlock(set);
+
+        interrupted = shmsem_sleep(&set->seq, seq, remainingp) == -1;
+    }
+}
+
+// Perform a semctl() cmd on an shm backend semaphore set. IPC_STAT fills in
+// only sem_perm and sem_nsems.
+static int shmsem_ctl(int semid, int semnum, int cmd, union semun arg) {
+    struct shmsem_set *set;
+    struct shmid_ds shminfo;
+    int result = 0;
+
+    if ((set = shmsem_attach(semid)) == NULL)
+        return -1;
+    if ((cmd == GETVAL || cmd == SETVAL || cmd == GETPID || cmd == GETNCNT ||
+         cmd == GETZCNT) && (semnum < 0 || (uint32_t)semnum >= set->nsems)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (cmd == SETVAL && (arg.val < 0 || arg.val > SHMSEM_SEMVMX)) {
+        errno = ERANGE;
+        return -1;
+    }
+    if (cmd == IPC_STAT || cmd == IPC_RMID) {
+        if (shmctl(SHMSEM_SHMID(semid), IPC_STAT, &shminfo) == -1)
+            return -1;
+    }
+
+    shmsem_lock(set);
+    switch (cmd) {
+        case GETVAL:
+            result = set->sem[semnum].semval;
+            break;
+        case GETPID:
+            result = set->sem[semnum].sempid;
+            break;
+        case GETNCNT:
+            shmsem_reap(set);
+            result = (int)set->sem[semnum].semncnt;
+            break;
+        case GETZCNT:
+            shmsem_reap(set);
+            result = (int)set->sem[semnum].semzcnt;
+            break;
+        case GETALL:
+            for (uint32_t i = 0; i < set->nsems; i++)
+                arg.array[i] = (unsigned short)set->sem[i].semval;
+            break;
+        case SETVAL:
+            set->sem[semnum].semval = arg.val;
+            set->seq++;
+            break;
+        case SETALL:
+            for (uint32_t i = 0; i < set->nsems; i++)
+                set->sem[i].semval = arg.array[i];
+            set->seq++;
+            break;
+        case IPC_STAT:
+            memset(arg.buf, 0, sizeof(*arg.buf));
+            arg.buf->sem_perm = shminfo.shm_perm;
+            arg.buf->sem_nsems = set->nsems;
+            break;
+        case IPC_RMID:
+            set->magic = SHMSEM_REMOVED; // waiters fail with EIDRM
+            set->seq++;
+            break;
+        default:
+            errno = EINVAL;
+            result = -1;
+    }
+    shmsem_unlock(set);
+    if (cmd == SETVAL || cmd == SETALL || cmd == IPC_RMID)
+        shmsem_wake(&set->seq);
+    if (cmd == IPC_RMID && shmctl(SHMSEM_SHMID(semid), IPC_RMID, NULL) == -1)
+        return -1;
+    return result;
+}
+
+// semctl() for either backend
+static int semctl_any(int semid, int semnum, int cmd, union semun arg) {
+    if (IS_SHMSEM(semid))
+        return shmsem_ctl(semid, semnum, cmd, arg);
+    if (IS_BRIDGESEM(semid))
+        return bridge_semctl(semnum, cmd, arg);
+    return semctl(semid, semnum, cmd, arg);
+}
+
+// Convert a semid argument (an integer, SHMSEM_PREFIX followed by an
+// integer, as written by "ipcmd semget -b shm", or the address of a bridge
+// serving a set) to a semid.
+static int get_semid_arg(const char *semid_arg, const char *ipcmd_command) {
+    int semid;
+    if (strncmp(semid_arg, "unix:", strlen("unix:")) == 0 ||
+        strncmp(semid_arg, "tcp:", strlen("tcp:")) == 0) {
+        bridge_sem_address = semid_arg;
+        return semset_handle(SEMSET_BRIDGE, -1);
+    }
+    if (strncmp(semid_arg, SHMSEM_PREFIX, strlen(SHMSEM_PREFIX)) == 0) {
+        if ((semid = get_int_arg(semid_arg + strlen(SHMSEM_PREFIX),
+                                 ipcmd_command)) < 0) {
+            fprintf(stderr, "ipcmd %s: invalid semid: %s\n", ipcmd_command,
+                    semid_arg);
+            exit(EXIT_FAILURE);
+        }
+        return SHMSEM_SEMID(semid);
+    }
+    if ((semid = get_int_arg(semid_arg, ipcmd_command)) < 0) {
+        fprintf(stderr, "ipcmd %s: invalid semid: %s\n", ipcmd_command,
+                semid_arg);
+        exit(EXIT_FAILURE);
+    }
+    return semid;
+}
+
+// Exit if semid identifies a set served by a bridge: feature (which keeps
+// state in a shared memory segment of this host) only supports local sets.
+static void require_local_semid(
+    int semid,
+    const char *feature,
+    const char *ipcmd_command
+) {
+    if (IS_BRIDGESEM(semid)) {
+        fprintf(stderr, "ipcmd %s: %s is not supported for semaphore sets "
+                        "served by a bridge\n", ipcmd_command, feature);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// TODO: restrict mode argument to bits 666 (i.e., no "execute" bit)
+// * NOTE: semget() allows specifying nsems without IPC_CREAT, (i.e., we could 
+//   use '-N nsems' without '-c', so ipcmd semget could verifies that the
+//   semaphore set contains at least nsems semaphores, but would specifying
+//   the two together likely be a mistake? Revisit this and decide.
+// * Does it make sense to accept "-s semid", or could we just use
+// IPCMD_SEMID=SEMID ipcmd...
+static void ipcmd_semget(int argc, char *argv[]) {
+    const char *usage = 
+    "ipcmd semget [-S semkey [-e]] [-m mode] [-N nsems] [-b backend]\n"
+    "  -S       : create semaphore set associated with semkey\n"
+    "  -e       : no error if the semaphore set already exists\n"
+    "  -m mode  : read/alter permissions (octal value; default: 600)\n"
+    "  -N nsems : create a semaphores set with nsems semaphores (default 1)\n"
+    "  -b backend : sysv (XSI semaphores; default) or shm (shared memory)";
+
+    const int default_mode = 0600; // read & alter permission for owner
+    // default: create semaphore set, error if already exists, mode 600
+    int semflg = IPC_CREAT | IPC_EXCL | default_mode;
+    key_t key = IPC_PRIVATE; // default if "-S semkey" is not specified
+    int nsems = 1;  // create 1 semaphore by default if "-c" (IPC_CREAT) is 
+                    // specified; this parameter is ignored otherwise
+    int shm = 0; // if 1, "-b shm" was specified
+    int semid;
+    int c;
+
+    while ((c = getopt(argc, argv, "b:em:N:S:")) != -1)
+    {
+        switch (c)
+        {
+            case 'b':
+                if (strcmp(optarg, "shm") == 0)
+                    shm = 1;
+                else if (strcmp(optarg, "sysv") == 0)
+                    shm = 0;
+                else
+                    print_usage_and_exit(usage);
+                break;
+            case 'e':
+                semflg ^= IPC_EXCL; // remove IPC_EXCL from semflg
+                break;
+            case 'm':
+                semflg ^= default_mode; // clear default_mode bits
+                semflg |= get_mode_arg(optarg, "semget"); // user-supplied mode
+                break;
+            case 'N':
+                nsems = get_int_arg(optarg, "semget");
+                break;
+            case 'S':
+                key = get_key_t_arg(optarg, "semget");
+                break;
+            default: // unknown or missing argument
+                print_usage_and_exit(usage);
+        }
+    }
+
+    if (optind != argc) // arguments specified
+        print_usage_and_exit(usage);
+
+    // detect invalid option combinations (-e and not -S)
+    if ((!(semflg & IPC_EXCL) && key == IPC_PRIVATE))
+        print_usage_and_exit(usage);
+        
+    if ((semid = shm ? shmsem_get(key, nsems, semflg) :
+                       semget(key, nsems, semflg)) == -1) {
+        fprintf(stderr, "ipcmd semget (semget()): ");
+        switch (errno) {
+            case EACCES:
+                fprintf(stderr, "A semaphore identifier exists for key, but "
+                    "operation permission as specified by the low-order 9 bits "
+                    "of semflg would not be granted.\n");
+                break;
+            case EEXIST:
+                fprintf(stderr, "A semaphore identifier exists for the "
+                    "argument key but ((semflg &IPC_CREAT) && "
+                    "(semflg &IPC_EXCL)) is non-zero.\n");
+                exit(2);
+                break;
+            case EINVAL:
+                fprintf(stderr, "The value of nsems is either less than or "
+                    "equal to 0 or greater than the system-imposed limit, or a "
+                    "semaphore identifier exists for the argument key, but the "
+                    "number of semaphores in the set associated with it is "
+                    "less than nsems and nsems is not equal to 0.\n");
+                break;
+            case ENOENT:
+                fprintf(stderr, "A semaphore identifier does not exist for the "
+                                "argument key and (semflg &IPC_CREAT) is equal "
+                                "to 0.\n");
+                break;
+            case ENOSPC:
+                fprintf(stderr, "A semaphore identifier is to be created but "
+                    "the system-imposed limit on the maximum number of allowed "
+                    "semaphores system-wide would be exceeded.\n");
+                break;
+            default:
+                fprintf(stderr, "%s\n", strerror(errno));
+        }
+        exit(EXIT_FAILURE);
+    }
+
+    trace_object(semid, 0, "");
+    if (IS_SHMSEM(semid))
+        printf(SHMSEM_PREFIX "%i\n", SHMSEM_SHMID(semid));
+    else
+        printf("%i\n", semid);
+}
+
+// unsigned short interval due to SEMMSL <= USHRT_MAX in all known
+// implementations (Mac OS X 10.5/10.6 claims 87381 as the default SEMMSL, but
+// it doesn't appear to support this in practice)
+static void get_interval(
+    const char *interval_arg,    // lower_bound[:upper_bound]=...
+    const char delimiter,        // character after interval; "=" or ":"
+    unsigned short *lower_bound, 
+    unsigned short *upper_bound  // == lower_bound if no upper_bound specified
+) {
+    char *beginptr, *endptr;
+    errno = 0;
+    long val = strtol(interval_arg, &endptr, 10);
+
+    // if error converting to long, or argument not a digit, or argument not
+    // entirely a digit
+    if (errno != 0) {
+        perror("ipcmd: strtol");
+        exit(EXIT_FAILURE);
+    } else if (endptr == interval_arg) {
+        // no integer at beginning of string
+        fprintf(stderr, "ipcmd: invalid argument: %s\n", interval_arg);
+        exit(EXIT_FAILURE);
+    } else if (val < 0 || val > USHRT_MAX) {
+        fprintf(stderr, "ipcmd: argument (%li) out of valid range\n", val);
+        exit(EXIT_FAILURE);
+    }
+
+    *lower_bound = (unsigned short) val;
+
+    if (*endptr == ':') {
+        beginptr = endptr+1; // next character
+        errno = 0;
+        val = strtol(beginptr, &endptr, 10);
+        if (errno != 0) {
+            perror("strtol");
+            exit(EXIT_FAILURE);
+        } else if (endptr == beginptr) {
+            // no integer after comma
+            fprintf(stderr, "ipcmd: invalid argument: %s\n", interval_arg);
+            exit(EXIT_FAILURE);
+        } else if (val < 0 || val > USHRT_MAX) {
+            fprintf(stderr, "ipcmd: argument (%li) out of valid range\n", val);
+            exit(EXIT_FAILURE);
+        }
+
+        *upper_bound = (unsigned short) val;
+
+        if (*upper_bound < *lower_bound) {
+            fprintf(stderr, "ipcmd: invalid argument (%s); upper bound of "
+                  "interval must be >= lower bound\n", interval_arg);
+            exit(EXIT_FAILURE);
+        }
+    } else
+        *upper_bound = *lower_bound; // no upper_bound specified
+
+    // kludge: the function that gets the value will pick up at the delimiter;
+    // ensure it exists immediately after the interval to verify the entire
+    // argument is of the right form
+    if (*endptr != delimiter) {
+        fprintf(stderr, "ipcmd: invalid argument (%s)\n", interval_arg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static unsigned short get_interval_semval(
+    const char *arg, // sem_num_lbound[,sem_num_ubound]=semval
+    const char *ipcmd_command // whence this function was called
+)
+{
+    long val;
+    char *beginptr, *endptr;
+
+    // this check shouldn't be needed, as it was done in get_interval()
+    if ((beginptr = strchr(arg, '=')) == NULL) {
+        fprintf(stderr, "ipcmd: invalid argument (%s)\n", arg);
+        exit(EXIT_FAILURE);
+    }
+
+    beginptr++; // next character
+
+    errno = 0;
+    val = strtol(beginptr, &endptr, 10);
+    // if error converting to long, or argument not a digit, or argument not
+    // entirely a digit
+    if (errno != 0) {
+        perror("strtol");
+        exit(EXIT_FAILURE);
+    } else if (endptr == beginptr) {
+        // no integer at beginning of field
+        fprintf(stderr, "ipcmd %s: invalid argument: %s\n", ipcmd_command,
+                arg);
+        exit(EXIT_FAILURE);
+    } else if (val < 0 || val > USHRT_MAX) {
+        fprintf(stderr, "ipcmd %s: semval (%li) out of valid range\n",
+                ipcmd_command, val);
+        exit(EXIT_FAILURE);
+    } else if (*endptr != '\0') {
+        // extra characters after semval
+        fprintf(stderr, "ipcmd %s: invalid argument: %s\n", ipcmd_command,
+                arg);
+        exit(EXIT_FAILURE);
+    }
+
+    return (unsigned short) val;
+}
+
+// Set array (of nsems semaphore values) from the SEMVAL operands of "ipcmd
+// semctl setall": either one value for every semaphore, or
+// sem_num_lbound[:sem_num_ubound]=semval intervals covering each semaphore
+// exactly once.
+static void get_setall_array(
+    unsigned short *array,
+    unsigned short nsems,
+    int nargs,
+    char *args[],
+    const char *ipcmd_command // whence this function was called
+) {
+    // one non-interval SEMVAL operand
+    if (nargs == 1 && !strchr(args[0], '=')) {
+        unsigned short semval = get_unsigned_short_arg(args[0],
+                                                       ipcmd_command);
+        for (unsigned short i = 0; i < nsems; i++)
+            array[i] = semval;
+    } else { 
+        unsigned short sem_num_lbound, sem_num_ubound;
+        // Verify that there exists a semval for each semaphore in the
+        // set. While this isn't explicitly required by SETALL, it's
+        // likely that the user made a mistake if these aren't equal,
+        // and will likely cause data-corruption! 
+
+        int semval_count = 0; // number of specified semvals
+        int sem_num_sum = 0;  // sum of specified sem_nums
+        for (int i = 0; i < nargs; i++) {
+            get_interval(args[i], '=', &sem_num_lbound, &sem_num_ubound);
+            semval_count += (sem_num_ubound - sem_num_lbound + 1);
+            // sem_num_sum == sem_num_lbound + ... + sem_num_ubound
+            sem_num_sum += ((int)sem_num_ubound+1)*sem_num_ubound/2 -
+                           ((int)sem_num_lbound)*(sem_num_lbound-1)/2;
+        }
+        if (semval_count != (int)nsems || 
+            // 0+1+...+N-1 == N*(N-1)/2-1
+            sem_num_sum != (int)nsems*(nsems-1)/2) {
+            fprintf(stderr, "ipcmd %s: invalid number of semval arguments "
+                            "specified\n", ipcmd_command);
+            exit(EXIT_FAILURE);
+        }
+
+        // now actually set array
+        for (int i = 0; i < nargs; i++) {
+            get_interval(args[i], '=', &sem_num_lbound, &sem_num_ubound); 
+            for (unsigned short sem_num = sem_num_lbound; 
+                 sem_num <= sem_num_ubound; sem_num++)
+                array[sem_num] = get_interval_semval(args[i], ipcmd_command);
+        }
+    }
+}
+
+const char *ipcmd_semctl_strerror(int errnum) {
+    switch(errnum) {
+        case EACCES:
+            return "Operation permission is denied to the calling process.";
+        case EINVAL:
+            return "The value of semid is not a valid semaphore identifier, "
+                   "or the value of semnum is less than 0 or greater than or "
+                   "equal to sem_nsems, or the value of cmd is not a valid "
+                   "command.";
+        case EPERM:
+            return "The argument cmd is equal to IPC_RMID or IPC_SET and the "
+                   "effective user ID of the calling process is not equal to "
+                   "that of a process with appropriate privileges and it is "
+                   "not equal to the value of sem_perm.cuid or sem_perm.uid in "
+                   "the data structure associated with semid.";
+        case ERANGE:
+            return "The argument cmd is equal to SETVAL or SETALL and the "
+                   "value to which semval is to be set is greater than the "
+                   "system-imposed maximum.";
+        default:
+            return strerror(errnum);
+    }
+}
+// RETURN VALUE
+//     semid if it was specified with "-s semid" (i.e., it is not -1);
+//     otherwise, the value of the IPCMD_SEMID environment variable. The
+//     program will exit if neither was specified.
+static int get_semid(
+    int semid,
+    const char *ipcmd_command // whence this function was called
+) {
+    if (semid != -1) // -s option used
+        return semid;
+    if (!getenv("IPCMD_SEMID")) { // IPCMD_SEMID environment variable not set
+        fprintf(stderr, "ipcmd %s: must either specify [-s semid] or set "
+                        "IPCMD_SEMID environment variable\n", ipcmd_command);
+        exit(EXIT_FAILURE);
+    }
+    return get_semid_arg(getenv("IPCMD_SEMID"), ipcmd_command);
+}
+
+// TODO: This would be more elegant if we used long options as follows:
+//     [--chown owner] [--chgrp group] [--chmod mode]
+//     --getval semnum
+//     --setval semnum value
+//     --getpid semnum
+//     --getncnt semnum
+//     --getzcnt semnum
+//     --getall
+//     --setall arg [arg...]
+static void ipcmd_semctl(int argc, char *argv[]) {
+    const char *usage = 
+    "ipcmd semctl [-s semid] <subcommand> <args>\n"
+    "Where <subcommand> <args> is one of the following:\n"
+    "  getval  SEMNUM\n"
+    "  setval  SEMNUM SEMVAL\n"
+    "  getpid  SEMNUM\n"
+    "  getncnt SEMNUM\n"
+    "  getzcnt SEMNUM\n"
+    "  getall\n"
+    "  setall  [SEMNUM_LBOUND[,SEMNUM_UBOUND]=]SEMVAL...\n"
+    "  rmid";
+    int semid = -1;
+    int semnum = -1; // semnum argument for some commands
+    int cmd = IPC_STAT; // command that won't be supported, so it's safe to use
+                        // as an "unset" value
+    unsigned short sem_nsems;
+    union semun arg;
+    struct semid_ds seminfo;
+    int c;
+
+    while ((c = getopt(argc, argv, "s:")) != -1)
+    {
+        switch (c)
+        {
+            case 's':
+                semid = get_semid_arg(optarg, "semctl");
+                break;
+            default: // unknown or missing argument
+                print_usage_and_exit(usage);
+        }
+    }
+
+    if (optind == argc) // no subcommand specified
+        print_usage_and_exit(usage);
+
+    if (semid == -1) { // -s option not used
+        if (!getenv("IPCMD_SEMID")) { //IPCMD_SEMID environment variable not set
+            fprintf(stderr, "ipcmd semctl: must either specify [-s semid] or "
+                            "set IPCMD_SEMID environment variable\n");
+            exit(1);
+        } else
+            semid = get_semid_arg(getenv("IPCMD_SEMID"), "semctl");
+    }
+
+    if (strncmp(argv[optind], "getval", (size_t)_POSIX_ARG_MAX) == 0)
+        cmd = GETVAL;
+    else if (strncmp(argv[optind], "setval", (size_t)_POSIX_ARG_MAX) == 0)
+        cmd = SETVAL;
+    else if (strncmp(argv[optind], "getpid", (size_t)_POSIX_ARG_MAX) == 0)
+        cmd = GETPID;
+    else if (strncmp(argv[optind], "getncnt", (size_t)_POSIX_ARG_MAX) == 0)
+        cmd = GETNCNT;
+    else if (strncmp(argv[optind], "getzcnt", (size_t)_POSIX_ARG_MAX) == 0)
+        cmd = GETZCNT;
+    else if (strncmp(argv[optind], "getall", (size_t)_POSIX_ARG_MAX) == 0)
+        cmd = GETALL;
+    else if (strncmp(argv[optind], "setall", (size_t)_POSIX_ARG_MAX) == 0)
+        cmd = SETALL;
+    else if (strncmp(argv[optind], "rmid", (size_t)_POSIX_ARG_MAX) == 0)
+        cmd = IPC_RMID;
+    else
+        print_usage_and_exit(usage);
+
+    trace_object(semid, 0, "%s", argv[optind]);
+    optind++;
+
+    switch(cmd) {
+        case GETVAL:
+        case GETPID:
+        case GETNCNT:
+        case GETZCNT:
+            if (optind+1 != argc) // if not exactly one more argument (SEMNUM)
+                print_usage_and_exit(usage);
+            semnum = get_int_arg(argv[optind++], "semctl");
+            int result;
+            if ((result = semctl_any(semid, semnum, cmd, arg)) == -1) {
+                fprintf(stderr, "ipcmd semctl getzcnt (semctl()): %s\n",
+                        ipcmd_semctl_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            printf("%i\n", result);
+            break;
+        // 2010-10-10: For OS X 10.5/10.6, SETVAL works with values up to 32767;
+        // however, it doesn't report an error for values >= 32767.
+        case SETVAL:
+            if (optind == argc) // if missing SEMNUM operand
+                print_usage_and_exit(usage);
+            semnum = get_int_arg(argv[optind++], "semctl");
+            if (optind == argc) // if missing VALUE operand
+                print_usage_and_exit(usage);
+            arg.val = get_int_arg(argv[optind++], "semctl setval VALUE");
+            if (optind != argc) // if arguments after VALUE
+                print_usage_and_exit(usage);
+            if (semctl_any(semid, semnum, cmd, arg) == -1) {
+                fprintf(stderr, "ipcmd semctl setval (semctl()): %s\n",
+                        ipcmd_semctl_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case SETALL:
+            if (optind == argc) // missing SEMVAL operands
+                print_usage_and_exit(usage);
+
+            // need to know sem_nsems
+            arg.buf = &seminfo;
+            if (semctl_any(semid, 0, IPC_STAT, arg) == -1) {
+                fprintf(stderr, "ipcmd semctl setall (semctl()): %s\n",
+                        ipcmd_semctl_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            // NOTE: The (short) cast is used because Linux 2.4+ defines
+            // sem_nsems as an unsigned long int, while everyone else (and
+            // SUSv4) defines it as an unsigned short. This should never
+            // be > USHRT_MAX anyway, as the sem_num member of struct sembuf
+            // is unsigned short, and it wouldn't make sense to have more
+            // semaphores than could be operated on.
+            sem_nsems = (short)arg.buf->sem_nsems;
+
+            if ((arg.array = 
+                (unsigned short *)malloc(sem_nsems*sizeof(unsigned short)))
+                == NULL) {
+                perror("ipcmd semctl setall: malloc");
+                exit(EXIT_FAILURE);
+            }
+
+            get_setall_array(arg.array, sem_nsems, argc - optind,
+                             &argv[optind], "semctl setall");
+
+            if (semctl_any(semid, 0, SETALL, arg) == -1) {
+                fprintf(stderr, "ipcmd semctl setall (semctl()): %s\n",
+                        ipcmd_semctl_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            break;
+        case GETALL:
+            if (optind != argc) // if extra arguments after "getall"
+                print_usage_and_exit(usage);
+
+            // get number of semaphores in set
+            arg.buf = &seminfo;
+            if (semctl_any(semid, 0, IPC_STAT, arg) == -1) {
+                fprintf(stderr, "ipcmd semctl getall (semctl()): %s\n",
+                        ipcmd_semctl_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            // Allocate array for semaphores. Again, the (short) cast is
+            // needed because for Linux 2.4+ defines sem_nsems as an unsigned
+            // long
+            sem_nsems = (unsigned short)arg.buf->sem_nsems;
+            if ((arg.array = 
+                (unsigned short *)malloc(sem_nsems*sizeof(unsigned short)))
+                == NULL) {
+                    perror("ipcmd semctl getall: malloc");
+                    exit(EXIT_FAILURE);
+            }
+
+            if (semctl_any(semid, 0, GETALL, arg) == -1) {
+                fprintf(stderr, "ipcmd semctl getall (semctl()): %s\n",
+                        ipcmd_semctl_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            for (int i = 0; i < (int)sem_nsems; i++) {
+                if (i < sem_nsems - 1)
+                    printf("%hu ", arg.array[i]);
+                else // last semaphore to print
+                    printf("%hu\n", arg.array[i]);
+            }
+            break;
+        case IPC_RMID:
+            if (optind != argc) // if extra arguments after "rmid"
+                print_usage_and_exit(usage);
+            if (semctl_any(semid, 0, IPC_RMID, arg) == -1) {
+                fprintf(stderr, "ipcmd semctl rmid (semctl()): %s\n",
+                        ipcmd_semctl_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            // statistics (if any) would otherwise outlive the set
+            remove_segment(SEGMENT_SEMSTAT, semid, "semctl rmid");
+            remove_segment(SEGMENT_RATELIMIT, semid, "semctl rmid");
+            remove_segment(SEGMENT_MUTEX, semid, "semctl rmid");
+            break;
+        default:
+            break; // will never get here
+    }
+}
+
+static void get_interval_sem_op (
+    const char *arg, // sem_num_lbound[,sem_num_ubound]=sem_op[un]
+    short *sem_op,
+    short *sem_flg   // SEM_UNDO and/or IPC_NOWAIT
+)
+{
+    long val;
+    char *beginptr, *endptr;
+
+    // this check shouldn't be needed, as it was done in get_interval()
+    if ((beginptr = strchr(arg, '=')) == NULL) {
+        fprintf(stderr, "ipcmd: invalid argument (%s)\n", arg);
+        exit(EXIT_FAILURE);
+    }
+
+    beginptr++; // next character
+
+    errno = 0;
+    val = strtol(beginptr, &endptr, 10);
+    // if error converting to long, or argument not a digit, or argument not
+    // entirely a digit
+    if (errno != 0) {
+        perror("strtol");
+        exit(EXIT_FAILURE);
+    } else if (endptr == beginptr) {
+        // no integer at beginning of field
+        fprintf(stderr, "ipcmd semop: invalid argument: %s\n", arg);
+        exit(EXIT_FAILURE);
+    } else if (val < SHRT_MIN || val > SHRT_MAX) {
+        fprintf(stderr, "ipcmd semop: sem_op (%li) out of valid range "
+                        "[%hi,%hi]\n", val, SHRT_MIN, SHRT_MAX);
+        exit(EXIT_FAILURE);
+    }
+
+    *sem_op = (short) val;
+
+    // ensure any remaining string contains only "n" or "u"
+    if (strcspn(endptr, "nu")) {
+        fprintf(stderr, "ipcmd semop: invalid argument: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+
+    *sem_flg = 0;
+    if (strchr(endptr, 'n') != NULL)
+        *sem_flg |= IPC_NOWAIT;
+    if (strchr(endptr, 'u') != NULL)
+        *sem_flg |= SEM_UNDO;
+}
+
+// Sum of cardinalities of all integer intervals in arguments. This is useful
+// for determining the size of various arrays before allocating memory for
+// them.
+static size_t get_interval_count(
+    int interval_argc,
+    char *interval_argv[]
+) {
+    size_t count = 0;
+
+    unsigned short lower_bound;
+    unsigned short upper_bound;
+
+    for (int i = 0; i < interval_argc; i++) {
+        get_interval(interval_argv[i], '=', &lower_bound, &upper_bound);
+        count += (size_t)(upper_bound - lower_bound + 1);
+    }
+
+    return count;
+}
+
+
+// set semaphore-operation array from interval arguments
+//
+// RETURN VALUE
+//     nsops - total number of semaphore operations (for semop(..., nsops))
+static size_t set_interval_sops (
+    int argc,               // number of args in argv[]
+    char *argv[],           // semaphore interval argument array
+    struct sembuf *sops,
+    short sem_flg_additions // add these flags to sem_flg for each operation
+)
+{
+    size_t nsops = 0;
+
+    unsigned short sem_num_lbound; // lower bound of sem_num interval
+    unsigned short sem_num_ubound; // upper bound of sem_num interval
+    short sem_op;
+    short sem_flg;
+
+    for (int i = 0; i < argc; i++) {
+        get_interval(argv[i], '=', &sem_num_lbound, &sem_num_ubound);
+        get_interval_sem_op(argv[i], &sem_op, &sem_flg);
+        sem_flg |= sem_flg_additions;
+        for (int sem = (int)sem_num_lbound;
+             sem <= (int)sem_num_ubound; 
+             sem++, nsops++)
+        {
+            sops[nsops].sem_num = (unsigned short)sem;
+            sops[nsops].sem_op = sem_op;
+            sops[nsops].sem_flg = sem_flg;
+        }
+    }
+
+    return nsops;
+}
+
+const char *ipcmd_semop_strerror(int errnum) {
+    switch(errnum) {
+        case E2BIG:
+            return "The value of nsops is greater than the system-imposed "
+                   "maximum.";
+        case EACCES:
+            return "Operation permission is denied to the calling process.";
+        case EFBIG:
+            return "The value of sem_num is less than 0 or greater than or "
+                   "equal to the number of semaphores in the set associated "
+                   "with semid.";
+        case EIDRM:
+            return "The semaphore identifier semid is removed from the "
+                   "system.";
+        case EINTR:
+            return "The semop() function was interrupted by a signal.";
+        case EINVAL:
+            return "The value of semid is not a valid semaphore identifier, "
+                   "or the number of individual semaphores for which the "
+                   "calling process requests a SEM_UNDO would exceed the "
+                   "system-imposed limit.";
+        case ENOSPC:
+            return "The limit on the number of individual processes "
+                   "requesting a SEM_UNDO would be exceeded.";
+        case ENOTSUP:
+            return "SEM_UNDO (-u) is not supported for semaphore sets "
+                   "created with \"ipcmd semget -b shm\".";
+        case ERANGE:
+            return "An operation would cause a semval to overflow the "
+                   "system-imposed limit, or an operation would cause a "
+                   "semadj value to overflow the system-imposed limit.";
+        default:
+            return strerror(errnum);
+    }
+}
+
+// Like semop() (for either backend), but if timeout is not NULL, give up after
+// that long and fail with EAGAIN, as semtimedop() does. Where semtimedop() is
+// unavailable, an interval timer interrupts the semop() instead.
+static int semop_timed(
+    int semid,
+    struct sembuf *sops,
+    size_t nsops,
+    const struct timespec *timeout
+) {
+    if (IS_SHMSEM(semid))
+        return shmsem_op(semid, sops, nsops, timeout);
+    if (IS_BRIDGESEM(semid))
+        return bridge_semop(sops, nsops, timeout);
+    if (timeout == NULL)
+        return semop(semid, sops, nsops);
+#ifdef HAVE_SEMTIMEDOP
+    return semtimedop(semid, sops, nsops, timeout);
+#else
+    struct sigaction oact;
+    int status, saved_errno;
+
+    // a zero timeout would disarm the timer; poll instead
+    if (timeout->tv_sec == 0 && timeout->tv_nsec == 0) {
+        for (size_t i = 0; i < nsops; i++)
+            sops[i].sem_flg |= IPC_NOWAIT;
+        return semop(semid, sops, nsops);
+    }
+
+    timeout_start(timeout, &oact);
+    status = semop(semid, sops, nsops);
+    saved_errno = errno;
+    timeout_stop(&oact);
+
+    errno = (status == -1 && saved_errno == EINTR) ? EAGAIN : saved_errno;
+    return status;
+#endif
+}
+
+//**************************************
+// semaphore sets served over a bridge ("ipcmd bridge -S")
+//**************************************
+
+#define BRIDGE_POLL_USEC 200000 // how often a waiting operation checks its
+                                // client, and the bridge the set
+
+// RETURN VALUE
+//     The portable code for errnum (see bridge_errnos).
+static uint32_t bridge_errno_code(int errnum) {
+    for (uint32_t i = 2; i < sizeof(bridge_errnos) / sizeof(bridge_errnos[0]);
+         i++)
+        if (bridge_errnos[i] == errnum)
+            return i;
+    return 1; // EIO
+}
+
+// Perform the semaphore operations of a client on fd, as semop_timed()
+// would with a timeout of timeout_msec (or none, if BRIDGE_NO_TIMEOUT), but
+// waiting in intervals, between which the client is checked.
+//
+// RETURN VALUE
+//     0 on success, or -1 with errno set (to EPIPE if the client has gone).
+static int bridge_served_semop(
+    int fd,
+    int semid,
+    struct sembuf *sops,
+    size_t nsops,
+    uint32_t timeout_msec
+) {
+    uint64_t deadline = timeout_msec == BRIDGE_NO_TIMEOUT ? 0 :
+                        now_usec() + (uint64_t)timeout_msec * 1000;
+    for (;;) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        uint64_t now = now_usec();
+        uint64_t interval = BRIDGE_POLL_USEC;
+        struct timespec ts;
+
+        if (deadline)
+            interval = deadline <= now ? 0 : deadline - now < interval ?
+                                             deadline - now : interval;
+        ts.tv_sec = (time_t)(interval / 1000000);
+        ts.tv_nsec = (long)(interval % 1000000) * 1000;
+        if (semop_timed(semid, sops, nsops, &ts) == 0)
+            return 0;
+        // EAGAIN before the interval is up is from IPC_NOWAIT
+        if ((errno != EAGAIN && errno != EINTR) ||
+            (errno == EAGAIN && now_usec() < now + interval) ||
+            (deadline && now_usec() >= deadline))
+            return -1;
+        // a client waiting for its reply sends nothing, unless it has gone
+        if (poll(&pfd, 1, 0) == 1) {
+            errno = EPIPE;
+            return -1;
+        }
+    }
+}
+
+// Perform the requests of the client on fd, until it closes the connection.
+static void bridge_serve_client(int fd, int semid) {
+    unsigned char *req = NULL, *reply = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+
+    while ((len = bridge_read_frame(fd, &req, &capacity)) != -1) {
+        union semun arg;
+        struct semid_ds seminfo;
+        struct sembuf *sops = NULL;
+        uint32_t n = 0, count = 0;
+        int result = -1;
+
+        errno = EINVAL; // for a malformed request
+        if (len >= 9 && req[0] == 'o' &&
+            (size_t)len == 9 + 6 * (size_t)(n = bridge_get32(req + 5))) {
+            if ((sops = malloc((n ? n : 1) * sizeof(*sops))) == NULL) {
+                perror("ipcmd bridge: malloc");
+                exit(EXIT_FAILURE);
+            }
+            for (uint32_t i = 0; i < n; i++) {
+                const unsigned char *op = req + 9 + 6*i;
+                uint16_t flg = bridge_get16(op + 4);
+                sops[i].sem_num = bridge_get16(op);
+                sops[i].sem_op = (short)(int16_t)bridge_get16(op + 2);
+                sops[i].sem_flg =
+                    (short)((flg & BRIDGE_NOWAIT ? IPC_NOWAIT : 0) |
+                            (flg & BRIDGE_UNDO ? SEM_UNDO : 0));
+            }
+            result = bridge_served_semop(fd, semid, sops, n,
+                                         bridge_get32(req + 1));
+            if (result == -1 && errno == EPIPE)
+                exit(EXIT_SUCCESS); // the client has gone
+        } else if (len >= 17 && req[0] == 'c' &&
+                   (size_t)len == 17 + 2 * (size_t)bridge_get32(req + 13)) {
+            uint32_t code = bridge_get32(req + 1);
+            int semnum = (int)bridge_get32(req + 5);
+            static const int cmds[] = {
+                0, IPC_STAT, GETVAL, SETVAL, GETPID, GETNCNT, GETZCNT,
+                GETALL, SETALL
+            };
+            arg.buf = &seminfo;
+            if (code == BRIDGE_SETVAL)
+                arg.val = (int)bridge_get32(req + 9);
+            if (code == BRIDGE_GETALL || code == BRIDGE_SETALL) {
+                // the number of values is that of the set
+                if (semctl_any(semid, 0, IPC_STAT, arg) == -1)
+                    goto reply;
+                n = (uint32_t)seminfo.sem_nsems;
+                if ((arg.array = calloc(n, sizeof(unsigned short))) == NULL) {
+                    perror("ipcmd bridge: malloc");
+                    exit(EXIT_FAILURE);
+                }
+                if (code == BRIDGE_SETALL && bridge_get32(req + 13) != n) {
+                    errno = EINVAL;
+                    goto reply;
+                }
+                for (uint32_t i = 0; code == BRIDGE_SETALL && i < n; i++)
+                    arg.array[i] = bridge_get16(req + 17 + 2*i);
+            }
+            if (code >= BRIDGE_IPC_STAT && code <= BRIDGE_SETALL &&
+                (result = semctl_any(semid, semnum, cmds[code], arg)) != -1) {
+                if (code == BRIDGE_IPC_STAT)
+                    result = (int)seminfo.sem_nsems;
+                if (code == BRIDGE_GETALL)
+                    count = n;
+            }
+        }
+    reply:
+        if ((reply = realloc(reply, 16 + 2 * (size_t)count)) == NULL) {
+            perror("ipcmd bridge: malloc");
+            exit(EXIT_FAILURE);
+        }
+        bridge_put32(reply, 12 + 2 * count);
+        bridge_put32(reply + 4, result == -1 ? bridge_errno_code(errno) : 0);
+        bridge_put32(reply + 8, (uint32_t)result);
+        bridge_put32(reply + 12, count);
+        for (uint32_t i = 0; i < count; i++)
+            bridge_put16(reply + 16 + 2*i, arg.array[i]);
+        if (write_all(fd, reply, 16 + 2 * (size_t)count) == -1) {
+            // the client has gone: revert operations it didn't see succeed
+            size_t m = 0;
+            for (uint32_t i = 0; sops && result == 0 && i < n; i++)
+                if (sops[i].sem_op != 0) {
+                    sops[m] = sops[i];
+                    sops[m].sem_op = (short)-sops[i].sem_op;
+                    sops[m++].sem_flg |= IPC_NOWAIT;
+                }
+            if (m > 0)
+                semop_timed(semid, sops, m, NULL);
+            exit(EXIT_SUCCESS);
+        }
+        if (req[0] == 'c' && n > 0)
+            free(arg.array);
+        free(sops);
+    }
+}
+
+// Serve semid to the clients that connect to listener, in a process for
+// each, until semid is removed.
+static void bridge_serve_semaphores(int listener, int semid) {
+    union semun arg;
+    struct semid_ds seminfo;
+    int one = 1;
+
+    arg.buf = &seminfo;
+    signal(SIGCHLD, SIG_IGN); // reap the processes serving clients
+    for (;;) {
+        struct pollfd pfd = {listener, POLLIN, 0};
+        int ready = poll(&pfd, 1, BRIDGE_POLL_USEC / 1000);
+        int fd;
+
+        if (semctl_any(semid, 0, IPC_STAT, arg) == -1) {
+            if (errno == EINVAL || errno == EIDRM) // removed
+                return;
+            fprintf(stderr, "ipcmd bridge (semctl()): %s\n",
+                    ipcmd_semctl_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (ready != 1 || (fd = accept(listener, NULL, NULL)) == -1)
+            continue;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        switch (fork()) {
+            case -1:
+                perror("ipcmd bridge: fork");
+                exit(EXIT_FAILURE);
+            case 0:
+                close(listener);
+                bridge_serve_client(fd, semid);
+                exit(EXIT_SUCCESS);
+        }
+        close(fd);
+    }
+}
+
+static void ipcmd_bridge(int argc, char *argv[]) {
+    const char *usage =
+    "ipcmd bridge [-q msqid] [-t msgtyp] [-W window] [-B batch] [-n]\n"
+    "             [-w timeout] -c address\n"
+    "ipcmd bridge [-q msqid] -l address\n"
+    "ipcmd bridge [-s semid] -S -l address\n"
+    "  address is unix:PATH or tcp:[HOST]:PORT\n"
+    "  -c address : connect to a receiving bridge, and forward messages to it\n"
+    "  -l address : wait for a sending bridge, and send its messages to msqid\n"
+    "  -t msgtyp  : forward only messages that msgrcv -t msgtyp would receive\n"
+    "  -W window  : most unacknowledged messages (default: 256)\n"
+    "  -B batch   : most messages per write (default: 64)\n"
+    "  -n         : exit once the queue is empty (rather than once removed)\n"
+    "  -w timeout : keep trying to connect for timeout seconds\n"
+    "  -S         : serve semid to commands given address as their semid,\n"
+    "               until semid is removed";
+    const char *address = NULL;
+    int listening = 0;
+    int msqid = 0;
+    long msgtyp = 0;
+    int window = BRIDGE_WINDOW;
+    int batch = BRIDGE_BATCH;
+    int exit_when_empty = 0;
+    struct timespec timeout;
+    struct timespec *timeoutp = NULL; // non-NULL if "-w timeout" specified
+    int semid = -1;
+    int semaphores = 0; // if 1, "-S" was specified
+    int fd;
+    int c;
+
+    while ((c = getopt(argc, argv, "B:c:l:nq:s:St:w:W:")) != -1)
+    {
+        switch (c)
+        {
+            case 'B':
+                batch = get_int_arg(optarg, "bridge");
+                break;
+            case 'c':
+            case 'l':
+                if (address)
+                    print_usage_and_exit(usage);
+                address = optarg;
+                listening = c == 'l';
+                break;
+            case 'n':
+                exit_when_empty = 1;
+                break;
+            case 'q':
+                msqid = get_msqid_arg(optarg, "bridge");
+                break;
+            case 's':
+                semid = get_semid_arg(optarg, "bridge");
+                break;
+            case 'S':
+                semaphores = 1;
+                break;
+            case 't':
+                msgtyp = get_long_arg(optarg, "bridge");
+                break;
+            case 'w':
+                timeout = get_timeout_arg(optarg, "bridge");
+                timeoutp = &timeout;
+                break;
+            case 'W':
+                window = get_int_arg(optarg, "bridge");
+                break;
+            default: // unknown or missing argument
+                print_usage_and_exit(usage);
+        }
+    }
+
+    if (optind != argc || !address || window <= 0 || batch <= 0 ||
+        (semaphores && !listening) || (semid != -1 && !semaphores))
+        print_usage_and_exit(usage);
+
+    signal(SIGPIPE, SIG_IGN); // report a closed connection as an error
+    if (semaphores) {
+        semid = get_semid(semid, "bridge");
+        require_local_semid(semid, "-S", "bridge");
+        fd = bridge_connect(address, BRIDGE_LISTENER, NULL);
+        bridge_serve_semaphores(fd, semid);
+        if (strncmp(address, "unix:", strlen("unix:")) == 0)
+            unlink(address + strlen("unix:"));
+        close(fd);
+        return;
+    }
+    msqid = get_msqid(msqid, "bridge");
+    require_xsi_msqid(msqid, "bridge", "bridge");
+    fd = bridge_connect(address, listening, timeoutp);
+    if (listening)
+        bridge_receive(fd, msqid);
+    else
+        bridge_send(fd, msqid, msgtyp, (uint64_t)window,
+                    (size_t)(batch < window ? batch : window),
+                    exit_when_empty);
+    close(fd);
+}
+
+// Attach the semstat segment of a semaphore set (see "ipcmd semstat"),
+// creating it if create is nonzero, and set *nsems to the number of
+// semaphores in the set.
+//
+// RETURN VALUE
+//     The histograms, one per semaphore, or NULL if the segment doesn't exist
+//     and create is zero.
+static struct histogram *attach_semstat(
+    int semid,
+    int create,
+    unsigned short *nsems,
+    const char *ipcmd_command // whence this function was called
+) {
+    union semun arg;
+    struct semid_ds seminfo;
+    struct segment_header *header;
+
+    require_local_semid(semid, "IPCMD_SEMSTAT", ipcmd_command);
+    arg.buf = &seminfo;
+    if (semctl_any(semid, 0, IPC_STAT, arg) == -1) {
+        fprintf(stderr, "ipcmd %s (semctl()): %s\n", ipcmd_command,
+                ipcmd_semctl_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    *nsems = (unsigned short)seminfo.sem_nsems;
+
+    // the segment is usable by anyone who may use the semaphore set
+    header = attach_segment(SEGMENT_SEMSTAT, semid,
+                            sizeof(struct segment_header) +
+                            *nsems * sizeof(struct histogram),
+                            seminfo.sem_perm.mode & 0666, create,
+                            ipcmd_command);
+    return header ? (struct histogram *)(header + 1) : NULL;
+}
+
+// Perform the semaphore operations as semop_timed() does, recording in the
+// semstat segment how long each semaphore operation that could have blocked
+// (sem_op <= 0) took. The operations are first attempted with IPC_NOWAIT; if
+// they would block, the time spent waiting is attributed to the semaphores
+// whose values didn't permit their operations at that point, while the
+// others are recorded as acquired without waiting.
+static int semop_recorded(
+    int semid,
+    struct sembuf *sops,
+    size_t nsops,
+    const struct timespec *timeout
+) {
+    struct histogram *histograms;
+    unsigned short nsems;
+    unsigned short *sem_flg;
+    char *blocked; // blocked[i] != 0 if sops[i] couldn't be performed
+    uint64_t usec = 0;
+    int status;
+
+    histograms = attach_semstat(semid, 1, &nsems, "semop");
+
+    if ((sem_flg = malloc(nsops * sizeof(unsigned short))) == NULL ||
+        (blocked = calloc(nsops, 1)) == NULL) {
+        perror("ipcmd semop: malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < nsops; i++) {
+        sem_flg[i] = (unsigned short)sops[i].sem_flg;
+        sops[i].sem_flg |= IPC_NOWAIT;
+    }
+    status = semop_timed(semid, sops, nsops, NULL);
+    for (size_t i = 0; i < nsops; i++)
+        sops[i].sem_flg = (short)sem_flg[i];
+
+    if (status == -1 && errno == EAGAIN) {
+        union semun arg;
+        arg.val = 0;
+        for (size_t i = 0; i < nsops; i++) {
+            int semval = semctl_any(semid, sops[i].sem_num, GETVAL, arg);
+            blocked[i] = sops[i].sem_op == 0 ? semval != 0 :
+                                               semval < -sops[i].sem_op;
+        }
+        uint64_t start = now_usec();
+        if ((status = semop_timed(semid, sops, nsops, timeout)) == -1)
+            return -1;
+        usec = now_usec() - start;
+    } else if (status == -1)
+        return -1;
+
+    for (size_t i = 0; i < nsops; i++)
+        if (sops[i].sem_op <= 0 && sops[i].sem_num < nsems)
+            histogram_record(&histograms[sops[i].sem_num],
+                             blocked[i] ? usec : 0, blocked[i]);
+
+    return status;
+}
+
+// Describe the semaphore operations in the trace, in the form of semop's
+// sem_num=sem_op[n][u] arguments.
+static void trace_sops(int semid, const struct sembuf *sops, size_t nsops) {
+    char detail[sizeof(trace.detail)];
+    size_t len = 0;
+    if (trace.fd == -1)
+        return;
+    detail[0] = '\0';
+    for (size_t i = 0; i < nsops && len < sizeof(detail); i++)
+        len += (size_t)snprintf(detail + len, sizeof(detail) - len,
+                                "%s%hu=%+hd%s%s", i ? " " : "",
+                                sops[i].sem_num, sops[i].sem_op,
+                                sops[i].sem_flg & IPC_NOWAIT ? "n" : "",
+                                sops[i].sem_flg & SEM_UNDO ? "u" : "");
+    trace_object(semid, 0, "%s", detail);
+}
+
+static void ipcmd_semop(int argc, char *argv[]) {
+    const char *usage = 
+    "ipcmd semop [-s semid] [-n] [-u] [-w timeout] <ARGS>\n"
+    "Where ARGS is one of the following forms:\n"
+    "  sem_op [: COMMAND [<COMMAND_ARGS>]]\n"
+    "or\n"
+    "  sem_num[:sem_num]=[+|-]sem_op[n][u]... [: COMMAND [<COMMAND_ARGS>]]\n"
+    "Options:\n"
+    "  -s semid : semaphore identifier of an existing semaphore set\n"
+    "  -n       : (IPC_NOWAIT) all operations are non-blocking\n"
+    "  -u       : (SEM_UNDO) undo all nonzero operations upon exit\n"
+    "  -w secs  : give up (exit status 2) after waiting secs seconds";
+    int semid = -1;
+    short int sem_flg = 0;
+    size_t nsops;
+    struct sembuf *sops;
+    int command_arg = 0; // index into argv[] of optional command argument
+    struct timespec timeout;
+    struct timespec *timeoutp = NULL; // non-NULL if "-w timeout" specified
+    uint64_t wait_begin;
+    int status;
+    int c;
+
+#ifdef __GNU_LIBRARY__
+    // disable GNU getopt() permutation of argv so any user-specified command
+    // argument(s) isn't mangled
+    while ((c = getopt(argc, argv, "+ns:uw:0123456789")) != -1)
+#else
+    while ((c = getopt(argc, argv, "ns:uw:0123456789")) != -1)
+#endif
+    {
+        switch (c)
+        {
+            case 'n':
+                sem_flg |= IPC_NOWAIT;
+                break;
+            case 's':
+                semid = get_semid_arg(optarg, "semop");
+                break;
+            case 'u':
+                sem_flg |= SEM_UNDO;
+                break;
+            case 'w':
+                timeout = get_timeout_arg(optarg, "semop");
+                timeoutp = &timeout;
+                break;
+            // Test if a negative integer so we can handle this case:
+            // $ ipcmd semop -1
+            case '0':
+            case '1':
+            case '2':
+            case '3':
+            case '4':
+            case '5':
+            case '6':
+            case '7':
+            case '8':
+            case '9':
+                // if there is only one digit (e.g., "-1"), getopt() will have 
+                // incremented optind, so back up so it still indexes the
+                // sem_op argument in argv[]. If there was more than one
+                // digit, getopt() would have treated it as a string containing
+                // multiple options, and would not have incremented optind.
+                optind = (optind == argc || strcmp(argv[optind],":") == 0) ?
+                         optind-1 : optind;
+                goto process_arguments;
+        }
+    }
+
+process_arguments:
+
+    if (optind == argc) // if no operands specified
+        print_usage_and_exit(usage);
+
+    if (semid == -1) { // -s option not used
+        if (!getenv("IPCMD_SEMID")) { //IPCMD_SEMID environment variable not set
+            fprintf(stderr, "ipcmd semop: must either specify [-s semid] or "
+                            "set IPCMD_SEMID environment variable\n");
+            exit(1);
+        } else
+            semid = get_semid_arg(getenv("IPCMD_SEMID"), "semctl");
+    }
+
+    // if first operand has a "=", assume semaphore interval arguments
+    // (sem_num[:sem_num]=[+|-]sem_op[n][u]...)
+    if (strchr(argv[optind], '=')) {
+        // determine start of user-specified command argument, if any
+        for (int opt = optind+1; opt < argc; opt++)
+            if (strncmp(argv[opt], ":", strlen(":")+1) == 0) {
+                command_arg = opt+1;
+                // verify command argument after ":" exists
+                if (command_arg == argc)
+                    print_usage_and_exit(usage);
+                break;
+            }
+        
+        int interval_argc = (command_arg>0? command_arg-1-optind : argc-optind);
+        // get number of sops
+        nsops = get_interval_count(interval_argc, &argv[optind]);
+        if ((sops=(struct sembuf *)malloc(nsops*sizeof(struct sembuf)))==NULL){
+            perror("ipcmd semop: malloc");
+            exit(EXIT_FAILURE);
+        }
+        // second pass through semaphore arguments sets sembuf array
+        set_interval_sops(interval_argc, &argv[optind], sops, sem_flg);
+    } else { // assume a single sem_op applied to all semaphores in the set
+
+        // verify there is either a command argument...
+        if ((optind+2 < argc) && strcmp(argv[optind+1], ":") == 0)
+            command_arg = optind+2;
+        else if (optind+1 != argc) // or exactly one (sem_op) argument
+            print_usage_and_exit(usage);
+
+        short sem_op = get_short_arg(argv[optind], "semop");
+
+        union semun arg;
+        struct semid_ds seminfo;
+        arg.buf = &seminfo;
+
+        if (semctl_any(semid, 0, IPC_STAT, arg) == -1) {
+            fprintf(stderr, "ipcmd semop (semctl()): %s\n",
+                ipcmd_semctl_strerror(errno));
+            exit(EXIT_FAILURE);
+        } 
+
+        nsops = (size_t)arg.buf->sem_nsems;
+        
+        if ((sops=(struct sembuf *)malloc(nsops*sizeof(struct sembuf)))==NULL){
+            perror("ipcmd semop: malloc");
+            exit(EXIT_FAILURE);
+        }
+        // NOTE: POSIX.1-2008 lists incorrect type for sem_num member of
+        // sembuf in the description of semop() (listed as "short", should be
+        // "unsigned short") see: http://austingroupbugs.net/view.php?id=329
+        for (unsigned short sem_num=0; sem_num < nsops; sem_num++) {
+           sops[sem_num].sem_num = sem_num;
+           sops[sem_num].sem_op = sem_op;
+           sops[sem_num].sem_flg = sem_flg;
+        }
+    }
+
+    trace_sops(semid, sops, nsops);
+
+    // IPCMD_SEMSTAT set to a non-empty string: record wait times (of local
+    // sets; those of a set served by a bridge are recorded by neither host)
+    wait_begin = trace_clock();
+    status = getenv("IPCMD_SEMSTAT") && *getenv("IPCMD_SEMSTAT") &&
+             !IS_BRIDGESEM(semid) ?
+             semop_recorded(semid, sops, nsops, timeoutp) :
+             semop_timed(semid, sops, nsops, timeoutp);
+    trace_wait(wait_begin);
+    if (status == -1) {
+        if (errno == EAGAIN) // process would have be suspended had IPC_NOWAIT
+            exit(2);         // (-n) not been specified, or -w timed out
+        else {
+            fprintf(stderr, "ipcmd semop (semop()): %s\n",
+                    ipcmd_semop_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (command_arg) {
+        trace_close(); // atexit() functions aren't called on exec
+        if (execvp(argv[command_arg], &argv[command_arg]) == -1) {
+            perror("ipcmd semop: execvp");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void ipcmd_semstat(int argc, char *argv[]) {
+    const char *usage =
+    "ipcmd semstat [-s semid] [-r]\n"
+    "  -s semid : semaphore identifier of an existing semaphore set\n"
+    "  -r       : remove the statistics (they are otherwise kept until the\n"
+    "             shared memory segment is removed)";
+    int semid = -1;
+    int reset = 0;
+    unsigned short nsems;
+    struct histogram *histograms;
+    int c;
+
+    while ((c = getopt(argc, argv, "rs:")) != -1)
+    {
+        switch (c)
+        {
+            case 'r':
+                reset = 1;
+                break;
+            case 's':
+                semid = get_semid_arg(optarg, "semstat");
+                break;
+            default: // unknown or missing argument
+                print_usage_and_exit(usage);
+        }
+    }
+
+    if (optind != argc) // arguments specified
+        print_usage_and_exit(usage);
+
+    semid = get_semid(semid, "semstat");
+
+    if (reset) {
+        remove_segment(SEGMENT_SEMSTAT, semid, "semstat");
+        return;
+    }
+
+    if ((histograms = attach_semstat(semid, 0, &nsems, "semstat")) == NULL) {
+        fprintf(stderr, "ipcmd semstat: no statistics have been recorded for "
+                        "semid %i (set IPCMD_SEMSTAT=1 for ipcmd semop)\n",
+                semid);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-8s %12s %12s %12s %12s %12s\n", "sem_num", "count", "blocked",
+           "p50_usec", "p99_usec", "max_usec");
+    for (unsigned short sem_num = 0; sem_num < nsems; sem_num++) {
+        struct histogram *h = &histograms[sem_num];
+        printf("%-8hu %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64
+               " %12" PRIu64 "\n", sem_num, h->count, h->blocked,
+               histogram_percentile(h, 50), histogram_percentile(h, 99),
+               h->max_usec);
+    }
+}
+
+//**************************************
+// token-bucket rate limiting ("ipcmd ratelimit")
+//**************************************
+
+// The tokens of a bucket are the value of a one-semaphore set, so taking
+// them is a single semop(). The bucket is refilled lazily by whoever takes
+// from it: the RATELIMIT segment records the time up to which tokens have
+// been credited, and the process that advances it (by compare-and-swap) adds
+// the tokens that have accrued since, up to the burst size.
+struct ratelimit {
+    uint64_t usec_per_token;
+    uint64_t burst;
+    uint64_t stamp; // now_usec() up to which tokens have been credited
+};
+
+static struct ratelimit *attach_ratelimit(
+    int semid,
+    int create,
+    const char *ipcmd_command // whence this function was called
+) {
+    union semun arg;
+    struct semid_ds seminfo;
+    struct segment_header *header;
+
+    require_local_semid(semid, "ratelimit", ipcmd_command);
+    arg.buf = &seminfo;
+    if (semctl_any(semid, 0, IPC_STAT, arg) == -1) {
+        fprintf(stderr, "ipcmd %s (semctl()): %s\n", ipcmd_command,
+                ipcmd_semctl_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    header = attach_segment(SEGMENT_RATELIMIT, semid,
+                            sizeof(struct segment_header) +
+                            sizeof(struct ratelimit),
+                            seminfo.sem_perm.mode & 0666, create,
+                            ipcmd_command);
+    if (header == NULL) {
+        fprintf(stderr, "ipcmd %s: semid %s%i is not a rate limiter (see "
+                        "ipcmd ratelimit create)\n", ipcmd_command,
+                IS_SHMSEM(semid) ? SHMSEM_PREFIX : "",
+                IS_SHMSEM(semid) ? SHMSEM_SHMID(semid) : semid);
+        exit(EXIT_FAILURE);
+    }
+    return (struct ratelimit *)(header + 1);
+}
+
+// Credit the tokens that have accrued since r->stamp.
+//
+// RETURN VALUE
+//     The number of tokens in the bucket before any were added.
+static int ratelimit_refill(int semid, struct ratelimit *r, uint64_t now) {
+    union semun arg;
+    struct sembuf sop;
+    uint64_t stamp = r->stamp;
+    uint64_t due, stamp_new;
+    int semval;
+
+    arg.val = 0;
+    if ((semval = semctl_any(semid, 0, GETVAL, arg)) == -1) {
+        fprintf(stderr, "ipcmd ratelimit take (semctl()): %s\n",
+                ipcmd_semctl_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (now <= stamp || (due = (now - stamp) / r->usec_per_token) == 0)
+        return semval;
+    if ((uint64_t)semval + due >= r->burst) { // the rest overflows the bucket
+        due = (uint64_t)semval < r->burst ? r->burst - (uint64_t)semval : 0;
+        stamp_new = now;
+    } else
+        stamp_new = stamp + due * r->usec_per_token;
+    if (atomic_cas(&r->stamp, stamp, stamp_new) != stamp || due == 0)
+        return semval; // another process credited them
+
+    sop.sem_num = 0;
+    sop.sem_op = (short)due;
+    sop.sem_flg = 0;
+    if (semop_timed(semid, &sop, 1, NULL) == -1) {
+        fprintf(stderr, "ipcmd ratelimit take (semop()): %s\n",
+                ipcmd_semop_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return semval;
+}
+
+static void ipcmd_ratelimit(int argc, char *argv[]) {
+    const char *usage =
+    "ipcmd ratelimit create -r rate [-B burst] [-m mode] [-b backend]\n"
+    "ipcmd ratelimit take [-s semid] [-k tokens] [-n] [-w timeout]\n"
+    "                     [: command [argument...]]\n"
+    "  -r rate    : tokens added per second (may be fractional)\n"
+    "  -B burst   : bucket size, and initial tokens (default: 1)\n"
+    "  -m mode    : read/alter permissions (octal value; default: 600)\n"
+    "  -b backend : sysv (XSI semaphores; default) or shm (shared memory)\n"
+    "  -s semid   : the rate limiter's semaphore set\n"
+    "  -k tokens  : tokens to take (default: 1)\n"
+    "  -n         : exit with status 2 rather than wait\n"
+    "  -w timeout : exit with status 2 after waiting timeout seconds";
+    const char *subcommand;
+    double rate = 0;
+    int burst = 1;
+    int mode = 0600;
+    int shm = 0;
+    int semid = -1;
+    int tokens = 1;
+    int nowait = 0;
+    struct timespec timeout;
+    struct timespec *timeoutp = NULL; // non-NULL if "-w timeout" specified
+    struct ratelimit *r;
+    int command_arg = 0; // index of command after ":", if any
+    uint64_t wait_begin;
+    char *endptr;
+    int c;
+
+    if (argc < 2)
+        print_usage_and_exit(usage);
+    subcommand = argv[1];
+    argc--; argv++; // consume "ratelimit", leaving <subcommand> [options]...
+
+#ifdef __GNU_LIBRARY__
+    // disable GNU getopt() permutation of argv so any user-specified command
+    // argument(s) isn't mangled
+    while ((c = getopt(argc, argv, "+b:B:k:m:nr:s:w:")) != -1)
+#else
+    while ((c = getopt(argc, argv, "b:B:k:m:nr:s:w:")) != -1)
+#endif
+    {
+        switch (c)
+        {
+            case 'b':
+                if (strcmp(optarg, "shm") == 0)
+                    shm = 1;
+                else if (strcmp(optarg, "sysv") == 0)
+                    shm = 0;
+                else
+                    print_usage_and_exit(usage);
+                break;
+            case 'B':
+                burst = get_int_arg(optarg, "ratelimit");
+                break;
+            case 'k':
+                tokens = get_int_arg(optarg, "ratelimit");
+                break;
+            case 'm':
+                mode = get_mode_arg(optarg, "ratelimit");
+                break;
+            case 'n':
+                nowait = 1;
+                break;
+            case 'r':
+                errno = 0;
+                rate = strtod(optarg, &endptr);
+                if (errno != 0 || endptr == optarg || *endptr != '\0' ||
+                    !(rate > 0 && rate <= 1e6)) {
+                    fprintf(stderr, "ipcmd ratelimit: invalid rate (%s)\n",
+                            optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                semid = get_semid_arg(optarg, "ratelimit");
+                break;
+            case 'w':
+                timeout = get_timeout_arg(optarg, "ratelimit");
+                timeoutp = &timeout;
+                break;
+            default: // unknown or missing argument
+                print_usage_and_exit(usage);
+        }
+    }
+
+    if (strcmp(subcommand, "create") == 0) {
+        if (optind != argc || rate == 0 || burst <= 0 ||
+            burst > SHMSEM_SEMVMX)
+            print_usage_and_exit(usage);
+        semid = shm ? shmsem_get(IPC_PRIVATE, 1, IPC_CREAT | IPC_EXCL | mode) :
+                      semget(IPC_PRIVATE, 1, IPC_CREAT | IPC_EXCL | mode);
+        if (semid == -1) {
+            fprintf(stderr, "ipcmd ratelimit create (semget()): %s\n",
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        r = attach_ratelimit(semid, 1, "ratelimit create");
+        r->usec_per_token = (uint64_t)(1e6 / rate);
+        if (r->usec_per_token == 0)
+            r->usec_per_token = 1;
+        r->burst = (uint64_t)burst;
+        r->stamp = now_usec();
+        union semun arg;
+        arg.val = burst;
+        if (semctl_any(semid, 0, SETVAL, arg) == -1) {
+            fprintf(stderr, "ipcmd ratelimit create (semctl()): %s\n",
+                    ipcmd_semctl_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        trace_object(semid, 0, "create");
+        if (IS_SHMSEM(semid))
+            printf(SHMSEM_PREFIX "%i\n", SHMSEM_SHMID(semid));
+        else
+            printf("%i\n", semid);
+        return;
+    } else if (strcmp(subcommand, "take") != 0)
+        print_usage_and_exit(usage);
+
+    if (optind < argc) { // ": command [argument...]"
+        if (strcmp(argv[optind], ":") != 0 || optind+1 == argc)
+            print_usage_and_exit(usage);
+        command_arg = optind+1;
+    }
+    semid = get_semid(semid, "ratelimit take");
+    r = attach_ratelimit(semid, 0, "ratelimit take");
+    if (tokens <= 0 || (uint64_t)tokens > r->burst) {
+        fprintf(stderr, "ipcmd ratelimit take: can't take %i tokens from a "
+                        "bucket of %" PRIu64 "\n", tokens, r->burst);
+        exit(EXIT_FAILURE);
+    }
+    trace_object(semid, 0, "take %i", tokens);
+
+    // Until the tokens are taken: credit those that have accrued, then wait
+    // in semop() until either enough are there (others may add them) or
+    // enough should have accrued, whichever comes first.
+    uint64_t start = now_usec();
+    uint64_t deadline = timeoutp ? start + (uint64_t)timeoutp->tv_sec *
+                        1000000 + (uint64_t)timeoutp->tv_nsec / 1000 : 0;
+    wait_begin = trace_clock();
+    for (uint64_t now = start; ; now = now_usec()) {
+        struct sembuf sop;
+        struct timespec wait;
+        int semval = ratelimit_refill(semid, r, now);
+        uint64_t usec = 0;
+
+        if (semval < tokens) {
+            // the next token accrues usec_per_token after r->stamp
+            uint64_t stamp = r->stamp;
+            usec = (uint64_t)(tokens - semval) * r->usec_per_token;
+            usec = stamp + usec > now ? stamp + usec - now : 1;
+        }
+        if (timeoutp && now + usec > deadline)
+            usec = deadline > now ? deadline - now : 0;
+        wait.tv_sec = (time_t)(usec / 1000000);
+        wait.tv_nsec = (long)(usec % 1000000) * 1000;
+
+        sop.sem_num = 0;
+        sop.sem_op = (short)-tokens;
+        sop.sem_flg = nowait ? IPC_NOWAIT : 0;
+        if (semop_timed(semid, &sop, 1, nowait ? NULL : &wait) == 0)
             break;
-        // 2010-10-10: For OS X 10.5/10.6, SETVAL works with values up to 32767;
-        // however, it doesn't report an error for values >= 32767.
-        case SETVAL:
-            if (optind == argc) // if missing SEMNUM operand
-                print_usage_and_exit(usage);
-            semnum = get_int_arg(argv[optind++], "semctl");
-            if (optind == argc) // if missing VALUE operand
+        if (errno != EAGAIN && errno != EINTR) {
+            fprintf(stderr, "ipcmd ratelimit take (semop()): %s\n",
+                    ipcmd_semop_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (nowait || (timeoutp && now_usec() >= deadline)) {
+            trace_wait(wait_begin);
+            exit(2);
+        }
+    }
+    trace_wait(wait_begin);
+
+    if (command_arg) {
+        trace_close(); // atexit() functions aren't called on exec
+        if (execvp(argv[command_arg], &argv[command_arg]) == -1) {
+            perror("ipcmd ratelimit: execvp");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+//**************************************
+// FIFO-fair queued mutex ("ipcmd mutex")
+//**************************************
+
+// A ticket lock: the MUTEX segment holds the next ticket to hand out and the
+// ticket being served, and each ticket t waits on semaphore t % slots, so a
+// waiter sleeps on a semaphore of its own. Unlocking advances the ticket
+// being served and posts its semaphore, waking exactly one process, the
+// longest waiting. Slot 0 starts at 1, for ticket 0.
+//
+// Each slot also records the (low 32 bits of the) ticket waiting on it and
+// its waiter's process ID, so that unlocking can skip a ticket whose waiter
+// has died, or has given up (MUTEX_ABANDONED) on SIGINT or SIGTERM. The
+// unlocking process marks the ticket it hands the mutex to MUTEX_HANDED,
+// even before its waiter has recorded itself; each of the two changes the
+// record only if the other hasn't.
+#define MUTEX_SLOTS_DEFAULT 64
+#define MUTEX_POLL_USEC 100000 // how often a waiter checks for a signal
+#define MUTEX_ABANDONED 0
+#define MUTEX_HANDED UINT32_MAX
+#define MUTEX_RECORD(ticket, pid) \
+    ((uint64_t)(uint32_t)(ticket) << 32 | (uint32_t)(pid))
+
+struct mutex {
+    uint64_t next; // next ticket to hand out
+    uint64_t serving; // ticket holding (or about to hold) the mutex
+    uint64_t slots;
+    uint64_t waiter[]; // one MUTEX_RECORD per slot
+};
+
+static struct mutex *attach_mutex(
+    int semid,
+    int create,
+    const char *ipcmd_command // whence this function was called
+) {
+    union semun arg;
+    struct semid_ds seminfo;
+    struct segment_header *header;
+
+    require_local_semid(semid, "mutex", ipcmd_command);
+    arg.buf = &seminfo;
+    if (semctl_any(semid, 0, IPC_STAT, arg) == -1) {
+        fprintf(stderr, "ipcmd %s (semctl()): %s\n", ipcmd_command,
+                ipcmd_semctl_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    header = attach_segment(SEGMENT_MUTEX, semid,
+                            sizeof(struct segment_header) +
+                            sizeof(struct mutex) +
+                            seminfo.sem_nsems * sizeof(uint64_t), // a slot each
+                            seminfo.sem_perm.mode & 0666, create,
+                            ipcmd_command);
+    if (header == NULL) {
+        fprintf(stderr, "ipcmd %s: semid %s%i is not a mutex (see "
+                        "ipcmd mutex create)\n", ipcmd_command,
+                IS_SHMSEM(semid) ? SHMSEM_PREFIX : "",
+                IS_SHMSEM(semid) ? SHMSEM_SHMID(semid) : semid);
+        exit(EXIT_FAILURE);
+    }
+    return (struct mutex *)(header + 1);
+}
+
+static volatile sig_atomic_t mutex_signal; // caught while waiting
+
+static void mutex_catch(int sig) {
+    mutex_signal = sig;
+}
+
+// Restore the dispositions of SIGINT and SIGTERM saved at old, and deliver
+// the one caught (if any) while waiting.
+static void mutex_restore(const struct sigaction old[2]) {
+    sigaction(SIGINT, &old[0], NULL);
+    sigaction(SIGTERM, &old[1], NULL);
+    if (mutex_signal)
+        raise(mutex_signal);
+}
+
+static void mutex_unlock(int semid, struct mutex *m) {
+    struct sembuf sop;
+    uint64_t ticket;
+
+    do {
+        ticket = m->serving;
+        if (m->next == ticket) {
+            fprintf(stderr, "ipcmd mutex unlock: the mutex isn't locked\n");
+            exit(EXIT_FAILURE);
+        }
+    } while (atomic_cas(&m->serving, ticket, ticket + 1) != ticket);
+
+    // hand the mutex to the next ticket whose waiter is alive and waiting (or
+    // that hasn't been handed out yet)
+    for (ticket++; ; ) {
+        volatile uint64_t *record = &m->waiter[ticket % m->slots];
+        uint64_t old = *record;
+        pid_t pid = (pid_t)(uint32_t)old;
+        if (old >> 32 == (uint32_t)ticket &&
+            old != MUTEX_RECORD(ticket, MUTEX_HANDED) &&
+            (pid == MUTEX_ABANDONED || (kill(pid, 0) == -1 &&
+                                        errno == ESRCH))) {
+            atomic_add(&m->serving, 1); // skip it
+            ticket++;
+        } else if (atomic_cas(record, old, MUTEX_RECORD(ticket, MUTEX_HANDED))
+                   == old)
+            break;
+    }
+
+    sop.sem_num = (unsigned short)(ticket % m->slots);
+    sop.sem_op = 1;
+    sop.sem_flg = 0;
+    if (semop_timed(semid, &sop, 1, NULL) == -1) {
+        fprintf(stderr, "ipcmd mutex unlock (semop()): %s\n",
+                ipcmd_semop_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Take a ticket and wait for its turn. With nowait, take one only if the
+// mutex is unlocked. SIGINT or SIGTERM (unless ignored) gives up the ticket,
+// or unlocks the mutex if it has just been handed over, before taking
+// effect. A signal caught just before the wait begins doesn't interrupt it,
+// so the wait is cut into MUTEX_POLL_USEC intervals, after each of which the
+// signal is checked for again.
+//
+// RETURN VALUE
+//     0 once the mutex is held, or -1 if nowait is nonzero and it is locked.
+static int mutex_lock(int semid, struct mutex *m, int nowait) {
+    const struct timespec interval = {0, MUTEX_POLL_USEC * 1000};
+    struct sigaction sa, old[2];
+    sigset_t signals, unblocked;
+    struct sembuf sop;
+    volatile uint64_t *record;
+    uint64_t ticket, mine, seen;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sa.sa_handler = mutex_catch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0; // interrupt semop()
+    sigaction(SIGINT, &sa, &old[0]);
+    sigaction(SIGTERM, &sa, &old[1]);
+    if (old[0].sa_handler == SIG_IGN) // left ignored by the shell, say
+        sigaction(SIGINT, &old[0], NULL);
+    if (old[1].sa_handler == SIG_IGN)
+        sigaction(SIGTERM, &old[1], NULL);
+
+    if (nowait) {
+        ticket = m->serving;
+        if (atomic_cas(&m->next, ticket, ticket + 1) != ticket) {
+            mutex_restore(old);
+            return -1;
+        }
+        // the previous holder may not have posted the slot quite yet, so
+        // this waits (briefly) all the same
+    } else
+        ticket = atomic_add(&m->next, 1) - 1;
+
+    // record this process as the ticket's waiter, unless it has been handed
+    // the mutex already
+    record = &m->waiter[ticket % m->slots];
+    mine = MUTEX_RECORD(ticket, getpid());
+    for (uint64_t was = *record; was != MUTEX_RECORD(ticket, MUTEX_HANDED);
+         was = seen)
+        if ((seen = atomic_cas(record, was, mine)) == was)
+            break;
+
+    sop.sem_num = (unsigned short)(ticket % m->slots);
+    sop.sem_op = -1;
+    sop.sem_flg = 0;
+    for (;;) {
+        // no signal can arrive between checking for one and giving up
+        sigprocmask(SIG_BLOCK, &signals, &unblocked);
+        if (mutex_signal && atomic_cas(record, mine, MUTEX_RECORD(ticket,
+                                       MUTEX_ABANDONED)) == mine) {
+            sigprocmask(SIG_SETMASK, &unblocked, NULL);
+            mutex_restore(old); // given up before being handed the mutex
+            exit(128 + mutex_signal); // if the signal is handled or blocked
+        }
+        sigprocmask(SIG_SETMASK, &unblocked, NULL);
+        if (semop_timed(semid, &sop, 1, &interval) == 0)
+            break;
+        if (errno != EINTR && errno != EAGAIN) {
+            fprintf(stderr, "ipcmd mutex lock (semop()): %s\n",
+                    ipcmd_semop_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (mutex_signal)
+        mutex_unlock(semid, m);
+    mutex_restore(old);
+    return 0;
+}
+
+static void ipcmd_mutex(int argc, char *argv[]) {
+    const char *usage =
+    "ipcmd mutex create [-N slots] [-m mode] [-b backend]\n"
+    "ipcmd mutex lock [-s semid] [-n]\n"
+    "ipcmd mutex unlock [-s semid]\n"
+    "ipcmd mutex run [-s semid] [-n] : command [argument...]\n"
+    "  -N slots   : semaphores to queue waiters on; more waiters than slots\n"
+    "               are not served in order (default: 64)\n"
+    "  -m mode    : read/alter permissions (octal value; default: 600)\n"
+    "  -b backend : sysv (XSI semaphores; default) or shm (shared memory)\n"
+    "  -s semid   : the mutex's semaphore set\n"
+    "  -n         : exit with status 2 rather than wait";
+    const char *subcommand;
+    int slots = MUTEX_SLOTS_DEFAULT;
+    int mode = 0600;
+    int shm = 0;
+    int semid = -1;
+    int nowait = 0;
+    struct mutex *m;
+    uint64_t wait_begin;
+    pid_t pid;
+    int status;
+    int c;
+
+    if (argc < 2)
+        print_usage_and_exit(usage);
+    subcommand = argv[1];
+    argc--; argv++; // consume "mutex", leaving <subcommand> [options]...
+
+#ifdef __GNU_LIBRARY__
+    // disable GNU getopt() permutation of argv so any user-specified command
+    // argument(s) isn't mangled
+    while ((c = getopt(argc, argv, "+b:m:nN:s:")) != -1)
+#else
+    while ((c = getopt(argc, argv, "b:m:nN:s:")) != -1)
+#endif
+    {
+        switch (c)
+        {
+            case 'b':
+                if (strcmp(optarg, "shm") == 0)
+                    shm = 1;
+                else if (strcmp(optarg, "sysv") == 0)
+                    shm = 0;
+                else
+                    print_usage_and_exit(usage);
+                break;
+            case 'm':
+                mode = get_mode_arg(optarg, "mutex");
+                break;
+            case 'n':
+                nowait = 1;
+                break;
+            case 'N':
+                slots = get_int_arg(optarg, "mutex");
+                break;
+            case 's':
+                semid = get_semid_arg(optarg, "mutex");
+                break;
+            default: // unknown or missing argument
                 print_usage_and_exit(usage);
-            arg.val = get_int_arg(argv[optind++], "semctl setval VALUE");
-            if (optind != argc) // if arguments after VALUE
+        }
+    }
+
+    if (strcmp(subcommand, "create") == 0) {
+        union semun arg;
+        if (optind != argc || slots <= 0 || slots > USHRT_MAX)
+            print_usage_and_exit(usage);
+        semid = shm ? shmsem_get(IPC_PRIVATE, slots,
+                                 IPC_CREAT | IPC_EXCL | mode) :
+                      semget(IPC_PRIVATE, slots, IPC_CREAT | IPC_EXCL | mode);
+        if (semid == -1) {
+            fprintf(stderr, "ipcmd mutex create (semget()): %s\n",
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        m = attach_mutex(semid, 1, "mutex create");
+        m->slots = (uint64_t)slots;
+        arg.val = 1; // for ticket 0
+        if (semctl_any(semid, 0, SETVAL, arg) == -1) {
+            fprintf(stderr, "ipcmd mutex create (semctl()): %s\n",
+                    ipcmd_semctl_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        trace_object(semid, 0, "create");
+        if (IS_SHMSEM(semid))
+            printf(SHMSEM_PREFIX "%i\n", SHMSEM_SHMID(semid));
+        else
+            printf("%i\n", semid);
+        return;
+    }
+
+    if (strcmp(subcommand, "run") == 0) {
+        // "--" has been consumed by getopt(), if used rather than ":"
+        if (optind < argc && strcmp(argv[optind], ":") == 0)
+            optind++;
+        if (optind == argc)
+            print_usage_and_exit(usage);
+    } else if ((strcmp(subcommand, "lock") != 0 &&
+                strcmp(subcommand, "unlock") != 0) || optind != argc ||
+               (nowait && strcmp(subcommand, "unlock") == 0))
+        print_usage_and_exit(usage);
+
+    semid = get_semid(semid, "mutex");
+    m = attach_mutex(semid, 0, "mutex");
+    trace_object(semid, 0, "%s", subcommand);
+    if (strcmp(subcommand, "unlock") == 0) {
+        mutex_unlock(semid, m);
+        return;
+    }
+
+    wait_begin = trace_clock();
+    if (mutex_lock(semid, m, nowait) == -1) {
+        trace_wait(wait_begin);
+        exit(2);
+    }
+    trace_wait(wait_begin);
+    if (strcmp(subcommand, "lock") == 0)
+        return;
+
+    // run: unlock once the command has exited, however it exits
+    if ((pid = fork()) == -1) {
+        perror("ipcmd mutex run: fork");
+        mutex_unlock(semid, m);
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        execvp(argv[optind], &argv[optind]);
+        fprintf(stderr, "ipcmd mutex run: %s: %s\n", argv[optind],
+                strerror(errno));
+        _exit(127);
+    }
+    signal(SIGINT, SIG_IGN); // the command decides whether to stop
+    signal(SIGQUIT, SIG_IGN);
+    while (waitpid(pid, &status, 0) == -1)
+        if (errno != EINTR) {
+            perror("ipcmd mutex run: waitpid");
+            mutex_unlock(semid, m);
+            exit(EXIT_FAILURE);
+        }
+    mutex_unlock(semid, m);
+    exit(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+}
+
+//**************************************
+// broadcast events and countdown latches ("ipcmd event", "ipcmd latch")
+//**************************************
+
+// An event is a set of two semaphores: waiters wait for EVENT_GATE to be 0,
+// so one semop() that opens the gate wakes them all. EVENT_LATCHED is 1 while
+// the event is set; a pulse opens the gate without it, and closes the gate
+// again (unless the event has been set meanwhile) once the waiters are gone.
+// The states (gate, latched) are thus (1, 0): reset, (0, 1): set, and (0, 0):
+// pulsing.
+enum {EVENT_GATE, EVENT_LATCHED};
+// A pulse gives up waiting for the waiters to go once their count hasn't
+// fallen for this long, so a stopped waiter (with the shm backend) can't hold
+// the gate open; it misses the pulse instead. Meanwhile it sleeps between
+// checks, the interval doubling from EVENT_PULSE_MIN_NSEC to
+// EVENT_PULSE_MAX_NSEC while the count doesn't fall.
+#define EVENT_PULSE_USEC 500000
+#define EVENT_PULSE_MIN_NSEC 50000
+#define EVENT_PULSE_MAX_NSEC 16000000
+
+// A latch is a one-semaphore set counting the arrivals still expected;
+// waiters wait for it to be 0.
+
+// Create a semaphore set of nsems semaphores, set the first to value, and
+// write its identifier to standard output.
+static void sync_create(
+    int nsems,
+    int value,
+    int mode,
+    int shm,
+    const char *ipcmd_command // whence this function was called
+) {
+    union semun arg;
+    int semid = shm ? shmsem_get(IPC_PRIVATE, nsems, IPC_CREAT|IPC_EXCL|mode) :
+                      semget(IPC_PRIVATE, nsems, IPC_CREAT | IPC_EXCL | mode);
+    if (semid == -1) {
+        fprintf(stderr, "ipcmd %s (semget()): %s\n", ipcmd_command,
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    arg.val = value;
+    if (semctl_any(semid, 0, SETVAL, arg) == -1) {
+        fprintf(stderr, "ipcmd %s (semctl()): %s\n", ipcmd_command,
+                ipcmd_semctl_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    trace_object(semid, 0, "create");
+    if (IS_SHMSEM(semid))
+        printf(SHMSEM_PREFIX "%i\n", SHMSEM_SHMID(semid));
+    else
+        printf("%i\n", semid);
+}
+
+// Perform the nsops operations at sops atomically, without waiting.
+//
+// RETURN VALUE
+//     0 if they were performed, or -1 if they couldn't be at once. The program
+//     exits on any other error.
+static int sync_try(
+    int semid,
+    struct sembuf *sops,
+    size_t nsops,
+    const char *ipcmd_command // whence this function was called
+) {
+    for (size_t i = 0; i < nsops; i++)
+        sops[i].sem_flg = IPC_NOWAIT;
+    if (semop_timed(semid, sops, nsops, NULL) == 0)
+        return 0;
+    if (errno != EAGAIN) {
+        fprintf(stderr, "ipcmd %s (semop()): %s\n", ipcmd_command,
+                ipcmd_semop_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return -1;
+}
+
+// Wait for semaphore semnum to be 0, exiting with status 2 if that would
+// mean waiting and nowait is 1, or once timeout (if not NULL) has elapsed.
+static void sync_wait(
+    int semid,
+    int semnum,
+    int nowait,
+    const struct timespec *timeout,
+    const char *ipcmd_command // whence this function was called
+) {
+    struct sembuf sop;
+    uint64_t wait_begin = trace_clock();
+    int status;
+
+    sop.sem_num = (unsigned short)semnum;
+    sop.sem_op = 0;
+    sop.sem_flg = nowait ? IPC_NOWAIT : 0;
+    do
+        status = semop_timed(semid, &sop, 1, timeout);
+    while (status == -1 && errno == EINTR && timeout == NULL);
+    trace_wait(wait_begin);
+    if (status == -1) {
+        if (errno == EAGAIN || errno == EINTR)
+            exit(2);
+        fprintf(stderr, "ipcmd %s (semop()): %s\n", ipcmd_command,
+                ipcmd_semop_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void ipcmd_event(int argc, char *argv[]) {
+    const char *usage =
+    "ipcmd event create [-m mode] [-b backend]\n"
+    "ipcmd event wait [-s semid] [-n] [-w timeout]\n"
+    "ipcmd event set|reset|pulse [-s semid]\n"
+    "  -m mode    : read/alter permissions (octal value; default: 600)\n"
+    "  -b backend : sysv (XSI semaphores; default) or shm (shared memory)\n"
+    "  -s semid   : the event's semaphore set\n"
+    "  -n         : exit with status 2 rather than wait\n"
+    "  -w timeout : exit with status 2 after waiting timeout seconds";
+    const char *subcommand;
+    int mode = 0600;
+    int shm = 0;
+    int semid = -1;
+    int nowait = 0;
+    struct timespec timeout;
+    struct timespec *timeoutp = NULL; // non-NULL if "-w timeout" specified
+    struct sembuf sops[3];
+    union semun arg;
+    int c;
+
+    if (argc < 2)
+        print_usage_and_exit(usage);
+    subcommand = argv[1];
+    argc--; argv++; // consume "event", leaving <subcommand> [options]...
+
+    while ((c = getopt(argc, argv, "b:m:ns:w:")) != -1)
+    {
+        switch (c)
+        {
+            case 'b':
+                if (strcmp(optarg, "shm") == 0)
+                    shm = 1;
+                else if (strcmp(optarg, "sysv") == 0)
+                    shm = 0;
+                else
+                    print_usage_and_exit(usage);
+                break;
+            case 'm':
+                mode = get_mode_arg(optarg, "event");
+                break;
+            case 'n':
+                nowait = 1;
+                break;
+            case 's':
+                semid = get_semid_arg(optarg, "event");
+                break;
+            case 'w':
+                timeout = get_timeout_arg(optarg, "event");
+                timeoutp = &timeout;
+                break;
+            default: // unknown or missing argument
                 print_usage_and_exit(usage);
-            if (semctl(semid, semnum, cmd, arg) == -1) {
-                fprintf(stderr, "ipcmd semctl setval (semctl()): %s\n",
+        }
+    }
+    if (optind != argc)
+        print_usage_and_exit(usage);
+
+    if (strcmp(subcommand, "create") == 0) {
+        sync_create(2, 1, mode, shm, "event create"); // reset
+        return;
+    }
+
+    semid = get_semid(semid, "event");
+    trace_object(semid, 0, "%s", subcommand);
+    memset(sops, 0, sizeof(sops));
+    if (strcmp(subcommand, "wait") == 0)
+        sync_wait(semid, EVENT_GATE, nowait, timeoutp, "event wait");
+    else if (strcmp(subcommand, "set") == 0) {
+        // from reset, or from pulsing; otherwise, it's already set
+        sops[0].sem_num = EVENT_GATE;    sops[0].sem_op = -1;
+        sops[1].sem_num = EVENT_LATCHED; sops[1].sem_op = 1;
+        if (sync_try(semid, sops, 2, "event set") == -1) {
+            sops[0].sem_num = EVENT_GATE;    sops[0].sem_op = 0;
+            sops[1].sem_num = EVENT_LATCHED; sops[1].sem_op = 0;
+            sops[2].sem_num = EVENT_LATCHED; sops[2].sem_op = 1;
+            sync_try(semid, sops, 3, "event set");
+        }
+    } else if (strcmp(subcommand, "reset") == 0) {
+        // from set, or from pulsing; otherwise, it's already reset
+        sops[0].sem_num = EVENT_LATCHED; sops[0].sem_op = -1;
+        sops[1].sem_num = EVENT_GATE;    sops[1].sem_op = 1;
+        if (sync_try(semid, sops, 2, "event reset") == -1) {
+            sops[0].sem_num = EVENT_LATCHED; sops[0].sem_op = 0;
+            sops[1].sem_num = EVENT_GATE;    sops[1].sem_op = 0;
+            sops[2].sem_num = EVENT_GATE;    sops[2].sem_op = 1;
+            sync_try(semid, sops, 3, "event reset");
+        }
+    } else if (strcmp(subcommand, "pulse") == 0) {
+        // only from reset: if set, the waiters have been woken already
+        sops[0].sem_num = EVENT_LATCHED; sops[0].sem_op = 0;
+        sops[1].sem_num = EVENT_GATE;    sops[1].sem_op = -1;
+        if (sync_try(semid, sops, 2, "event pulse") == -1)
+            return;
+        // The waiters' operations complete as the gate opens (or, with the
+        // shm backend, they are counted until they have), so they are gone
+        // once there are none waiting for it.
+        arg.val = 0;
+        uint64_t progress = 0; // when the count of waiters last fell
+        struct timespec interval = {0, EVENT_PULSE_MIN_NSEC};
+        for (int last = INT_MAX; ; ) {
+            int zcnt = semctl_any(semid, EVENT_GATE, GETZCNT, arg);
+            if (zcnt == -1) {
+                fprintf(stderr, "ipcmd event pulse (semctl()): %s\n",
                         ipcmd_semctl_strerror(errno));
                 exit(EXIT_FAILURE);
             }
-            break;
-        case SETALL:
-            if (optind == argc) // missing SEMVAL operands
+            if (zcnt == 0)
+                break;
+            if (zcnt < last) {
+                progress = now_usec();
+                last = zcnt;
+                interval.tv_nsec = EVENT_PULSE_MIN_NSEC;
+            } else if (now_usec() - progress >= EVENT_PULSE_USEC)
+                break;
+            else if (interval.tv_nsec < EVENT_PULSE_MAX_NSEC)
+                interval.tv_nsec *= 2;
+            nanosleep(&interval, NULL);
+        }
+        sops[0].sem_num = EVENT_LATCHED; sops[0].sem_op = 0;
+        sops[1].sem_num = EVENT_GATE;    sops[1].sem_op = 0;
+        sops[2].sem_num = EVENT_GATE;    sops[2].sem_op = 1;
+        sync_try(semid, sops, 3, "event pulse"); // unless set meanwhile
+    } else
+        print_usage_and_exit(usage);
+}
+
+static void ipcmd_latch(int argc, char *argv[]) {
+    const char *usage =
+    "ipcmd latch init [-m mode] [-b backend] count\n"
+    "ipcmd latch arrive [-s semid] [-k arrivals]\n"
+    "ipcmd latch wait [-s semid] [-n] [-w timeout]\n"
+    "  -m mode      : read/alter permissions (octal value; default: 600)\n"
+    "  -b backend   : sysv (XSI semaphores; default) or shm (shared memory)\n"
+    "  -s semid     : the latch's semaphore set\n"
+    "  -k arrivals  : arrivals to count (default: 1)\n"
+    "  -n           : exit with status 2 rather than wait\n"
+    "  -w timeout   : exit with status 2 after waiting timeout seconds";
+    const char *subcommand;
+    int mode = 0600;
+    int shm = 0;
+    int semid = -1;
+    int arrivals = 1;
+    int nowait = 0;
+    struct timespec timeout;
+    struct timespec *timeoutp = NULL; // non-NULL if "-w timeout" specified
+    int c;
+
+    if (argc < 2)
+        print_usage_and_exit(usage);
+    subcommand = argv[1];
+    argc--; argv++; // consume "latch", leaving <subcommand> [options]...
+
+    while ((c = getopt(argc, argv, "b:k:m:ns:w:")) != -1)
+    {
+        switch (c)
+        {
+            case 'b':
+                if (strcmp(optarg, "shm") == 0)
+                    shm = 1;
+                else if (strcmp(optarg, "sysv") == 0)
+                    shm = 0;
+                else
+                    print_usage_and_exit(usage);
+                break;
+            case 'k':
+                arrivals = get_int_arg(optarg, "latch");
+                break;
+            case 'm':
+                mode = get_mode_arg(optarg, "latch");
+                break;
+            case 'n':
+                nowait = 1;
+                break;
+            case 's':
+                semid = get_semid_arg(optarg, "latch");
+                break;
+            case 'w':
+                timeout = get_timeout_arg(optarg, "latch");
+                timeoutp = &timeout;
+                break;
+            default: // unknown or missing argument
                 print_usage_and_exit(usage);
+        }
+    }
 
-            // need to know sem_nsems
-            arg.buf = &seminfo;
-            if (semctl(semid, 0, IPC_STAT, arg) == -1) {
-                fprintf(stderr, "ipcmd semctl setall (semctl()): %s\n",
-                        ipcmd_semctl_strerror(errno));
+    if (strcmp(subcommand, "init") == 0) {
+        int count;
+        if (optind+1 != argc)
+            print_usage_and_exit(usage);
+        count = get_int_arg(argv[optind], "latch");
+        if (count < 0 || count > SHMSEM_SEMVMX) {
+            fprintf(stderr, "ipcmd latch init: count must be between 0 and "
+                            "%i\n", SHMSEM_SEMVMX);
+            exit(EXIT_FAILURE);
+        }
+        sync_create(1, count, mode, shm, "latch init");
+        return;
+    }
+    if (optind != argc)
+        print_usage_and_exit(usage);
+
+    semid = get_semid(semid, "latch");
+    trace_object(semid, 0, "%s", subcommand);
+    if (strcmp(subcommand, "wait") == 0)
+        sync_wait(semid, 0, nowait, timeoutp, "latch wait");
+    else if (strcmp(subcommand, "arrive") == 0) {
+        struct sembuf sop;
+        if (arrivals <= 0 || arrivals > SHMSEM_SEMVMX)
+            print_usage_and_exit(usage);
+        sop.sem_num = 0;
+        sop.sem_op = (short)-arrivals;
+        if (sync_try(semid, &sop, 1, "latch arrive") == -1)
+            exit(2); // fewer arrivals than that were still expected
+    } else
+        print_usage_and_exit(usage);
+}
+
+//**************************************
+// dependency-graph job runner ("ipcmd dag")
+//**************************************
+
+// Each target's semaphore counts its dependencies that haven't finished. A
+// worker that finishes a target decrements its dependents' semaphores (in
+// arrays of up to DAG_SEMOPS_MAX operations, or SEMOPM if smaller, each
+// performed atomically), and
+// queues those that reach 0 on a private message queue from which all
+// workers receive. Queuing is decided by compare-and-swap on the target's
+// state in a shared memory segment, which also records run times.
+#define DAG_SEMOPS_MAX 32
+#define DAG_STOP (-1) // a message telling a worker to exit
+
+enum {DAG_PENDING, DAG_QUEUED, DAG_DONE, DAG_FAILED, DAG_SKIPPED};
+
+struct dag_node {
+    char *target;
+    char *command; // NULL if none
+    int line; // in the spec
+    char *deps_text; // the unparsed dependencies, while parsing
+    size_t ndeps;
+    int *deps;
+    size_t ndependents;
+    int *dependents;
+};
+
+struct dag_state {
+    uint64_t state;
+    uint64_t start; // now_usec()
+    uint64_t end;
+    int status; // of the command, as from waitpid()
+};
+
+struct dag_shared {
+    uint64_t remaining; // targets not done, failed, or skipped
+    uint64_t stopping; // 1 once workers have been told to exit
+    struct dag_state node[];
+};
+
+struct dag {
+    size_t n;
+    struct dag_node *node;
+    int *order; // topological
+    int semid;
+    int msqid;
+    int workers;
+    int keep_going;
+    int semops; // operations per semop()
+    struct dag_shared *shared;
+    int *local; // targets this worker couldn't queue, to run itself
+    size_t nlocal;
+};
+
+struct dag_msg {long mtype; int node;};
+
+static int dag_find(const struct dag *g, const char *target) {
+    for (size_t i = 0; i < g->n; i++)
+        if (strcmp(g->node[i].target, target) == 0)
+            return (int)i;
+    return -1;
+}
+
+// Parse a spec: lines of the form "target: [dependency...] [; command]",
+// ignoring empty lines and those beginning with '#'. The text is modified in
+// place, and referred to by g.
+static void dag_parse(struct dag *g, char *text, const char *spec) {
+    size_t lines = 1, nedges = 0;
+    int *edges;
+    char *p, *line, *next;
+    int lineno = 0;
+
+    for (p = text; *p; p++)
+        lines += *p == '\n';
+    if ((g->node = calloc(lines, sizeof(*g->node))) == NULL) {
+        perror("ipcmd dag: calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    // targets and commands first, so dependencies may be declared later
+    for (line = text; line; line = next) {
+        struct dag_node *node = &g->node[g->n];
+        char *colon, *semicolon;
+        lineno++;
+        if ((next = strchr(line, '\n')) != NULL)
+            *next++ = '\0';
+        line += strspn(line, " \t");
+        if (*line == '\0' || *line == '#')
+            continue;
+        if ((colon = strchr(line, ':')) == NULL) {
+            fprintf(stderr, "ipcmd dag: %s:%i: missing ':'\n", spec, lineno);
+            exit(EXIT_FAILURE);
+        }
+        *colon = '\0';
+        if ((semicolon = strchr(colon+1, ';')) != NULL) {
+            *semicolon = '\0';
+            node->command = semicolon+1 + strspn(semicolon+1, " \t");
+            if (*node->command == '\0')
+                node->command = NULL;
+        }
+        node->target = strtok(line, " \t");
+        if (node->target == NULL || strtok(NULL, " \t") != NULL) {
+            fprintf(stderr, "ipcmd dag: %s:%i: expected one target before "
+                            "':'\n", spec, lineno);
+            exit(EXIT_FAILURE);
+        }
+        if (dag_find(g, node->target) != -1) {
+            fprintf(stderr, "ipcmd dag: %s:%i: %s: duplicate target\n", spec,
+                    lineno, node->target);
+            exit(EXIT_FAILURE);
+        }
+        node->line = lineno;
+        node->deps_text = colon+1;
+        g->n++;
+    }
+
+    // then dependencies, and from them, dependents (all in edges[])
+    for (size_t i = 0; i < g->n; i++) {
+        char *deps = g->node[i].deps_text;
+        size_t ndeps = 0;
+        int *node_deps;
+        for (p = deps; *p; ) { // count them
+            p += strspn(p, " \t");
+            if (*p) {
+                ndeps++;
+                p += strcspn(p, " \t");
+            }
+        }
+        if ((node_deps = malloc((ndeps ? ndeps : 1) * sizeof(int))) == NULL) {
+            perror("ipcmd dag: malloc");
+            exit(EXIT_FAILURE);
+        }
+        g->node[i].ndeps = 0;
+        for (p = strtok(deps, " \t"); p; p = strtok(NULL, " \t")) {
+            int dep = dag_find(g, p);
+            if (dep == -1) {
+                fprintf(stderr, "ipcmd dag: %s:%i: %s: no such target\n",
+                        spec, g->node[i].line, p);
                 exit(EXIT_FAILURE);
             }
+            node_deps[g->node[i].ndeps++] = dep;
+            g->node[dep].ndependents++;
+        }
+        g->node[i].deps = node_deps;
+        nedges += ndeps;
+    }
+    if ((edges = malloc((nedges ? nedges : 1) * sizeof(int))) == NULL) {
+        perror("ipcmd dag: malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < g->n; i++) {
+        g->node[i].dependents = edges;
+        edges += g->node[i].ndependents;
+        g->node[i].ndependents = 0;
+    }
+    for (size_t i = 0; i < g->n; i++)
+        for (size_t j = 0; j < g->node[i].ndeps; j++) {
+            struct dag_node *dep = &g->node[g->node[i].deps[j]];
+            dep->dependents[dep->ndependents++] = (int)i;
+        }
+}
 
-            // NOTE: The (short) cast is used because Linux 2.4+ defines
-            // sem_nsems as an unsigned long int, while everyone else (and
-            // SUSv4) defines it as an unsigned short. This should never
-            // be > USHRT_MAX anyway, as the sem_num member of struct sembuf
-            // is unsigned short, and it wouldn't make sense to have more
-            // semaphores than could be operated on.
-            sem_nsems = (short)arg.buf->sem_nsems;
+// Order the targets topologically (Kahn's algorithm), exiting if there is a
+// cycle.
+static void dag_sort(struct dag *g) {
+    size_t *pending, head = 0, tail = 0;
 
-            if ((arg.array = 
-                (unsigned short *)malloc(sem_nsems*sizeof(unsigned short)))
-                == NULL) {
-                perror("ipcmd semctl setall: malloc");
-                exit(EXIT_FAILURE);
+    if ((g->order = malloc((g->n ? g->n : 1) * sizeof(int))) == NULL ||
+        (pending = malloc((g->n ? g->n : 1) * sizeof(size_t))) == NULL) {
+        perror("ipcmd dag: malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < g->n; i++)
+        if ((pending[i] = g->node[i].ndeps) == 0)
+            g->order[tail++] = (int)i;
+    while (head < tail) {
+        struct dag_node *node = &g->node[g->order[head++]];
+        for (size_t j = 0; j < node->ndependents; j++)
+            if (--pending[node->dependents[j]] == 0)
+                g->order[tail++] = node->dependents[j];
+    }
+    if (tail < g->n) {
+        for (size_t i = 0; i < g->n; i++)
+            if (pending[i] > 0) {
+                fprintf(stderr, "ipcmd dag: %s: dependency cycle\n",
+                        g->node[i].target);
+                break;
             }
+        exit(EXIT_FAILURE);
+    }
+    free(pending);
+}
 
-            // one non-interval SEMVAL operand
-            if (optind+1 == argc && !strchr(argv[optind], '=')) {
-                unsigned short semval = 
-                               get_unsigned_short_arg(argv[optind], "semctl");
-                for (unsigned short i = 0; i < sem_nsems; i++)
-                    arg.array[i]=semval;
-            } else { 
-                unsigned short sem_num_lbound, sem_num_ubound;
-                // Verify that there exists a semval for each semaphore in the
-                // set. While this isn't explicitly required by SETALL, it's
-                // likely that the user made a mistake if these aren't equal,
-                // and will likely cause data-corruption! 
-
-                int semval_count = 0; // number of specified semvals
-                int sem_num_sum = 0;  // sum of specified sem_nums
-                for (int i = optind; i < argc; i++) {
-                    get_interval(argv[i],'=',&sem_num_lbound,&sem_num_ubound);
-                    semval_count += (sem_num_ubound - sem_num_lbound + 1);
-                    // sem_num_sum == sem_num_lbound + ... + sem_num_ubound
-                    sem_num_sum += ((int)sem_num_ubound+1)*sem_num_ubound/2 -
-                                   ((int)sem_num_lbound)*(sem_num_lbound-1)/2;
-                }
-                if (semval_count != (int)sem_nsems || 
-                    // 0+1+...+N-1 == N*(N-1)/2-1
-                    sem_num_sum != (int)sem_nsems*(sem_nsems-1)/2) {
-                    fprintf(stderr, "ipcmd semctl setall: invalid number of "
-                                    "semval arguments specified\n");
+// Queue a target that is ready to run, or keep it to run in this worker if
+// the queue is full.
+static void dag_queue(struct dag *g, int node) {
+    struct dag_msg msg;
+    msg.mtype = 1;
+    msg.node = node;
+    if (msgsnd(g->msqid, &msg, sizeof(msg.node), IPC_NOWAIT) == 0)
+        return;
+    if (errno != EAGAIN) {
+        fprintf(stderr, "ipcmd dag (msgsnd()): %s\n",
+                ipcmd_msgsnd_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    g->local[g->nlocal++] = node;
+}
+
+// Tell the other workers to exit, unless that has been done already.
+//
+// RETURN VALUE
+//     1 if this call did so (so this worker should exit too), otherwise 0.
+static int dag_stop(struct dag *g) {
+    struct dag_msg msg;
+    if (atomic_cas(&g->shared->stopping, 0, 1) != 0)
+        return 0;
+    msg.mtype = 1;
+    msg.node = DAG_STOP;
+    for (int w = 1; w < g->workers; w++) // the others receive them
+        if (msgsnd(g->msqid, &msg, sizeof(msg.node), 0) == -1) {
+            fprintf(stderr, "ipcmd dag (msgsnd()): %s\n",
+                    ipcmd_msgsnd_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    return 1;
+}
+
+// Skip the targets that depend (directly or not) on a failed one.
+//
+// RETURN VALUE
+//     The number of targets skipped.
+static uint64_t dag_skip(struct dag *g, int node) {
+    uint64_t skipped = 0;
+    for (size_t j = 0; j < g->node[node].ndependents; j++) {
+        int dependent = g->node[node].dependents[j];
+        if (atomic_cas(&g->shared->node[dependent].state, DAG_PENDING,
+                       DAG_SKIPPED) == DAG_PENDING)
+            skipped += 1 + dag_skip(g, dependent);
+    }
+    return skipped;
+}
+
+// Run a target's command, if any, with sh -c.
+//
+// RETURN VALUE
+//     Its status, as from waitpid().
+static int dag_run(struct dag *g, int node) {
+    const char *command = g->node[node].command;
+    int status = 0;
+    pid_t pid;
+
+    if (command == NULL)
+        return 0;
+    if ((pid = fork()) == -1) {
+        perror("ipcmd dag: fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        perror("ipcmd dag: execl");
+        _exit(127);
+    }
+    while (waitpid(pid, &status, 0) == -1)
+        if (errno != EINTR) {
+            perror("ipcmd dag: waitpid");
+            exit(EXIT_FAILURE);
+        }
+    return status;
+}
+
+// Decrement the semaphores of a finished target's dependents, and queue
+// those that are then ready.
+static void dag_release(struct dag *g, int node) {
+    struct dag_node *n = &g->node[node];
+    struct sembuf sops[DAG_SEMOPS_MAX];
+
+    for (size_t j = 0; j < n->ndependents; ) {
+        size_t nsops = 0;
+        for (; j < n->ndependents && nsops < (size_t)g->semops;
+             j++, nsops++) {
+            sops[nsops].sem_num = (unsigned short)n->dependents[j];
+            sops[nsops].sem_op = -1;
+            sops[nsops].sem_flg = 0;
+        }
+        if (semop(g->semid, sops, nsops) == -1) {
+            fprintf(stderr, "ipcmd dag (semop()): %s\n",
+                    ipcmd_semop_strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (size_t j = 0; j < n->ndependents; j++) {
+        int dependent = n->dependents[j];
+        sops[0].sem_num = (unsigned short)dependent;
+        sops[0].sem_op = 0;
+        // whichever worker sees it ready first queues it
+        if (sync_try(g->semid, sops, 1, "dag") == 0 &&
+            atomic_cas(&g->shared->node[dependent].state, DAG_PENDING,
+                       DAG_QUEUED) == DAG_PENDING)
+            dag_queue(g, dependent);
+    }
+}
+
+static void dag_worker(struct dag *g) {
+    for (;;) {
+        struct dag_msg msg;
+        struct dag_state *s;
+        uint64_t finished = 1; // this target, and any skipped
+        int node;
+
+        if (g->nlocal > 0 && !g->shared->stopping)
+            node = g->local[--g->nlocal];
+        else {
+            while (msgrcv(g->msqid, &msg, sizeof(msg.node), 1, 0) == -1)
+                if (errno != EINTR) {
+                    fprintf(stderr, "ipcmd dag (msgrcv()): %s\n",
+                            strerror(errno));
                     exit(EXIT_FAILURE);
                 }
+            if ((node = msg.node) == DAG_STOP)
+                return;
+        }
+        if (g->shared->stopping)
+            continue; // after a failure (without -k): wait to be told to exit
 
-                // now actually set arg.array
-                for (int i = optind; i < argc; i++) {
-                    get_interval(argv[i],'=',&sem_num_lbound,&sem_num_ubound); 
-                    for (unsigned short sem_num = sem_num_lbound; 
-                         sem_num <= sem_num_ubound; sem_num++)
-                        arg.array[sem_num]=get_interval_semval(argv[i]);
-                }
-            }
+        s = &g->shared->node[node];
+        trace_object(g->semid, 0, "%s", g->node[node].target);
+        s->start = now_usec();
+        s->status = dag_run(g, node);
+        s->end = now_usec();
+        if (s->status == 0) {
+            s->state = DAG_DONE;
+            dag_release(g, node);
+        } else {
+            s->state = DAG_FAILED;
+            if (!g->keep_going && dag_stop(g))
+                return;
+            finished += dag_skip(g, node);
+        }
+        // the last to finish tells the others to exit
+        if (atomic_add(&g->shared->remaining, -finished) == 0 && dag_stop(g))
+            return;
+    }
+}
 
-            if (semctl(semid, 0, SETALL, arg) == -1) {
-                fprintf(stderr, "ipcmd semctl setall (semctl()): %s\n",
-                        ipcmd_semctl_strerror(errno));
-                exit(EXIT_FAILURE);
+// Write the run's elapsed time and its critical path (the chain of
+// dependencies that took the longest) to standard error.
+static void dag_report(const struct dag *g, uint64_t elapsed) {
+    uint64_t *path = calloc(g->n ? g->n : 1, sizeof(uint64_t));
+    int *prev = malloc((g->n ? g->n : 1) * sizeof(int));
+    int last = -1, *chain;
+    size_t nchain = 0;
+    char line[256];
+
+    if (path == NULL || prev == NULL ||
+        (chain = malloc((g->n ? g->n : 1) * sizeof(int))) == NULL) {
+        perror("ipcmd dag: malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t k = 0; k < g->n; k++) {
+        int i = g->order[k];
+        const struct dag_state *s = &g->shared->node[i];
+        prev[i] = -1;
+        if (s->state != DAG_DONE && s->state != DAG_FAILED)
+            continue;
+        for (size_t j = 0; j < g->node[i].ndeps; j++) {
+            int dep = g->node[i].deps[j];
+            if (path[dep] > path[i]) {
+                path[i] = path[dep];
+                prev[i] = dep;
             }
+        }
+        path[i] += s->end - s->start;
+        if (last == -1 || path[i] > path[last])
+            last = i;
+    }
 
-            break;
-        case GETALL:
-            if (optind != argc) // if extra arguments after "getall"
-                print_usage_and_exit(usage);
+    snprintf(line, sizeof(line), "ipcmd dag: %zu targets in %.3f s; critical "
+             "path %.3f s:\n", g->n, elapsed / 1e6,
+             last == -1 ? 0.0 : path[last] / 1e6);
+    fputs(line, stderr);
+    for (int i = last; i != -1; i = prev[i])
+        chain[nchain++] = i;
+    while (nchain-- > 0) {
+        const struct dag_state *s = &g->shared->node[chain[nchain]];
+        fprintf(stderr, "ipcmd dag:   %s %.3f s%s\n",
+                g->node[chain[nchain]].target, (s->end - s->start) / 1e6,
+                s->state == DAG_FAILED ? " (failed)" : "");
+    }
+    free(path);
+    free(prev);
+    free(chain);
+}
 
-            // get number of semaphores in set
-            arg.buf = &seminfo;
-            if (semctl(semid, 0, IPC_STAT, arg) == -1) {
-                fprintf(stderr, "ipcmd semctl getall (semctl()): %s\n",
-                        ipcmd_semctl_strerror(errno));
+static void ipcmd_dag(int argc, char *argv[]) {
+    const char *usage =
+        "ipcmd dag [-j workers] [-k] [-q] [file]\n"
+        "  -j workers : run up to workers commands at once (default: 1)\n"
+        "  -k         : keep going after a command fails\n"
+        "  -q         : don't report the critical path";
+    struct dag g;
+    const char *spec = "-";
+    FILE *stream = stdin;
+    char *text = NULL;
+    size_t size = 0, len = 0;
+    int quiet = 0;
+    int shmid;
+    pid_t *pids;
+    uint64_t start;
+    int failed = 0;
+    int c;
+
+    memset(&g, 0, sizeof(g));
+    g.workers = 1;
+    while ((c = getopt(argc, argv, "j:kq")) != -1)
+    {
+        switch (c)
+        {
+            case 'j':
+                g.workers = get_int_arg(optarg, "dag");
+                if (g.workers <= 0)
+                    print_usage_and_exit(usage);
+                break;
+            case 'k':
+                g.keep_going = 1;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:  // unknown option
+                print_usage_and_exit(usage);
+        }
+    }
+    if (optind+1 < argc)
+        print_usage_and_exit(usage);
+    if (optind < argc && strcmp(argv[optind], "-") != 0 &&
+        (stream = fopen(spec = argv[optind], "r")) == NULL) {
+        fprintf(stderr, "ipcmd dag: %s: %s\n", spec, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (;;) {
+        if (len + BUFSIZ + 1 > size) {
+            size = 2 * size + BUFSIZ + 1;
+            if ((text = realloc(text, size)) == NULL) {
+                perror("ipcmd dag: realloc");
                 exit(EXIT_FAILURE);
             }
+        }
+        size_t n = fread(text + len, 1, BUFSIZ, stream);
+        len += n;
+        if (n < BUFSIZ)
+            break;
+    }
+    if (ferror(stream)) {
+        fprintf(stderr, "ipcmd dag: %s: %s\n", spec, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    text[len] = '\0';
+    if (stream != stdin)
+        fclose(stream);
 
-            // Allocate array for semaphores. Again, the (short) cast is
-            // needed because for Linux 2.4+ defines sem_nsems as an unsigned
-            // long
-            sem_nsems = (unsigned short)arg.buf->sem_nsems;
-            if ((arg.array = 
-                (unsigned short *)malloc(sem_nsems*sizeof(unsigned short)))
-                == NULL) {
-                    perror("ipcmd semctl getall: malloc");
-                    exit(EXIT_FAILURE);
-            }
+    dag_parse(&g, text, spec);
+    g.semops = semopm_limit(DAG_SEMOPS_MAX);
+    dag_sort(&g);
+    if (g.n == 0)
+        return;
 
-            if (semctl(semid, 0, GETALL, arg) == -1) {
-                fprintf(stderr, "ipcmd semctl getall (semctl()): %s\n",
-                        ipcmd_semctl_strerror(errno));
+    // a semaphore per target, holding its number of dependencies
+    if ((g.semid = semget(IPC_PRIVATE, (int)g.n, IPC_CREAT | 0600)) == -1) {
+        fprintf(stderr, "ipcmd dag (semget()): %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if ((g.msqid = msgget(IPC_PRIVATE, IPC_CREAT | 0600)) == -1) {
+        fprintf(stderr, "ipcmd dag (msgget()): %s\n", strerror(errno));
+        semctl(g.semid, 0, IPC_RMID);
+        exit(EXIT_FAILURE);
+    }
+    shmid = shmget(IPC_PRIVATE, sizeof(struct dag_shared) +
+                   g.n * sizeof(struct dag_state), IPC_CREAT | 0600);
+    if (shmid == -1 || (g.shared = shmat(shmid, NULL, 0)) == (void *)-1) {
+        fprintf(stderr, "ipcmd dag (%s()): %s\n",
+                shmid == -1 ? "shmget" : "shmat", strerror(errno));
+        semctl(g.semid, 0, IPC_RMID);
+        msgctl(g.msqid, IPC_RMID, NULL);
+        exit(EXIT_FAILURE);
+    }
+    shmctl(shmid, IPC_RMID, NULL); // removed once the workers detach
+    g.shared->remaining = g.n;
+    for (size_t i = 0; i < g.n; i++) {
+        union semun arg;
+        arg.val = (int)g.node[i].ndeps;
+        if (g.node[i].ndeps > SHMSEM_SEMVMX ||
+            semctl(g.semid, (int)i, SETVAL, arg) == -1) {
+            fprintf(stderr, "ipcmd dag: %s: too many dependencies\n",
+                    g.node[i].target);
+            semctl(g.semid, 0, IPC_RMID);
+            msgctl(g.msqid, IPC_RMID, NULL);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Queue the targets without dependencies; any that don't fit are
+    // divided among the workers' own lists.
+    if ((g.local = malloc(g.n * sizeof(int))) == NULL ||
+        (pids = malloc((size_t)g.workers * sizeof(pid_t))) == NULL) {
+        perror("ipcmd dag: malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < g.n && g.node[g.order[i]].ndeps == 0; i++) {
+        g.shared->node[g.order[i]].state = DAG_QUEUED;
+        dag_queue(&g, g.order[i]);
+    }
+    int *roots = g.local;
+    size_t nroots = g.nlocal;
+
+    fflush(stdout);
+    start = now_usec();
+    for (int w = 0; w < g.workers; w++) {
+        if ((pids[w] = fork()) == -1) {
+            perror("ipcmd dag: fork");
+            exit(EXIT_FAILURE);
+        }
+        if (pids[w] == 0) {
+            size_t mine = 0;
+            if ((g.local = malloc(g.n * sizeof(int))) == NULL) {
+                perror("ipcmd dag: malloc");
                 exit(EXIT_FAILURE);
             }
+            for (size_t i = (size_t)w; i < nroots; i += (size_t)g.workers)
+                g.local[mine++] = roots[i];
+            g.nlocal = mine;
+            dag_worker(&g);
+            exit(EXIT_SUCCESS);
+        }
+    }
+    for (int w = 0; w < g.workers; w++) {
+        int status;
+        while (waitpid(pids[w], &status, 0) == -1 && errno == EINTR)
+            ;
+    }
 
-            for (int i = 0; i < (int)sem_nsems; i++) {
-                if (i < sem_nsems - 1)
-                    printf("%hu ", arg.array[i]);
-                else // last semaphore to print
-                    printf("%hu\n", arg.array[i]);
-            }
+    semctl(g.semid, 0, IPC_RMID);
+    msgctl(g.msqid, IPC_RMID, NULL);
+    for (size_t i = 0; i < g.n; i++) {
+        const struct dag_state *s = &g.shared->node[i];
+        if (s->state != DAG_FAILED)
+            continue;
+        failed = 1;
+        if (WIFEXITED(s->status))
+            fprintf(stderr, "ipcmd dag: %s: exit status %i\n",
+                    g.node[i].target, WEXITSTATUS(s->status));
+        else
+            fprintf(stderr, "ipcmd dag: %s: killed by signal %i\n",
+                    g.node[i].target, WTERMSIG(s->status));
+    }
+    if (!quiet)
+        dag_report(&g, now_usec() - start);
+    if (failed || g.shared->remaining > 0) // not all run
+        exit(EXIT_FAILURE);
+}
+
+//**************************************
+// one-shot object setup ("ipcmd setup" and "ipcmd teardown")
+//**************************************
+
+#define SETUP_LINE_MAX 4096
+#define SETUP_NAME_MAX 64
+
+struct setup_object {
+    char name[SETUP_NAME_MAX]; // environment variable to export the ID as
+    char kind; // 's' (semaphore set), 'q' (message queue), 'm' (shm segment)
+    int nsems;
+    unsigned short *semvals; // for SETALL, or NULL to leave them 0
+    size_t size; // of a shared memory segment
+    int id; // -1 until created
+};
+
+// Remove an IPC object listed in IPCMD_SETUP (kind and ID), along with any
+// segments ipcmd associated with it.
+//
+// RETURN VALUE
+//     0 on success, or if the object no longer exists; -1 (with an error
+//     message written) otherwise.
+static int setup_remove(char kind, int id, const char *ipcmd_command) {
+    union semun arg;
+    int result;
+
+    memset(&arg, 0, sizeof(arg));
+    switch (kind) {
+        case 's':
+            result = semctl_any(id, 0, IPC_RMID, arg);
+            break;
+        case 'q':
+            result = msgctl(id, IPC_RMID, NULL);
             break;
         default:
-            break; // will never get here
+            result = shmctl(id, IPC_RMID, NULL);
+    }
+    if (result == -1 && errno != EINVAL && errno != EIDRM) {
+        fprintf(stderr, "ipcmd %s (%s()): %c:%i: %s\n", ipcmd_command,
+                kind == 's' ? "semctl" : kind == 'q' ? "msgctl" : "shmctl",
+                kind, id, strerror(errno));
+        return -1;
+    }
+    if (kind == 's') {
+        remove_segment(SEGMENT_SEMSTAT, id, ipcmd_command);
+        remove_segment(SEGMENT_RATELIMIT, id, ipcmd_command);
+        remove_segment(SEGMENT_MUTEX, id, ipcmd_command);
+    } else if (kind == 'q') {
+        remove_segment(SEGMENT_MSGSTAT, id, ipcmd_command);
+        remove_segment(SEGMENT_CONFLATE, id, ipcmd_command);
     }
+    return 0;
 }
 
-static void get_interval_sem_op (
-    const char *arg, // sem_num_lbound[,sem_num_ubound]=sem_op[un]
-    short *sem_op,
-    short *sem_flg   // SEM_UNDO and/or IPC_NOWAIT
-)
-{
-    long val;
-    char *beginptr, *endptr;
+// Parse a line of the setup file into *o.
+//
+// RETURN VALUE
+//     1 if the line declared an object, 0 if it was blank or a comment.
+static int setup_parse_line(
+    struct setup_object *o,
+    char *line,
+    const char *spec,
+    int lineno
+) {
+    char *args[SETUP_LINE_MAX / 2];
+    int nargs = 0;
+    char *word;
 
-    // this check shouldn't be needed, as it was done in get_interval()
-    if ((beginptr = strchr(arg, '=')) == NULL) {
-        fprintf(stderr, "ipcmd: invalid argument (%s)\n", arg);
+    for (word = strtok(line, " \t\n"); word && *word != '#';
+         word = strtok(NULL, " \t\n"))
+        args[nargs++] = word;
+    if (nargs == 0)
+        return 0;
+    memset(o, 0, sizeof(*o));
+    o->id = -1;
+    if (nargs < 2 || strlen(args[0]) >= SETUP_NAME_MAX ||
+        strspn(args[0], "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+                        "0123456789_") != strlen(args[0]) ||
+        (args[0][0] >= '0' && args[0][0] <= '9') ||
+        strcmp(args[0], "IPCMD_SETUP") == 0)
+        goto invalid;
+    strcpy(o->name, args[0]);
+
+    if (strcmp(args[1], "sem") == 0 && nargs >= 3) {
+        o->kind = 's';
+        o->nsems = get_int_arg(args[2], "setup");
+        if (o->nsems <= 0 || o->nsems > USHRT_MAX)
+            goto invalid;
+        if (nargs > 3) {
+            if ((o->semvals = malloc((size_t)o->nsems *
+                                     sizeof(unsigned short))) == NULL) {
+                perror("ipcmd setup: malloc");
+                exit(EXIT_FAILURE);
+            }
+            get_setall_array(o->semvals, (unsigned short)o->nsems, nargs - 3,
+                             &args[3], "setup");
+        }
+    } else if (strcmp(args[1], "msg") == 0 && nargs == 2)
+        o->kind = 'q';
+    else if (strcmp(args[1], "shm") == 0 && nargs == 3) {
+        o->kind = 'm';
+        o->size = (size_t)get_size_arg(args[2], "setup");
+    } else
+        goto invalid;
+    return 1;
+
+invalid:
+    fprintf(stderr, "ipcmd setup: %s:%i: expected \"name sem nsems "
+                    "[semval...]\", \"name msg\", or \"name shm size\"\n",
+            spec, lineno);
+    exit(EXIT_FAILURE);
+}
+
+static void ipcmd_setup(int argc, char *argv[]) {
+    const char *usage =
+        "ipcmd setup [-m mode] [-b backend] [file]\n"
+        "  -m mode    : read/write permissions of every object (octal value; "
+        "default: 600)\n"
+        "  -b backend : semaphore sets' backend, sysv (default) or shm";
+    struct setup_object *objects = NULL;
+    size_t nobjects = 0;
+    const char *spec = "-";
+    FILE *stream = stdin;
+    char line[SETUP_LINE_MAX];
+    int mode = 0600;
+    int shm = 0;
+    int lineno = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "b:m:")) != -1)
+    {
+        switch (c)
+        {
+            case 'b':
+                if (strcmp(optarg, "shm") == 0)
+                    shm = 1;
+                else if (strcmp(optarg, "sysv") == 0)
+                    shm = 0;
+                else
+                    print_usage_and_exit(usage);
+                break;
+            case 'm':
+                mode = get_mode_arg(optarg, "setup");
+                break;
+            default: // unknown option
+                print_usage_and_exit(usage);
+        }
+    }
+    if (optind+1 < argc)
+        print_usage_and_exit(usage);
+    if (optind < argc && strcmp(argv[optind], "-") != 0 &&
+        (stream = fopen(spec = argv[optind], "r")) == NULL) {
+        fprintf(stderr, "ipcmd setup: %s: %s\n", spec, strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    beginptr++; // next character
+    // parse the whole file before creating anything
+    while (fgets(line, sizeof(line), stream)) {
+        lineno++;
+        if (strchr(line, '\n') == NULL && !feof(stream)) {
+            fprintf(stderr, "ipcmd setup: %s:%i: line too long\n", spec,
+                    lineno);
+            exit(EXIT_FAILURE);
+        }
+        if ((objects = realloc(objects, (nobjects+1) *
+                                        sizeof(*objects))) == NULL) {
+            perror("ipcmd setup: realloc");
+            exit(EXIT_FAILURE);
+        }
+        nobjects += setup_parse_line(&objects[nobjects], line, spec, lineno);
+    }
+    if (ferror(stream)) {
+        fprintf(stderr, "ipcmd setup: %s: %s\n", spec, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-    errno = 0;
-    val = strtol(beginptr, &endptr, 10);
-    // if error converting to long, or argument not a digit, or argument not
-    // entirely a digit
-    if (errno != 0) {
-        perror("strtol");
+    // create the objects, removing those already created if one fails
+    for (size_t i = 0; i < nobjects; i++) {
+        struct setup_object *o = &objects[i];
+        union semun arg;
+        const char *call;
+
+        switch (o->kind) {
+            case 's':
+                call = "semget";
+                o->id = shm ? shmsem_get(IPC_PRIVATE, o->nsems,
+                                         IPC_CREAT | IPC_EXCL | mode) :
+                              semget(IPC_PRIVATE, o->nsems,
+                                     IPC_CREAT | IPC_EXCL | mode);
+                arg.array = o->semvals;
+                if (o->id != -1 && o->semvals &&
+                    semctl_any(o->id, 0, SETALL, arg) == -1) {
+                    int errnum = errno;
+                    setup_remove('s', o->id, "setup");
+                    o->id = -1;
+                    errno = errnum;
+                    call = "semctl";
+                }
+                break;
+            case 'q':
+                call = "msgget";
+                o->id = msgget(IPC_PRIVATE, IPC_CREAT | IPC_EXCL | mode);
+                break;
+            default:
+                call = "shmget";
+                o->id = shmget(IPC_PRIVATE, o->size,
+                               IPC_CREAT | IPC_EXCL | mode);
+        }
+        if (o->id == -1) {
+            fprintf(stderr, "ipcmd setup (%s()): %s: %s\n", call, o->name,
+                    o->kind == 's' && strcmp(call, "semctl") == 0 ?
+                    ipcmd_semctl_strerror(errno) : strerror(errno));
+            while (i-- > 0)
+                setup_remove(objects[i].kind, objects[i].id, "setup");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (size_t i = 0; i < nobjects; i++) {
+        if (IS_SHMSEM(objects[i].id) && objects[i].kind == 's')
+            printf("export %s=" SHMSEM_PREFIX "%i\n", objects[i].name,
+                   SHMSEM_SHMID(objects[i].id));
+        else
+            printf("export %s=%i\n", objects[i].name, objects[i].id);
+    }
+    // the objects for "ipcmd teardown" to remove
+    printf("export IPCMD_SETUP='");
+    for (size_t i = 0; i < nobjects; i++) {
+        if (IS_SHMSEM(objects[i].id) && objects[i].kind == 's')
+            printf("%ss:" SHMSEM_PREFIX "%i", i ? " " : "",
+                   SHMSEM_SHMID(objects[i].id));
+        else
+            printf("%s%c:%i", i ? " " : "", objects[i].kind, objects[i].id);
+    }
+    printf("'\n");
+}
+
+static void ipcmd_teardown(int argc, char *argv[]) {
+    const char *usage = "ipcmd teardown [kind:id...]";
+    char *list = NULL;
+    int failed = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "")) != -1)
+        print_usage_and_exit(usage);
+
+    if (optind == argc) {
+        if (!getenv("IPCMD_SETUP")) {
+            fprintf(stderr, "ipcmd teardown: must either specify objects or "
+                            "set IPCMD_SETUP environment variable\n");
+            exit(EXIT_FAILURE);
+        }
+        if ((list = strdup(getenv("IPCMD_SETUP"))) == NULL) {
+            perror("ipcmd teardown: strdup");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // remove every object, even if removing one fails
+    for (char *object = list ? strtok(list, " ") : argv[optind]; object;
+         object = list ? strtok(NULL, " ") :
+                  ++optind < argc ? argv[optind] : NULL) {
+        char kind = object[0];
+        int id;
+        if ((kind != 's' && kind != 'q' && kind != 'm') || object[1] != ':') {
+            fprintf(stderr, "ipcmd teardown: invalid object: %s\n", object);
+            failed = 1;
+            continue;
+        }
+        id = kind == 's' ? get_semid_arg(object + 2, "teardown") :
+                           get_int_arg(object + 2, "teardown");
+        if (setup_remove(kind, id, "teardown") == -1)
+            failed = 1;
+    }
+    if (failed)
         exit(EXIT_FAILURE);
-    } else if (endptr == beginptr) {
-        // no integer at beginning of field
-        fprintf(stderr, "ipcmd semop: invalid argument: %s\n", arg);
+}
+
+// semaphore numbers of the partition hand-off protocol used by
+// examples/parallelpipe.sh
+enum {SPLIT_SLOT_SEM, SPLIT_WRITE_SEM, SPLIT_READ_SEM};
+
+// Wait for a free partition slot and the partition file, or announce that a
+// partition has been written.
+static void split_semop(int semid, int read_sem_post) {
+    struct sembuf sops[2];
+    size_t nsops;
+
+    if (read_sem_post) {
+        sops[0].sem_num = SPLIT_READ_SEM;
+        sops[0].sem_op = 1;
+        sops[0].sem_flg = 0;
+        nsops = 1;
+    } else {
+        sops[0].sem_num = SPLIT_SLOT_SEM;
+        sops[0].sem_op = -1;
+        sops[0].sem_flg = 0;
+        sops[1].sem_num = SPLIT_WRITE_SEM;
+        sops[1].sem_op = -1;
+        sops[1].sem_flg = 0;
+        nsops = 2;
+    }
+
+    if (semop_timed(semid, sops, nsops, NULL) == -1) {
+        fprintf(stderr, "ipcmd split (semop()): %s\n",
+                ipcmd_semop_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Hand one partition to the consumer through the partition file: wait for the
+// slot & write semaphores, (over)write the file, then post the read semaphore.
+static void split_put_partition(
+    int semid,
+    const char *path,
+    const char *partition,
+    size_t length
+) {
+    int fd;
+
+    split_semop(semid, 0);
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+        fprintf(stderr, "ipcmd split: %s: %s\n", path, strerror(errno));
         exit(EXIT_FAILURE);
-    } else if (val < SHRT_MIN || val > SHRT_MAX) {
-        fprintf(stderr, "ipcmd semop: sem_op (%li) out of valid range "
-                        "[%hi,%hi]\n", val, SHRT_MIN, SHRT_MAX);
+    }
+    if (write_all(fd, partition, length) == -1 || close(fd) == -1) {
+        fprintf(stderr, "ipcmd split: %s: %s\n", path, strerror(errno));
         exit(EXIT_FAILURE);
     }
+    split_semop(semid, 1);
+}
 
-    *sem_op = (short) val;
+// Map [offset, offset+length) of fd. The mapping must start on a page
+// boundary, so the returned address is that of the page containing offset;
+// *skip is set to the distance from there to offset.
+static char *split_map(int fd, off_t offset, size_t length, size_t *skip) {
+    static long pagesize = 0;
+    char *map;
 
-    // ensure any remaining string contains only "n" or "u"
-    if (strcspn(endptr, "nu")) {
-        fprintf(stderr, "ipcmd semop: invalid argument: %s\n", arg);
+    if (pagesize == 0)
+        pagesize = sysconf(_SC_PAGESIZE);
+    *skip = (size_t)(offset % pagesize);
+    map = mmap(NULL, length + *skip, PROT_READ, MAP_SHARED, fd,
+               offset - (off_t)*skip);
+    if (map == MAP_FAILED) {
+        perror("ipcmd split: mmap");
         exit(EXIT_FAILURE);
     }
+    return map;
+}
 
-    *sem_flg = 0;
-    if (strchr(endptr, 'n') != NULL)
-        *sem_flg |= IPC_NOWAIT;
-    if (strchr(endptr, 'u') != NULL)
-        *sem_flg |= SEM_UNDO;
+// RETURN VALUE
+//     The offset just past the first delimiter at or after offset, or
+//     file_size if there is none. Only the pages around the cut point are
+//     mapped, a window at a time.
+static off_t split_find_cut(int fd, off_t offset, off_t file_size, int delim) {
+    const size_t window = 64*1024;
+
+    while (offset < file_size) {
+        size_t length = (file_size - offset < (off_t)window) ?
+                        (size_t)(file_size - offset) : window;
+        size_t skip;
+        char *map = split_map(fd, offset, length, &skip);
+        char *found = memchr(map + skip, delim, length);
+        munmap(map, length + skip);
+        if (found != NULL)
+            return offset + (found - (map + skip)) + 1;
+        offset += (off_t)length;
+    }
+    return file_size;
 }
 
-// Sum of cardinalities of all integer intervals in arguments. This is useful
-// for determining the size of various arrays before allocating memory for
-// them.
-static size_t get_interval_count(
-    int interval_argc,
-    char *interval_argv[]
+// Partition a regular file. Cut points are found by mapping only the region
+// around each nominal cut; each partition is either described to consumers
+// as an "OFFSET,LENGTH" message (msqid != 0), or mapped and written to the
+// partition file.
+static void split_file(
+    int fd,
+    off_t size,
+    int delim,
+    int msqid,
+    int semid,
+    const char *path
 ) {
-    size_t count = 0;
-
-    unsigned short lower_bound;
-    unsigned short upper_bound;
+    struct msg {long mtype; char mtext[64];} msgbuf;
+    struct stat st;
+    off_t offset = 0;
 
-    for (int i = 0; i < interval_argc; i++) {
-        get_interval(interval_argv[i], '=', &lower_bound, &upper_bound);
-        count += (size_t)(upper_bound - lower_bound + 1);
+    if (fstat(fd, &st) == -1) {
+        perror("ipcmd split: fstat");
+        exit(EXIT_FAILURE);
     }
 
-    return count;
+    msgbuf.mtype = 0;
+    while (offset < st.st_size) {
+        off_t cut = (size >= st.st_size - offset) ? st.st_size :
+                    split_find_cut(fd, offset + size - 1, st.st_size, delim);
+        if (msqid) {
+            int msgsz = snprintf(msgbuf.mtext, sizeof(msgbuf.mtext),
+                                 "%jd,%jd", (intmax_t)offset,
+                                 (intmax_t)(cut - offset));
+            msgbuf.mtype++; // partition number
+            if (msgsnd(msqid, &msgbuf, (size_t)msgsz, 0) == -1) {
+                fprintf(stderr, "ipcmd split (msgsnd()): %s\n",
+                        ipcmd_msgsnd_strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            size_t skip;
+            char *map = split_map(fd, offset, (size_t)(cut - offset), &skip);
+            split_put_partition(semid, path, map + skip,
+                                (size_t)(cut - offset));
+            munmap(map, (size_t)(cut - offset) + skip);
+        }
+        offset = cut;
+    }
+    if (!msqid)
+        split_put_partition(semid, path, NULL, 0); // end of input
 }
 
+// Partition a stream. Each partition extends to the first delimiter at or
+// after "size" bytes, so the buffer grows only for records longer than that.
+static void split_stream(
+    int fd,
+    off_t size,
+    int delim,
+    int semid,
+    const char *path
+) {
+    size_t capacity = 2 * (size_t)size;
+    size_t length = 0; // bytes in buf
+    size_t scanned = 0; // bytes of buf known not to contain a cut point
+    int eof = 0;
+    char *buf;
 
-// set semaphore-operation array from interval arguments
-//
-// RETURN VALUE
-//     nsops - total number of semaphore operations (for semop(..., nsops))
-static size_t set_interval_sops (
-    int argc,               // number of args in argv[]
-    char *argv[],           // semaphore interval argument array
-    struct sembuf *sops,
-    short sem_flg_additions // add these flags to sem_flg for each operation
-)
-{
-    size_t nsops = 0;
+    if ((buf = malloc(capacity)) == NULL) {
+        perror("ipcmd split: malloc");
+        exit(EXIT_FAILURE);
+    }
 
-    unsigned short sem_num_lbound; // lower bound of sem_num interval
-    unsigned short sem_num_ubound; // upper bound of sem_num interval
-    short sem_op;
-    short sem_flg;
+    while (!eof || length > 0) {
+        char *found = NULL;
 
-    for (int i = 0; i < argc; i++) {
-        get_interval(argv[i], '=', &sem_num_lbound, &sem_num_ubound);
-        get_interval_sem_op(argv[i], &sem_op, &sem_flg);
-        sem_flg |= sem_flg_additions;
-        for (int sem = (int)sem_num_lbound;
-             sem <= (int)sem_num_ubound; 
-             sem++, nsops++)
-        {
-            sops[nsops].sem_num = (unsigned short)sem;
-            sops[nsops].sem_op = sem_op;
-            sops[nsops].sem_flg = sem_flg;
+        // read until there is a delimiter beyond the nominal cut, or EOF
+        while (!eof) {
+            if (length >= (size_t)size) {
+                size_t from = scanned > (size_t)size-1 ? scanned :
+                                                         (size_t)size-1;
+                if ((found = memchr(buf + from, delim, length - from)) != NULL)
+                    break;
+                scanned = length;
+            }
+            if (length == capacity) {
+                capacity *= 2;
+                if ((buf = realloc(buf, capacity)) == NULL) {
+                    perror("ipcmd split: realloc");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            ssize_t n = read(fd, buf + length, capacity - length);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                perror("ipcmd split: read");
+                exit(EXIT_FAILURE);
+            }
+            if (n == 0)
+                eof = 1;
+            length += (size_t)n;
         }
+
+        size_t cut = found ? (size_t)(found - buf) + 1 : length;
+        if (cut == 0)
+            break;
+        split_put_partition(semid, path, buf, cut);
+        memmove(buf, buf + cut, length - cut);
+        length -= cut;
+        scanned = 0;
+    }
+    split_put_partition(semid, path, NULL, 0); // end of input
+}
+
+// Write the "OFFSET,LENGTH" range of a file (as described by a message from
+// "ipcmd split -q") to standard output.
+static void split_range(int fd, const char *range) {
+    char *endptr;
+    intmax_t offset, length = -1; // -1 if no ",LENGTH"
+    size_t skip;
+    char *map;
+    struct stat st;
+
+    errno = 0;
+    offset = strtoimax(range, &endptr, 10);
+    if (errno == 0 && *endptr == ',' && offset >= 0) {
+        range = endptr + 1;
+        length = strtoimax(range, &endptr, 10);
+    }
+    if (errno != 0 || *endptr != '\0' || endptr == range || offset < 0 ||
+        length < 0) {
+        fprintf(stderr, "ipcmd split: invalid range (expected "
+                        "OFFSET,LENGTH)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (fstat(fd, &st) == -1) {
+        perror("ipcmd split: fstat");
+        exit(EXIT_FAILURE);
+    }
+    // mapping beyond the end of the file would write zeros, or fault
+    if (offset > (intmax_t)st.st_size ||
+        length > (intmax_t)st.st_size - offset) {
+        fprintf(stderr, "ipcmd split: range %jd,%jd is beyond the end of the "
+                        "file (%jd bytes)\n", offset, length,
+                (intmax_t)st.st_size);
+        exit(EXIT_FAILURE);
     }
+    if (length == 0)
+        return;
 
-    return nsops;
+    map = split_map(fd, (off_t)offset, (size_t)length, &skip);
+    if (write_all(STDOUT_FILENO, map + skip, (size_t)length) == -1) {
+        perror("ipcmd split: write");
+        exit(EXIT_FAILURE);
+    }
+    munmap(map, (size_t)length + skip);
 }
 
-static void ipcmd_semop(int argc, char *argv[]) {
-    const char *usage = 
-    "ipcmd semop [-s semid] [-n] [-u] <ARGS>\n"
-    "Where ARGS is one of the following forms:\n"
-    "  sem_op [: COMMAND [<COMMAND_ARGS>]]\n"
-    "or\n"
-    "  sem_num[:sem_num]=[+|-]sem_op[n][u]... [: COMMAND [<COMMAND_ARGS>]]\n"
-    "Options:\n"
-    "  -s semid : semaphore identifier of an existing semaphore set\n"
-    "  -n       : (IPC_NOWAIT) all operations are non-blocking\n"
-    "  -u       : (SEM_UNDO) undo all nonzero operations upon exit";
+static void ipcmd_split(int argc, char *argv[]) {
+    const char *usage =
+    "ipcmd split [-s size] [-d delim] [-o path | -q msqid] [file]\n"
+    "ipcmd split -r offset,length file\n"
+    "  -s size   : partitions end at the first delim after size[k|m|g] bytes\n"
+    "              (default 2m)\n"
+    "  -d delim  : record delimiter (default \\n)\n"
+    "  -o path   : partition file (default $PARTITION_PATH)\n"
+    "  -q msqid  : send each partition of file as an \"offset,length\" "
+    "message\n"
+    "  -r range  : write an offset,length range of file to standard output";
+    off_t size = 2*1024*1024;
+    int delim = '\n';
+    const char *path = getenv("PARTITION_PATH");
+    const char *range = NULL;
+    int msqid = 0;
     int semid = -1;
-    short int sem_flg = 0;
-    size_t nsops;
-    struct sembuf *sops;
-    int command_arg = 0; // index into argv[] of optional command argument
+    int fd = STDIN_FILENO;
+    struct stat st;
     int c;
 
-#ifdef __GNU_LIBRARY__
-    // disable GNU getopt() permutation of argv so any user-specified command
-    // argument(s) isn't mangled
-    while ((c = getopt(argc, argv, "+ns:u0123456789")) != -1)
-#else
-    while ((c = getopt(argc, argv, "ns:u0123456789")) != -1)
-#endif
+    while ((c = getopt(argc, argv, "d:o:q:r:s:")) != -1)
     {
         switch (c)
         {
-            case 'n':
-                sem_flg |= IPC_NOWAIT;
+            case 'd':
+                if (strcmp(optarg, "\\n") == 0)
+                    delim = '\n';
+                else if (strcmp(optarg, "\\t") == 0)
+                    delim = '\t';
+                else if (strcmp(optarg, "\\0") == 0)
+                    delim = '\0';
+                else if (strlen(optarg) == 1)
+                    delim = (unsigned char)optarg[0];
+                else
+                    print_usage_and_exit(usage);
                 break;
-            case 's':
-                semid = get_int_arg(optarg, "semop");
+            case 'o':
+                path = optarg;
                 break;
-            case 'u':
-                sem_flg |= SEM_UNDO;
+            case 'q':
+                msqid = get_msqid_arg(optarg, "split");
                 break;
-            // Test if a negative integer so we can handle this case:
-            // $ ipcmd semop -1
-            case '0':
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9':
-                // if there is only one digit (e.g., "-1"), getopt() will have 
-                // incremented optind, so back up so it still indexes the
-                // sem_op argument in argv[]. If there was more than one
-                // digit, getopt() would have treated it as a string containing
-                // multiple options, and would not have incremented optind.
-                optind = (optind == argc || strcmp(argv[optind],":") == 0) ?
-                         optind-1 : optind;
-                goto process_arguments;
+            case 'r':
+                range = optarg;
+                break;
+            case 's':
+                size = get_size_arg(optarg, "split");
+                break;
+            default: // unknown or missing argument
+                print_usage_and_exit(usage);
         }
     }
 
-process_arguments:
-
-    if (optind == argc) // if no operands specified
+    if (optind+1 < argc || ((range || msqid) && optind == argc))
         print_usage_and_exit(usage);
+    require_xsi_msqid(msqid, "-q", "split");
 
-    if (semid == -1) { // -s option not used
-        if (!getenv("IPCMD_SEMID")) { //IPCMD_SEMID environment variable not set
-            fprintf(stderr, "ipcmd semop: must either specify [-s semid] or "
-                            "set IPCMD_SEMID environment variable\n");
-            exit(1);
-        } else
-            semid = get_int_arg(getenv("IPCMD_SEMID"), "semctl");
+    if (optind < argc && (fd = open(argv[optind], O_RDONLY)) == -1) {
+        fprintf(stderr, "ipcmd split: %s: %s\n", argv[optind],
+                strerror(errno));
+        exit(EXIT_FAILURE);
     }
 
-    // if first operand has a "=", assume semaphore interval arguments
-    // (sem_num[:sem_num]=[+|-]sem_op[n][u]...)
-    if (strchr(argv[optind], '=')) {
-        // determine start of user-specified command argument, if any
-        for (int opt = optind+1; opt < argc; opt++)
-            if (strncmp(argv[opt], ":", strlen(":")+1) == 0) {
-                command_arg = opt+1;
-                // verify command argument after ":" exists
-                if (command_arg == argc)
-                    print_usage_and_exit(usage);
-                break;
-            }
-        
-        int interval_argc = (command_arg>0? command_arg-1-optind : argc-optind);
-        // get number of sops
-        nsops = get_interval_count(interval_argc, &argv[optind]);
-        if ((sops=(struct sembuf *)malloc(nsops*sizeof(struct sembuf)))==NULL){
-            perror("ipcmd semop: malloc");
+    if (range) {
+        split_range(fd, range);
+        return;
+    }
+
+    if (!msqid) {
+        if (!path) {
+            fprintf(stderr, "ipcmd split: must either specify [-o path] or "
+                            "set PARTITION_PATH environment variable\n");
             exit(EXIT_FAILURE);
         }
-        // second pass through semaphore arguments sets sembuf array
-        set_interval_sops(interval_argc, &argv[optind], sops, sem_flg);
-    } else { // assume a single sem_op applied to all semaphores in the set
+        if (!getenv("IPCMD_SEMID")) {
+            fprintf(stderr, "ipcmd split: IPCMD_SEMID environment variable "
+                            "must be set\n");
+            exit(EXIT_FAILURE);
+        }
+        semid = get_semid_arg(getenv("IPCMD_SEMID"), "split");
+    }
 
-        // verify there is either a command argument...
-        if ((optind+2 < argc) && strcmp(argv[optind+1], ":") == 0)
-            command_arg = optind+2;
-        else if (optind+1 != argc) // or exactly one (sem_op) argument
-            print_usage_and_exit(usage);
+    if (fstat(fd, &st) == -1) {
+        perror("ipcmd split: fstat");
+        exit(EXIT_FAILURE);
+    }
 
-        short sem_op = get_short_arg(argv[optind], "semop");
+    if (S_ISREG(st.st_mode))
+        split_file(fd, size, delim, msqid, semid, path);
+    else if (msqid) {
+        fprintf(stderr, "ipcmd split: -q requires a regular file\n");
+        exit(EXIT_FAILURE);
+    } else
+        split_stream(fd, size, delim, semid, path);
+}
 
-        union semun {
-            int val;
-            struct semid_ds *buf;
-            unsigned short  *array;
-        } arg;
-        struct semid_ds seminfo;
-        arg.buf = &seminfo;
+// an event read from a trace file (see trace_open())
+struct trace_event {
+    uint64_t ts;
+    int phase; // TRACE_BEGIN, TRACE_WAIT, or TRACE_END
+    long pid;
+    char command[65];
+    int id;
+    uint64_t bytes;
+    uint64_t wait_usec;
+    char detail[TRACE_LINE_MAX];
+};
 
-        if (semctl(semid, 0, IPC_STAT, arg) == -1) {
-            fprintf(stderr, "ipcmd semop (semctl()): %s\n",
-                ipcmd_semctl_strerror(errno));
-            exit(EXIT_FAILURE);
-        } 
+// at equal times, a begin precedes a wait, which precedes an end
+enum {TRACE_BEGIN, TRACE_WAIT, TRACE_END};
 
-        nsops = (size_t)arg.buf->sem_nsems;
-        
-        if ((sops=(struct sembuf *)malloc(nsops*sizeof(struct sembuf)))==NULL){
-            perror("ipcmd semop: malloc");
-            exit(EXIT_FAILURE);
+static int trace_event_compare(const void *a, const void *b) {
+    const struct trace_event *x = a, *y = b;
+    if (x->ts != y->ts)
+        return x->ts < y->ts ? -1 : 1;
+    return x->phase - y->phase;
+}
+
+// Write s as a JSON string.
+static void json_string(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            printf("\\u%04x", (unsigned)*s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+// Read the events in a trace file, appending them to *events (of which there
+// are *nevents, in space for *capacity).
+static void trace_read(
+    const char *path,
+    struct trace_event **events,
+    size_t *nevents,
+    size_t *capacity
+) {
+    char line[TRACE_LINE_MAX+1];
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "ipcmd trace-export: %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        struct trace_event e;
+        uint64_t wait_begin;
+        char *newline = strchr(line, '\n');
+        int n = 0;
+
+        if (newline)
+            *newline = '\0';
+        memset(&e, 0, sizeof(e));
+        e.id = -1;
+        if (sscanf(line, "B %" SCNu64 " %li %64s", &e.ts, &e.pid, e.command)
+            == 3)
+            e.phase = TRACE_BEGIN;
+        else if (sscanf(line, "E %" SCNu64 " %li %64s %i %" SCNu64 " %" SCNu64
+                        " %" SCNu64 "%n", &e.ts, &e.pid, e.command, &e.id,
+                        &e.bytes, &wait_begin, &e.wait_usec, &n) == 7 && n) {
+            e.phase = TRACE_END;
+            strcpy(e.detail, line[n] == ' ' ? line + n + 1 : line + n);
+        } else
+            continue; // not a trace line (or one truncated by a crash)
+
+        // one more for the wait event, if any
+        if (*nevents + 2 > *capacity) {
+            *capacity = *capacity ? 2 * *capacity : 1024;
+            if ((*events = realloc(*events, *capacity * sizeof(**events)))
+                == NULL) {
+                perror("ipcmd trace-export: realloc");
+                exit(EXIT_FAILURE);
+            }
         }
-        // NOTE: POSIX.1-2008 lists incorrect type for sem_num member of
-        // sembuf in the description of semop() (listed as "short", should be
-        // "unsigned short") see: http://austingroupbugs.net/view.php?id=329
-        for (unsigned short sem_num=0; sem_num < nsops; sem_num++) {
-           sops[sem_num].sem_num = sem_num;
-           sops[sem_num].sem_op = sem_op;
-           sops[sem_num].sem_flg = sem_flg;
+        (*events)[(*nevents)++] = e;
+        if (e.phase == TRACE_END && e.wait_usec > 0) {
+            e.phase = TRACE_WAIT;
+            e.ts = wait_begin;
+            (*events)[(*nevents)++] = e;
         }
     }
+    fclose(fp);
+}
 
-    if (semop(semid, sops, nsops) == -1) {
-        if (errno == EAGAIN) // process would have be suspended had IPC_NOWAIT
-            exit(2);         // (-n) not been specified
-        else {
-            fprintf(stderr, "ipcmd semop (semop()): ");
-            switch (errno) {
-                case E2BIG:
-                    fprintf(stderr, "The value of nsops is greater than the "
-                        "system-imposed maximum.\n");
-                    break;
-                case EACCES:
-                    fprintf(stderr, "Operation permission is denied to the "
-                        "calling process.\n");
-                    break;
-                case EFBIG:
-                    fprintf(stderr, "The value of sem_num is less than 0 or "
-                        "greater than or equal to the number of semaphores in "
-                        "the set associated with semid.\n");
-                    break;
-                case EIDRM:
-                    fprintf(stderr, "The semaphore identifier semid is "
-                        "removed from the system.\n");
-                    break;
-                case EINTR:
-                    fprintf(stderr, "The semop() function was interrupted by "
-                        "a signal.\n");
-                    break;
-                case EINVAL:
-                    fprintf(stderr, "The value of semid is not a valid "
-                        "semaphore identifier, or the number of individual "
-                        "semaphores for which the calling process requests a "
-                        "SEM_UNDO would exceed the system-imposed limit.\n");
-                    break;
-                case ENOSPC:
-                    fprintf(stderr, "The limit on the number of individual "
-                        "processes requesting a SEM_UNDO would be exceeded.\n");
-                    break;
+static void ipcmd_trace_export(int argc, char *argv[]) {
+    const char *usage = "ipcmd trace-export [file...]";
+    struct trace_event *events = NULL;
+    size_t nevents = 0, capacity = 0;
+    int c;
 
-                case ERANGE:
-                    fprintf(stderr, "An operation would cause a semval to "
-                        "overflow the system-imposed limit, or an operation "
-                        "would cause a semadj value to overflow the "
-                        "system-imposed limit.\n");
-                    break;
-                default:
-                    fprintf(stderr, "%s\n", strerror(errno));
-            }
+    while ((c = getopt(argc, argv, "")) != -1)
+        print_usage_and_exit(usage);
+
+    if (optind == argc) { // no file arguments: use IPCMD_TRACE
+        if (!getenv("IPCMD_TRACE") || !*getenv("IPCMD_TRACE")) {
+            fprintf(stderr, "ipcmd trace-export: must either specify a file "
+                            "or set IPCMD_TRACE environment variable\n");
             exit(EXIT_FAILURE);
         }
+        trace_read(getenv("IPCMD_TRACE"), &events, &nevents, &capacity);
     }
-    if (command_arg)
-        if (execvp(argv[command_arg], &argv[command_arg]) == -1) {
-            perror("ipcmd semop: execvp");
-            exit(EXIT_FAILURE);
+    for (; optind < argc; optind++)
+        trace_read(argv[optind], &events, &nevents, &capacity);
+
+    // processes append concurrently, so the files are only roughly in order
+    qsort(events, nevents, sizeof(*events), trace_event_compare);
+
+    // Each process is a track (pid = tid); each invocation a B/E pair, with
+    // the time it spent blocked as a nested "X" (complete) event.
+    printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (size_t i = 0; i < nevents; i++) {
+        const struct trace_event *e = &events[i];
+        printf("%s\n{\"name\":", i ? "," : "");
+        json_string(e->phase == TRACE_WAIT ? "blocked" : e->command);
+        printf(",\"cat\":\"ipcmd\",\"ph\":\"%s\",\"ts\":%" PRIu64
+               ",\"pid\":%li,\"tid\":%li",
+               e->phase == TRACE_BEGIN ? "B" :
+               e->phase == TRACE_WAIT ? "X" : "E", e->ts, e->pid, e->pid);
+        if (e->phase == TRACE_WAIT)
+            printf(",\"dur\":%" PRIu64, e->wait_usec);
+        if (e->phase != TRACE_BEGIN) {
+            printf(",\"args\":{\"id\":%i,\"bytes\":%" PRIu64 ",\"detail\":",
+                   e->id, e->bytes);
+            json_string(e->detail);
+            printf("}");
         }
+        printf("}");
+    }
+    printf("\n]}\n");
+    free(events);
 }
 
 int main(int argc, char *argv[]) {
     const char *usage = 
         "ipcmd <command> [options] [args]\n\n"
         "Where <command> is one of the following:\n"
+        "    bridge    forward a message queue to another host over a socket\n"
+        "    call      send a request to ipcmd serve and wait for the reply\n"
+        "    coll      collective operations among ranked processes\n"
+        "    dag       run commands in dependency order, in parallel\n"
+        "    event     broadcast events (set, reset, pulse, wait)\n"
         "    ftok      generate an IPC key\n"
+        "    latch     countdown latches (init, arrive, wait)\n"
+        "    limits    report kernel IPC limits, and which a workload reaches\n"
+        "    msgctl    query/adjust message queue attributes\n"
+        "    msgdump   write a message queue's messages to standard output\n"
         "    msgget    create a message queue\n"
+        "    msgload   send messages written by msgdump\n"
         "    msgrcv    receive a message\n"
         "    msgsnd    send a message\n"
+        "    msgstat   message queue residence-time statistics\n"
+        "    mutex     FIFO-fair mutex (lock, unlock, run)\n"
+        "    ratelimit token-bucket rate limiting\n"
+        "    route     dispatch messages to destinations by type\n"
         "    semctl    initialization/query semaphores\n"
         "    semget    create a semaphore set\n"
-        "    semop     semaphore operations"
+        "    semop     semaphore operations\n"
+        "    semstat   semaphore wait-time statistics\n"
+        "    serve     run a command for each request from ipcmd call\n"
+        "    setup     create the IPC objects a script needs, in one process\n"
+        "    split     partition input on record boundaries\n"
+        "    teardown  remove the IPC objects created by ipcmd setup\n"
+        "    trace-export  convert an IPCMD_TRACE file to trace-event JSON"
                         ;
     if (argc < 2)
         print_usage_and_exit(usage);
 
     argc--; argv++; // consume "ipcmd" from argv, leaving <command> ...
 
-    if (strncmp(argv[0], "ftok", (size_t)_POSIX_ARG_MAX) == 0)
+    if (strncmp(argv[0], "trace-export", strlen("trace-export")+1) != 0)
+        trace_open(argv[0]);
+
+    if (strncmp(argv[0], "bridge", strlen("bridge")+1) == 0)
+        ipcmd_bridge(argc, argv);
+    else if (strncmp(argv[0], "call", strlen("call")+1) == 0)
+        ipcmd_call(argc, argv);
+    else if (strncmp(argv[0], "coll", strlen("coll")+1) == 0)
+        ipcmd_coll(argc, argv);
+    else if (strncmp(argv[0], "dag", strlen("dag")+1) == 0)
+        ipcmd_dag(argc, argv);
+    else if (strncmp(argv[0], "event", strlen("event")+1) == 0)
+        ipcmd_event(argc, argv);
+    else if (strncmp(argv[0], "ftok", (size_t)_POSIX_ARG_MAX) == 0)
         ipcmd_ftok(argc, argv);
+    else if (strncmp(argv[0], "latch", strlen("latch")+1) == 0)
+        ipcmd_latch(argc, argv);
+    else if (strncmp(argv[0], "limits", strlen("limits")+1) == 0)
+        ipcmd_limits(argc, argv);
+    else if (strncmp(argv[0], "msgctl", strlen("msgctl")+1) == 0)
+        ipcmd_msgctl(argc, argv);
+    else if (strncmp(argv[0], "msgdump", strlen("msgdump")+1) == 0)
+        ipcmd_msgdump(argc, argv);
     else if (strncmp(argv[0], "msgget", strlen("msgget")+1) == 0)
         ipcmd_msgget(argc, argv);
+    else if (strncmp(argv[0], "msgload", strlen("msgload")+1) == 0)
+        ipcmd_msgload(argc, argv);
     else if (strncmp(argv[0], "msgrcv", strlen("msgrcv")+1) == 0)
         ipcmd_msgrcv(argc, argv);
     else if (strncmp(argv[0], "msgsnd", strlen("msgsnd")+1) == 0)
         ipcmd_msgsnd(argc, argv);
+    else if (strncmp(argv[0], "msgstat", strlen("msgstat")+1) == 0)
+        ipcmd_msgstat(argc, argv);
+    else if (strncmp(argv[0], "mutex", strlen("mutex")+1) == 0)
+        ipcmd_mutex(argc, argv);
+    else if (strncmp(argv[0], "ratelimit", strlen("ratelimit")+1) == 0)
+        ipcmd_ratelimit(argc, argv);
+    else if (strncmp(argv[0], "route", strlen("route")+1) == 0)
+        ipcmd_route(argc, argv);
     else if (strncmp(argv[0], "semctl", strlen("semctl")+1) == 0)
         ipcmd_semctl(argc, argv);
     else if (strncmp(argv[0], "semget", strlen("semget")+1) == 0)
         ipcmd_semget(argc, argv);
     else if (strncmp(argv[0], "semop", strlen("semop")+1) == 0)
         ipcmd_semop(argc, argv);
+    else if (strncmp(argv[0], "semstat", strlen("semstat")+1) == 0)
+        ipcmd_semstat(argc, argv);
+    else if (strncmp(argv[0], "serve", strlen("serve")+1) == 0)
+        ipcmd_serve(argc, argv);
+    else if (strncmp(argv[0], "setup", strlen("setup")+1) == 0)
+        ipcmd_setup(argc, argv);
+    else if (strncmp(argv[0], "split", strlen("split")+1) == 0)
+        ipcmd_split(argc, argv);
+    else if (strncmp(argv[0], "teardown", strlen("teardown")+1) == 0)
+        ipcmd_teardown(argc, argv);
+    else if (strncmp(argv[0], "trace-export", strlen("trace-export")+1) == 0)
+        ipcmd_trace_export(argc, argv);
     else 
         print_usage_and_exit(usage);
 
@@ -9,8 +9,9 @@ readonly NUM_MESSAGES=100
 
 export IPCMD_MSQID=$(ipcmd msgget)
 
-# clean up message queue upon (normal or abnormal) program termination
-trap 'ipcrm -q $IPCMD_MSQID' EXIT
+# clean up message queue (and any segments ipcmd associated with it) upon
+# (normal or abnormal) program termination
+trap 'ipcmd msgctl rmid' EXIT
 
 awk -v N=$NUM_MESSAGES 'BEGIN {for(i=1;i<=N;i++) print i}' |
   xargs ipcmd msgsnd &
@@ -33,3 +34,412 @@ then
    echo "$0: failed - sum == $sum (expected $EXPECTED_RESULT)"
 fi
 
+
+########################################
+# msgctl set/stat & msgsnd -g (autogrow)
+########################################
+msg_qbytes() {
+  ipcmd msgctl stat | awk '$1 == "msg_qbytes" {print $2}'
+}
+
+ipcmd msgctl set qbytes=1000
+if [ $(msg_qbytes) -ne 1000 ]
+then
+  echo "$0: failed - msg_qbytes == $(msg_qbytes) (expected 1000)"
+  exit 1
+fi
+
+message=$(awk 'BEGIN {for(i=0;i<700;i++) printf("x")}')
+ipcmd msgsnd -n "$message"
+if ipcmd msgsnd -n "$message"
+then
+  echo "$0: failed - second message fit in a 1000-byte queue"
+  exit 1
+fi
+ipcmd msgsnd -n -g 4000 "$message"
+if [ $(msg_qbytes) -le 1000 ] || [ $(msg_qbytes) -gt 4000 ]
+then
+  echo "$0: failed - msg_qbytes == $(msg_qbytes) (expected (1000,4000])"
+  exit 1
+fi
+for invalid in 'msgsnd -g -1 hello' 'msgsnd -g 0 hello' 'msgctl set qbytes=-1'
+do
+  if ipcmd $invalid 2> /dev/null
+  then
+    echo "$0: failed - ipcmd $invalid succeeded"
+    exit 1
+  fi
+done
+
+########################################
+# msgrcv -x (MSG_EXCEPT; Linux only)
+########################################
+if [ $(uname) = Linux ]
+then
+  ipcmd msgctl set qbytes=16384
+  while ipcmd msgrcv -n > /dev/null; do :; done
+  ipcmd msgsnd -t 1 one
+  ipcmd msgsnd -t 2 two
+  message=$(ipcmd msgrcv -n -x 1)
+  if [ "$message" != two ]
+  then
+    echo "$0: failed - msgrcv -x 1 received '$message' (expected 'two')"
+    exit 1
+  fi
+fi
+
+########################################
+# msgrcv -p (MSG_COPY; Linux only)
+########################################
+while ipcmd msgrcv -n > /dev/null; do :; done
+ipcmd msgsnd zeroth first second
+if message=$(ipcmd msgrcv -p 1 2> /dev/null)
+then
+  set -- $(ipcmd msgctl stat | awk '$1 == "msg_qnum" {print $2}')
+  status=0
+  ipcmd msgrcv -p 3 > /dev/null || status=$?
+  if [ "$message" != first ] || [ $1 -ne 3 ] || [ $status -ne 2 ]
+  then
+    echo "$0: failed - msgrcv -p 1 received '$message' and left $1" \
+         "messages, msgrcv -p 3 exited with $status (expected 'first', 3, 2)"
+    exit 1
+  fi
+fi
+while ipcmd msgrcv -n > /dev/null; do :; done
+
+########################################
+# msgsnd -E / msgrcv -E (envelopes)
+########################################
+while ipcmd msgrcv -n > /dev/null; do :; done
+ipcmd msgsnd -E 'enveloped message'
+ipcmd msgsnd 'plain message'
+for expected in 'enveloped message' 'plain message'
+do
+  message=$(ipcmd msgrcv -n -E)
+  if [ "$message" != "$expected" ]
+  then
+    echo "$0: failed - msgrcv -E received '$message' (expected '$expected')"
+    exit 1
+  fi
+done
+
+########################################
+# msgrcv -w (timeout)
+########################################
+while ipcmd msgrcv -n > /dev/null; do :; done
+status=0
+ipcmd msgrcv -w 0.1 > /dev/null || status=$?
+if [ $status -ne 2 ]
+then
+  echo "$0: failed - msgrcv -w exit status == $status (expected 2)"
+  exit 1
+fi
+
+########################################
+# POSIX message queues (where supported)
+########################################
+mq=/ipcmd-message_queues.$$
+if ipcmd msgget -P $mq -M 4 -S 1k > /dev/null 2>&1
+then
+  ipcmd msgsnd -q $mq -t 1 low
+  ipcmd msgsnd -q $mq -t 5 high
+  for expected in high low
+  do
+    message=$(ipcmd msgrcv -q $mq)
+    if [ "$message" != $expected ]
+    then
+      ipcmd msgctl -q $mq rmid
+      echo "$0: failed - POSIX msgrcv received '$message' (expected '$expected')"
+      exit 1
+    fi
+  done
+  status=0
+  ipcmd msgrcv -q $mq -w 0.1 > /dev/null || status=$?
+  ipcmd msgctl -q $mq rmid
+  if [ $status -ne 2 ]
+  then
+    echo "$0: failed - POSIX msgrcv -w exit status == $status (expected 2)"
+    exit 1
+  fi
+fi
+
+########################################
+# coll: the sum above as a reduction over 8 ranks, and bcast/gather
+########################################
+readonly RANKS=8
+coll_dir=${TMPDIR:-/tmp}/message_queues.sh.$$
+mkdir $coll_dir
+rank=0
+while [ $rank -lt $RANKS ]
+do
+  # rank r contributes r+1, r+1+RANKS, ... up to NUM_MESSAGES
+  awk -v r=$rank -v n=$RANKS -v N=$NUM_MESSAGES \
+      'BEGIN {s=0; for(i=r+1;i<=N;i+=n) s+=i; print s, r}' |
+    ipcmd coll reduce -r $rank -N $RANKS -R 3 > $coll_dir/reduce.$rank &
+  ipcmd coll gather -r $rank -N $RANKS "$rank," > $coll_dir/gather.$rank &
+  rank=$((rank+1))
+done
+wait
+result=$(cat $coll_dir/reduce.*)
+if [ "$result" != "$EXPECTED_RESULT $((RANKS*(RANKS-1)/2))" ]
+then
+  rm -rf $coll_dir
+  echo "$0: failed - coll reduce == '$result'"
+  exit 1
+fi
+result=$(cat $coll_dir/gather.*)
+if [ "$result" != "0,1,2,3,4,5,6,7," ]
+then
+  rm -rf $coll_dir
+  echo "$0: failed - coll gather == '$result'"
+  exit 1
+fi
+awk 'BEGIN {for(i=1;i<=5000;i++) print "line", i}' > $coll_dir/input
+rank=0
+while [ $rank -lt $RANKS ]
+do
+  ipcmd coll bcast -r $rank -N $RANKS -R 5 < $coll_dir/input \
+    > $coll_dir/bcast.$rank &
+  rank=$((rank+1))
+done
+wait
+for output in $coll_dir/bcast.*
+do
+  if ! cmp -s $coll_dir/input $output
+  then
+    rm -rf $coll_dir
+    echo "$0: failed - coll bcast output $output differs from input"
+    exit 1
+  fi
+done
+rm -rf $coll_dir
+
+########################################
+# msgdump & msgload
+########################################
+dump=${TMPDIR:-/tmp}/message_queues.sh.$$.dump
+while ipcmd msgrcv -n > /dev/null; do :; done
+ipcmd msgsnd -t 3 first second
+printf 'binary\0payload\n' | ipcmd msgsnd -t 9
+if ipcmd msgdump -p > $dump 2> /dev/null # MSG_COPY (Linux only)
+then
+  set -- $(ipcmd msgctl stat | awk '$1 == "msg_qnum" {print $2}')
+  if [ $1 -ne 3 ]
+  then
+    rm -f $dump $dump.*
+    echo "$0: failed - msgdump -p left $1 messages (expected 3)"
+    exit 1
+  fi
+fi
+ipcmd msgdump > $dump.drained
+ipcmd msgload < $dump.drained
+# a write error must stop msgdump before it drains messages it can't write
+if [ -w /dev/full ]
+then
+  if ipcmd msgdump > /dev/full 2> /dev/null ||
+     [ $(ipcmd msgctl stat | awk '$1 == "msg_qnum" {print $2}') -ne 3 ]
+  then
+    rm -f $dump $dump.*
+    echo "$0: failed - msgdump to a full device lost messages"
+    exit 1
+  fi
+fi
+ipcmd msgdump > $dump.reloaded
+if ! cmp -s $dump.drained $dump.reloaded ||
+   { [ -s $dump ] && ! cmp -s $dump $dump.drained; }
+then
+  rm -f $dump $dump.*
+  echo "$0: failed - msgdump output differs after msgload"
+  exit 1
+fi
+rm -f $dump $dump.*
+
+########################################
+# route
+########################################
+routed=${TMPDIR:-/tmp}/message_queues.sh.$$.route
+routed_msqid=$(ipcmd msgget)
+for message in 1 2 3
+do
+  ipcmd msgsnd -t 1 one$message
+  ipcmd msgsnd -t 2 two$message
+  ipcmd msgsnd -t 3 three$message
+  ipcmd msgsnd -t 7 seven$message
+done
+ipcmd route -n -b 8 1=c:"sed 's/^/cmd /' > $routed.cmd" 2=f:$routed.file \
+  3:4=q:$routed_msqid > $routed.stdout
+result=$(cat $routed.cmd $routed.file $routed.stdout | tr '\n' ' ')
+queued=$(ipcmd msgctl -q $routed_msqid stat | awk '$1 == "msg_qnum" {print $2}')
+ipcmd msgctl -q $routed_msqid rmid
+rm -f $routed.*
+if [ "$result" != "cmd one1 cmd one2 cmd one3 two1 two2 two3 seven1 seven2 seven3 " ] ||
+   [ $queued -ne 3 ]
+then
+  echo "$0: failed - route output == '$result', $queued messages queued (expected 3)"
+  exit 1
+fi
+
+########################################
+# msgsnd -z & msgrcv -z (compression)
+########################################
+compressed=${TMPDIR:-/tmp}/message_queues.sh.$$.z
+while ipcmd msgrcv -n > /dev/null; do :; done
+# 18000 bytes: more than a message can hold (MSGMAX is typically 8192)
+# uncompressed
+awk 'BEGIN {for(i=1;i<=1000;i++) printf "%08d,record,%d\n", i, i%7}' \
+  > $compressed
+ipcmd msgsnd -z < $compressed
+ipcmd msgsnd -z short
+ipcmd msgrcv -z > $compressed.out
+if ! cmp -s $compressed $compressed.out || [ "$(ipcmd msgrcv -z)" != short ]
+then
+  rm -f $compressed $compressed.*
+  echo "$0: failed - msgrcv -z output differs from msgsnd -z input"
+  exit 1
+fi
+rm -f $compressed $compressed.*
+
+########################################
+# bridge
+########################################
+bridge_socket=${TMPDIR:-/tmp}/message_queues.sh.$$.sock
+bridged_msqid=$(ipcmd msgget)
+while ipcmd msgrcv -n > /dev/null; do :; done
+ipcmd bridge -q $bridged_msqid -l unix:$bridge_socket &
+bridge_pid=$!
+awk -v N=$NUM_MESSAGES 'BEGIN {for(i=1;i<=N;i++) print i}' |
+  xargs ipcmd msgsnd -t 4
+ipcmd bridge -n -w 10 -B 8 -W 32 -c unix:$bridge_socket
+wait $bridge_pid
+sum=0
+while message=$(ipcmd msgrcv -n -q $bridged_msqid -t 4)
+do
+  sum=$((sum + message))
+done
+ipcmd msgctl -q $bridged_msqid rmid
+rm -f $bridge_socket
+if [ $sum -ne $EXPECTED_RESULT ]
+then
+  echo "$0: failed - sum of bridged messages == $sum (expected $EXPECTED_RESULT)"
+  exit 1
+fi
+
+########################################
+# msgsnd -R & msgrcv -D (reference messages)
+########################################
+referenced=${TMPDIR:-/tmp}/message_queues.sh.$$.ref
+while ipcmd msgrcv -n > /dev/null; do :; done
+awk 'BEGIN {for(i=1;i<=10000;i++) printf "%08d\n", i}' > $referenced
+cp $referenced $referenced.copy # msgrcv -u removes $referenced
+ipcmd msgsnd -R $referenced:18:9 # the third line
+ipcmd msgsnd -R $referenced
+third=$(ipcmd msgrcv -D)
+ipcmd msgrcv -D -u > $referenced.out
+if ! cmp -s $referenced.copy $referenced.out || [ "$third" != 00000003 ] ||
+   [ -f $referenced ]
+then
+  rm -f $referenced $referenced.*
+  echo "$0: failed - msgrcv -D output differs from the file sent by msgsnd -R"
+  exit 1
+fi
+# a file modified since it was sent is refused, rather than written
+cp $referenced.copy $referenced
+ipcmd msgsnd -R $referenced
+echo 00010001 >> $referenced
+modified_status=0
+ipcmd msgrcv -D > $referenced.out 2> /dev/null || modified_status=$?
+if [ $modified_status -ne 1 ] || [ -s $referenced.out ]
+then
+  echo "$0: failed - msgrcv -D of a modified file exited with status" \
+       "$modified_status (expected 1) and wrote $(wc -c < $referenced.out) bytes"
+  rm -f $referenced $referenced.*
+  exit 1
+fi
+rm -f $referenced $referenced.*
+
+########################################
+# msgsnd -f & msgsnd -F (messages from files)
+########################################
+item_dir=${TMPDIR:-/tmp}/message_queues.sh.$$.items
+mkdir $item_dir
+for i in 1 2 3 4 5
+do
+  echo "item $i" > $item_dir/$i.item
+done
+while ipcmd msgrcv -n > /dev/null; do :; done
+ipcmd msgsnd -f -T seq -t 11 $item_dir/1.item $item_dir/2.item
+ls $item_dir/*.item | ipcmd msgsnd -F -T name
+result=$(ipcmd msgrcv -t 12; ipcmd msgrcv -t 11; ipcmd msgrcv -t 4)
+rm -rf $item_dir
+if [ "$result" != "$(printf 'item 2\nitem 1\nitem 4')" ] ||
+   [ $(ipcmd msgctl stat | awk '$1 == "msg_qnum" {print $2}') -ne 4 ]
+then
+  echo "$0: failed - msgsnd -f/-F sent '$result'"
+  exit 1
+fi
+while ipcmd msgrcv -n > /dev/null; do :; done
+
+########################################
+# call & serve (request/reply)
+########################################
+rpc_msqid=$(ipcmd msgget)
+ipcmd serve -q $rpc_msqid -N 2 : tr a-z A-Z &
+# a line-mode handler must not buffer its output
+ipcmd serve -q $rpc_msqid -t 2 -l : sh -c 'while read l; do echo "> $l"; done' &
+result=$(ipcmd call -q $rpc_msqid hello; echo world | ipcmd call -q $rpc_msqid;
+         ipcmd call -q $rpc_msqid -t 2 line)
+timeout_status=0
+ipcmd call -q $rpc_msqid -t 3 -w 0.1 nobody || timeout_status=$?
+# -t 0 serves any request; the one that timed out is dropped unanswered
+ipcmd serve -q $rpc_msqid -t 0 : cat &
+late=$(ipcmd call -q $rpc_msqid -t 3 -w 5 late)
+leftover_status=0
+ipcmd msgrcv -q $rpc_msqid -n > /dev/null || leftover_status=$?
+ipcmd msgctl -q $rpc_msqid rmid
+wait
+if [ "$result" != "$(printf 'HELLOWORLD\n> line')" ] ||
+   [ $timeout_status -ne 2 ] || [ "$late" != late ] ||
+   [ $leftover_status -ne 2 ]
+then
+  echo "$0: failed - call/serve replied '$result' and '$late' (timeout" \
+       "$timeout_status, msgrcv of a leftover $leftover_status)"
+  exit 1
+fi
+
+########################################
+# msgsnd -K & msgrcv -K (last-value messages)
+########################################
+while ipcmd msgrcv -n > /dev/null; do :; done
+for load in 1 2 3
+do
+  ipcmd msgsnd -K cpu "load $load"
+done
+echo 'free 42' | ipcmd msgsnd -K mem
+messages=$(ipcmd msgctl stat | awk '$1 == "msg_qnum" {print $2}')
+result=$(ipcmd msgrcv -K; echo; ipcmd msgrcv -K)
+# a key's slot is reused once its value has been received, so more keys than
+# slots (128) may be sent over time
+key=0
+received=0
+while [ $key -lt 130 ]
+do
+  key=$((key+1))
+  ipcmd msgsnd -K key$key $key
+  [ "$(ipcmd msgrcv -K -n)" = "$(printf 'key%s\t%s' $key $key)" ] &&
+    received=$((received+1))
+done
+# a receiver that dies between receiving a key's message and taking its
+# value, like a plain msgrcv, leaves the key pending with no message queued;
+# the next value sends one again
+ipcmd msgsnd -K orphan 1
+ipcmd msgrcv > /dev/null
+ipcmd msgsnd -K orphan 2
+orphan=$(ipcmd msgrcv -K -n || :)
+if [ $messages -ne 2 ] ||
+   [ "$result" != "$(printf 'cpu\tload 3\nmem\tfree 42')" ] ||
+   [ $received -ne 130 ] || [ "$orphan" != "$(printf 'orphan\t2')" ]
+then
+  echo "$0: failed - msgsnd -K sent $messages messages, received '$result'," \
+       "$received of 130 keys and '$orphan'"
+  exit 1
+fi
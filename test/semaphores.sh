@@ -254,3 +254,307 @@ do
     exit 1
   fi
 done
+
+########################################
+# test 9: ipcmd semop -w (timeout)
+########################################
+
+ipcmd semctl setall 0
+
+set +o errexit # disable for this test -- we expect exit status 2
+ipcmd semop -w 0.2 0=-1
+exit_status=$?
+set -o errexit
+if [ $exit_status -ne 2 ]
+then
+  error_message="(semop -w) exit status == $exit_status (expected 2)"
+  exit 1
+fi
+
+ipcmd semctl setval 0 1
+ipcmd semop -w 10 0=-1
+
+########################################
+# test 10: ipcmd semstat
+########################################
+
+ipcmd semctl setall 0
+IPCMD_SEMSTAT=1 ipcmd semop 0=-1 &
+sleep 1
+IPCMD_SEMSTAT=1 ipcmd semop 0=+1
+wait
+
+# "sem_num count blocked p50_usec p99_usec max_usec" for semaphore 0
+set -- $(ipcmd semstat | awk '$1 == "0"')
+ipcmd semstat -r
+if [ $2 -ne 1 ] || [ $3 -ne 1 ] || [ $6 -lt 500000 ]
+then
+  error_message="(semstat) count == $2, blocked == $3, max_usec == $6 (expected 1, 1, >= 500000)"
+  exit 1
+fi
+
+########################################
+# test 11: ipcmd ratelimit
+########################################
+
+ratelimit=$(ipcmd ratelimit create -r 10 -B 3)
+ipcmd ratelimit take -s $ratelimit -n -k 3
+set +o errexit
+ipcmd ratelimit take -s $ratelimit -n
+exit_status=$?
+set -o errexit
+if [ $exit_status -ne 2 ]
+then
+  ipcmd semctl -s $ratelimit rmid
+  error_message="(ratelimit take -n) exit status == $exit_status (expected 2)"
+  exit 1
+fi
+# the next token accrues after 0.1 seconds
+output=$(ipcmd ratelimit take -s $ratelimit -w 10 : echo taken)
+tokens=$(ipcmd semctl -s $ratelimit getval 0)
+ipcmd semctl -s $ratelimit rmid
+if [ "$output" != taken ] || [ $tokens -ne 0 ]
+then
+  error_message="(ratelimit take) output == '$output', tokens == $tokens (expected 'taken', 0)"
+  exit 1
+fi
+
+########################################
+# test 12: ipcmd event & ipcmd latch
+########################################
+
+event=$(ipcmd event create)
+latch=$(ipcmd latch init 3)
+# each waiter arrives at the latch once the event wakes it
+for waiter in 1 2 3
+do
+  ( ipcmd event wait -s $event -w 10 && ipcmd latch arrive -s $latch ) &
+done
+while [ $(ipcmd semctl -s $event getzcnt 0) -lt 3 ]
+do
+  sleep 1
+done
+ipcmd event pulse -s $event
+set +o errexit
+ipcmd latch wait -s $latch -w 10
+latch_status=$?
+ipcmd event wait -s $event -n # a pulse leaves the event reset
+pulse_status=$?
+ipcmd event set -s $event
+ipcmd event wait -s $event -n
+set_status=$?
+set -o errexit
+wait
+ipcrm -s $event
+ipcrm -s $latch
+if [ $latch_status -ne 0 ] || [ $pulse_status -ne 2 ] || [ $set_status -ne 0 ]
+then
+  error_message="(event/latch) exit statuses == $latch_status, $pulse_status, $set_status (expected 0, 2, 0)"
+  exit 1
+fi
+
+########################################
+# test 13: ipcmd dag
+########################################
+
+dag_output=${TMPDIR:-/tmp}/semaphores.sh.$$.dag
+# a diamond: left and right may run in either order, but after top and
+# before bottom
+output=$(ipcmd dag -j 2 -q <<END_DAG
+bottom: left right ; echo bottom
+left: top ; echo left
+right: top ; echo right
+top: ; echo top
+END_DAG
+)
+output=$(echo $output)
+set +o errexit
+ipcmd dag -q -k > $dag_output 2> /dev/null <<END_DAG
+a: ; exit 1
+b: a ; echo b
+c: ; echo c
+END_DAG
+dag_status=$?
+set -o errexit
+dag_skipped=$(cat $dag_output)
+rm -f $dag_output
+if { [ "$output" != "top left right bottom" ] &&
+     [ "$output" != "top right left bottom" ]; } ||
+   [ $dag_status -ne 1 ] || [ "$dag_skipped" != c ]
+then
+  error_message="(dag) output == '$output', '$dag_skipped', exit status == $dag_status (expected 'top left right bottom', 'c', 1)"
+  exit 1
+fi
+
+########################################
+# test 14: ipcmd setup & ipcmd teardown
+########################################
+
+objects=$(ipcmd setup <<END_SETUP
+# one of each kind
+setup_semid sem 3 0=2 1:2=1
+setup_msqid msg
+setup_shmid shm 4k
+END_SETUP
+)
+semvals=$(eval "$objects"; ipcmd semctl -s $setup_semid getall)
+nsets=$(ipcs -s | grep -c '^0x')
+set +o errexit
+# the second set's semval is beyond SEMVMX (32767) but parses, so setting it
+# fails once the first set exists, which must then be removed
+ipcmd setup > /dev/null 2>&1 <<END_SETUP
+rolled_back sem 1
+invalid sem 1 40000
+END_SETUP
+failed_status=$?
+set -o errexit
+leftover=$(($(ipcs -s | grep -c '^0x') - nsets))
+(eval "$objects"; ipcmd teardown)
+remaining=$(eval "$objects"; { ipcs -s; ipcs -q; ipcs -m; } |
+            awk -v s=$setup_semid -v q=$setup_msqid -v m=$setup_shmid \
+                '$2 == s || $2 == q || $2 == m' | wc -l)
+if [ "$semvals" != "2 1 1" ] || [ $failed_status -ne 1 ] ||
+   [ $leftover -ne 0 ] || [ $remaining -ne 0 ]
+then
+  error_message="(setup) semvals == '$semvals', exit status == $failed_status, $leftover/$remaining objects left (expected '2 1 1', 1, 0/0)"
+  exit 1
+fi
+
+########################################
+# test 15: ipcmd mutex
+########################################
+
+mutex=$(ipcmd mutex create -N 4)
+mutex_output=${TMPDIR:-/tmp}/semaphores.sh.$$.mutex
+: > $mutex_output
+ipcmd mutex lock -s $mutex
+set +o errexit
+ipcmd mutex lock -s $mutex -n
+trylock_status=$?
+set -o errexit
+# ticket i waits on semaphore i; queue each waiter before starting the next
+for waiter in 1 2 3
+do
+  ipcmd mutex run -s $mutex : sh -c "echo $waiter >> $mutex_output" &
+  while [ $(ipcmd semctl -s $mutex getncnt $waiter) -eq 0 ]
+  do
+    sleep 0.01
+  done
+done
+ipcmd mutex unlock -s $mutex
+wait
+order=$(echo $(cat $mutex_output))
+rm -f $mutex_output
+ipcmd semctl -s $mutex rmid
+if [ $trylock_status -ne 2 ] || [ "$order" != "1 2 3" ]
+then
+  error_message="(mutex) lock -n exit status == $trylock_status, order == '$order' (expected 2, '1 2 3')"
+  exit 1
+fi
+
+########################################
+# test 16: ipcmd limits
+########################################
+
+limits=$(ipcmd limits)
+plan=$(ipcmd limits -p 4 -s 16)
+sem_limits=$(echo "$limits" | awk '$1 == "semmsl" || $1 == "semopm" {print $1, $2}')
+# compared with the system's own report, where there is one and the limits
+# are known (not "-", as in a build without Linux extensions)
+expected_limits=$sem_limits
+if echo "$limits" | grep -q '^semmsl [0-9]'
+then
+  if [ $(uname) = Linux ] && [ -r /proc/sys/kernel/sem ]
+  then
+    expected_limits=$(awk '{print "semmsl " $1; print "semopm " $3}' \
+                      /proc/sys/kernel/sem)
+  elif ipcs -T > /dev/null 2>&1 # the BSDs and macOS
+  then
+    expected_limits=$(ipcs -T | awk '$1 ~ /^semmsl:?$/ {print "semmsl " $2}
+                                     $1 ~ /^semopm:?$/ {print "semopm " $2}')
+  fi
+fi
+if [ "$sem_limits" != "$expected_limits" ] ||
+   ! echo "$plan" | grep -q '^first '
+then
+  error_message="(limits) output == '$limits', plan == '$plan' (expected '$expected_limits', and a first limit)"
+  exit 1
+fi
+
+########################################
+# test 17: a semaphore set served by ipcmd bridge -S
+########################################
+
+bridged=$(ipcmd semget -N 2)
+bridge_socket=${TMPDIR:-/tmp}/semaphores.sh.$$.sock
+remote=unix:$bridge_socket
+ipcmd semctl -s $bridged setall 0=1 1=0
+ipcmd bridge -s $bridged -S -l $remote &
+tries=0
+until ipcmd semctl -s $remote getval 0 > /dev/null 2>&1 || [ $tries -ge 500 ]
+do
+  sleep 0.01
+  tries=$((tries+1))
+done
+ipcmd semop -s $remote 0=-1 1=+2
+nowait_status=0
+ipcmd semop -s $remote -n 0=-1 || nowait_status=$?
+# undone by the bridge once the connection, kept by true, is closed
+ipcmd semop -s $remote -u 1=-1 : true
+tries=0
+while [ "$(ipcmd semctl -s $bridged getall)" != '0 2' ] && [ $tries -lt 500 ]
+do
+  sleep 0.01
+  tries=$((tries+1))
+done
+values=$(ipcmd semctl -s $remote getall)
+ipcmd semctl -s $bridged rmid
+wait
+if [ "$values" != '0 2' ] || [ $nowait_status -ne 2 ] || [ -e $bridge_socket ]
+then
+  error_message="(bridge -S) getall == '$values', semop -n exit status == $nowait_status (expected '0 2', 2, and the socket removed)"
+  exit 1
+fi
+
+########################################
+# test 18: ipcmd mutex skips the tickets of waiters killed or interrupted
+########################################
+
+mutex=$(ipcmd mutex create -N 4)
+ipcmd mutex lock -s $mutex
+# tickets 1 (killed), 2 (given up on SIGTERM) and 3
+for waiter in 1 2 3
+do
+  if [ $waiter -eq 3 ]
+  then
+    ipcmd mutex run -s $mutex : true &
+  else
+    ipcmd mutex lock -s $mutex &
+  fi
+  eval waiter_$waiter=$!
+  while [ $(ipcmd semctl -s $mutex getncnt $waiter) -eq 0 ]
+  do
+    sleep 0.01
+  done
+done
+kill -KILL $waiter_1
+kill -TERM $waiter_2
+wait $waiter_1 $waiter_2 2> /dev/null || :
+ipcmd mutex unlock -s $mutex
+tries=0
+while kill -0 $waiter_3 2> /dev/null && [ $tries -lt 500 ]
+do
+  sleep 0.01
+  tries=$((tries+1))
+done
+run_status=0
+kill -0 $waiter_3 2> /dev/null && { run_status=1; kill -KILL $waiter_3; }
+wait $waiter_3 || run_status=$?
+trylock_status=0
+ipcmd mutex lock -s $mutex -n || trylock_status=$?
+ipcmd semctl -s $mutex rmid
+if [ $run_status -ne 0 ] || [ $trylock_status -ne 0 ]
+then
+  error_message="(mutex with dead waiters) run exit status == $run_status, lock -n exit status == $trylock_status (expected 0, 0)"
+  exit 1
+fi
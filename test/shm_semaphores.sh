@@ -0,0 +1,165 @@
+#!/usr/bin/env sh
+# SYNOPSIS
+#     shm_semaphores.sh
+#
+# Semaphore sets created with "ipcmd semget -b shm"
+
+set -o errexit
+set -o nounset
+
+readonly COUNTER=${TMPDIR:-/tmp}/shm_semaphores.sh.$$
+
+export IPCMD_SEMID=$(ipcmd semget -b shm -N 3)
+
+trap 'ipcmd semctl rmid 2> /dev/null || :; rm -f $COUNTER; test -n "${error_message:-}" && echo "${0##*/}:$LINENO: ERROR - $error_message" 1>&2' EXIT
+
+########################################
+# test 1: identifier, setall/getall
+########################################
+case $IPCMD_SEMID in
+  shm:[0-9]*) ;;
+  *) error_message="semget -b shm printed '$IPCMD_SEMID'"; exit 1 ;;
+esac
+ipcmd semctl setall 0=1 1=2 2=0
+if [ "$(ipcmd semctl getall)" != '1 2 0' ]
+then
+  error_message="getall == '$(ipcmd semctl getall)' (expected '1 2 0')"
+  exit 1
+fi
+
+########################################
+# test 2: IPC_NOWAIT and -w timeout (exit status 2), SEM_UNDO unsupported
+########################################
+for cmd in 'ipcmd semop -n 2=-1' 'ipcmd semop -w 0.2 2=-1' \
+           'ipcmd semop -n 0=-1 2=-1'
+do
+  status=0
+  $cmd || status=$?
+  if [ $status -ne 2 ]
+  then
+    error_message="'$cmd' exit status == $status (expected 2)"
+    exit 1
+  fi
+done
+if [ "$(ipcmd semctl getall)" != '1 2 0' ] # all-or-nothing
+then
+  error_message="failed semop changed semaphore values"
+  exit 1
+fi
+if ipcmd semop -u 0=-1 2> /dev/null
+then
+  error_message="'semop -u' did not fail"
+  exit 1
+fi
+
+########################################
+# test 3: waiting (semncnt), wakeup, and atomicity of the operation array
+########################################
+ipcmd semop 0=-1 1=-2 2=-1 &
+sleep 1
+if [ $(ipcmd semctl getncnt 2) -ne 1 ] ||
+   [ "$(ipcmd semctl getall)" != '1 2 0' ]
+then
+  error_message="waiting semop: getncnt 2 == $(ipcmd semctl getncnt 2), getall == '$(ipcmd semctl getall)'"
+  exit 1
+fi
+ipcmd semop 2=+1
+wait
+if [ "$(ipcmd semctl getall)" != '0 0 0' ]
+then
+  error_message="getall == '$(ipcmd semctl getall)' after wakeup (expected '0 0 0')"
+  exit 1
+fi
+
+########################################
+# test 4: mutual exclusion among concurrent processes
+########################################
+ipcmd semctl setval 0 1
+echo 0 > $COUNTER
+for process in 1 2 3 4
+do
+  (
+    i=0
+    while [ $i -lt 25 ]
+    do
+      ipcmd semop 0=-1
+      n=$(cat $COUNTER)
+      echo $((n+1)) > $COUNTER
+      ipcmd semop 0=+1
+      i=$((i+1))
+    done
+  ) &
+done
+wait
+if [ $(cat $COUNTER) -ne 100 ]
+then
+  error_message="counter == $(cat $COUNTER) (expected 100)"
+  exit 1
+fi
+
+########################################
+# test 5: semctl rmid wakes waiters, which fail
+########################################
+ipcmd semctl setall 0
+status=0
+(sleep 1; ipcmd semctl rmid) &
+ipcmd semop 0=-1 2> /dev/null || status=$?
+wait
+if [ $status -ne 1 ]
+then
+  error_message="semop on removed set: exit status == $status (expected 1)"
+  exit 1
+fi
+
+########################################
+# test 6: a sleeper that is killed is no longer counted
+########################################
+export IPCMD_SEMID=$(ipcmd semget -b shm)
+ipcmd semop 0=-1 &
+sleeper=$!
+while [ $(ipcmd semctl getncnt 0) -ne 1 ]
+do
+  sleep 0.1
+done
+kill -KILL $sleeper
+wait $sleeper || :
+if [ $(ipcmd semctl getncnt 0) -ne 0 ]
+then
+  error_message="getncnt == $(ipcmd semctl getncnt 0) after the sleeper was killed (expected 0)"
+  exit 1
+fi
+
+########################################
+# test 7: an event pulse wakes its waiters, but not a stopped one for long
+########################################
+event=$(ipcmd event create -b shm)
+ipcmd event wait -s $event -w 10 &
+waiter=$!
+ipcmd event wait -s $event -w 10 &
+stopped=$!
+while [ $(ipcmd semctl -s $event getzcnt 0) -ne 2 ]
+do
+  sleep 0.1
+done
+kill -STOP $stopped
+ipcmd event pulse -s $event &
+pulse=$!
+tries=0
+while kill -0 $pulse 2> /dev/null && [ $tries -lt 50 ]
+do
+  sleep 0.1
+  tries=$((tries+1))
+done
+status=0
+kill -0 $pulse 2> /dev/null && status=1
+kill -KILL $pulse $stopped 2> /dev/null || :
+wait $waiter || status=$?
+wait $pulse $stopped 2> /dev/null || :
+reset_status=0
+ipcmd event wait -s $event -n || reset_status=$?
+ipcmd semctl -s $event rmid
+if [ $status -ne 0 ] || [ $reset_status -ne 2 ]
+then
+  error_message="event pulse with a stopped waiter: status == $status, event wait -n status == $reset_status (expected 0, 2)"
+  exit 1
+fi
@@ -0,0 +1,75 @@
+#!/usr/bin/env sh
+# SYNOPSIS
+#     split.sh
+
+set -o errexit
+set -o nounset
+
+readonly INPUT=${TMPDIR:-/tmp}/split.sh.$$
+export PARTITION_PATH=$INPUT.partition
+
+awk 'BEGIN {for(i=1;i<=20000;i++) print "record", i}' > $INPUT
+
+export IPCMD_SEMID=$(ipcmd semget -N 3)
+export IPCMD_MSQID=$(ipcmd msgget)
+
+trap 'ipcrm -s $IPCMD_SEMID; ipcrm -q $IPCMD_MSQID; rm -f $INPUT $INPUT.*; test -n "${error_message:-}" && echo "${0##*/}: ERROR - $error_message" 1>&2' EXIT
+
+########################################
+# test 1: stream & file partitions via the slot/write/read semaphores
+########################################
+for file in '' $INPUT
+do
+  ipcmd semctl setall 0=1 1=1 2=0
+  ipcmd split -s 10k $file < $INPUT &
+  : > $INPUT.out
+  while true
+  do
+    ipcmd semop 2=-1
+    if [ ! -s $PARTITION_PATH ]
+    then
+      break
+    fi
+    if [ "$(tail -c 1 $PARTITION_PATH | od -An -c | tr -d ' ')" != '\n' ]
+    then
+      error_message="partition does not end with a newline"
+      exit 1
+    fi
+    cat $PARTITION_PATH >> $INPUT.out
+    ipcmd semop 0=+1 1=+1
+  done
+  wait
+  if ! cmp -s $INPUT $INPUT.out
+  then
+    error_message="partitions of '${file:-stdin}' differ from input"
+    exit 1
+  fi
+done
+
+########################################
+# test 2: file partitions as offset,length messages
+########################################
+ipcmd split -q $IPCMD_MSQID -s 10k $INPUT
+: > $INPUT.out
+while range=$(ipcmd msgrcv -n)
+do
+  ipcmd split -r $range $INPUT >> $INPUT.out
+done
+if ! cmp -s $INPUT $INPUT.out
+then
+  error_message="offset,length ranges differ from input"
+  exit 1
+fi
+
+########################################
+# test 3: a range beyond the end of the file is refused
+########################################
+size=$(wc -c < $INPUT)
+for range in "$((size - 2)),3" "$((size + 8192)),1"
+do
+  if ipcmd split -r $range $INPUT > /dev/null 2>&1
+  then
+    error_message="split -r $range of a $size-byte file succeeded"
+    exit 1
+  fi
+done
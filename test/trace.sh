@@ -0,0 +1,57 @@
+#!/usr/bin/env sh
+# SYNOPSIS
+#     trace.sh
+
+set -o errexit
+set -o nounset
+
+export IPCMD_TRACE=${TMPDIR:-/tmp}/trace.sh.$$
+
+export IPCMD_SEMID=$(ipcmd semget)
+export IPCMD_MSQID=$(ipcmd msgget)
+
+trap 'ipcrm -s $IPCMD_SEMID; ipcrm -q $IPCMD_MSQID; rm -f $IPCMD_TRACE $IPCMD_TRACE.*; test -n "${error_message:-}" && echo "${0##*/}: ERROR - $error_message" 1>&2' EXIT
+
+########################################
+# test 1: begin/end lines for each invocation, including before exec
+########################################
+ipcmd semctl setall 0=0
+(sleep 1; ipcmd semop 0=+1) &
+ipcmd semop 0=-1 : ipcmd msgsnd -t 3 hello
+wait
+ipcmd msgrcv > /dev/null
+
+if [ $(grep -c '^B ' $IPCMD_TRACE) -ne 7 ] ||
+   [ $(grep -c '^E ' $IPCMD_TRACE) -ne 7 ]
+then
+  error_message="expected 7 begin and 7 end lines in trace"
+  exit 1
+fi
+
+# the waiting semop: blocked for ~1 second on 0=-1
+if ! awk '$1 == "E" && $4 == "semop" && $9 == "0=-1" && $8 >= 500000 {found=1}
+          END {exit !found}' $IPCMD_TRACE
+then
+  error_message="semop wait not recorded"
+  exit 1
+fi
+
+if ! grep -q "^E [0-9]* [0-9]* msgsnd $IPCMD_MSQID 5 [0-9]* [0-9]* mtype=3\$" \
+     $IPCMD_TRACE
+then
+  error_message="msgsnd not recorded"
+  exit 1
+fi
+
+########################################
+# test 2: trace-export
+########################################
+ipcmd trace-export > $IPCMD_TRACE.json
+for ph in B E X
+do
+  if ! grep -q "\"ph\":\"$ph\"" $IPCMD_TRACE.json
+  then
+    error_message="trace-export output lacks \"ph\":\"$ph\" events"
+    exit 1
+  fi
+done